@@ -9,6 +9,7 @@
 
 #include "rocksdb/cache.h"
 
+#include <atomic>
 #include <forward_list>
 #include <functional>
 #include <iostream>
@@ -16,8 +17,10 @@
 #include <vector>
 #include "cache/clock_cache.h"
 #include "cache/lru_cache.h"
+#include "port/port.h"
 #include "test_util/testharness.h"
 #include "util/coding.h"
+#include "util/random.h"
 #include "util/string_util.h"
 
 namespace ROCKSDB_NAMESPACE {
@@ -749,6 +752,47 @@ TEST_P(CacheTest, DefaultShardBits) {
   ASSERT_EQ(6, sc->GetNumShardBits());
 }
 
+TEST_P(CacheTest, ConcurrentLookupsSeeTheirKeys) {
+  // Lookups race with inserts, evictions and erases of the same keys, a hit
+  // must still return the value of its own key.
+  std::shared_ptr<Cache> cache = NewCache(500, 2, false);
+  const int kNumThreads = 8;
+  const int kNumKeys = 1000;
+  std::atomic<int> wrong_values{0};
+  std::vector<port::Thread> threads;
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&, t]() {
+      Random rnd(301 + t);
+      for (int i = 0; i < 20000; i++) {
+        int key = rnd.Uniform(kNumKeys);
+        switch (rnd.Uniform(4)) {
+          case 0:
+            cache->Insert(EncodeKey(key), EncodeValue(key), 1, nullptr);
+            break;
+          case 1:
+            cache->Erase(EncodeKey(key));
+            break;
+          default: {
+            Cache::Handle* handle = cache->Lookup(EncodeKey(key));
+            if (handle != nullptr) {
+              if (DecodeValue(cache->Value(handle)) != key) {
+                wrong_values++;
+              }
+              cache->Release(handle);
+            }
+          }
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(0, wrong_values.load());
+  ASSERT_EQ(0, cache->GetPinnedUsage());
+  ASSERT_LE(cache->GetUsage(), 500);
+}
+
 TEST_P(CacheTest, GetCharge) {
   Insert(1, 2);
   Cache::Handle* h1 = cache_->Lookup(EncodeKey(1));
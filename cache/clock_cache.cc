@@ -27,13 +27,8 @@ std::shared_ptr<Cache> NewClockCache(
 #include <assert.h>
 #include <atomic>
 #include <deque>
-
-// "tbb/concurrent_hash_map.h" requires RTTI if exception is enabled.
-// Disable it so users can chooose to disable RTTI.
-#ifndef ROCKSDB_USE_RTTI
-#define TBB_USE_EXCEPTIONS 0
-#endif
-#include "tbb/concurrent_hash_map.h"
+#include <memory>
+#include <vector>
 
 #include "cache/sharded_cache.h"
 #include "port/malloc.h"
@@ -61,9 +56,9 @@ namespace {
 // to be re-use. This is to avoid memory dealocation, which is hard to deal
 // with in concurrent environment.
 //
-// The cache also maintains a concurrent hash map for lookup. Any concurrent
-// hash map implementation should do the work. We currently use
-// tbb::concurrent_hash_map because it supports concurrent erase.
+// The cache also maintains a concurrent hash map for lookup, see HandleTable.
+// It is an open addressing table of handle pointers that lookups read without
+// any lock.
 //
 // Each cache handle has the following flags and counters, which are squeeze
 // in an atomic interger, to make sure the handle always be in a consistent
@@ -141,8 +136,9 @@ namespace {
 // hold the mutex. Lookup() only access the hash map and the flags associated
 // with each handle, and don't require explicit locking. Release() has to
 // acquire the mutex only when it releases the last reference to the entry and
-// the entry has been erased from cache explicitly. A future improvement could
-// be to remove the mutex completely.
+// the entry has been erased from cache explicitly. So a cache hit takes no
+// lock at all, unlike LRUCache, whose Lookup() and Release() both take the
+// shard mutex to maintain the LRU list.
 //
 // Benchmark:
 // We run readrandom db_bench on a test DB of size 13GB, with size of each
@@ -176,7 +172,9 @@ namespace {
 // Cache entry meta data.
 struct CacheHandle {
   Slice key;
-  uint32_t hash;
+  // Atomic since lock-free lookups compare it before they take a reference,
+  // while the handle may be re-used for another key, see HandleTable.
+  std::atomic<uint32_t> hash;
   void* value;
   size_t charge;
   void (*deleter)(const Slice&, void* value);
@@ -227,25 +225,154 @@ struct CacheHandle {
   }
 };
 
-// Key of hash map. We store hash value with the key for convenience.
-struct CacheKey {
-  Slice key;
-  uint32_t hash_value;
+// Open addressing hash table from key to cache handle with linear probing,
+// the hash map of a ClockCacheShard. Lookup() doesn't take any lock, the
+// other methods have to hold the shard mutex.
+//
+// Erasing an entry just empties its slot, there are no tombstones. Instead
+// each slot counts the entries stored past it in the probe sequence started
+// at their home slot (displacements), and a lookup stops at the first slot
+// that no entry probed past. Both are updated before a new handle is stored
+// with release semantics, so a lookup that sees the handle sees them too.
+//
+// The table doubles once it is 3/4 full. Lookups may still probe the old
+// array, so it is only freed with the table. The retired arrays add up to
+// less than the current one.
+class HandleTable {
+ public:
+  HandleTable() {
+    arrays_.emplace_back(new Array(kInitialSize));
+    current_.store(arrays_.back().get(), std::memory_order_relaxed);
+  }
+
+  // Probe the slots a handle with the hash may be in and return the first
+  // handle try_ref accepts, nullptr if there is none. The handles are found
+  // by their hash only and may be erased or re-used concurrently, try_ref
+  // has to take a reference and check the key.
+  template <typename TryRef>
+  CacheHandle* Lookup(uint32_t hash, const TryRef& try_ref) const {
+    const Array* array = current_.load(std::memory_order_acquire);
+    size_t i = hash & array->mask;
+    for (size_t probes = 0; probes <= array->mask; probes++) {
+      const Slot& slot = array->slots[i];
+      CacheHandle* handle = slot.handle.load(std::memory_order_acquire);
+      if (handle != nullptr &&
+          handle->hash.load(std::memory_order_relaxed) == hash &&
+          try_ref(handle)) {
+        return handle;
+      }
+      if (slot.displacements.load(std::memory_order_acquire) == 0) {
+        break;
+      }
+      i = (i + 1) & array->mask;
+    }
+    return nullptr;
+  }
 
-  CacheKey() = default;
+  // Has to hold the shard mutex, the keys of the handles in the table can't
+  // change then.
+  CacheHandle* Find(const Slice& key, uint32_t hash) const {
+    const Array* array = current_.load(std::memory_order_relaxed);
+    size_t i = hash & array->mask;
+    for (size_t probes = 0; probes <= array->mask; probes++) {
+      const Slot& slot = array->slots[i];
+      CacheHandle* handle = slot.handle.load(std::memory_order_relaxed);
+      if (handle != nullptr &&
+          handle->hash.load(std::memory_order_relaxed) == hash &&
+          handle->key == key) {
+        return handle;
+      }
+      if (slot.displacements.load(std::memory_order_relaxed) == 0) {
+        break;
+      }
+      i = (i + 1) & array->mask;
+    }
+    return nullptr;
+  }
 
-  CacheKey(const Slice& k, uint32_t h) {
-    key = k;
-    hash_value = h;
+  // The key of the handle must not be in the table yet. Has to hold the
+  // shard mutex.
+  void Insert(CacheHandle* handle) {
+    Array* array = current_.load(std::memory_order_relaxed);
+    if ((occupancy_ + 1) * 4 > (array->mask + 1) * 3) {
+      array = Grow(array);
+    }
+    InsertInto(array, handle);
+    occupancy_++;
+  }
+
+  // The handle must be in the table. Has to hold the shard mutex.
+  void Erase(CacheHandle* handle) {
+    Array* array = current_.load(std::memory_order_relaxed);
+    size_t home = handle->hash.load(std::memory_order_relaxed) & array->mask;
+    size_t i = home;
+    while (array->slots[i].handle.load(std::memory_order_relaxed) != handle) {
+      i = (i + 1) & array->mask;
+      assert(i != home);
+    }
+    array->slots[i].handle.store(nullptr, std::memory_order_release);
+    for (size_t j = home; j != i; j = (j + 1) & array->mask) {
+      array->slots[j].displacements.fetch_sub(1, std::memory_order_release);
+    }
+    occupancy_--;
   }
 
-  static bool equal(const CacheKey& a, const CacheKey& b) {
-    return a.hash_value == b.hash_value && a.key == b.key;
+  // Has to hold the shard mutex.
+  void Clear() {
+    Array* array = current_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i <= array->mask; i++) {
+      array->slots[i].handle.store(nullptr, std::memory_order_release);
+      array->slots[i].displacements.store(0, std::memory_order_release);
+    }
+    occupancy_ = 0;
   }
 
-  static size_t hash(const CacheKey& a) {
-    return static_cast<size_t>(a.hash_value);
+ private:
+  static const size_t kInitialSize = 64;
+
+  struct Slot {
+    std::atomic<CacheHandle*> handle{nullptr};
+    std::atomic<uint32_t> displacements{0};
+  };
+
+  struct Array {
+    explicit Array(size_t size) : mask(size - 1), slots(new Slot[size]) {
+      assert((size & mask) == 0);
+    }
+
+    const size_t mask;
+    std::unique_ptr<Slot[]> slots;
+  };
+
+  static void InsertInto(Array* array, CacheHandle* handle) {
+    size_t i = handle->hash.load(std::memory_order_relaxed) & array->mask;
+    while (array->slots[i].handle.load(std::memory_order_relaxed) != nullptr) {
+      array->slots[i].displacements.fetch_add(1, std::memory_order_release);
+      i = (i + 1) & array->mask;
+    }
+    array->slots[i].handle.store(handle, std::memory_order_release);
+  }
+
+  Array* Grow(Array* array) {
+    size_t size = (array->mask + 1) * 2;
+    arrays_.emplace_back(new Array(size));
+    Array* new_array = arrays_.back().get();
+    for (size_t i = 0; i <= array->mask; i++) {
+      CacheHandle* handle =
+          array->slots[i].handle.load(std::memory_order_relaxed);
+      if (handle != nullptr) {
+        InsertInto(new_array, handle);
+      }
+    }
+    current_.store(new_array, std::memory_order_release);
+    return new_array;
   }
+
+  std::atomic<Array*> current_;
+  // Number of handles in the current array.
+  size_t occupancy_ = 0;
+  // All the arrays so far, the current one last.
+  std::vector<std::unique_ptr<Array>> arrays_;
 };
 
 struct CleanupContext {
@@ -259,9 +386,6 @@ struct CleanupContext {
 // A cache shard which maintains its own CLOCK cache.
 class ClockCacheShard final : public CacheShard {
  public:
-  // Hash map type.
-  typedef tbb::concurrent_hash_map<CacheKey, CacheHandle*, CacheKey> HashTable;
-
   ClockCacheShard();
   ~ClockCacheShard() override;
 
@@ -377,8 +501,8 @@ class ClockCacheShard final : public CacheShard {
   // Whether allow insert into cache if cache is full.
   std::atomic<bool> strict_capacity_limit_;
 
-  // Hash table (tbb::concurrent_hash_map) for lookup.
-  HashTable table_;
+  // Hash table for lookup.
+  HandleTable table_;
 };
 
 ClockCacheShard::ClockCacheShard()
@@ -473,6 +597,9 @@ bool ClockCacheShard::Unref(CacheHandle* handle, bool set_usage,
   if (set_usage) {
     handle->flags.fetch_or(kUsageBit, std::memory_order_relaxed);
   }
+  // Read the charge while we still hold the reference. Once the last one is
+  // gone, eviction may recycle the handle for another key right away.
+  size_t total_charge = handle->CalcTotalCharge(metadata_charge_policy_);
   // Use acquire-release semantics as previous operations on the cache entry
   // has to be order before reference count is decreased, and potential cleanup
   // of the entry has to be order after.
@@ -480,7 +607,6 @@ bool ClockCacheShard::Unref(CacheHandle* handle, bool set_usage,
   assert(CountRefs(flags) > 0);
   if (CountRefs(flags) == 1) {
     // this is the last reference.
-    size_t total_charge = handle->CalcTotalCharge(metadata_charge_policy_);
     pinned_usage_.fetch_sub(total_charge, std::memory_order_relaxed);
     // Cleanup if it is the last reference.
     if (!InCache(flags)) {
@@ -511,9 +637,7 @@ bool ClockCacheShard::TryEvict(CacheHandle* handle, CleanupContext* context) {
   uint32_t flags = kInCacheBit;
   if (handle->flags.compare_exchange_strong(flags, 0, std::memory_order_acquire,
                                             std::memory_order_relaxed)) {
-    bool erased __attribute__((__unused__)) =
-        table_.erase(CacheKey(handle->key, handle->hash));
-    assert(erased);
+    table_.Erase(handle);
     RecycleHandle(handle, context);
     return true;
   }
@@ -591,20 +715,21 @@ CacheHandle* ClockCacheShard::Insert(
   }
   // Fill handle.
   handle->key = key;
-  handle->hash = hash;
+  handle->hash.store(hash, std::memory_order_relaxed);
   handle->value = value;
   handle->charge = charge;
   handle->deleter = deleter;
   uint32_t flags = hold_reference ? kInCacheBit + kOneRef : kInCacheBit;
-  handle->flags.store(flags, std::memory_order_relaxed);
-  HashTable::accessor accessor;
-  if (table_.find(accessor, CacheKey(key, hash))) {
+  // Use release semantics so that a lock-free lookup whose Ref() sees the
+  // in-cache bit also sees the fields above.
+  handle->flags.store(flags, std::memory_order_release);
+  CacheHandle* existing_handle = table_.Find(key, hash);
+  if (existing_handle != nullptr) {
     *overwritten = true;
-    CacheHandle* existing_handle = accessor->second;
-    table_.erase(accessor);
+    table_.Erase(existing_handle);
     UnsetInCache(existing_handle, context);
   }
-  table_.insert(HashTable::value_type(CacheKey(key, hash), handle));
+  table_.Insert(handle);
   if (hold_reference) {
     pinned_usage_.fetch_add(total_charge, std::memory_order_relaxed);
   }
@@ -618,7 +743,6 @@ Status ClockCacheShard::Insert(const Slice& key, uint32_t hash, void* value,
                                Cache::Handle** out_handle,
                                Cache::Priority /*priority*/) {
   CleanupContext context;
-  HashTable::accessor accessor;
   char* key_data = new char[key.size()];
   memcpy(key_data, key.data(), key.size());
   Slice key_copy(key_data, key.size());
@@ -642,27 +766,25 @@ Status ClockCacheShard::Insert(const Slice& key, uint32_t hash, void* value,
 }
 
 Cache::Handle* ClockCacheShard::Lookup(const Slice& key, uint32_t hash) {
-  HashTable::const_accessor accessor;
-  if (!table_.find(accessor, CacheKey(key, hash))) {
-    return nullptr;
-  }
-  CacheHandle* handle = accessor->second;
-  accessor.release();
-  // Ref() could fail if another thread sneak in and evict/erase the cache
-  // entry before we are able to hold reference.
-  if (!Ref(reinterpret_cast<Cache::Handle*>(handle))) {
-    return nullptr;
-  }
-  // Double check the key since the handle may now representing another key
-  // if other threads sneak in, evict/erase the entry and re-used the handle
-  // for another cache entry.
-  if (hash != handle->hash || key != handle->key) {
-    CleanupContext context;
-    Unref(handle, false, &context);
-    // It is possible Unref() delete the entry, so we need to cleanup.
-    Cleanup(context);
-    return nullptr;
-  }
+  CleanupContext context;
+  CacheHandle* handle = table_.Lookup(hash, [&](CacheHandle* candidate) {
+    // Ref() could fail if another thread sneak in and evict/erase the cache
+    // entry before we are able to hold reference.
+    if (!Ref(reinterpret_cast<Cache::Handle*>(candidate))) {
+      return false;
+    }
+    // Double check the key since the handle may now representing another key
+    // if other threads sneak in, evict/erase the entry and re-used the handle
+    // for another cache entry.
+    if (hash != candidate->hash.load(std::memory_order_relaxed) ||
+        key != candidate->key) {
+      // It is possible Unref() delete the entry, so we need to cleanup.
+      Unref(candidate, false, &context);
+      return false;
+    }
+    return true;
+  });
+  Cleanup(context);
   return reinterpret_cast<Cache::Handle*>(handle);
 }
 
@@ -671,7 +793,9 @@ bool ClockCacheShard::Release(Cache::Handle* h, bool force_erase) {
   CacheHandle* handle = reinterpret_cast<CacheHandle*>(h);
   bool erased = Unref(handle, true, &context);
   if (force_erase && !erased) {
-    erased = EraseAndConfirm(handle->key, handle->hash, &context);
+    erased = EraseAndConfirm(handle->key,
+                             handle->hash.load(std::memory_order_relaxed),
+                             &context);
   }
   Cleanup(context);
   return erased;
@@ -686,11 +810,10 @@ void ClockCacheShard::Erase(const Slice& key, uint32_t hash) {
 bool ClockCacheShard::EraseAndConfirm(const Slice& key, uint32_t hash,
                                       CleanupContext* context) {
   MutexLock l(&mutex_);
-  HashTable::accessor accessor;
   bool erased = false;
-  if (table_.find(accessor, CacheKey(key, hash))) {
-    CacheHandle* handle = accessor->second;
-    table_.erase(accessor);
+  CacheHandle* handle = table_.Find(key, hash);
+  if (handle != nullptr) {
+    table_.Erase(handle);
     erased = UnsetInCache(handle, context);
   }
   return erased;
@@ -700,7 +823,7 @@ void ClockCacheShard::EraseUnRefEntries() {
   CleanupContext context;
   {
     MutexLock l(&mutex_);
-    table_.clear();
+    table_.Clear();
     for (auto& handle : list_) {
       UnsetInCache(&handle, &context);
     }
@@ -743,7 +866,8 @@ class ClockCache final : public ShardedCache {
   }
 
   uint32_t GetHash(Handle* handle) const override {
-    return reinterpret_cast<const CacheHandle*>(handle)->hash;
+    return reinterpret_cast<const CacheHandle*>(handle)->hash.load(
+        std::memory_order_relaxed);
   }
 
   void DisownData() override { shards_ = nullptr; }
@@ -0,0 +1,188 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "cache/compressed_secondary_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "util/mutexlock.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+namespace {
+void DeleteEntry(const Slice& /*key*/, void* value) {
+  delete reinterpret_cast<std::string*>(value);
+}
+
+bool IsZSTD(CompressionType type) {
+  return type == kZSTD || type == kZSTDNotFinalCompression;
+}
+}  // namespace
+
+CompressedSecondaryCache::CompressedSecondaryCache(
+    const CompressedSecondaryCacheOptions& opts)
+    : opts_(opts),
+      cache_(NewLRUCache(opts.capacity, opts.num_shard_bits,
+                         false /* strict_capacity_limit */,
+                         0.0 /* high_pri_pool_ratio */,
+                         nullptr /* memory_allocator */,
+                         kDefaultToAdaptiveMutex,
+                         opts.metadata_charge_policy)) {}
+
+CompressedSecondaryCache::~CompressedSecondaryCache() {}
+
+Status CompressedSecondaryCache::Insert(const Slice& key,
+                                        const Slice& contents) {
+  const CompressionType type = opts_.compression_type;
+  bool use_dict = false;
+  if (type != kNoCompression && opts_.max_dict_bytes > 0) {
+    if (dict_built_.load(std::memory_order_acquire)) {
+      use_dict = true;
+    } else {
+      MaybeSample(contents);
+    }
+  }
+
+  std::string compressed;
+  bool compressed_ok = false;
+  if (type != kNoCompression) {
+    CompressionContext context(type);
+    CompressionInfo info(
+        compression_opts_, context,
+        use_dict ? *compression_dict_ : CompressionDict::GetEmptyDict(), type,
+        0 /* sample_for_compression */);
+    compressed_ok =
+        CompressData(contents, info, kCompressFormatVersion, &compressed) &&
+        compressed.size() < contents.size();
+  }
+
+  std::string* entry = new std::string();
+  if (compressed_ok) {
+    entry->reserve(1 + compressed.size());
+    entry->push_back(use_dict ? kCompressedWithDict : kCompressed);
+    entry->append(compressed);
+  } else {
+    entry->reserve(1 + contents.size());
+    entry->push_back(kRaw);
+    entry->append(contents.data(), contents.size());
+  }
+  // Without a handle the cache deletes the entry if it cannot keep it
+  return cache_->Insert(key, entry, sizeof(std::string) + entry->capacity(),
+                        &DeleteEntry);
+}
+
+Status CompressedSecondaryCache::Take(const Slice& key,
+                                      std::unique_ptr<char[]>* contents,
+                                      size_t* size) {
+  Cache::Handle* handle = cache_->Lookup(key);
+  if (handle == nullptr) {
+    return Status::NotFound();
+  }
+  const std::string* entry =
+      reinterpret_cast<const std::string*>(cache_->Value(handle));
+  assert(!entry->empty());
+  const char* data = entry->data() + 1;
+  const size_t n = entry->size() - 1;
+
+  Status s;
+  if (entry->front() == kRaw) {
+    contents->reset(new char[n]);
+    memcpy(contents->get(), data, n);
+    *size = n;
+  } else {
+    // entries tagged kCompressedWithDict were compressed after the
+    // dictionary was built
+    const UncompressionDict& dict = entry->front() == kCompressedWithDict
+                                        ? *uncompression_dict_
+                                        : UncompressionDict::GetEmptyDict();
+    UncompressionContext context(opts_.compression_type);
+    UncompressionInfo info(context, dict, opts_.compression_type);
+    CacheAllocationPtr uncompressed =
+        UncompressData(info, data, n, size, kCompressFormatVersion);
+    if (uncompressed) {
+      // allocated without a memory allocator, so it is a plain char[]
+      contents->reset(uncompressed.release());
+    } else {
+      s = Status::Corruption("Cannot uncompress a secondary cache entry");
+    }
+  }
+
+  // The entry moves back to the primary cache
+  cache_->Erase(key);
+  cache_->Release(handle);
+  return s;
+}
+
+void CompressedSecondaryCache::Erase(const Slice& key) { cache_->Erase(key); }
+
+size_t CompressedSecondaryCache::GetCapacity() const {
+  return cache_->GetCapacity();
+}
+
+size_t CompressedSecondaryCache::GetUsage() const {
+  return cache_->GetUsage();
+}
+
+std::string CompressedSecondaryCache::GetPrintableOptions() const {
+  std::string ret;
+  const int kBufferSize = 200;
+  char buffer[kBufferSize];
+  snprintf(buffer, kBufferSize, "    capacity : %" ROCKSDB_PRIszt "\n",
+           cache_->GetCapacity());
+  ret.append(buffer);
+  snprintf(buffer, kBufferSize, "    compression_type : %s\n",
+           CompressionTypeToString(opts_.compression_type).c_str());
+  ret.append(buffer);
+  snprintf(buffer, kBufferSize, "    max_dict_bytes : %u\n",
+           opts_.max_dict_bytes);
+  ret.append(buffer);
+  return ret;
+}
+
+void CompressedSecondaryCache::MaybeSample(const Slice& contents) {
+  MutexLock l(&sample_mutex_);
+  if (dict_built_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  samples_.append(contents.data(), contents.size());
+  sample_lens_.push_back(contents.size());
+  if (samples_.size() <
+      static_cast<size_t>(opts_.max_dict_bytes) * kSampleBytesPerDictByte) {
+    return;
+  }
+
+  const CompressionType type = opts_.compression_type;
+  std::string dict;
+  if (IsZSTD(type) && ZSTD_TrainDictionarySupported()) {
+    dict = ZSTD_TrainDictionary(samples_, sample_lens_, opts_.max_dict_bytes);
+  }
+  if (dict.empty()) {
+    // the most recent samples make the dictionary
+    size_t dict_size =
+        std::min(samples_.size(), static_cast<size_t>(opts_.max_dict_bytes));
+    dict = samples_.substr(samples_.size() - dict_size);
+  }
+  uncompression_dict_.reset(new UncompressionDict(dict, IsZSTD(type)));
+  compression_dict_.reset(
+      new CompressionDict(std::move(dict), type, compression_opts_.level));
+  std::string().swap(samples_);
+  std::vector<size_t>().swap(sample_lens_);
+  dict_built_.store(true, std::memory_order_release);
+}
+
+std::shared_ptr<SecondaryCache> NewCompressedSecondaryCache(
+    const CompressedSecondaryCacheOptions& opts) {
+  if (opts.num_shard_bits >= 20) {
+    return nullptr;  // the cache cannot be sharded into too many fine pieces
+  }
+  if (opts.compression_type != kNoCompression &&
+      !CompressionTypeSupported(opts.compression_type)) {
+    return nullptr;
+  }
+  return std::make_shared<CompressedSecondaryCache>(opts);
+}
+
+}  // namespace ROCKSDB_NAMESPACE
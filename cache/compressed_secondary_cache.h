@@ -0,0 +1,80 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "port/port.h"
+#include "rocksdb/cache.h"
+#include "rocksdb/secondary_cache.h"
+#include "util/compression.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+// A secondary tier that keeps the entries the primary cache evicts
+// compressed, in an LRUCache of its own. Every entry starts with a tag:
+// kRaw if it did not compress and is kept as is, kCompressed or
+// kCompressedWithDict otherwise, followed by the output of CompressData().
+//
+// With max_dict_bytes set, the first entries are sampled until there are
+// enough samples to build the dictionary. It never changes once built, so
+// the entries compressed with it are read without a lock.
+class CompressedSecondaryCache : public SecondaryCache {
+ public:
+  explicit CompressedSecondaryCache(
+      const CompressedSecondaryCacheOptions& opts);
+  ~CompressedSecondaryCache() override;
+
+  const char* Name() const override { return "CompressedSecondaryCache"; }
+
+  Status Insert(const Slice& key, const Slice& contents) override;
+
+  Status Take(const Slice& key, std::unique_ptr<char[]>* contents,
+              size_t* size) override;
+
+  void Erase(const Slice& key) override;
+
+  size_t GetCapacity() const override;
+
+  size_t GetUsage() const override;
+
+  std::string GetPrintableOptions() const override;
+
+ private:
+  enum Tag : char {
+    kRaw = 0,
+    kCompressed = 1,
+    kCompressedWithDict = 2,
+  };
+
+  // The samples add up to this many times max_dict_bytes before the
+  // dictionary is built, as ZSTD recommends for its trainer
+  static const size_t kSampleBytesPerDictByte = 100;
+
+  // The format of the uncompressed size CompressData() prepends
+  static const uint32_t kCompressFormatVersion = 2;
+
+  // Add contents to the samples, and build the dictionary once there are
+  // enough of them
+  void MaybeSample(const Slice& contents);
+
+  const CompressedSecondaryCacheOptions opts_;
+  std::shared_ptr<Cache> cache_;
+  const CompressionOptions compression_opts_;
+
+  port::Mutex sample_mutex_;
+  std::string samples_;
+  std::vector<size_t> sample_lens_;
+  // Set once, before dict_built_
+  std::unique_ptr<CompressionDict> compression_dict_;
+  std::unique_ptr<UncompressionDict> uncompression_dict_;
+  std::atomic<bool> dict_built_{false};
+};
+
+}  // namespace ROCKSDB_NAMESPACE
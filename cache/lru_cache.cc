@@ -95,15 +95,16 @@ void LRUHandleTable::Resize() {
   length_ = new_length;
 }
 
-LRUCacheShard::LRUCacheShard(size_t capacity, bool strict_capacity_limit,
-                             double high_pri_pool_ratio,
-                             bool use_adaptive_mutex,
-                             CacheMetadataChargePolicy metadata_charge_policy)
+LRUCacheShard::LRUCacheShard(
+    size_t capacity, bool strict_capacity_limit, double high_pri_pool_ratio,
+    bool use_adaptive_mutex, CacheMetadataChargePolicy metadata_charge_policy,
+    const std::shared_ptr<SecondaryCache>& secondary_cache)
     : capacity_(0),
       high_pri_pool_usage_(0),
       strict_capacity_limit_(strict_capacity_limit),
       high_pri_pool_ratio_(high_pri_pool_ratio),
       high_pri_pool_capacity_(0),
+      secondary_cache_(secondary_cache),
       usage_(0),
       lru_usage_(0),
       mutex_(use_adaptive_mutex) {
@@ -248,6 +249,17 @@ void LRUCacheShard::EvictFromLRU(size_t charge,
   }
 }
 
+void LRUCacheShard::Demote(LRUHandle* e) {
+  if (secondary_cache_ == nullptr || e->helper == nullptr) {
+    return;
+  }
+  Slice contents = e->helper->contents_cb(e->value);
+  if (!contents.empty()) {
+    // the entry is only dropped if the tier cannot take it
+    secondary_cache_->Insert(e->key(), contents).PermitUncheckedError();
+  }
+}
+
 void LRUCacheShard::SetCapacity(size_t capacity) {
   autovector<LRUHandle*> last_reference_list;
   {
@@ -259,6 +271,7 @@ void LRUCacheShard::SetCapacity(size_t capacity) {
 
   // Free the entries outside of mutex for performance reasons
   for (auto entry : last_reference_list) {
+    Demote(entry);
     entry->Free();
   }
 }
@@ -283,6 +296,34 @@ Cache::Handle* LRUCacheShard::Lookup(const Slice& key, uint32_t hash) {
   return reinterpret_cast<Cache::Handle*>(e);
 }
 
+Cache::Handle* LRUCacheShard::LookupWithHelper(
+    const Slice& key, uint32_t hash, const Cache::CacheItemHelper* helper,
+    const Cache::CreateCallback& create_cb, Cache::Priority priority) {
+  Cache::Handle* handle = Lookup(key, hash);
+  if (handle != nullptr || secondary_cache_ == nullptr || helper == nullptr ||
+      !create_cb) {
+    return handle;
+  }
+  std::unique_ptr<char[]> contents;
+  size_t size = 0;
+  if (!secondary_cache_->Take(key, &contents, &size).ok()) {
+    return nullptr;
+  }
+  void* value = nullptr;
+  size_t charge = 0;
+  if (!create_cb(std::move(contents), size, &value, &charge).ok()) {
+    return nullptr;
+  }
+  // Promote the entry, it is no longer in the secondary tier
+  Status s = InsertItem(key, hash, value, charge, helper->deleter, helper,
+                        &handle, priority);
+  if (!s.ok()) {
+    (*helper->deleter)(key, value);
+    return nullptr;
+  }
+  return handle;
+}
+
 bool LRUCacheShard::Ref(Cache::Handle* h) {
   LRUHandle* e = reinterpret_cast<LRUHandle*>(h);
   MutexLock l(&mutex_);
@@ -340,16 +381,37 @@ Status LRUCacheShard::Insert(const Slice& key, uint32_t hash, void* value,
                              size_t charge,
                              void (*deleter)(const Slice& key, void* value),
                              Cache::Handle** handle, Cache::Priority priority) {
+  return InsertItem(key, hash, value, charge, deleter, nullptr /* helper */,
+                    handle, priority);
+}
+
+Status LRUCacheShard::InsertWithHelper(const Slice& key, uint32_t hash,
+                                       void* value,
+                                       const Cache::CacheItemHelper* helper,
+                                       size_t charge, Cache::Handle** handle,
+                                       Cache::Priority priority) {
+  return InsertItem(key, hash, value, charge, helper->deleter, helper, handle,
+                    priority);
+}
+
+Status LRUCacheShard::InsertItem(const Slice& key, uint32_t hash, void* value,
+                                 size_t charge,
+                                 void (*deleter)(const Slice& key, void* value),
+                                 const Cache::CacheItemHelper* helper,
+                                 Cache::Handle** handle,
+                                 Cache::Priority priority) {
   // Allocate the memory here outside of the mutex
   // If the cache is full, we'll have to release it
   // It shouldn't happen very often though.
   LRUHandle* e = reinterpret_cast<LRUHandle*>(
       new char[sizeof(LRUHandle) - 1 + key.size()]);
   Status s = Status::OK();
+  autovector<LRUHandle*> evicted_list;
   autovector<LRUHandle*> last_reference_list;
 
   e->value = value;
   e->deleter = deleter;
+  e->helper = helper;
   e->charge = charge;
   e->key_length = key.size();
   e->flags = 0;
@@ -366,7 +428,7 @@ Status LRUCacheShard::Insert(const Slice& key, uint32_t hash, void* value,
 
     // Free the space following strict LRU policy until enough space
     // is freed or the lru list is empty
-    EvictFromLRU(total_charge, &last_reference_list);
+    EvictFromLRU(total_charge, &evicted_list);
 
     if ((usage_ + total_charge) > capacity_ &&
         (strict_capacity_limit_ || handle == nullptr)) {
@@ -409,6 +471,10 @@ Status LRUCacheShard::Insert(const Slice& key, uint32_t hash, void* value,
   }
 
   // Free the entries here outside of mutex for performance reasons
+  for (auto entry : evicted_list) {
+    Demote(entry);
+    entry->Free();
+  }
   for (auto entry : last_reference_list) {
     entry->Free();
   }
@@ -462,14 +528,20 @@ std::string LRUCacheShard::GetPrintableOptions() const {
     snprintf(buffer, kBufferSize, "    high_pri_pool_ratio: %.3lf\n",
              high_pri_pool_ratio_);
   }
-  return std::string(buffer);
+  std::string ret(buffer);
+  if (secondary_cache_ != nullptr) {
+    ret.append("    secondary_cache:\n");
+    ret.append(secondary_cache_->GetPrintableOptions());
+  }
+  return ret;
 }
 
 LRUCache::LRUCache(size_t capacity, int num_shard_bits,
                    bool strict_capacity_limit, double high_pri_pool_ratio,
                    std::shared_ptr<MemoryAllocator> allocator,
                    bool use_adaptive_mutex,
-                   CacheMetadataChargePolicy metadata_charge_policy)
+                   CacheMetadataChargePolicy metadata_charge_policy,
+                   std::shared_ptr<SecondaryCache> secondary_cache)
     : ShardedCache(capacity, num_shard_bits, strict_capacity_limit,
                    std::move(allocator)) {
   num_shards_ = 1 << num_shard_bits;
@@ -479,7 +551,8 @@ LRUCache::LRUCache(size_t capacity, int num_shard_bits,
   for (int i = 0; i < num_shards_; i++) {
     new (&shards_[i])
         LRUCacheShard(per_shard, strict_capacity_limit, high_pri_pool_ratio,
-                      use_adaptive_mutex, metadata_charge_policy);
+                      use_adaptive_mutex, metadata_charge_policy,
+                      secondary_cache);
   }
 }
 
@@ -545,31 +618,33 @@ double LRUCache::GetHighPriPoolRatio() {
 }
 
 std::shared_ptr<Cache> NewLRUCache(const LRUCacheOptions& cache_opts) {
-  return NewLRUCache(cache_opts.capacity, cache_opts.num_shard_bits,
-                     cache_opts.strict_capacity_limit,
-                     cache_opts.high_pri_pool_ratio,
-                     cache_opts.memory_allocator, cache_opts.use_adaptive_mutex,
-                     cache_opts.metadata_charge_policy);
-}
-
-std::shared_ptr<Cache> NewLRUCache(
-    size_t capacity, int num_shard_bits, bool strict_capacity_limit,
-    double high_pri_pool_ratio,
-    std::shared_ptr<MemoryAllocator> memory_allocator, bool use_adaptive_mutex,
-    CacheMetadataChargePolicy metadata_charge_policy) {
-  if (num_shard_bits >= 20) {
+  if (cache_opts.num_shard_bits >= 20) {
     return nullptr;  // the cache cannot be sharded into too many fine pieces
   }
-  if (high_pri_pool_ratio < 0.0 || high_pri_pool_ratio > 1.0) {
+  if (cache_opts.high_pri_pool_ratio < 0.0 ||
+      cache_opts.high_pri_pool_ratio > 1.0) {
     // invalid high_pri_pool_ratio
     return nullptr;
   }
+  int num_shard_bits = cache_opts.num_shard_bits;
   if (num_shard_bits < 0) {
-    num_shard_bits = GetDefaultCacheShardBits(capacity);
+    num_shard_bits = GetDefaultCacheShardBits(cache_opts.capacity);
   }
   return std::make_shared<LRUCache>(
+      cache_opts.capacity, num_shard_bits, cache_opts.strict_capacity_limit,
+      cache_opts.high_pri_pool_ratio, cache_opts.memory_allocator,
+      cache_opts.use_adaptive_mutex, cache_opts.metadata_charge_policy,
+      cache_opts.secondary_cache);
+}
+
+std::shared_ptr<Cache> NewLRUCache(
+    size_t capacity, int num_shard_bits, bool strict_capacity_limit,
+    double high_pri_pool_ratio,
+    std::shared_ptr<MemoryAllocator> memory_allocator, bool use_adaptive_mutex,
+    CacheMetadataChargePolicy metadata_charge_policy) {
+  return NewLRUCache(LRUCacheOptions(
       capacity, num_shard_bits, strict_capacity_limit, high_pri_pool_ratio,
-      std::move(memory_allocator), use_adaptive_mutex, metadata_charge_policy);
+      std::move(memory_allocator), use_adaptive_mutex, metadata_charge_policy));
 }
 
 }  // namespace ROCKSDB_NAMESPACE
@@ -13,6 +13,7 @@
 #include "cache/sharded_cache.h"
 
 #include "port/malloc.h"
+#include "rocksdb/secondary_cache.h"
 #include "port/port.h"
 #include "util/autovector.h"
 
@@ -50,6 +51,8 @@ namespace ROCKSDB_NAMESPACE {
 struct LRUHandle {
   void* value;
   void (*deleter)(const Slice&, void* value);
+  // Set if the entry may move to the secondary tier once evicted
+  const Cache::CacheItemHelper* helper;
   LRUHandle* next_hash;
   LRUHandle* next;
   LRUHandle* prev;
@@ -193,7 +196,8 @@ class ALIGN_AS(CACHE_LINE_SIZE) LRUCacheShard final : public CacheShard {
  public:
   LRUCacheShard(size_t capacity, bool strict_capacity_limit,
                 double high_pri_pool_ratio, bool use_adaptive_mutex,
-                CacheMetadataChargePolicy metadata_charge_policy);
+                CacheMetadataChargePolicy metadata_charge_policy,
+                const std::shared_ptr<SecondaryCache>& secondary_cache);
   virtual ~LRUCacheShard() override = default;
 
   // Separate from constructor so caller can easily make an array of LRUCache
@@ -214,6 +218,14 @@ class ALIGN_AS(CACHE_LINE_SIZE) LRUCacheShard final : public CacheShard {
                         Cache::Handle** handle,
                         Cache::Priority priority) override;
   virtual Cache::Handle* Lookup(const Slice& key, uint32_t hash) override;
+  virtual Status InsertWithHelper(const Slice& key, uint32_t hash, void* value,
+                                  const Cache::CacheItemHelper* helper,
+                                  size_t charge, Cache::Handle** handle,
+                                  Cache::Priority priority) override;
+  virtual Cache::Handle* LookupWithHelper(
+      const Slice& key, uint32_t hash, const Cache::CacheItemHelper* helper,
+      const Cache::CreateCallback& create_cb,
+      Cache::Priority priority) override;
   virtual bool Ref(Cache::Handle* handle) override;
   virtual bool Release(Cache::Handle* handle,
                        bool force_erase = false) override;
@@ -256,6 +268,16 @@ class ALIGN_AS(CACHE_LINE_SIZE) LRUCacheShard final : public CacheShard {
   // holding the mutex_
   void EvictFromLRU(size_t charge, autovector<LRUHandle*>* deleted);
 
+  // Hand the contents of an entry evicted by EvictFromLRU to the secondary
+  // tier, if it has a helper. Called outside of mutex_, before Free()
+  void Demote(LRUHandle* e);
+
+  Status InsertItem(const Slice& key, uint32_t hash, void* value,
+                    size_t charge,
+                    void (*deleter)(const Slice& key, void* value),
+                    const Cache::CacheItemHelper* helper,
+                    Cache::Handle** handle, Cache::Priority priority);
+
   // Initialized before use.
   size_t capacity_;
 
@@ -280,6 +302,9 @@ class ALIGN_AS(CACHE_LINE_SIZE) LRUCacheShard final : public CacheShard {
   // Pointer to head of low-pri pool in LRU list.
   LRUHandle* lru_low_pri_;
 
+  // Evicted entries with a helper move there, shared by all the shards
+  std::shared_ptr<SecondaryCache> secondary_cache_;
+
   // ------------^^^^^^^^^^^^^-----------
   // Not frequently modified data members
   // ------------------------------------
@@ -316,7 +341,8 @@ class LRUCache
            std::shared_ptr<MemoryAllocator> memory_allocator = nullptr,
            bool use_adaptive_mutex = kDefaultToAdaptiveMutex,
            CacheMetadataChargePolicy metadata_charge_policy =
-               kDontChargeCacheMetadata);
+               kDontChargeCacheMetadata,
+           std::shared_ptr<SecondaryCache> secondary_cache = nullptr);
   virtual ~LRUCache();
   virtual const char* Name() const override { return "LRUCache"; }
   virtual CacheShard* GetShard(int shard) override;
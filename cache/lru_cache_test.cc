@@ -8,7 +8,9 @@
 #include <string>
 #include <vector>
 #include "port/port.h"
+#include "rocksdb/secondary_cache.h"
 #include "test_util/testharness.h"
+#include "util/compression.h"
 
 namespace ROCKSDB_NAMESPACE {
 
@@ -32,7 +34,8 @@ class LRUCacheTest : public testing::Test {
         port::cacheline_aligned_alloc(sizeof(LRUCacheShard)));
     new (cache_) LRUCacheShard(capacity, false /*strict_capcity_limit*/,
                                high_pri_pool_ratio, use_adaptive_mutex,
-                               kDontChargeCacheMetadata);
+                               kDontChargeCacheMetadata,
+                               nullptr /*secondary_cache*/);
   }
 
   void Insert(const std::string& key,
@@ -191,6 +194,109 @@ TEST_F(LRUCacheTest, EntriesWithPriority) {
   ValidateLRUList({"e", "f", "g", "Z", "d"}, 2);
 }
 
+class LRUSecondaryCacheTest : public testing::Test {
+ public:
+  static Slice StringContents(void* value) {
+    return *reinterpret_cast<std::string*>(value);
+  }
+
+  static void DeleteString(const Slice& /*key*/, void* value) {
+    delete reinterpret_cast<std::string*>(value);
+  }
+
+  static Status CreateString(std::unique_ptr<char[]>&& contents, size_t size,
+                             void** value, size_t* charge) {
+    *value = new std::string(contents.get(), size);
+    *charge = size;
+    return Status::OK();
+  }
+
+  static const Cache::CacheItemHelper kHelper;
+
+  // compresses well, and better with a dictionary
+  static std::string Value(int i) {
+    std::string value;
+    while (value.size() < 1000) {
+      value.append("value of the entry " + std::to_string(i) + ", ");
+    }
+    return value;
+  }
+};
+
+const Cache::CacheItemHelper LRUSecondaryCacheTest::kHelper{
+    &LRUSecondaryCacheTest::StringContents,
+    &LRUSecondaryCacheTest::DeleteString};
+
+TEST_F(LRUSecondaryCacheTest, EvictedEntriesMoveToSecondaryTier) {
+  std::shared_ptr<SecondaryCache> secondary_cache =
+      NewCompressedSecondaryCache(CompressedSecondaryCacheOptions(
+          1 << 20, 0 /*num_shard_bits*/, kNoCompression));
+  LRUCacheOptions opts(5000, 0 /*num_shard_bits*/,
+                       false /*strict_capacity_limit*/,
+                       0.0 /*high_pri_pool_ratio*/);
+  opts.metadata_charge_policy = kDontChargeCacheMetadata;
+  opts.secondary_cache = secondary_cache;
+  std::shared_ptr<Cache> cache = NewLRUCache(opts);
+
+  // 0 to 4 are evicted to make room for 5 to 9
+  for (int i = 0; i < 10; i++) {
+    std::string* value = new std::string(Value(i));
+    ASSERT_OK(cache->InsertWithHelper(std::to_string(i), value, &kHelper,
+                                      value->size()));
+  }
+  // entries without a helper are only dropped
+  ASSERT_OK(
+      cache->Insert("plain", new std::string(Value(10)), 1000, &DeleteString));
+  ASSERT_GT(secondary_cache->GetUsage(), 5 * 1000);
+  ASSERT_EQ(nullptr, cache->Lookup("0"));
+
+  Cache::Handle* handle = cache->LookupWithHelper(
+      "0", &kHelper, &CreateString, Cache::Priority::LOW);
+  ASSERT_NE(nullptr, handle);
+  ASSERT_EQ(Value(0), *reinterpret_cast<std::string*>(cache->Value(handle)));
+  cache->Release(handle);
+
+  // the tiers are exclusive
+  std::unique_ptr<char[]> contents;
+  size_t size;
+  ASSERT_TRUE(secondary_cache->Take("0", &contents, &size).IsNotFound());
+  ASSERT_OK(secondary_cache->Take("1", &contents, &size));
+  ASSERT_EQ(Value(1), std::string(contents.get(), size));
+  ASSERT_TRUE(secondary_cache->Take("plain", &contents, &size).IsNotFound());
+  ASSERT_EQ(nullptr, cache->LookupWithHelper("1", &kHelper, &CreateString,
+                                             Cache::Priority::LOW));
+}
+
+TEST_F(LRUSecondaryCacheTest, CompressedEntries) {
+  for (CompressionType type : {kNoCompression, kSnappyCompression,
+                                kZlibCompression, kLZ4Compression, kZSTD}) {
+    if (type != kNoCompression && !CompressionTypeSupported(type)) {
+      continue;
+    }
+    for (uint32_t max_dict_bytes : {0, 256}) {
+      std::shared_ptr<SecondaryCache> secondary_cache =
+          NewCompressedSecondaryCache(CompressedSecondaryCacheOptions(
+              1 << 20, 0 /*num_shard_bits*/, type, max_dict_bytes));
+      ASSERT_NE(nullptr, secondary_cache);
+      // the first ones are sampled for the dictionary
+      const int kNumEntries = 100;
+      for (int i = 0; i < kNumEntries; i++) {
+        ASSERT_OK(secondary_cache->Insert(std::to_string(i), Value(i)));
+      }
+      if (type != kNoCompression) {
+        ASSERT_LT(secondary_cache->GetUsage(), kNumEntries * 1000);
+      }
+      for (int i = 0; i < kNumEntries; i++) {
+        std::unique_ptr<char[]> contents;
+        size_t size;
+        ASSERT_OK(secondary_cache->Take(std::to_string(i), &contents, &size));
+        ASSERT_EQ(Value(i), std::string(contents.get(), size));
+      }
+      ASSERT_EQ(0, secondary_cache->GetUsage());
+    }
+  }
+}
+
 }  // namespace ROCKSDB_NAMESPACE
 
 int main(int argc, char** argv) {
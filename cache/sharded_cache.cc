@@ -56,6 +56,25 @@ Cache::Handle* ShardedCache::Lookup(const Slice& key, Statistics* /*stats*/) {
   return GetShard(Shard(hash))->Lookup(key, hash);
 }
 
+Status ShardedCache::InsertWithHelper(const Slice& key, void* value,
+                                      const CacheItemHelper* helper,
+                                      size_t charge, Handle** handle,
+                                      Priority priority) {
+  uint32_t hash = HashSlice(key);
+  return GetShard(Shard(hash))
+      ->InsertWithHelper(key, hash, value, helper, charge, handle, priority);
+}
+
+Cache::Handle* ShardedCache::LookupWithHelper(const Slice& key,
+                                              const CacheItemHelper* helper,
+                                              const CreateCallback& create_cb,
+                                              Priority priority,
+                                              Statistics* /*stats*/) {
+  uint32_t hash = HashSlice(key);
+  return GetShard(Shard(hash))
+      ->LookupWithHelper(key, hash, helper, create_cb, priority);
+}
+
 bool ShardedCache::Ref(Handle* handle) {
   uint32_t hash = GetHash(handle);
   return GetShard(Shard(hash))->Ref(handle);
@@ -29,6 +29,21 @@ class CacheShard {
                         void (*deleter)(const Slice& key, void* value),
                         Cache::Handle** handle, Cache::Priority priority) = 0;
   virtual Cache::Handle* Lookup(const Slice& key, uint32_t hash) = 0;
+  // See Cache::InsertWithHelper and Cache::LookupWithHelper, shards without
+  // a secondary tier ignore the helper
+  virtual Status InsertWithHelper(const Slice& key, uint32_t hash, void* value,
+                                  const Cache::CacheItemHelper* helper,
+                                  size_t charge, Cache::Handle** handle,
+                                  Cache::Priority priority) {
+    return Insert(key, hash, value, charge, helper->deleter, handle, priority);
+  }
+  virtual Cache::Handle* LookupWithHelper(
+      const Slice& key, uint32_t hash,
+      const Cache::CacheItemHelper* /*helper*/,
+      const Cache::CreateCallback& /*create_cb*/,
+      Cache::Priority /*priority*/) {
+    return Lookup(key, hash);
+  }
   virtual bool Ref(Cache::Handle* handle) = 0;
   virtual bool Release(Cache::Handle* handle, bool force_erase = false) = 0;
   virtual void Erase(const Slice& key, uint32_t hash) = 0;
@@ -73,6 +88,15 @@ class ShardedCache : public Cache {
                         void (*deleter)(const Slice& key, void* value),
                         Handle** handle, Priority priority) override;
   virtual Handle* Lookup(const Slice& key, Statistics* stats) override;
+  virtual Status InsertWithHelper(const Slice& key, void* value,
+                                  const CacheItemHelper* helper, size_t charge,
+                                  Handle** handle = nullptr,
+                                  Priority priority = Priority::LOW) override;
+  virtual Handle* LookupWithHelper(const Slice& key,
+                                   const CacheItemHelper* helper,
+                                   const CreateCallback& create_cb,
+                                   Priority priority,
+                                   Statistics* stats = nullptr) override;
   virtual bool Ref(Handle* handle) override;
   virtual bool Release(Handle* handle, bool force_erase = false) override;
   virtual void Erase(const Slice& key) override;
@@ -135,6 +135,8 @@ Status BuildTable(
   if (iter->Valid() || !range_del_agg->IsEmpty()) {
     TableBuilder* builder;
     std::unique_ptr<WritableFileWriter> file_writer;
+    // [RUBBLE] set if the table is streamed to the remote slot as it's built
+    std::shared_ptr<SstStreamShipper> sst_shipper;
     // Currently we only enable dictionary compression during compaction to the
     // bottommost level.
     CompressionOptions compression_opts_for_flush(compression_opts);
@@ -148,8 +150,8 @@ Status BuildTable(
 #endif  // !NDEBUG
       IOStatus io_s = NewWritableFile(fs, fname, &file, file_options);
       // [RUBBLE]
-      if(NeedShipSST(db_options)) {
-        AddFile(sta, num_mems_to_flush, meta->fd.GetNumber());
+      if (io_s.ok() && NeedShipSST(db_options)) {
+        io_s = AddFile(sta, num_mems_to_flush, meta->fd.GetNumber(), &sst_shipper);
       }
       // [RUBBLE END]
       assert(s.ok());
@@ -173,7 +175,11 @@ Status BuildTable(
           ioptions.file_checksum_gen_factory));
 
       // [RUBBLE]
-      if(db_options->is_rubble && db_options->is_primary){
+      if (sst_shipper != nullptr) {
+        // chunks are shipped as soon as they are written, no need to hold
+        // the whole table in memory
+        file_writer->SetWriteMirror(sst_shipper);
+      } else if(db_options->is_rubble && db_options->is_primary){
         // allocate an aligned buffer whose size is equal to the sst file size 
         // so we can accumulate small block chunks into this buffer 
         // and we can write the sst to the local sst_dir and remote sst_dir using the same buffer when the buffer is full
@@ -285,8 +291,9 @@ Status BuildTable(
     if (s.ok() && !empty) {
       StopWatch sw(env, ioptions.statistics, TABLE_SYNC_MICROS);
       *io_status = file_writer->Sync(ioptions.use_fsync);
-      if (sta != nullptr) {
-        PrepareFile(sta, file_writer->GetAlignedBuffer());
+      if (sta != nullptr && io_status->ok()) {
+        *io_status = PrepareFile(sta, file_writer->GetAlignedBuffer(),
+                                 file_writer->GetFileSize());
       }
     }
     TEST_SYNC_POINT("BuildTable:BeforeCloseTableFile");
@@ -355,6 +362,11 @@ Status BuildTable(
     Status ignored = fs->DeleteFile(fname, IOOptions(), dbg);
     ignored.PermitUncheckedError();
 
+    // [RUBBLE] the file is never shipped, give its slot back
+    if (sta != nullptr) {
+      DropFile(sta, meta->fd.GetNumber());
+    }
+
     assert(blob_file_additions || blob_file_paths.empty());
 
     if (blob_file_additions) {
@@ -14,6 +14,7 @@
 #include <vector>
 #include <atomic>
 
+#include "db/memtable_epoch.h"
 #include "db/memtable_list.h"
 #include "db/table_cache.h"
 #include "db/table_properties_collector.h"
@@ -363,6 +364,8 @@ class ColumnFamilyData {
   InternalStats* internal_stats() { return internal_stats_.get(); }
 
   MemTableList* imm() { return &imm_; }
+  // rubble: where the memtables switched on the head
+  MemTableEpoch* mem_epoch() { return &mem_epoch_; }
   MemTable* mem() { return mem_; }
   Version* current() { return current_; }
   Version* dummy_versions() { return dummy_versions_; }
@@ -376,6 +379,14 @@ class ColumnFamilyData {
     mem_ = new_mem;
   }
 
+  // rubble: a tail that installed a snapshot of the head goes on from the
+  // head's memtable mem_id. REQUIRES: DB mutex held, the memtable is empty
+  void ResetMemtableID(uint64_t mem_id) {
+    assert(mem_->IsEmpty());
+    last_memtable_id_.store(mem_id);
+    mem_->SetID(mem_id);
+  }
+
   // calculate the oldest log needed for the durability of this column family
   uint64_t OldestLogToKeep();
 
@@ -560,6 +571,7 @@ class ColumnFamilyData {
 
   MemTable* mem_;
   MemTableList imm_;
+  MemTableEpoch mem_epoch_;
   SuperVersion* super_version_;
 
   // An ordinal representing the current SuperVersion. Updated by
@@ -1388,8 +1388,9 @@ Status CompactionJob::FinishCompactionOutputFile(
   if (s.ok()) {
     StopWatch sw(env_, stats_, COMPACTION_OUTFILE_SYNC_MICROS);
     io_s = sub_compact->outfile->Sync(db_options_.use_fsync);
-    if (sta_ != nullptr) {
-      PrepareFile(sta_, sub_compact->outfile->GetAlignedBuffer());
+    if (sta_ != nullptr && io_s.ok()) {
+      io_s = PrepareFile(sta_, sub_compact->outfile->GetAlignedBuffer(),
+                         sub_compact->outfile->GetFileSize());
     }
   }
   if (s.ok() && io_s.ok()) {
@@ -1427,6 +1428,10 @@ Status CompactionJob::FinishCompactionOutputFile(
         TableFileName(sub_compact->compaction->immutable_cf_options()->cf_paths,
                       meta->fd.GetNumber(), meta->fd.GetPathId());
     env_->DeleteFile(fname);
+    // [RUBBLE] the file is never shipped, give its slot back
+    if (sta_ != nullptr) {
+      DropFile(sta_, meta->fd.GetNumber());
+    }
 
     // Also need to remove the file from outputs, or it will be added to the
     // VersionEdit.
@@ -1434,6 +1439,10 @@ Status CompactionJob::FinishCompactionOutputFile(
     sub_compact->outputs.pop_back();
     meta = nullptr;
   }
+  if (!s.ok() && sta_ != nullptr) {
+    // [RUBBLE] a failed output is never shipped
+    DropFile(sta_, output_number);
+  }
 
   if (s.ok() && (current_entries > 0 || tp.num_range_deletions > 0)) {
     // Output to event logger and fire events.
@@ -1621,8 +1630,9 @@ Status CompactionJob::OpenCompactionOutputFile(
       NewWritableFile(fs_.get(), fname, &writable_file, file_options_);
 
   //[RUBBLE]
-  if(NeedShipSST(&db_options_)) {
-    AddFile(sta_, 1, file_number);
+  std::shared_ptr<SstStreamShipper> sst_shipper;
+  if (io_s.ok() && NeedShipSST(&db_options_)) {
+    io_s = AddFile(sta_, 1, file_number, &sst_shipper);
   }
   // [RUBBLE END]
 
@@ -1692,7 +1702,9 @@ Status CompactionJob::OpenCompactionOutputFile(
       db_options_.file_checksum_gen_factory.get()));
 
   //[RUBBLE]
-  if(db_options_.is_rubble && db_options_.is_primary){
+  if (sst_shipper != nullptr) {
+    sub_compact->outfile->SetWriteMirror(sst_shipper);
+  } else if(db_options_.is_rubble && db_options_.is_primary){
     size_t buffer_size = sub_compact->compaction->mutable_cf_options()->target_file_size_base  + db_options_.sst_pad_len;
     sub_compact->outfile->SetBufferAlignment(sub_compact->outfile->writable_file()->GetRequiredBufferAlignment());
     sub_compact->outfile->AllocateNewBuffer(buffer_size);
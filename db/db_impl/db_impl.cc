@@ -106,11 +106,6 @@
 #include "util/debug_buffer.h"
 
 namespace ROCKSDB_NAMESPACE {
-uint64_t g_mem_op_cnt = 0;
-uint64_t g_mem_id = 0;
-std::mutex g_mem_op_cnt_mtx;
-uint64_t g_mem_id_arr[G_MEM_ARR_LEN];
-uint64_t g_mem_op_cnt_arr[G_MEM_ARR_LEN];
 // thread_local std::stringstream debug_buffer_ss;
 // thread_local const char *debug_buffer;
 // thread_local std::mutex debug_buffer_mu;
@@ -253,6 +248,16 @@ DBImpl::DBImpl(const DBOptions& options, const std::string& dbname,
   // TODO: Check for an error here
   env_->GetAbsolutePath(dbname, &db_absolute_path_).PermitUncheckedError();
 
+  if (NeedShipSST(&immutable_db_options_)) {
+    if (immutable_db_options_.max_sst_ship_threads > 0) {
+      sst_ship_executor_.reset(new SstShipExecutor(
+          immutable_db_options_.max_sst_ship_threads,
+          immutable_db_options_.max_sst_ships_per_target));
+      immutable_db_options_.sst_ship_executor = sst_ship_executor_.get();
+    }
+    immutable_db_options_.shipping_db = this;
+  }
+
   // std::cout << "------ db_absolute_path : " << db_absolute_path_ << " ------- \n";
 
   // Reserve ten files or so for other uses and give the rest to TableCache.
@@ -3869,6 +3874,14 @@ void DBImpl::SetDbSessionId() {
   TEST_SYNC_POINT_CALLBACK("DBImpl::SetDbSessionId", &db_session_id_);
 }
 
+void DBImpl::SetShipError(const IOStatus& io_s) {
+  InstrumentedMutexLock l(&mutex_);
+  // the secondaries can't apply any later edit, so this isn't recoverable
+  // with Resume
+  error_handler_.SetBGError(io_s, BackgroundErrorReason::kManifestWrite)
+      .PermitUncheckedError();
+}
+
 // Default implementation -- returns not supported status
 Status DB::CreateColumnFamily(const ColumnFamilyOptions& /*cf_options*/,
                               const std::string& /*column_family_name*/,
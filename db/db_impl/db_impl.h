@@ -579,6 +579,10 @@ class DBImpl : public DB {
   Status TraceIteratorSeekForPrev(const uint32_t& cf_id, const Slice& key);
 #endif  // ROCKSDB_LITE
 
+  // primary: a shipped sst can't reach the secondaries and its version edits
+  // are dropped, stop the writes until the chain is recovered
+  void SetShipError(const IOStatus& io_s);
+
   // Similar to GetSnapshot(), but also lets the db know that this snapshot
   // will be used for transaction write-conflict checking.  The DB can then
   // make sure not to compact any keys that would prevent a write-conflict from
@@ -1047,6 +1051,9 @@ class DBImpl : public DB {
   std::shared_ptr<IOTracer> io_tracer_;
   // const ImmutableDBOptions immutable_db_options_;
   ImmutableDBOptions immutable_db_options_;
+  // ships sst files to the secondaries, immutable_db_options_ points to it,
+  // see max_sst_ship_threads
+  std::unique_ptr<SstShipExecutor> sst_ship_executor_;
   FileSystemPtr fs_;
   MutableDBOptions mutable_db_options_;
   Statistics* stats_;
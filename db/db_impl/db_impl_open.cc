@@ -12,6 +12,7 @@
 #include "db/db_impl/db_impl.h"
 #include "db/error_handler.h"
 #include "db/periodic_work_scheduler.h"
+#include "db/ship_job.h"
 #include "env/composite_env_wrapper.h"
 #include "file/read_write_util.h"
 #include "file/sst_file_manager_impl.h"
@@ -264,6 +265,22 @@ Status DBImpl::ValidateOptions(const DBOptions& db_options) {
         "atomic_flush is currently incompatible with best-efforts recovery");
   }
 
+  // the chunks of a shipped sst are read back with direct I/O
+  if (db_options.sst_checksum_chunk_size % kDefaultPageSize != 0) {
+    return Status::InvalidArgument(
+        "sst_checksum_chunk_size must be a multiple of the page size");
+  }
+
+  if (db_options.is_rubble && db_options.is_primary &&
+      db_options.sst_checksum_chunk_size > 0 &&
+      (db_options.file_checksum_gen_factory == nullptr ||
+       strcmp(db_options.file_checksum_gen_factory->Name(),
+              kSstChunkChecksumGenFactoryName) != 0)) {
+    return Status::InvalidArgument(
+        "sst_checksum_chunk_size is incompatible with a user "
+        "file_checksum_gen_factory");
+  }
+
   return Status::OK();
 }
 
@@ -1874,17 +1874,14 @@ Status DBImpl::SwitchMemtable(ColumnFamilyData* cfd, WriteContext* context) {
   // std::cout << "[rocksdb] switch to memtable " << new_mem->GetID() << std::endl;
 
   if (immutable_db_options_.is_rubble && immutable_db_options_.is_primary) {
-    assert(g_mem_op_cnt == 0);
-    assert(g_mem_id == 0);
-    g_mem_op_cnt = num_operations;
-    g_mem_id = new_mem->GetID();
-    // std::cout << "[rocksdb] set " << new_mem->GetID() - 1 << " 's g_mem_op_cnt " << num_operations << std::endl;
+    cfd->mem_epoch()->RecordSwitch(new_mem->GetID(), num_operations);
+    // std::cout << "[rocksdb] set " << new_mem->GetID() - 1 << " 's mem_op_cnt " << num_operations << std::endl;
   }
   if (immutable_db_options_.is_rubble && !immutable_db_options_.is_primary) {
-    uint64_t mem_id = cfd->mem()->GetID();
-    uint64_t idx = mem_id % G_MEM_ARR_LEN;
-    if (g_mem_id_arr[idx] == mem_id) {
-      cfd->mem()->set_num_target_op(g_mem_op_cnt_arr[idx]);
+    // the op count may have come before the switch, see MemTableEpoch
+    uint64_t target_op_cnt = 0;
+    if (cfd->mem_epoch()->TargetOpCount(cfd->mem()->GetID(), &target_op_cnt)) {
+      cfd->mem()->set_num_target_op(target_op_cnt);
     }
   }
   InstallSuperVersionAndScheduleWork(cfd, &context->superversion_context,
@@ -1894,8 +1891,8 @@ Status DBImpl::SwitchMemtable(ColumnFamilyData* cfd, WriteContext* context) {
     std::lock_guard<std::mutex> memtable_ready_lk{*immutable_db_options_.memtable_ready_mu};
     // std::cout << "[version edits] Switch to memtable " << cfd->mem()->GetID() << " so notify\n";
     immutable_db_options_.memtable_ready_cv->notify_all();
-    std::unique_lock<std::mutex> op_buffer_cv{*immutable_db_options_.op_buffer_mu};
-    immutable_db_options_.op_buffer_cv->notify_all();
+    // the ops for the new memtable can go now
+    cfd->mem_epoch()->Notify(cfd->mem()->GetID());
 
   }
   
@@ -248,7 +248,7 @@ Status FlushJob::Run(LogsWithPrepTracker* prep_tracker,
         cfd_, mutable_cf_options_, mems_, prep_tracker, versions_, db_mutex_,
         meta_.fd.GetNumber(), &job_context_->memtables_to_free, db_directory_,
         log_buffer_, &committed_flush_jobs_info_, &tmp_io_s, sta_, job_context_->job_id);
-    if (sta_ != nullptr && HasEditJson(sta_)) {
+    if (sta_ != nullptr && HasEdits(sta_)) {
       db_options_.env->Schedule(&BGWorkShip, (void *)sta_, sta_->GetEditId(), Env::Priority::SHIP, this,
                                 &UnscheduleShipCallback);
     }
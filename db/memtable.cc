@@ -151,7 +151,8 @@ size_t MemTable::ApproximateMemoryUsage() {
 
 bool MemTable::ShouldFlushNow() {
   if (db_options->is_rubble && !db_options->is_primary) {
-    return num_target_op_ != 0 && num_target_op_ == num_operations_.load();
+    uint64_t num_target_op = num_target_op_.load();
+    return num_target_op != 0 && num_target_op == num_operations_.load();
   }
 
   size_t write_buffer_size = write_buffer_size_.load(std::memory_order_relaxed);
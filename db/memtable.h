@@ -90,6 +90,9 @@ class MemTable {
                            const char* prefix_len_key2) const override;
     virtual int operator()(const char* prefix_len_key,
                            const DecodedType& key) const override;
+    virtual const Comparator* user_comparator() const override {
+      return comparator.user_comparator();
+    }
   };
 
   // MemTables are reference counted.  The initial reference count
@@ -301,11 +304,12 @@ class MemTable {
   }
 
   uint64_t num_target_op() const {
-    return num_target_op_;
+    return num_target_op_.load();
   }
 
+  // set by the memtable switch and by HandleOp, whichever comes second
   void set_num_target_op(uint64_t num) {
-    num_target_op_ = num;
+    num_target_op_.store(num);
   }
 
   // Get total number of deletes in the mem table.
@@ -562,7 +566,7 @@ class MemTable {
   std::unique_ptr<FlushJobInfo> flush_job_info_;
 #endif  // !ROCKSDB_LITE
 
-  uint64_t num_target_op_;
+  std::atomic<uint64_t> num_target_op_;
 
   const ImmutableDBOptions *db_options; 
 
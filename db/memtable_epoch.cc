@@ -0,0 +1,116 @@
+#include "db/memtable_epoch.h"
+
+#include <cassert>
+#include <vector>
+
+namespace ROCKSDB_NAMESPACE {
+
+MemTableEpoch::MemTableEpoch() : slots_(new Slot[kRingSize]) {}
+
+void MemTableEpoch::Publish(Slot* slot, uint64_t mem_id, uint64_t num_ops) {
+  assert(mem_id != 0);
+  // hide the slot while the count changes
+  slot->mem_id.store(0, std::memory_order_relaxed);
+  slot->num_ops.store(num_ops, std::memory_order_relaxed);
+  slot->mem_id.store(mem_id, std::memory_order_seq_cst);
+}
+
+void MemTableEpoch::RecordSwitch(uint64_t new_mem_id, uint64_t num_ops) {
+  Publish(&slots_[new_mem_id % kRingSize], new_mem_id, num_ops);
+}
+
+bool MemTableEpoch::ClaimSwitch(uint64_t mem_id, uint64_t* num_ops) {
+  Slot& slot = slots_[mem_id % kRingSize];
+  if (mem_id == 0 || slot.mem_id.load(std::memory_order_acquire) != mem_id) {
+    return false;
+  }
+  uint64_t ops = slot.num_ops.load(std::memory_order_relaxed);
+  uint64_t expected = mem_id;
+  if (!slot.mem_id.compare_exchange_strong(expected, 0,
+                                           std::memory_order_acq_rel)) {
+    return false;
+  }
+  *num_ops = ops;
+  return true;
+}
+
+void MemTableEpoch::SetTargetOpCount(uint64_t mem_id, uint64_t num_ops) {
+  Publish(&slots_[mem_id % kRingSize], mem_id, num_ops);
+}
+
+bool MemTableEpoch::TargetOpCount(uint64_t mem_id, uint64_t* num_ops) const {
+  const Slot& slot = slots_[mem_id % kRingSize];
+  if (mem_id == 0 || slot.mem_id.load(std::memory_order_seq_cst) != mem_id) {
+    return false;
+  }
+  *num_ops = slot.num_ops.load(std::memory_order_relaxed);
+  // the slot may have been taken by a later memtable meanwhile
+  return slot.mem_id.load(std::memory_order_acquire) == mem_id;
+}
+
+void MemTableEpoch::Notify(uint64_t mem_id) {
+  // pairs with the fence in Wait: either the waiter sees the change made
+  // before this Notify, or this Notify sees the waiter
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (num_waiters_.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  std::vector<std::function<void()>> wakes;
+  {
+    std::lock_guard<std::mutex> lk{wait_mu_};
+    for (auto it = waiters_.begin();
+         it != waiters_.end() && it->first <= mem_id; ++it) {
+      it->second.cv.notify_all();
+    }
+    auto end = async_waiters_.upper_bound(mem_id);
+    for (auto it = async_waiters_.begin(); it != end; ++it) {
+      wakes.push_back(std::move(it->second));
+    }
+    async_waiters_.erase(async_waiters_.begin(), end);
+    num_waiters_.fetch_sub(static_cast<int>(wakes.size()),
+                           std::memory_order_relaxed);
+  }
+  // outside of the lock, a wake may park its stream again
+  for (auto& wake : wakes) {
+    wake();
+  }
+}
+
+void MemTableEpoch::Wait(uint64_t mem_id, const std::function<bool()>& pred) {
+  if (pred()) {
+    return;
+  }
+  std::unique_lock<std::mutex> lk{wait_mu_};
+  Waiters& waiters = waiters_[mem_id];
+  waiters.num++;
+  num_waiters_.fetch_add(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  waiters.cv.wait(lk, pred);
+  num_waiters_.fetch_sub(1, std::memory_order_relaxed);
+  if (--waiters.num == 0) {
+    waiters_.erase(mem_id);
+  }
+}
+
+void MemTableEpoch::WaitAsync(uint64_t mem_id,
+                              const std::function<bool()>& pred,
+                              std::function<void()> wake) {
+  if (!pred()) {
+    std::lock_guard<std::mutex> lk{wait_mu_};
+    auto it = async_waiters_.emplace(mem_id, std::move(wake));
+    num_waiters_.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!pred()) {
+      // the next Notify for mem_id runs it
+      return;
+    }
+    // it turned true meanwhile, no Notify took the wake up yet since we
+    // hold the lock
+    wake = std::move(it->second);
+    async_waiters_.erase(it);
+    num_waiters_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  wake();
+}
+
+}  // namespace ROCKSDB_NAMESPACE
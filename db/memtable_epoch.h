@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "rocksdb/rocksdb_namespace.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+// Switch points of the memtables of one column family, used in rubble mode
+// to make the followers switch memtables exactly where the head did.
+//
+// The head records the number of operations of a memtable when it switches
+// away from it (RecordSwitch), and the first op that lands in the next
+// memtable claims that count (ClaimSwitch) and carries it down the chain as
+// mem_op_cnt. A follower records the count it got for a memtable
+// (SetTargetOpCount) and the memtable switch of the follower picks it up if
+// it comes before the op (TargetOpCount).
+//
+// The counts are kept in a ring indexed by memtable id, slots are published
+// by a release store of the memtable id after the count, so neither side
+// takes a lock. Both the follower's HandleOp and SwitchMemtable store first
+// and check the other side after, so at least one of them sees both:
+//
+// Time
+// | SwitchMemtable                          HandleOp
+// | cfd->SetMemtable(new_mem)               SetTargetOpCount(mem, cnt)
+// | TargetOpCount(new_mem)                  if cfd->mem() == mem: set target
+// v
+class MemTableEpoch {
+ public:
+  MemTableEpoch();
+
+  // head: the memtable switched to new_mem_id after num_ops operations
+  void RecordSwitch(uint64_t new_mem_id, uint64_t num_ops);
+
+  // head: the op count of the memtable before mem_id, if mem_id is a switch
+  // point no op has claimed yet. Only one caller gets it
+  bool ClaimSwitch(uint64_t mem_id, uint64_t* num_ops);
+
+  // follower: the memtable mem_id must hold num_ops operations
+  void SetTargetOpCount(uint64_t mem_id, uint64_t num_ops);
+
+  // follower: the op count set for mem_id, if any
+  bool TargetOpCount(uint64_t mem_id, uint64_t* num_ops) const;
+
+  // follower: wake up the threads waiting for memtables up to mem_id, the
+  // others stay asleep. Doesn't take the lock if nobody waits
+  void Notify(uint64_t mem_id);
+
+  // follower: block until pred returns true, pred is checked whenever a
+  // Notify covers mem_id
+  void Wait(uint64_t mem_id, const std::function<bool()>& pred);
+
+  // follower: like Wait, but doesn't block. wake runs once, right here if
+  // pred returns true already, else on the thread of the next Notify that
+  // covers mem_id, which may come before pred is true, so wake has to check
+  // it again. Used by the async server to park a stream, wake must be cheap
+  void WaitAsync(uint64_t mem_id, const std::function<bool()>& pred,
+                 std::function<void()> wake);
+
+ private:
+  // the head can't be more switches ahead of the slowest op in flight
+  static const size_t kRingSize = 1024;
+
+  struct Slot {
+    // 0 if the slot is empty or claimed
+    std::atomic<uint64_t> mem_id{0};
+    std::atomic<uint64_t> num_ops{0};
+  };
+
+  void Publish(Slot* slot, uint64_t mem_id, uint64_t num_ops);
+
+  std::unique_ptr<Slot[]> slots_;
+
+  struct Waiters {
+    int num = 0;
+    std::condition_variable cv;
+  };
+
+  std::atomic<int> num_waiters_{0};
+  std::mutex wait_mu_;
+  // memtable id -> the threads waiting for it
+  std::map<uint64_t, Waiters> waiters_;
+  // memtable id -> the wake ups of the parked streams waiting for it
+  std::multimap<uint64_t, std::function<void()>> async_waiters_;
+};
+
+}  // namespace ROCKSDB_NAMESPACE
@@ -0,0 +1,133 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "db/memtable_epoch.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "test_util/testharness.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+class MemTableEpochTest : public testing::Test {};
+
+TEST_F(MemTableEpochTest, ClaimSwitchOnce) {
+  MemTableEpoch epoch;
+  uint64_t num_ops = 0;
+  ASSERT_FALSE(epoch.ClaimSwitch(2, &num_ops));
+
+  epoch.RecordSwitch(2, 100);
+  ASSERT_FALSE(epoch.ClaimSwitch(3, &num_ops));
+  ASSERT_TRUE(epoch.ClaimSwitch(2, &num_ops));
+  ASSERT_EQ(100U, num_ops);
+  // the first op of the memtable took it
+  ASSERT_FALSE(epoch.ClaimSwitch(2, &num_ops));
+}
+
+TEST_F(MemTableEpochTest, ConcurrentClaimSwitch) {
+  MemTableEpoch epoch;
+  const int kThreads = 8;
+  for (uint64_t mem_id = 1; mem_id <= 200; mem_id++) {
+    epoch.RecordSwitch(mem_id, mem_id * 10);
+    std::atomic<int> claimed{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kThreads; i++) {
+      threads.emplace_back([&] {
+        uint64_t n = 0;
+        if (epoch.ClaimSwitch(mem_id, &n)) {
+          ASSERT_EQ(mem_id * 10, n);
+          claimed.fetch_add(1);
+        }
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    ASSERT_EQ(1, claimed.load());
+  }
+}
+
+TEST_F(MemTableEpochTest, TargetOpCount) {
+  MemTableEpoch epoch;
+  uint64_t num_ops = 0;
+  ASSERT_FALSE(epoch.TargetOpCount(5, &num_ops));
+  epoch.SetTargetOpCount(5, 42);
+  ASSERT_TRUE(epoch.TargetOpCount(5, &num_ops));
+  ASSERT_EQ(42U, num_ops);
+  // reading it doesn't consume it
+  ASSERT_TRUE(epoch.TargetOpCount(5, &num_ops));
+
+  // a later memtable on the same ring slot replaces it
+  epoch.SetTargetOpCount(5 + 1024, 7);
+  ASSERT_FALSE(epoch.TargetOpCount(5, &num_ops));
+  ASSERT_TRUE(epoch.TargetOpCount(5 + 1024, &num_ops));
+  ASSERT_EQ(7U, num_ops);
+}
+
+TEST_F(MemTableEpochTest, NotifyWakesOnlyCoveredWaiters) {
+  MemTableEpoch epoch;
+  // t5's predicate stays false until right before Notify(5), so a spurious
+  // or foreign wake up only makes it check again
+  std::atomic<bool> ready3{false}, ready5{false};
+  std::atomic<int> checks3{0}, checks5{0};
+  std::atomic<bool> woke3{false}, woke5{false};
+  std::thread t3([&] {
+    epoch.Wait(3, [&] {
+      checks3.fetch_add(1);
+      return ready3.load();
+    });
+    woke3.store(true);
+  });
+  std::thread t5([&] {
+    epoch.Wait(5, [&] {
+      checks5.fetch_add(1);
+      return ready5.load();
+    });
+    woke5.store(true);
+  });
+  // the second check is made under the lock right before sleeping
+  while (checks3.load() < 2 || checks5.load() < 2) {
+    std::this_thread::yield();
+  }
+  ready3.store(true);
+
+  epoch.Notify(3);
+  t3.join();
+  ASSERT_TRUE(woke3.load());
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_FALSE(woke5.load());
+
+  ready5.store(true);
+  epoch.Notify(5);
+  t5.join();
+  ASSERT_TRUE(woke5.load());
+}
+
+TEST_F(MemTableEpochTest, NoLostWakeUp) {
+  // the waiter checks its predicate right before sleeping while the
+  // notifier changes it right before notifying, it never sleeps forever
+  MemTableEpoch epoch;
+  const uint64_t kSwitches = 20000;
+  std::atomic<uint64_t> mem_id{0};
+  std::thread waiter([&] {
+    for (uint64_t target = 1; target <= kSwitches; target++) {
+      epoch.Wait(target, [&] { return mem_id.load() >= target; });
+    }
+  });
+  for (uint64_t i = 1; i <= kSwitches; i++) {
+    mem_id.store(i);
+    epoch.Notify(i);
+  }
+  waiter.join();
+  ASSERT_EQ(kSwitches, mem_id.load());
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
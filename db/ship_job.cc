@@ -3,32 +3,187 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/file.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h> 
 #include <string.h>
+#include <cinttypes>
 #include <ctime>
 #include <iomanip>
+#include "db/db_impl/db_impl.h"
+#include "util/crc32c.h"
 
 namespace ROCKSDB_NAMESPACE {
-uint64_t CheckSum(const char* src, const size_t len) {
-    uint64_t sum = 0;
-    for (size_t i = 0; i < len; i++) {
-        sum += (uint64_t)src[i];
+const char* kSstChunkChecksumName = "RubbleSstChunkCrc32c";
+const char* kSstChunkChecksumGenFactoryName = "RubbleSstChunkChecksumGenFactory";
+
+namespace {
+class SstChunkChecksumGen : public FileChecksumGenerator {
+  public:
+    explicit SstChunkChecksumGen(uint64_t chunk_size)
+        : chunk_size_(chunk_size), chunk_len_(0), crc_(0) {
+        PutVarint64(&checksum_, chunk_size_);
     }
-    return sum;
+
+    void Update(const char* data, size_t n) override {
+        while (n > 0) {
+            size_t len = static_cast<size_t>(std::min<uint64_t>(n, chunk_size_ - chunk_len_));
+            crc_ = crc32c::Extend(crc_, data, len);
+            chunk_len_ += len;
+            data += len;
+            n -= len;
+            if (chunk_len_ == chunk_size_) {
+                PutFixed32(&checksum_, crc_);
+                chunk_len_ = 0;
+                crc_ = 0;
+            }
+        }
+    }
+
+    void Finalize() override {
+        if (chunk_len_ > 0) {
+            PutFixed32(&checksum_, crc_);
+            chunk_len_ = 0;
+        }
+    }
+
+    std::string GetChecksum() const override { return checksum_; }
+
+    const char* Name() const override { return kSstChunkChecksumName; }
+
+  private:
+    const uint64_t chunk_size_;
+    uint64_t chunk_len_;
+    uint32_t crc_;
+    std::string checksum_;
+};
+
+class SstChunkChecksumGenFactory : public FileChecksumGenFactory {
+  public:
+    explicit SstChunkChecksumGenFactory(uint64_t chunk_size) : chunk_size_(chunk_size) {}
+
+    std::unique_ptr<FileChecksumGenerator> CreateFileChecksumGenerator(
+        const FileChecksumGenContext& context) override {
+        if (!context.requested_checksum_func_name.empty() &&
+            context.requested_checksum_func_name != kSstChunkChecksumName) {
+            return nullptr;
+        }
+        return std::unique_ptr<FileChecksumGenerator>(new SstChunkChecksumGen(chunk_size_));
+    }
+
+    const char* Name() const override { return kSstChunkChecksumGenFactoryName; }
+
+  private:
+    const uint64_t chunk_size_;
+};
+
+// write all of src to fd at offset, retrying short writes
+IOStatus PWriteAll(int fd, const char* src, size_t n, uint64_t offset,
+                   const std::string& fname) {
+    while (n > 0) {
+        ssize_t done = pwrite(fd, src, n, static_cast<off_t>(offset));
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return IOStatus::IOError("While appending to " + fname,
+                                     done < 0 ? std::strerror(errno) : "short write");
+        }
+        n -= done;
+        src += done;
+        offset += done;
+    }
+    return IOStatus::OK();
+}
+}  // namespace
+
+std::shared_ptr<FileChecksumGenFactory> NewSstChunkChecksumGenFactory(uint64_t chunk_size) {
+    // chunks are read with direct I/O, DBImpl::ValidateOptions rejects a
+    // chunk size that isn't a multiple of the page size
+    assert(chunk_size > 0);
+    return std::make_shared<SstChunkChecksumGenFactory>(chunk_size);
+}
+
+size_t NumSSTChunks(const FileMetaData& meta) {
+    if (meta.file_checksum_func_name != kSstChunkChecksumName) {
+        return 0;
+    }
+    Slice input(meta.file_checksum);
+    uint64_t chunk_size = 0;
+    if (!GetVarint64(&input, &chunk_size) || chunk_size == 0) {
+        // VerifySSTChunks reports it
+        return 1;
+    }
+    uint64_t file_size = meta.fd.GetFileSize();
+    return static_cast<size_t>(std::max<uint64_t>((file_size + chunk_size - 1) / chunk_size, 1));
+}
+
+Status VerifySSTChunks(const std::string& fname, const FileMetaData& meta,
+                       size_t first_chunk, size_t num_chunks) {
+    Slice input(meta.file_checksum);
+    uint64_t chunk_size = 0;
+    uint64_t file_size = meta.fd.GetFileSize();
+    if (!GetVarint64(&input, &chunk_size) || chunk_size == 0 ||
+        input.size() != ((file_size + chunk_size - 1) / chunk_size) * sizeof(uint32_t)) {
+        return Status::Corruption("bad chunk checksums", fname);
+    }
+
+    int fd;
+    do {
+        fd = open(fname.c_str(), O_RDONLY | O_DIRECT);
+    } while (fd < 0 && errno == EINTR);
+    if (fd < 0) {
+        return Status::IOError("While open a file for reading", fname + ": " + std::strerror(errno));
+    }
+
+    AlignedBuffer buf;
+    buf.Alignment(kDefaultPageSize);
+    buf.AllocateNewBuffer(static_cast<size_t>(chunk_size));
+    Status s;
+    for (size_t i = first_chunk; i < first_chunk + num_chunks && s.ok(); i++) {
+        uint64_t offset = i * chunk_size;
+        if (offset >= file_size) {
+            break;
+        }
+        size_t len = static_cast<size_t>(std::min(chunk_size, file_size - offset));
+        // the slot is longer than the table, read whole pages past its end
+        size_t aligned_len = (len + kDefaultPageSize - 1) / kDefaultPageSize * kDefaultPageSize;
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = pread(fd, buf.BufferStart() + done, aligned_len - done, offset + done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            // O_DIRECT reads must start on a page, retry a short read from
+            // the last whole page it returned
+            size_t next = n <= 0 ? done :
+                done + n >= len ? done + n : (done + n) / kDefaultPageSize * kDefaultPageSize;
+            if (next == done) {
+                s = Status::IOError("While reading " + fname, n < 0 ? std::strerror(errno) : "short read");
+                break;
+            }
+            done = next;
+        }
+        if (s.ok() &&
+            crc32c::Value(buf.BufferStart(), len) != DecodeFixed32(input.data() + i * sizeof(uint32_t))) {
+            s = Status::Corruption("chunk checksum mismatch", fname + " chunk " + std::to_string(i));
+        }
+    }
+    close(fd);
+    return s;
 }
 
-bool HasEditJson(ShipThreadArg* const a) {
-    for (std::string json : a->edits_json_) {
-        if (json.length() > 0) {
+bool HasEdits(ShipThreadArg* const a) {
+    for (const std::string& edits : a->edits_) {
+        if (edits.length() > 0) {
             return true;
         }
     }
     return false;
 }
 
-void AddEditJson(ShipThreadArg* const a, std::string json) {
-    a->edits_json_.emplace_back(json);
+void AddEdits(ShipThreadArg* const a, std::string edits) {
+    a->edits_.emplace_back(std::move(edits));
 }
 
 void AddDependant(ShipThreadArg* const a, ShipThreadArg* const b) {
@@ -36,21 +191,196 @@ void AddDependant(ShipThreadArg* const a, ShipThreadArg* const b) {
     // printf("Add %p into %p's dependants\n", b, a);
 }
 
-void PrepareFile(ShipThreadArg* const sta, AlignedBuffer& buf) {
+RemoteSstDirs::RemoteSstDirs(const std::vector<std::string>& dirs)
+    : dirs_(std::make_shared<const std::vector<std::string>>(dirs)) {}
+
+std::shared_ptr<const std::vector<std::string>> RemoteSstDirs::Snapshot() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return dirs_;
+}
+
+bool RemoteSstDirs::Add(const std::string& dir) {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (std::find(dirs_->begin(), dirs_->end(), dir) != dirs_->end()) {
+        return false;
+    }
+    auto dirs = std::make_shared<std::vector<std::string>>(*dirs_);
+    dirs->push_back(dir);
+    dirs_ = std::move(dirs);
+    return true;
+}
+
+bool RemoteSstDirs::RemoveLast(std::string* dir) {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (dirs_->empty()) {
+        return false;
+    }
+    auto dirs = std::make_shared<std::vector<std::string>>(*dirs_);
+    *dir = dirs->back();
+    dirs->pop_back();
+    dirs_ = std::move(dirs);
+    return true;
+}
+
+SstStreamShipper::SstStreamShipper(const ImmutableDBOptions* db_options, int slot,
+                                   const std::vector<std::string>& remote_sst_dirs)
+    : db_options_(db_options), slot_(slot) {
+    for (const std::string& dir : remote_sst_dirs) {
+        std::string fname = dir + "/" + std::to_string(slot_);
+        int r_fd;
+        do {
+            r_fd = open(fname.c_str(), O_WRONLY | O_DIRECT | O_DSYNC, 0755);
+        } while (r_fd < 0 && errno == EINTR);
+
+        if (r_fd < 0) {
+            status_ = IOStatus::IOError("While open a file for appending",
+                                        fname + ": " + std::strerror(errno));
+            break;
+        }
+        remote_files_.push_back({dir, fname, r_fd});
+    }
+}
+
+SstStreamShipper::~SstStreamShipper() {
+    Finish().PermitUncheckedError();
+}
+
+IOStatus SstStreamShipper::MirrorWrite(const Slice& data, uint64_t offset) {
+    if (!status_.ok()) {
+        return status_;
+    }
+    SstShipExecutor* executor = db_options_->sst_ship_executor;
+    if (executor == nullptr) {
+        for (const RemoteFile& remote_file : remote_files_) {
+            IOStatus s = PWriteAll(remote_file.fd, data.data(), data.size(), offset,
+                                   remote_file.fname);
+            if (!s.ok()) {
+                return status_ = s;
+            }
+        }
+        return IOStatus::OK();
+    }
+
+    // the writer reuses its buffer once this returns, so the executor writes
+    // an aligned copy of the chunk to every remote file, see Finish
+    auto chunk = std::make_shared<AlignedBuffer>();
+    chunk->Alignment(kDefaultPageSize);
+    chunk->AllocateNewBuffer(data.size());
+    chunk->Append(data.data(), data.size());
+    uint64_t max_bytes = db_options_->max_sst_stream_bytes_in_flight;
+    if (max_bytes > 0) {
+        executor->Throttle(&batch_, max_bytes);
+    }
+    for (const RemoteFile& remote_file : remote_files_) {
+        int fd = remote_file.fd;
+        std::string fname = remote_file.fname;
+        Status s = executor->Submit(remote_file.dir, [chunk, fd, fname, offset] {
+            return PWriteAll(fd, chunk->BufferStart(), chunk->CurrentSize(), offset, fname);
+        }, &batch_, &remote_file, data.size());
+        if (!s.ok()) {
+            return status_ = IOStatus::IOError("While streaming sst to " + fname, s.ToString());
+        }
+    }
+    return IOStatus::OK();
+}
+
+IOStatus SstStreamShipper::Finish() {
+    SstShipExecutor* executor = db_options_->sst_ship_executor;
+    if (executor != nullptr) {
+        IOStatus s = executor->Wait(&batch_);
+        if (status_.ok()) {
+            status_ = s;
+        }
+    }
+    for (const RemoteFile& remote_file : remote_files_) {
+        close(remote_file.fd);
+        if (!status_.ok()) {
+            continue;
+        }
+        db_options_->shipped_files_nvmeof->fetch_add(1);
+        ROCKS_LOG_INFO(db_options_->info_log,
+            "Streamed SST file %s via NVMe-oF, total count: %d", remote_file.fname.c_str(),
+            db_options_->shipped_files_nvmeof->load());
+    }
+    remote_files_.clear();
+    return status_;
+}
+
+IOStatus PrepareFile(ShipThreadArg* const sta, AlignedBuffer& buf, uint64_t file_size) {
     FileInfo& file = sta->files_.back();
-    file.len_ = buf.Capacity();
+    if (file.streamed_) {
+        // the remote slots hold the whole file once the queued writes are done
+        IOStatus s = file.shipper_->Finish();
+        file.shipper_.reset();
+        return s;
+    }
+    // only ship the table, not the rest of the slot, see pad_sst_to_slot_size.
+    // The slot is written with direct I/O, so round it up to whole pages
+    size_t len = Roundup(static_cast<size_t>(file_size), kDefaultPageSize);
+    if (len > buf.Capacity()) {
+        return IOStatus::IOError("sst of " + std::to_string(file_size) +
+                                 " bytes doesn't fit the ship buffer of " +
+                                 std::to_string(buf.Capacity()) + " bytes");
+    }
+    memset(buf.BufferStart() + file_size, 0, len - static_cast<size_t>(file_size));
+    file.len_ = len;
     file.buf_ = buf.BufferStart();
     file.beg_ = buf.Release();
-    // file.checksum_ = CheckSum(file.buf_, file.len_);
+    return IOStatus::OK();
 }
 
-void AddFile(ShipThreadArg* const sta, uint64_t times, uint64_t file_number) {
+IOStatus AddFile(ShipThreadArg* const sta, uint64_t times, uint64_t file_number,
+                 std::shared_ptr<SstStreamShipper>* shipper) {
+    shipper->reset();
     sta->files_.emplace_back();
     FileInfo& file = sta->files_.back();
     file.times_ = times;
     file.file_number_ = file_number;
-    // TODO:Sheng
-    // file.slot_number_ = sta->db_options_->sst_bit_map->TakeOneAvailableSlot(file_number, times);
+    if (!NeedStreamSST(sta->db_options_)) {
+        return IOStatus::OK();
+    }
+
+    // the remote slot must be known before the first chunk is written. If
+    // the class is full, the file is shipped whole by BGWorkShip instead of
+    // holding up the flush or compaction until a slot frees up
+    const std::shared_ptr<SstBitMap>& sst_bit_map = sta->db_options_->sst_bit_map;
+    int slot = sst_bit_map->TakeOneAvailableSlot(file_number, static_cast<int>(times));
+    if (slot == -1) {
+        MaybeResizeSstPool(sta->db_options_, {{static_cast<int>(times), 1}});
+        return IOStatus::OK();
+    }
+    auto file_shipper = std::make_shared<SstStreamShipper>(
+        sta->db_options_, slot, *sta->db_options_->remote_sst_dirs->Snapshot());
+    if (!file_shipper->status().ok()) {
+        IOStatus s = file_shipper->Finish();
+        sst_bit_map->ReturnSlot(file_number);
+        sta->files_.pop_back();
+        return s;
+    }
+    file.slot_number_ = slot;
+    file.streamed_ = true;
+    file.shipper_ = file_shipper;
+    *shipper = file_shipper;
+    return IOStatus::OK();
+}
+
+void DropFile(ShipThreadArg* const sta, uint64_t file_number) {
+    for (auto it = sta->files_.begin(); it != sta->files_.end(); ++it) {
+        if (it->file_number_ != file_number) {
+            continue;
+        }
+        if (it->streamed_) {
+            // no write may land in the slot once it's handed out again
+            if (it->shipper_ != nullptr) {
+                it->shipper_->Finish().PermitUncheckedError();
+                it->shipper_.reset();
+            }
+            sta->db_options_->sst_bit_map->ReturnSlot(file_number);
+        }
+        delete [] it->beg_;
+        sta->files_.erase(it);
+        return;
+    }
 }
 
 bool NeedShipSST(const ImmutableDBOptions* db_options) {
@@ -58,90 +388,319 @@ bool NeedShipSST(const ImmutableDBOptions* db_options) {
     return db_options->is_rubble && db_options->is_primary && !db_options->is_tail;
 }
 
-void ShipSST(FileInfo& file, const std::vector<std::string>& remote_sst_dirs, ShipThreadArg* sta) {
-    // std::cout << "[ShipSST] file_number: " << file.file_number_ << " slot_number: " << file.slot_number_ << std::endl;
+void MaybeResizeSstPool(const ImmutableDBOptions* db_options, const std::map<int, int>& needed_slots) {
+    std::map<int, int> targets;
+    if (!db_options->sst_bit_map->PlanPoolSize(needed_slots, &targets)) {
+        return;
+    }
+    // the secondaries create the slot files and report them back in their
+    // sync replies, see RubbleKvServiceImpl::ResizeSstPool
+    SyncRequest request;
+    request.set_rid(db_options->rid);
+    for (const auto& p : targets) {
+        (*request.mutable_pool_size())[p.first] = p.second;
+    }
+    GetSyncClient(db_options)->Sync(request);
+}
 
-    for (std::string dir : remote_sst_dirs) {
-        std::string fname = dir + "/" + std::to_string(file.slot_number_);
-        int r_fd;
-        do {
-            r_fd = open(fname.c_str(), O_WRONLY | O_DIRECT | O_DSYNC, 0755);
-        } while (r_fd < 0 && errno == EINTR);
+bool NeedStreamSST(const ImmutableDBOptions* db_options) {
+    // streaming mirrors the aligned direct writes of the local file
+    return NeedShipSST(db_options) && db_options->stream_sst_shipping &&
+           db_options->use_direct_io_for_flush_and_compaction;
+}
 
-        if (r_fd < 0) {
-            std::cout << "While open a file for appending " << fname << " errno " << std::strerror(errno) << std::endl;
-            assert(false);
-        }
-
-        ssize_t done = write(r_fd, file.buf_, file.len_);
-        if (done != (ssize_t)file.len_) {
-            std::cout << "while appending to file " << fname << " errno " << std::strerror(errno) << std::endl;
-            assert(false);
-        }
-
-        sta->db_options_->shipped_files_nvmeof->fetch_add(1);
-        ROCKS_LOG_INFO(sta->db_options_->info_log, 
-            "Shipped SST file %s via NVMe-oF, total count: %d", fname.c_str(),
-            sta->db_options_->shipped_files_nvmeof->load());
-
-        // assert(fsync(r_fd) == 0);
-
-        // int w_fd;
-        // fname = "/mnt/data/dump/" + dir.substr(16) + "/" + std::to_string(file.slot_number_) + ".sst";
-        // do {
-        //     w_fd = open(fname.c_str(), O_WRONLY | O_DIRECT | O_DSYNC | O_CREAT, 0755);
-        // } while (w_fd < 0 && errno == EINTR);
-        // if (w_fd < 0) {
-        //     std::cout << "While open a file for appending " << fname << " errno " << std::strerror(errno) << std::endl;
-        //     assert(false);
-        // }
-
-        // done = write(w_fd, file.buf_, file.len_);
-        // if (done != (ssize_t)file.len_) {
-        //     std::cout << "while appending to file " << fname << " errno " << std::strerror(errno) << std::endl;
-        //     assert(false);
-        // }
-        // close(w_fd);
-
-        // uint64_t got = CheckSum(file.buf_, file.len_);
-        // uint64_t expected = file.checksum_;
-        // if (got != expected) {
-        //     std::cout << "[ShipSST] checksum mismatch expected: " << expected
-        //               << " got: " << got << " sta: " << reinterpret_cast<std::size_t>(sta) 
-        //               << std::endl;
-        //     assert(false);
-        // }
+IOStatus ShipSSTToDir(const FileInfo& file, const std::string& dir, const ImmutableDBOptions* db_options) {
+    std::string fname = dir + "/" + std::to_string(file.slot_number_);
+    if (file.len_ % kDefaultPageSize != 0) {
+        return IOStatus::InvalidArgument("While appending to " + fname,
+                                         "length is not page aligned");
+    }
+    int r_fd;
+    do {
+        r_fd = open(fname.c_str(), O_WRONLY | O_DIRECT | O_DSYNC, 0755);
+    } while (r_fd < 0 && errno == EINTR);
+
+    if (r_fd < 0) {
+        return IOStatus::IOError("While open a file for appending", fname + ": " + std::strerror(errno));
+    }
 
+    IOStatus s = PWriteAll(r_fd, file.buf_, file.len_, 0, fname);
+    if (!s.ok()) {
         close(r_fd);
+        return s;
+    }
+
+    db_options->shipped_files_nvmeof->fetch_add(1);
+    ROCKS_LOG_INFO(db_options->info_log, 
+        "Shipped SST file %s via NVMe-oF, total count: %d", fname.c_str(),
+        db_options->shipped_files_nvmeof->load());
+
+    close(r_fd);
+    return IOStatus::OK();
+}
+
+IOStatus CopySSTToDir(const std::string& fname, int slot, const std::string& dir,
+                      const ImmutableDBOptions* db_options) {
+    int fd;
+    do {
+        fd = open(fname.c_str(), O_RDONLY);
+    } while (fd < 0 && errno == EINTR);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return IOStatus::PathNotFound("While open a file for reading", fname);
+        }
+        return IOStatus::IOError("While open a file for reading", fname + ": " + std::strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        IOStatus s = IOStatus::IOError("While stat a file", fname + ": " + std::strerror(errno));
+        close(fd);
+        return s;
+    }
+
+    // the slot is written with direct I/O, pad the copy to whole pages
+    size_t len = (static_cast<size_t>(st.st_size) + kDefaultPageSize - 1) / kDefaultPageSize * kDefaultPageSize;
+    AlignedBuffer buf;
+    buf.Alignment(kDefaultPageSize);
+    buf.AllocateNewBuffer(len);
+    buf.PadWith(len, 0);
+
+    size_t done = 0;
+    while (done < static_cast<size_t>(st.st_size)) {
+        ssize_t n = pread(fd, buf.BufferStart() + done, st.st_size - done, done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            IOStatus s = IOStatus::IOError("While reading " + fname,
+                                           n < 0 ? std::strerror(errno) : "short read");
+            close(fd);
+            return s;
+        }
+        done += n;
+    }
+    close(fd);
+
+    FileInfo file;
+    file.buf_ = buf.BufferStart();
+    file.len_ = len;
+    file.slot_number_ = slot;
+    return ShipSSTToDir(file, dir, db_options);
+}
+
+IOStatus ShipSST(FileInfo& file, const std::vector<std::string>& remote_sst_dirs, ShipThreadArg* sta) {
+    IOStatus s;
+    for (const std::string& dir : remote_sst_dirs) {
+        IOStatus ship_s = ShipSSTToDir(file, dir, sta->db_options_);
+        if (s.ok()) {
+            s = ship_s;
+        }
     }
 
     delete [] file.beg_;
+    return s;
+}
+
+SstShipExecutor::SstShipExecutor(int num_threads, int max_ships_per_target)
+    : max_ships_per_target_(std::max(max_ships_per_target, 1)),
+      exit_(false) {
+    for (int i = 0; i < num_threads; i++) {
+        threads_.emplace_back(&SstShipExecutor::BGThread, this);
+    }
+}
+
+SstShipExecutor::~SstShipExecutor() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        exit_ = true;
+    }
+    task_cv_.notify_all();
+    for (auto& t : threads_) {
+        t.join();
+    }
+}
+
+Status SstShipExecutor::ShipFiles(const std::vector<const FileInfo*>& files,
+                                  const std::vector<std::string>& remote_sst_dirs,
+                                  const ImmutableDBOptions* db_options) {
+    if (files.empty() || remote_sst_dirs.empty()) {
+        return Status::OK();
+    }
+    Batch batch;
+    std::unique_lock<std::mutex> lock(mu_);
+    if (exit_ || threads_.empty()) {
+        // nothing would ever run the writes
+        return Status::Aborted("sst ship executor is not running");
+    }
+    // interleave the targets so every remote node gets busy right away
+    for (const FileInfo* file : files) {
+        for (const std::string& dir : remote_sst_dirs) {
+            queue_.push_back({dir, [file, &dir, db_options] {
+                return ShipSSTToDir(*file, dir, db_options);
+            }, &batch, nullptr, 0});
+            batch.remaining++;
+        }
+    }
+    task_cv_.notify_all();
+    done_cv_.wait(lock, [&batch] { return batch.remaining == 0; });
+    return batch.status;
+}
+
+Status SstShipExecutor::Submit(const std::string& dir, std::function<IOStatus()> write,
+                               Batch* batch, const void* order, uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (exit_ || threads_.empty()) {
+        return Status::Aborted("sst ship executor is not running");
+    }
+    queue_.push_back({dir, std::move(write), batch, order, bytes});
+    batch->remaining++;
+    batch->bytes += bytes;
+    task_cv_.notify_all();
+    return Status::OK();
 }
 
-std::string VersionEditsToJson(uint64_t next_file_number,
-                                  uint64_t log_and_apply_counter,
-                                  const autovector<VersionEdit*>& edit_list) {
-    nlohmann::json res;
+IOStatus SstShipExecutor::Wait(Batch* batch) {
+    std::unique_lock<std::mutex> lock(mu_);
+    done_cv_.wait(lock, [batch] { return batch->remaining == 0; });
+    return batch->status;
+}
+
+void SstShipExecutor::Throttle(Batch* batch, uint64_t max_bytes) {
+    std::unique_lock<std::mutex> lock(mu_);
+    done_cv_.wait(lock, [batch, max_bytes] { return batch->bytes < max_bytes; });
+}
+
+void SstShipExecutor::BGThread() {
+    std::unique_lock<std::mutex> lock(mu_);
+    while (true) {
+        // take the first queued write whose target is under its limit and
+        // whose order key has no running write. The writes of one order key
+        // share their target, so the first of them is always taken first. The
+        // queued writes are drained on shutdown so no ShipFiles call hangs
+        auto it = queue_.end();
+        task_cv_.wait(lock, [this, &it] {
+            for (it = queue_.begin(); it != queue_.end(); ++it) {
+                if (it->order != nullptr && running_orders_.count(it->order) > 0) {
+                    continue;
+                }
+                auto r = running_.find(it->dir);
+                if (r == running_.end() || r->second < max_ships_per_target_) {
+                    return true;
+                }
+            }
+            return exit_ && queue_.empty();
+        });
+        if (it == queue_.end()) {
+            break;
+        }
+
+        Task task = std::move(*it);
+        queue_.erase(it);
+        running_[task.dir]++;
+        if (task.order != nullptr) {
+            running_orders_.insert(task.order);
+        }
+        lock.unlock();
+
+        IOStatus s = task.write();
+
+        lock.lock();
+        if (!s.ok() && task.batch->status.ok()) {
+            task.batch->status = s;
+        }
+        auto r = running_.find(task.dir);
+        if (--r->second == 0) {
+            running_.erase(r);
+        }
+        if (task.order != nullptr) {
+            running_orders_.erase(task.order);
+        }
+        task.batch->bytes -= task.bytes;
+        if (--task.batch->remaining == 0 || task.bytes > 0) {
+            done_cv_.notify_all();
+        }
+        // the target can take another write
+        task_cv_.notify_all();
+    }
+}
 
+bool EncodeShippedEdits(uint64_t next_file_number,
+                        uint64_t log_and_apply_counter,
+                        const autovector<VersionEdit*>& edit_list,
+                        std::string* dst) {
+    uint32_t flags = 0;
+    int batch_count = 0;
     if (edit_list.back()->IsFlush()) {
-        res["IsFlush"] = true;
-        res["BatchCount"] = edit_list.back()->GetBatchCount();
+        flags |= kShippedEditFlush;
+        batch_count = edit_list.back()->GetBatchCount();
     } else if (edit_list.back()->IsTrivialMove()) {
-        res["IsTrivial"] = true;
+        flags |= kShippedEditTrivialMove;
     }
 
-    res["NextFileNum"] = next_file_number;
-    std::vector<std::string> version_edits;
+    PutVarint64Varint64(dst, log_and_apply_counter, next_file_number);
+    PutVarint32Varint32Varint32(dst, flags, static_cast<uint32_t>(batch_count),
+                                static_cast<uint32_t>(edit_list.size()));
 
-    for (auto e: edit_list) {
-        version_edits.emplace_back(e->DebugJSON((int) log_and_apply_counter, false));
+    std::string record;
+    for (auto e : edit_list) {
+        record.clear();
+        if (!e->EncodeTo(&record)) {
+            return false;
+        }
+        PutVarint32(dst, e->IsFlush() ? 1 : 0);
+        PutLengthPrefixedSlice(dst, record);
+    }
+    return true;
+}
+
+Status DecodeShippedEdits(const Slice& src,
+                          const std::unordered_map<uint64_t, int>& slots,
+                          uint64_t* id, std::vector<VersionEdit>* edits) {
+    Slice input = src;
+    uint64_t next_file_number = 0;
+    uint32_t flags = 0, batch_count = 0, num_edits = 0;
+    if (!GetVarint64(&input, id) || !GetVarint64(&input, &next_file_number) ||
+        !GetVarint32(&input, &flags) || !GetVarint32(&input, &batch_count) ||
+        !GetVarint32(&input, &num_edits)) {
+        return Status::Corruption("shipped edits", "bad record header");
     }
 
-    nlohmann::json j_vec(version_edits);
-    res["EditList"] = j_vec;
-    res["Id"] = log_and_apply_counter;
+    for (uint32_t i = 0; i < num_edits; i++) {
+        uint32_t is_flush = 0;
+        Slice record;
+        if (!GetVarint32(&input, &is_flush) ||
+            !GetLengthPrefixedSlice(&input, &record)) {
+            return Status::Corruption("shipped edits", "truncated edit");
+        }
+
+        VersionEdit edit;
+        Status s = edit.DecodeFrom(record);
+        if (!s.ok()) {
+            return s;
+        }
+        // right now, just use one column family(the default one)
+        edit.SetColumnFamily(0);
+        edit.SetEditNumber(*id);
+        if (is_flush) {
+            edit.MarkFlush();
+        }
+        if (flags & kShippedEditFlush) {
+            edit.SetBatchCount(static_cast<int>(batch_count));
+        } else if (flags & kShippedEditTrivialMove) {
+            edit.MarkTrivialMove();
+        }
+        edit.SetNextFile(next_file_number);
 
-    return res.dump();
+        for (const auto& new_file : edit.GetNewFiles()) {
+            uint64_t file_num = new_file.second.fd.GetNumber();
+            auto it = slots.find(file_num);
+            if (it != slots.end() && it->second != -1) {
+                edit.TrackSlot(file_num, it->second);
+            }
+        }
+        edits->push_back(std::move(edit));
+    }
+    return Status::OK();
 }
 
 SyncClient* GetSyncClient(const ImmutableDBOptions* db_options_) {
@@ -204,169 +763,136 @@ bool AddedFiles(const autovector<autovector<VersionEdit*>>& edit_lists) {
   return res;
 }
 
-// void ApplyDownstreamSstSlotDeletion(ShipThreadArg* sta, const nlohmann::json& reply_json) {
-//     std::stringstream ss;
-//     bool did_deletion = false;
-//     for (const auto& deleted_slot : reply_json["DeletedSlots"]) {
-//         int slot = deleted_slot.get<int>();
-//         // uint64_t filenumber = sta->db_options_->sst_bit_map->GetSlotFileNum(slot);
-//         sta->db_options_->sst_bit_map->FreeSlot2(slot);
-//         ss << slot << ',';
-//         did_deletion = true;
-//     }
-//     if (did_deletion)
-//         std::cout << "[sync] apply deletion from downstream nodes, deleted slot: " << ss.str() << std::endl;
-// }
-
-// void ShipJobTakeSlot(ShipThreadArg* sta, FileInfo& f) {
-//     while (true) {
-//         f.slot_number_ = sta->db_options_->sst_bit_map->TakeOneAvailableSlot(f.file_number_, f.times_);
-//         if (f.slot_number_ == -1) {
-//             std::cout << "ShipJobTakeSlot " << sta << " sst bitmap is full, waiting for a free slot..." << std::endl;
-//             sta->db_options_->sst_bit_map->WaitForFreeSlots();
-//             continue;
-//         }
-//         return;
-//     }
-// }
-
 void BGWorkShip(void* arg) {
-    // TODO: print edit ID timestamp
-    // auto t1_now = std::chrono::system_clock::now();
-    // auto t1 = std::chrono::system_clock::to_time_t(t1_now);
-    // auto tm_1 = *std::localtime(&t1);
     ShipThreadArg* sta = reinterpret_cast<ShipThreadArg*>(arg);
 
     // 1. ship SST file to secondary nodes
     // 1.1 find available slots in the SST pool
-    // int sst_slot = sta->db_options_->sst_bit_map->TakeOneAvailableSlot(sta->sst_number_, sta->times_);
-
-    // 1.2 ship SST file via NVMe-oF
-    // std::stringstream ss;
     std::vector<std::pair<uint64_t, int>> files_info;
     std::map<int, int> needed_slots;
 
-    for (FileInfo f : sta->files_) {
-        files_info.push_back({f.file_number_, f.times_});
-        needed_slots[f.times_]++;
-        // ss << f.file_number_ << ",";
-    }
-    for (ShipThreadArg* const s : sta->dependants_) {
-        for (FileInfo f : s->files_) {
+    // files that are streamed already own a slot
+    std::vector<uint64_t> file_numbers;
+
+    for (const FileInfo& f : sta->files_) {
+        file_numbers.push_back(f.file_number_);
+        if (!f.streamed_) {
             files_info.push_back({f.file_number_, f.times_});
             needed_slots[f.times_]++;
-            // ss << f.file_number_ << ",";
+        }
+    }
+    for (ShipThreadArg* const dep : sta->dependants_) {
+        for (const FileInfo& f : dep->files_) {
+            file_numbers.push_back(f.file_number_);
+            if (!f.streamed_) {
+                files_info.push_back({f.file_number_, f.times_});
+                needed_slots[f.times_]++;
+            }
         }
     }
 
-    // std::cout << "about to take slots for these files in batch: " << ss.str() << std::endl;
     // try to take slots for all sst files
-    // TODO: print edit ID timestamp
-    while (!sta->db_options_->sst_bit_map->TakeSlotsInBatch(files_info)) {
-        std::cout << "not able to take slots in batch, wait for freeing..." << std::endl;
+    while (!files_info.empty() && !sta->db_options_->sst_bit_map->TakeSlotsInBatch(files_info)) {
+        ROCKS_LOG_INFO(sta->db_options_->info_log,
+                       "Not able to take slots for %" ROCKSDB_PRIszt " ssts, wait for free slots",
+                       files_info.size());
+        MaybeResizeSstPool(sta->db_options_, needed_slots);
         sta->db_options_->sst_bit_map->WaitForFreeSlots(needed_slots);
-        std::cout << "Wake up! now I have " << sta->db_options_->sst_bit_map->GetAvailableSlots(1) << " free slots!" << std::endl;
     }
-    // std::cout << "take slots for files: " << ss.str() << "successfully" << std::endl;
-    // ss.str(std::string());
+    // grow the pool before it runs out
+    MaybeResizeSstPool(sta->db_options_, {});
 
-    // auto t2_now = std::chrono::system_clock::now();
-    // auto t2 = std::chrono::system_clock::to_time_t(t2_now);
-    // auto tm_2 = *std::localtime(&t2);
-
-    // then ship sst
-    // TODO: print edit ID timestamp
-    for (FileInfo f : sta->files_) {
-        int slot = sta->db_options_->sst_bit_map->GetFileSlotNum(f.file_number_);
-        f.slot_number_ = slot;
-        ShipSST(f, sta->db_options_->remote_sst_dirs, sta);
-        // ss << "file " << f.file_number_ << " takes slot " << slot << ", ";
+    // 1.2 ship SST file via NVMe-oF
+    std::vector<FileInfo*> to_ship;
+    for (FileInfo& f : sta->files_) {
+        if (!f.streamed_) {
+            to_ship.push_back(&f);
+        }
     }
-    for (ShipThreadArg* const s : sta->dependants_) {
-        for (FileInfo f : s->files_) {
-            int slot = sta->db_options_->sst_bit_map->GetFileSlotNum(f.file_number_);
-            f.slot_number_ = slot;
-            ShipSST(f, sta->db_options_->remote_sst_dirs, sta);
-            // ss << "file " << f.file_number_ << " takes slot " << slot << ", ";
+    for (ShipThreadArg* const dep : sta->dependants_) {
+        for (FileInfo& f : dep->files_) {
+            if (!f.streamed_) {
+                to_ship.push_back(&f);
+            }
         }
     }
+    for (FileInfo* f : to_ship) {
+        f->slot_number_ = sta->db_options_->sst_bit_map->GetFileSlotNum(f->file_number_);
+    }
 
-    // auto t3_now = std::chrono::system_clock::now();
-    // auto t3 = std::chrono::system_clock::to_time_t(t3_now);
-    // auto tm_3 = *std::localtime(&t3);
-
-    // auto now = std::chrono::system_clock::now();
-    // auto now_c = std::chrono::system_clock::to_time_t(now);
-    // std::tm tm = *std::localtime(&now_c);
-    // int ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
+    // a tail leaving or joining the chain doesn't change the dirs of a ship
+    std::shared_ptr<const std::vector<std::string>> remote_sst_dirs =
+        sta->db_options_->remote_sst_dirs->Snapshot();
+    SstShipExecutor* executor = sta->db_options_->sst_ship_executor;
+    Status s = Status::NotSupported();
+    if (executor != nullptr) {
+        // all the files of the job and its dependants go to all the remote
+        // nodes concurrently, the edits are sent only after every write is done
+        s = executor->ShipFiles(std::vector<const FileInfo*>(to_ship.begin(), to_ship.end()),
+                                *remote_sst_dirs, sta->db_options_);
+        if (!s.ok()) {
+            ROCKS_LOG_WARN(sta->db_options_->info_log,
+                           "Ship sst files on the executor failed: %s, ship them inline",
+                           s.ToString().c_str());
+        }
+    }
+    IOStatus ship_s;
+    if (s.ok()) {
+        for (FileInfo* f : to_ship) {
+            delete [] f->beg_;
+            f->beg_ = nullptr;
+        }
+    } else {
+        for (FileInfo* f : to_ship) {
+            IOStatus file_s = ShipSST(*f, *remote_sst_dirs, sta);
+            f->beg_ = nullptr;
+            if (!file_s.ok()) {
+                ROCKS_LOG_ERROR(sta->db_options_->info_log,
+                                "Ship sst %" PRIu64 " to slot %d failed: %s",
+                                f->file_number_, f->slot_number_, file_s.ToString().c_str());
+                if (ship_s.ok()) {
+                    ship_s = file_s;
+                }
+            }
+        }
+    }
 
-    // std::cout << std::put_time(&tm, "%y:%m:%d %H:%M:%S.") << std::setfill('0') << std::setw(3) << ms
-    // << " shipped sst: " << ss.str() << std::endl;
-    
-    
-    // 2. send version edits to secondary nodes
-    // printf("[BGWorkShip] sta_ %p json_size %ld\n", sta, sta->edits_json_.size());
-    for (std::string json : sta->edits_json_) {
-        // printf("[BGWorkShip] sta_ %p json_length %ld\n", sta, json.length());
-        if (json.length() > 0) {
-            // fill in the slot info in the json here
-            // printf("[BGWorkShip] sta: %p edits_json: %s\n", sta, json.data());
-            nlohmann::json j = nlohmann::json::parse(json), j_new;
-
-            for (auto& it : j.items()) {
-                if (it.key() != "EditList") {
-                    j_new[it.key()] = it.value();
-                } else {
-                    nlohmann::json edit_array = nlohmann::json::array();
-                    for (auto& edit_string : it.value().get<std::vector<std::string>>()) {
-                        nlohmann::json edit_json = nlohmann::json::parse(edit_string), edit_json_new;
-                        for (auto& edit_json_it : edit_json.items()) {
-                            if (edit_json_it.key() != "AddedFiles") {
-                                edit_json_new[edit_json_it.key()] = edit_json_it.value();
-                            } else {
-                                nlohmann::json added_files_array = nlohmann::json::array();
-                                
-                                for (auto& added_files_it : edit_json_it.value().items()) {
-                                    uint64_t filenumber;
-                                    nlohmann::json added_file_json = added_files_it.value();
-                                    added_file_json["Slot"] = sta->db_options_->sst_bit_map->GetFileSlotNum(added_file_json["FileNumber"].get<uint64_t>());
-                                    added_files_array.push_back(added_file_json);
-                                }
-                                edit_json_new["AddedFiles"] = added_files_array;
-                            }
-                        }
-                        edit_array.push_back(edit_json_new.dump());
-                    }
-                    
-                    j_new["EditList"] = edit_array;
+    if (!ship_s.ok() || sta->db_options_->ship_failed->load()) {
+        // the secondaries would open a broken slot, or wait forever for the
+        // edits of an earlier failed ship. Keep the edits, give the slots
+        // back and stop the writes on the primary, the chain has to be
+        // recovered
+        if (!sta->db_options_->ship_failed->exchange(true) &&
+            sta->db_options_->shipping_db != nullptr) {
+            sta->db_options_->shipping_db->SetShipError(ship_s);
+        }
+        ROCKS_LOG_ERROR(sta->db_options_->info_log,
+                        "Drop the version edits of %" ROCKSDB_PRIszt " ssts, a ship failed",
+                        file_numbers.size());
+        for (uint64_t file_number : file_numbers) {
+            sta->db_options_->sst_bit_map->ReturnSlot(file_number);
+        }
+    } else {
+        // 2. send version edits to secondary nodes
+        for (const std::string& edits : sta->edits_) {
+            if (edits.length() > 0) {
+                // attach the slots taken above to the binary edit record
+                SyncRequest request;
+                request.set_edits(edits);
+                request.set_rid(sta->db_options_->rid);
+                auto* slots = request.mutable_slots();
+                for (uint64_t file_number : file_numbers) {
+                    (*slots)[file_number] = sta->db_options_->sst_bit_map->GetFileSlotNum(file_number);
                 }
+
+                SyncClient* client = GetSyncClient(sta->db_options_);
+                client->Sync(request);
             }
-            // std::cout << "modified json: " << j_new.dump() << std::endl;
-            
-            // auto t4_now = std::chrono::system_clock::now();
-            // auto t4 = std::chrono::system_clock::to_time_t(t4_now);
-            // auto tm_4 = *std::localtime(&t4);
-            SyncClient* client = GetSyncClient(sta->db_options_);
-            client->Sync(j_new.dump(), sta->db_options_->rid);
-
-            // std::cout << "[ship event] edit id: " << j_new["Id"].get<uint64_t>() 
-            //     << ", t1: "
-            //     << std::put_time(&tm_1, "%H:%M:%S.") << std::setfill('0') << std::setw(3)
-            //     << std::chrono::duration_cast<std::chrono::milliseconds>(t1_now.time_since_epoch()).count() % 1000
-            //     << ", t2: "
-            //     << std::put_time(&tm_2, "%H:%M:%S.") << std::setfill('0') << std::setw(3)
-            //     << std::chrono::duration_cast<std::chrono::milliseconds>(t2_now.time_since_epoch()).count() % 1000
-            //     << ", t3: "
-            //     << std::put_time(&tm_3, "%H:%M:%S.") << std::setfill('0') << std::setw(3)
-            //     << std::chrono::duration_cast<std::chrono::milliseconds>(t3_now.time_since_epoch()).count() % 1000
-            //     << ", t4: "
-            //     << std::put_time(&tm_4, "%H:%M:%S.") << std::setfill('0') << std::setw(3)
-            //     << std::chrono::duration_cast<std::chrono::milliseconds>(t4_now.time_since_epoch()).count() % 1000 << std::endl;
         }
     }
 
-    for (ShipThreadArg* const s : sta->dependants_) {
-        delete s;
+    for (ShipThreadArg* const dep : sta->dependants_) {
+        delete dep;
     }
     delete reinterpret_cast<ShipThreadArg*>(arg);
 }
@@ -1,16 +1,155 @@
 #pragma once
 
 #include "util/aligned_buffer.h"
+#include "file/writable_file_writer.h"
 #include "options/db_options.h"
 #include "db/version_edit.h"
 #include "util/autovector.h"
+#include "util/coding.h"
+#include "port/port.h"
+#include "rocksdb/file_checksum.h"
 #include <grpcpp/grpcpp.h>
 #include <nlohmann/json.hpp>
 #include "rubble/sync_client.h"
 #include "util/aligned_buffer.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace ROCKSDB_NAMESPACE {
+// The remote dirs the sst files are shipped to. A tail leaves or joins the
+// chain at runtime (see RubbleKvServiceImpl::Recover and CatchUpCopy) while
+// files are being shipped, so every change publishes a new list and readers
+// keep the snapshot they took for the whole ship.
+class RemoteSstDirs {
+  public:
+    explicit RemoteSstDirs(const std::vector<std::string>& dirs);
+
+    std::shared_ptr<const std::vector<std::string>> Snapshot() const;
+
+    // returns false if dir is in the list already
+    bool Add(const std::string& dir);
+
+    // remove the last dir of the list and return it in dir, returns false if
+    // the list is empty
+    bool RemoveLast(std::string* dir);
+
+  private:
+    mutable std::mutex mu_;
+    std::shared_ptr<const std::vector<std::string>> dirs_;
+};
+
+struct FileInfo;
+
+// Ships sst files to the remote slots on a dedicated pool of threads. Every
+// (file, remote dir) pair is an independent write, at most
+// max_ships_per_target of them run against the same remote dir at a time.
+class SstShipExecutor {
+  public:
+    // a group of writes that are waited for together
+    struct Batch {
+        size_t remaining = 0;
+        // bytes of the queued and running writes, see Throttle
+        uint64_t bytes = 0;
+        // the first failed write
+        IOStatus status;
+    };
+
+    SstShipExecutor(int num_threads, int max_ships_per_target);
+
+    ~SstShipExecutor();
+
+    // write every file to its slot under every dir of remote_sst_dirs,
+    // returns once all the writes are done. Doesn't free the files' buffers.
+    // Fails if the executor is shutting down or has no thread, or with the
+    // first failed write
+    Status ShipFiles(const std::vector<const FileInfo*>& files,
+                     const std::vector<std::string>& remote_sst_dirs,
+                     const ImmutableDBOptions* db_options);
+
+    // queue one write of bytes against the remote dir without waiting for
+    // it, see Wait. The writes with the same non-null order key run one at a
+    // time in the order they are submitted, they must all go to the same dir.
+    // Fails if the executor is shutting down or has no thread
+    Status Submit(const std::string& dir, std::function<IOStatus()> write, Batch* batch,
+                  const void* order = nullptr, uint64_t bytes = 0);
+
+    // wait for every write submitted to the batch, returns the first failed one
+    IOStatus Wait(Batch* batch);
+
+    // wait until the writes of the batch hold less than max_bytes
+    void Throttle(Batch* batch, uint64_t max_bytes);
+
+  private:
+    struct Task {
+        std::string dir;
+        std::function<IOStatus()> write;
+        Batch* batch;
+        const void* order;
+        uint64_t bytes;
+    };
+
+    void BGThread();
+
+    const int max_ships_per_target_;
+    std::mutex mu_;
+    // signaled when a task is queued, a target frees up or on shutdown
+    std::condition_variable task_cv_;
+    // signaled when a batch is done
+    std::condition_variable done_cv_;
+    std::deque<Task> queue_;
+    // number of running writes per remote dir, a dir is dropped once it has
+    // none so the dirs of a removed tail don't pile up
+    std::unordered_map<std::string, int> running_;
+    // the order keys with a running write
+    std::unordered_set<const void*> running_orders_;
+    bool exit_;
+    std::vector<port::Thread> threads_;
+};
+
+// Streams an sst file to its slot on every remote node while the table is
+// being built. Each chunk written by the local direct I/O writer is queued to
+// the ship executor and written to the remote slot files at the same offset,
+// so the remote copy is complete (including footer and padding) once Finish
+// returns. The writer rewrites the last partial page of the file with every
+// chunk, so the chunks of one remote file are written in order, and
+// MirrorWrite blocks while max_sst_stream_bytes_in_flight bytes are queued.
+// Without an executor the chunks are written in place.
+class SstStreamShipper : public WriteMirror {
+  public:
+    SstStreamShipper(const ImmutableDBOptions* db_options, int slot,
+                     const std::vector<std::string>& remote_sst_dirs);
+
+    ~SstStreamShipper();
+
+    // fails if a remote slot file can't be opened
+    IOStatus status() const { return status_; }
+
+    IOStatus MirrorWrite(const Slice& data, uint64_t offset) override;
+
+    // wait for the queued writes and close the remote slot files once the
+    // local file is synced, returns the first failed write
+    IOStatus Finish();
+
+  private:
+    struct RemoteFile {
+        std::string dir;
+        std::string fname;
+        int fd;
+    };
+
+    const ImmutableDBOptions* db_options_;
+    int slot_;
+    std::vector<RemoteFile> remote_files_;
+    IOStatus status_;
+    // the chunks queued to db_options_->sst_ship_executor
+    SstShipExecutor::Batch batch_;
+};
+
 struct FileInfo {
     char * beg_;
     char * buf_;
@@ -18,7 +157,10 @@ struct FileInfo {
     uint64_t times_;
     int slot_number_;
     uint64_t file_number_;
-    uint64_t checksum_;
+    // the file's slot is taken when it's created and its content is
+    // streamed to the remote slots as it's written, see NeedStreamSST
+    bool streamed_;
+    std::shared_ptr<SstStreamShipper> shipper_;
 
     FileInfo() : 
         beg_(nullptr),
@@ -27,50 +169,120 @@ struct FileInfo {
         times_(1),
         slot_number_(0),
         file_number_(0),
-        checksum_(0) {};
+        streamed_(false),
+        shipper_(nullptr) {};
+};
+
+// Flags of a shipped version edit record
+enum ShippedEditFlag : uint32_t {
+    kShippedEditFlush = 1,
+    kShippedEditTrivialMove = 2,
 };
 
 struct ShipThreadArg {
     std::vector<FileInfo> files_;
-    std::vector<std::string> edits_json_;
+    // binary version edit records, see EncodeShippedEdits
+    std::vector<std::string> edits_;
     const ImmutableDBOptions* db_options_;
     std::vector<ShipThreadArg*> dependants_;
 
     ShipThreadArg(const ImmutableDBOptions* db_options) :
         files_(),
-        edits_json_(),
+        edits_(),
         db_options_(db_options),
         dependants_() {};
     
     int GetEditId() const {
-        assert(edits_json_.size() > 0 && edits_json_[0].size() > 0);
-        nlohmann::json j = nlohmann::json::parse(edits_json_[0]);
-        return j["Id"].get<int>();
-
+        assert(edits_.size() > 0 && edits_[0].size() > 0);
+        Slice input(edits_[0]);
+        uint64_t id = 0;
+        bool ok = GetVarint64(&input, &id);
+        assert(ok);
+        (void)ok;
+        return static_cast<int>(id);
     }
 };
 
-bool HasEditJson(ShipThreadArg* const a);
+bool HasEdits(ShipThreadArg* const a);
 
-void AddEditJson(ShipThreadArg* const a, std::string json);
+void AddEdits(ShipThreadArg* const a, std::string edits);
 
 void AddDependant(ShipThreadArg* const a, ShipThreadArg* const b);
 
-void PrepareFile(ShipThreadArg* const sta, AlignedBuffer& buf);
+// take over the buffer holding the whole synced file of file_size bytes,
+// fails if the buffer can't hold the file rounded up to whole pages
+IOStatus PrepareFile(ShipThreadArg* const sta, AlignedBuffer& buf, uint64_t file_size);
+
+// Track a new sst file of the job. If the file is streamed, its slot is taken
+// right away and *shipper should be set as the write mirror of the file's
+// writer, otherwise *shipper is nullptr and the file is shipped whole by
+// BGWorkShip. Fails if the remote slot files can't be opened
+IOStatus AddFile(ShipThreadArg* const sta, uint64_t times, uint64_t file_number,
+                 std::shared_ptr<SstStreamShipper>* shipper);
 
-void AddFile(ShipThreadArg* const sta, uint64_t times, uint64_t file_number);
+// stop tracking a file that is empty, deleted or failed to build, and give
+// its slot back if it's streamed
+void DropFile(ShipThreadArg* const sta, uint64_t file_number);
 
 bool NeedShipSST(const ImmutableDBOptions* db_options);
 
-void ApplyDownstreamSstSlotDeletion(ShipThreadArg* sta, const nlohmann::json& reply_json);
+bool NeedStreamSST(const ImmutableDBOptions* db_options);
+
+// ask the secondaries to resize the sst pool if a slot class of the primary
+// crossed a watermark or can't give the slots in needed_slots (times -> count)
+void MaybeResizeSstPool(const ImmutableDBOptions* db_options, const std::map<int, int>& needed_slots);
+
+// write the file to its slot under every remote dir and free its buffer,
+// returns the first failed write
+IOStatus ShipSST(FileInfo& file, const std::vector<std::string>& remote_sst_dirs, ShipThreadArg *sta);
+
+// write the whole file to its slot under one remote dir, file.len_ must be
+// a multiple of the page size
+IOStatus ShipSSTToDir(const FileInfo& file, const std::string& dir, const ImmutableDBOptions* db_options);
+
+// copy the local sst file fname to its slot under one remote dir, used to
+// fill the slots of a tail joining the chain. Returns PathNotFound if the
+// file is gone
+IOStatus CopySSTToDir(const std::string& fname, int slot, const std::string& dir,
+                      const ImmutableDBOptions* db_options);
+
+// Checksum of an sst made of the crc32c of every chunk_size bytes of the
+// file, computed by the file writer while the table is built. It travels
+// with the file's meta data in the version edit, laid out as
+//   chunk_size (varint64) | num_chunks * crc32c (fixed32)
+// so that a secondary can check the chunks of a shipped file in parallel,
+// see sst_checksum_chunk_size
+extern const char* kSstChunkChecksumName;
+extern const char* kSstChunkChecksumGenFactoryName;
+
+std::shared_ptr<FileChecksumGenFactory> NewSstChunkChecksumGenFactory(uint64_t chunk_size);
+
+// number of chunks of a file with chunk checksums, 0 if it has none
+size_t NumSSTChunks(const FileMetaData& meta);
 
-void ShipSST(FileInfo& file, const std::vector<std::string>& remote_sst_dirs, ShipThreadArg *sta);
+// read chunks [first_chunk, first_chunk + num_chunks) of the file at fname
+// and check them against the chunk checksums of meta
+Status VerifySSTChunks(const std::string& fname, const FileMetaData& meta,
+                       size_t first_chunk, size_t num_chunks);
 
-// void ShipJobTakeSlot(ShipThreadArg* sta, FileInfo& f);
+// Encode the edits of one LogAndApply call into a binary record that is
+// shipped to the downstream nodes in SyncRequest::edits. Layout:
+//   id (varint64) | next_file_number (varint64) | flags (varint32) |
+//   batch_count (varint32) | num_edits (varint32) |
+//   num_edits * [ is_flush (varint32) | VersionEdit::EncodeTo (length prefixed) ]
+// The file -> slot mapping is not part of the record, it travels in
+// SyncRequest::slots once the slots are taken in BGWorkShip.
+bool EncodeShippedEdits(uint64_t next_file_number,
+                        uint64_t log_and_apply_counter,
+                        const autovector<VersionEdit*>& edit_list,
+                        std::string* dst);
 
-std::string VersionEditsToJson(uint64_t next_file_number,
-                               uint64_t log_and_apply_counter,
-                               const autovector<VersionEdit*>& edit_lists);
+// Decode a record produced by EncodeShippedEdits. Every decoded edit carries
+// the edit number, flush/trivial move marks, batch count and next file number
+// of the record, and tracks the slot of each added file found in `slots`.
+Status DecodeShippedEdits(const Slice& src,
+                          const std::unordered_map<uint64_t, int>& slots,
+                          uint64_t* id, std::vector<VersionEdit>* edits);
 
 SyncClient* GetSyncClient(const ImmutableDBOptions* db_options_);
 SyncClient* GetPrimarySyncClient(const ImmutableDBOptions* db_options_);
@@ -4361,6 +4361,10 @@ uint64_t VersionSet::LogAndApplyCounter() {
   return log_and_apply_counter_.load();
 }
 
+void VersionSet::AdvanceLogAndApplyCounter(uint64_t n) {
+  log_and_apply_counter_.fetch_add(n);
+}
+
 // 'datas' is gramatically incorrect. We still use this notation to indicate
 // that this variable represents a collection of column_family_data.
 Status VersionSet::LogAndApply(
@@ -4383,12 +4387,14 @@ Status VersionSet::LogAndApply(
   ROCKS_LOG_INFO(db_options_->info_log, "LogAndApply called\n");
   log_and_apply_counter_.fetch_add(1);
   unsigned long laac = log_and_apply_counter_.load();
-  // printf("[LogAndApply] counter: %lu sta: %p edits: %s\n", log_and_apply_counter_.load(), sta, 
-  //   VersionEditsToJson(next_file_number_.load(), log_and_apply_counter_.load(), edit_lists.back()).data());
   if (sta != nullptr && AddedFiles(edit_lists)) {
-    AddEditJson(sta, VersionEditsToJson(next_file_number_.load(),
-                                        log_and_apply_counter_.load(),
-                                        edit_lists.back()));
+    std::string shipped_edits;
+    bool encoded = EncodeShippedEdits(next_file_number_.load(),
+                                      log_and_apply_counter_.load(),
+                                      edit_lists.back(), &shipped_edits);
+    assert(encoded);
+    (void)encoded;
+    AddEdits(sta, std::move(shipped_edits));
   }
   // RUBBLE END
   int num_edits = 0;
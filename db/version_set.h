@@ -990,6 +990,10 @@ class VersionSet {
   // Rubble: used in rubble server to order the version edits
   uint64_t LogAndApplyCounter();
 
+  // rubble secondary: the last LogAndApply applied the edits of n more of
+  // the primary's LogAndApply calls
+  void AdvanceLogAndApplyCounter(uint64_t n);
+
   static Status GetCurrentManifestPath(const std::string& dbname,
                                        FileSystem* fs,
                                        std::string* manifest_filename,
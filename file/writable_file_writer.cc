@@ -500,6 +500,9 @@ IOStatus WritableFileWriter::WriteDirect() {
         auto finish_ts = std::chrono::steady_clock::now();
         NotifyOnFileWriteFinish(write_offset, size, start_ts, finish_ts, s);
       }
+      if (s.ok() && write_mirror_ != nullptr) {
+        s = write_mirror_->MirrorWrite(Slice(src, size), write_offset);
+      }
       if (!s.ok()) {
         buf_.Size(file_advance + leftover_tail);
         return s;
@@ -26,6 +26,16 @@
 namespace ROCKSDB_NAMESPACE {
 class Statistics;
 
+// RUBBLE: receives every chunk a direct I/O WritableFileWriter persists, at
+// the same (aligned) offset, so the file can be replicated while it is still
+// being written. See SstStreamShipper in db/ship_job.h
+class WriteMirror {
+ public:
+  virtual ~WriteMirror() {}
+
+  virtual IOStatus MirrorWrite(const Slice& data, uint64_t offset) = 0;
+};
+
 // WritableFileWriter is a wrapper on top of Env::WritableFile. It provides
 // facilities to:
 // - Handle Buffered and Direct writes.
@@ -141,6 +151,8 @@ class WritableFileWriter {
   std::vector<std::shared_ptr<EventListener>> listeners_;
   std::unique_ptr<FileChecksumGenerator> checksum_generator_;
   bool checksum_finalized_;
+  // RUBBLE: only used with direct I/O
+  std::shared_ptr<WriteMirror> write_mirror_;
 
  public:
   WritableFileWriter(
@@ -252,6 +264,12 @@ class WritableFileWriter {
 
   AlignedBuffer& GetAlignedBuffer() { return buf_; }
 
+  // RUBBLE: mirror every direct write of this file to `mirror`
+  void SetWriteMirror(const std::shared_ptr<WriteMirror>& mirror) {
+    assert(mirror == nullptr || use_direct_io());
+    write_mirror_ = mirror;
+  }
+
  private:
   // Used when os buffering is OFF and we are writing
   // DMA such as in Direct I/O mode
@@ -23,6 +23,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <functional>
 #include <memory>
 #include <string>
 #include "rocksdb/memory_allocator.h"
@@ -33,6 +34,7 @@
 namespace ROCKSDB_NAMESPACE {
 
 class Cache;
+class SecondaryCache;
 struct ConfigOptions;
 
 extern const bool kDefaultToAdaptiveMutex;
@@ -87,6 +89,12 @@ struct LRUCacheOptions {
   CacheMetadataChargePolicy metadata_charge_policy =
       kDefaultCacheMetadataChargePolicy;
 
+  // If non-nullptr, the entries inserted with Cache::InsertWithHelper() move
+  // to this tier when they are evicted, instead of being deleted, and
+  // Cache::LookupWithHelper() moves them back on a hit. See
+  // NewCompressedSecondaryCache().
+  std::shared_ptr<SecondaryCache> secondary_cache;
+
   LRUCacheOptions() {}
   LRUCacheOptions(size_t _capacity, int _num_shard_bits,
                   bool _strict_capacity_limit, double _high_pri_pool_ratio,
@@ -122,10 +130,10 @@ extern std::shared_ptr<Cache> NewLRUCache(
 extern std::shared_ptr<Cache> NewLRUCache(const LRUCacheOptions& cache_opts);
 
 // Similar to NewLRUCache, but create a cache based on CLOCK algorithm with
-// better concurrent performance in some cases. See util/clock_cache.cc for
-// more detail.
+// better concurrent performance in some cases: a lookup takes no lock. See
+// cache/clock_cache.cc for more detail.
 //
-// Return nullptr if it is not supported.
+// Return nullptr if it is not supported (ROCKSDB_LITE).
 extern std::shared_ptr<Cache> NewClockCache(
     size_t capacity, int num_shard_bits = -1,
     bool strict_capacity_limit = false,
@@ -199,6 +207,41 @@ class Cache {
   // function.
   virtual Handle* Lookup(const Slice& key, Statistics* stats = nullptr) = 0;
 
+  // Describes how a secondary tier (see LRUCacheOptions::secondary_cache)
+  // keeps an entry once it is evicted. contents_cb returns the bytes the
+  // value can be rebuilt from, deleter is as in Insert().
+  struct CacheItemHelper {
+    Slice (*contents_cb)(void* value);
+    void (*deleter)(const Slice& key, void* value);
+  };
+
+  // Rebuilds a value from the contents a secondary tier handed back, and
+  // returns it with its charge.
+  using CreateCallback =
+      std::function<Status(std::unique_ptr<char[]>&& contents, size_t size,
+                           void** value, size_t* charge)>;
+
+  // Like Insert(), but when the entry is evicted it may move to the
+  // secondary tier instead of being deleted. Caches without one simply
+  // Insert().
+  virtual Status InsertWithHelper(const Slice& key, void* value,
+                                  const CacheItemHelper* helper, size_t charge,
+                                  Handle** handle = nullptr,
+                                  Priority priority = Priority::LOW) {
+    return Insert(key, value, charge, helper->deleter, handle, priority);
+  }
+
+  // Like Lookup(), but on a miss the entry is taken out of the secondary
+  // tier, rebuilt with create_cb and inserted again with helper and
+  // priority. Caches without a secondary tier simply Lookup().
+  virtual Handle* LookupWithHelper(const Slice& key,
+                                   const CacheItemHelper* /*helper*/,
+                                   const CreateCallback& /*create_cb*/,
+                                   Priority /*priority*/,
+                                   Statistics* stats = nullptr) {
+    return Lookup(key, stats);
+  }
+
   // Increments the reference count for the handle if it refers to an entry in
   // the cache. Returns true if refcount was incremented; otherwise, returns
   // false.
@@ -136,6 +136,10 @@ class FilterPolicy {
   //   "bloomfilter:[bits_per_key]:[use_block_based_builder]",
   //   e.g. ""bloomfilter:4:true"
   //   The above string is equivalent to calling NewBloomFilterPolicy(4, true).
+  // For Ribbon filters, value may be a ":"-delimited value of the form:
+  //   "ribbonfilter:[bloom_equivalent_bits_per_key]:[bloom_before_level]",
+  //   with bloom_before_level optional, e.g. "ribbonfilter:10:6" is
+  //   equivalent to calling NewRibbonFilterPolicy(10, 6).
   static Status CreateFromString(const ConfigOptions& config_options,
                                  const std::string& value,
                                  std::shared_ptr<const FilterPolicy>* result);
@@ -212,4 +216,32 @@ class FilterPolicy {
 // trailing spaces in keys.
 extern const FilterPolicy* NewBloomFilterPolicy(
     double bits_per_key, bool use_block_based_builder = false);
+
+// Return a new filter policy that uses a Standard Ribbon filter, which
+// needs about 25-30% less space than a Bloom filter for about the same
+// false positive rate, but takes several times more CPU (and temporary
+// memory) to build, and queries are somewhat slower.
+//
+// bloom_equivalent_bits_per_key: the Bloom filter bits per key with the
+// false positive rate wanted, as for NewBloomFilterPolicy. 10 yields a
+// filter with ~ 0.8% false positive rate and about 7.5 bits per key.
+//
+// bloom_before_level: tables created at a lower level get a Bloom filter
+// instead (as with NewBloomFilterPolicy), which is faster to build where
+// filters are short-lived or most of the space is elsewhere. With the
+// default 0, only tables of unknown level, such as from SstFileWriter, get
+// a Bloom filter. For example, with num_levels - 1, the bottommost level
+// (usually most of the filter memory) gets Ribbon filters, and the others
+// get Bloom filters. A filter for few keys is also a Bloom filter if that
+// is no larger.
+//
+// Ribbon filters need format_version >= 5 like the newer Bloom filters, or
+// a legacy Bloom filter is used instead. Versions that do not know Ribbon
+// filters read them as always matching.
+//
+// Callers must delete the result after any database that is using the
+// result has been closed. The note about custom comparators for
+// NewBloomFilterPolicy applies here too.
+extern const FilterPolicy* NewRibbonFilterPolicy(
+    double bloom_equivalent_bits_per_key, int bloom_before_level = 0);
 }  // namespace ROCKSDB_NAMESPACE
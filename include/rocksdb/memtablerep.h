@@ -45,6 +45,7 @@ namespace ROCKSDB_NAMESPACE {
 
 class Arena;
 class Allocator;
+class Comparator;
 class LookupKey;
 class SliceTransform;
 class Logger;
@@ -75,6 +76,10 @@ class MemTableRep {
     virtual int operator()(const char* prefix_len_key,
                            const Slice& key) const = 0;
 
+    // The comparator of the user keys the internal keys are ordered by, or
+    // nullptr if they are not ordered like internal keys
+    virtual const Comparator* user_comparator() const { return nullptr; }
+
     virtual ~KeyComparator() {}
   };
 
@@ -326,6 +331,28 @@ class SkipListFactory : public MemTableRepFactory {
   const size_t lookahead_;
 };
 
+// This uses an adaptive radix tree, whose nodes grow with the number of
+// children they have and skip the parts of the keys that do not branch. It
+// looks up keys in fewer steps than a skip list, and keeps the entries in a
+// sorted list for iteration. Writes of concurrent inserts take turns, reads
+// take no lock.
+//
+// The tree orders keys by their bytes, so it requires BytewiseComparator
+// without timestamps. The memtables of column families with other
+// comparators use a skip list instead.
+class ARTRepFactory : public MemTableRepFactory {
+ public:
+  using MemTableRepFactory::CreateMemTableRep;
+  virtual MemTableRep* CreateMemTableRep(const MemTableRep::KeyComparator&,
+                                         Allocator*, const SliceTransform*,
+                                         Logger* logger) override;
+  virtual const char* Name() const override { return "ARTRepFactory"; }
+
+  bool IsInsertConcurrentlySupported() const override { return true; }
+
+  bool CanHandleDuplicatedKey() const override { return true; }
+};
+
 #ifndef ROCKSDB_LITE
 // This creates MemTableReps that are backed by an std::vector. On iteration,
 // the vector is sorted. This is useful for workloads where iteration is very
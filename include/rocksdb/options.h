@@ -1230,6 +1230,11 @@ struct DBOptions {
   // This is for the tail to send back the sync reply.
   std::string primary_address = "";
 
+  // the replicator a node replies to once it becomes the tail, if the
+  // remove_tail call of the replicator doesn't carry its address.
+  // example string : 10.10.1.1:50040
+  std::string replicator_address = "";
+
   //upstream's remote sst directory, not "" for all nodes except tail
   std::string remote_sst_dir = "";
   std::vector<std::string> remote_sst_dirs;
@@ -1242,9 +1247,111 @@ struct DBOptions {
   //be set dynamically to DbPath.target_size/write_buffer_size
   int preallocated_sst_pool_size = 0;
 
+  // if > 0, the pool of normal slots starts with preallocated_sst_pool_size
+  // slots and grows up to max_sst_pool_size slots when the free slots fall
+  // below sst_pool_low_watermark, big slots are only created for the sst sizes
+  // actually shipped. Must be the same on every node of the chain
+  int max_sst_pool_size = 0;
+
+  // number of slots of each big slot class, the class of times holds the
+  // ssts of up to times * target_file_size_base bytes, times in
+  // [2, max_num_mems_in_flush]. Must be the same on every node of the chain
+  int sst_pool_big_slots = 100;
+
+  // the primary asks the secondaries to grow a slot class by at least
+  // sst_pool_grow_step slots once it has less than sst_pool_low_watermark
+  // free slots, and retires free slots once it has more than
+  // sst_pool_high_watermark. Only used if max_sst_pool_size > 0, a high
+  // watermark not above the low one never shrinks the pool
+  int sst_pool_low_watermark = 64;
+  int sst_pool_high_watermark = 0;
+  int sst_pool_grow_step = 64;
+
   // pad the sst size to sst_pad_len + target_file_size_base;
   uint64_t sst_pad_len = 0;
 
+  // if set to false, an sst is only padded to the direct I/O alignment instead
+  // of the size of its slot. The slot keeps its size, the real length of the
+  // table is the file size recorded in the version edit, which is what the
+  // readers use to find the footer, so the padding is never written or shipped
+  bool pad_sst_to_slot_size = true;
+
+  // if set to true, the primary takes a slot when it opens a new sst file and
+  // streams every chunk written to the local file to the remote slots right away,
+  // instead of buffering the whole sst in memory and shipping it after the table
+  // is finished. Only takes effect with use_direct_io_for_flush_and_compaction
+  bool stream_sst_shipping = false;
+
+  // number of threads the primary uses to ship sst files to the remote slots.
+  // If 0, the files are shipped one by one to one remote node at a time on the
+  // ship thread
+  int max_sst_ship_threads = 0;
+
+  // max number of concurrent sst writes to the same remote sst dir, only used
+  // when max_sst_ship_threads > 0
+  int max_sst_ships_per_target = 1;
+
+  // with stream_sst_shipping and max_sst_ship_threads > 0, the table builder
+  // stops once this many bytes of one sst are queued to the ship threads
+  // but not written to the remote slots yet. Each remote slot counts the
+  // chunk once. If 0, there is no limit
+  uint64_t max_sst_stream_bytes_in_flight = 64 << 20;
+
+  // max number of the primary's version edits a secondary applies with one
+  // LogAndApply, i.e. one MANIFEST write, when they are already queued up.
+  // If 1, the edits are applied one by one
+  int max_version_edit_group = 16;
+
+  // if > 0, a secondary opens the table of every sst it installs and loads
+  // its index and filter blocks on this many background threads as soon as
+  // the version edit arrives, and applies the edit only once they are loaded.
+  // The first reads of a new file then don't go to the slot for them
+  int sst_prewarm_threads = 0;
+
+  // if set to true, the head writes its WAL and a background thread syncs it
+  // for all the writes that came in since the last sync. The other nodes still
+  // don't write a WAL: the head forwards the sequence number its WAL is synced
+  // up to, and the tail only replies to an op once that watermark covers the
+  // head's writes for it. A crash of the whole chain then loses no write that
+  // was replied to
+  bool chain_group_commit = false;
+
+  // if set to true, a node that is not the tail counts the keys of the writes
+  // it applied that the tail hasn't replied to yet. A direct read of such a
+  // key goes down the chain to the tail instead of being answered by the node,
+  // as in CRAQ. The replicator must list the nodes of the chain so that it
+  // tells them which writes the tail replied to
+  bool serve_direct_reads = false;
+
+  // if > 0, the primary computes the crc32c of every sst_checksum_chunk_size
+  // bytes of an sst while the table is written, must be a multiple of the
+  // page size. The checksums travel with the file in the version edit, see
+  // verify_shipped_sst
+  uint64_t sst_checksum_chunk_size = 0;
+
+  // if set to true, a secondary reads every sst shipped to its slots once and
+  // checks its chunk checksums before the edit adding it is applied. The
+  // chunks are checked in parallel on the prewarm threads, at least one.
+  // Otherwise the blocks are only checked against their own checksums as
+  // they are read
+  bool verify_shipped_sst = false;
+
+  // if > 0, the node serves its rpcs with the asynchronous gRPC api on this
+  // many completion queues for DoOp, plus one for Sync and one for Recover,
+  // each polled by one thread. The ops of a DoOp stream then run in order on
+  // one of async_server_workers threads instead of a thread of their own,
+  // which doesn't scale past a few hundred streams. If 0, the synchronous
+  // server runs a thread per stream
+  int async_server_cqs = 0;
+
+  // number of threads running the DoOp ops of the async server, the streams
+  // are spread over them. If 0, one per core
+  int async_server_workers = 0;
+
+  // if set to true, the polling threads of the async server are pinned to
+  // the first cores, one each, and its workers to the cores after them
+  bool async_server_pin_threads = false;
+
   // the max size of memtables possibly appearing in a flush
   int max_num_mems_in_flush = 10;
 
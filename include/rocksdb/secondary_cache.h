@@ -0,0 +1,96 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+//
+// A SecondaryCache is a tier behind a primary Cache, see
+// LRUCacheOptions::secondary_cache. It only receives the entries the primary
+// cache evicts, and gives an entry up when it is looked up again, so an entry
+// lives in at most one of the two tiers and the tiers add up to the effective
+// cache capacity.
+
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+#include "rocksdb/cache.h"
+#include "rocksdb/compression_type.h"
+#include "rocksdb/slice.h"
+#include "rocksdb/status.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+class SecondaryCache {
+ public:
+  virtual ~SecondaryCache() {}
+
+  // The type of the SecondaryCache
+  virtual const char* Name() const = 0;
+
+  // Keep a copy of contents, the bytes of an entry the primary cache evicted
+  // (see Cache::CacheItemHelper). The entry may be dropped at any time to
+  // make room for others.
+  virtual Status Insert(const Slice& key, const Slice& contents) = 0;
+
+  // If the tier has an entry for key, remove it and return its contents in
+  // *contents and *size. Returns NotFound otherwise.
+  virtual Status Take(const Slice& key, std::unique_ptr<char[]>* contents,
+                      size_t* size) = 0;
+
+  // If the tier has an entry for key, drop it.
+  virtual void Erase(const Slice& key) = 0;
+
+  // returns the maximum configured capacity of the tier
+  virtual size_t GetCapacity() const = 0;
+
+  // returns the memory size for the entries residing in the tier
+  virtual size_t GetUsage() const = 0;
+
+  virtual std::string GetPrintableOptions() const { return ""; }
+};
+
+struct CompressedSecondaryCacheOptions {
+  // Capacity of the tier, charged with the compressed size of its entries.
+  size_t capacity = 0;
+
+  // The tier is sharded into 2^num_shard_bits shards by hash of key, see
+  // NewLRUCache.
+  int num_shard_bits = -1;
+
+  // How entries are compressed. An entry that does not compress is kept as
+  // is, and kNoCompression keeps every entry as is.
+  CompressionType compression_type = kLZ4Compression;
+
+  // If non-zero, the first entries the tier receives are sampled into a
+  // dictionary of up to max_dict_bytes, which every later entry is
+  // compressed with. Blocks of the same table share most of their bytes, so
+  // a dictionary pays off for small blocks. It is trained with ZSTD's
+  // trainer for kZSTD if the library supports it, and is the raw samples
+  // otherwise.
+  uint32_t max_dict_bytes = 0;
+
+  CacheMetadataChargePolicy metadata_charge_policy =
+      kDefaultCacheMetadataChargePolicy;
+
+  CompressedSecondaryCacheOptions() {}
+  CompressedSecondaryCacheOptions(
+      size_t _capacity, int _num_shard_bits,
+      CompressionType _compression_type = kLZ4Compression,
+      uint32_t _max_dict_bytes = 0,
+      CacheMetadataChargePolicy _metadata_charge_policy =
+          kDefaultCacheMetadataChargePolicy)
+      : capacity(_capacity),
+        num_shard_bits(_num_shard_bits),
+        compression_type(_compression_type),
+        max_dict_bytes(_max_dict_bytes),
+        metadata_charge_policy(_metadata_charge_policy) {}
+};
+
+// Create a secondary tier that keeps its entries compressed. Return nullptr
+// if the compression type is not supported in this build.
+extern std::shared_ptr<SecondaryCache> NewCompressedSecondaryCache(
+    const CompressedSecondaryCacheOptions& opts);
+
+}  // namespace ROCKSDB_NAMESPACE
@@ -212,6 +212,13 @@ struct BlockBasedTableOptions {
   enum DataBlockIndexType : char {
     kDataBlockBinarySearch = 0,   // traditional block type
     kDataBlockBinaryAndHash = 1,  // additional hash index
+    // Additional array of fixed-width user key prefixes, so that a seek can
+    // find its entry in a restart interval without comparing every key
+    // before it (with SIMD where available). It takes 4 bytes per key and
+    // is only used with BytewiseComparator and for blocks up to 64KiB; other
+    // blocks use kDataBlockBinarySearch. Older versions cannot read blocks
+    // with the array.
+    kDataBlockBinaryAndPrefix = 2,
   };
 
   DataBlockIndexType data_block_index_type = kDataBlockBinarySearch;
@@ -6371,6 +6371,9 @@ class DataBlockIndexTypeJni {
       case ROCKSDB_NAMESPACE::BlockBasedTableOptions::DataBlockIndexType::
           kDataBlockBinaryAndHash:
         return 0x1;
+      case ROCKSDB_NAMESPACE::BlockBasedTableOptions::DataBlockIndexType::
+          kDataBlockBinaryAndPrefix:
+        return 0x2;
       default:
         return 0x7F;  // undefined
     }
@@ -6387,6 +6390,9 @@ class DataBlockIndexTypeJni {
       case 0x1:
         return ROCKSDB_NAMESPACE::BlockBasedTableOptions::DataBlockIndexType::
             kDataBlockBinaryAndHash;
+      case 0x2:
+        return ROCKSDB_NAMESPACE::BlockBasedTableOptions::DataBlockIndexType::
+            kDataBlockBinaryAndPrefix;
       default:
         // undefined/default
         return ROCKSDB_NAMESPACE::BlockBasedTableOptions::DataBlockIndexType::
@@ -18,7 +18,12 @@ public enum DataBlockIndexType {
   /**
    * additional hash index
    */
-  kDataBlockBinaryAndHash((byte)0x1);
+  kDataBlockBinaryAndHash((byte)0x1),
+
+  /**
+   * additional array of fixed-width user key prefixes
+   */
+  kDataBlockBinaryAndPrefix((byte)0x2);
 
   private final byte value;
 
@@ -0,0 +1,809 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+//
+// AdaptiveRadixTree is an adaptive radix tree (ART, Leis et al., "The
+// Adaptive Radix Tree: ARTful Indexing for Main-Memory Databases") over the
+// entries of a memtable, ordered like InternalKeyComparator orders them
+// with BytewiseComparator. An inner node has 4, 16, 48 or 256 child slots,
+// and is replaced by the next size once full, so a node costs about as much
+// as the children it has. Paths where keys do not branch are compressed
+// into the prefix of the next node.
+//
+// Like InlineSkipList, the key storage is allocated through the tree: every
+// entry is a leaf, and the leaves are also kept in a doubly linked list in
+// key order. A seek descends the tree to find its leaf, iteration follows
+// the list.
+//
+// Thread safety -------------
+//
+// Writes via Insert require external synchronization, most likely a mutex.
+// InsertConcurrently can be called concurrently with other concurrent
+// inserts, it serializes them on a spin lock. Reads require a guarantee
+// that the tree will not be destroyed while the read is in progress. Apart
+// from that, reads progress without any internal locking or
+// synchronization.
+//
+// Invariants:
+//
+// (1) Allocated nodes and leaves are never deleted until the tree is
+// destroyed. A node that is replaced stays where it is, so a reader that
+// is in it reads a consistent, if older, view of its subtree.
+//
+// (2) A node only changes by appending a child: the child is written, then
+// published with a release-store of the child count (Node4, Node16), of
+// the index entry (Node48) or of the slot itself (Node256). Every other
+// change, growing a full node or splitting a prefix, builds a new node and
+// publishes it with a release-store into the parent's slot. A slot may be
+// overwritten that way at any time, so readers acquire-load every child.
+//
+// (3) A new leaf is published in the tree before it is linked into the
+// list, so a reader may find a leaf in the tree that the list skips. The
+// tree only tells where to start in the list: a seek moves forward from the
+// leaf it found to the first leaf that is not smaller than the target.
+
+#pragma once
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include "memory/allocator.h"
+#include "port/likely.h"
+#include "port/port.h"
+#include "rocksdb/slice.h"
+#include "util/coding.h"
+#include "util/mutexlock.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+class AdaptiveRadixTree {
+ private:
+  struct Leaf;
+  struct Node;
+
+ public:
+  // Create a new tree that will allocate memory using "*allocator".
+  // Objects allocated in the allocator must remain allocated for the
+  // lifetime of the tree object.
+  explicit AdaptiveRadixTree(Allocator* allocator);
+  // No copying allowed
+  AdaptiveRadixTree(const AdaptiveRadixTree&) = delete;
+  AdaptiveRadixTree& operator=(const AdaptiveRadixTree&) = delete;
+
+  // Allocates a key and its leaf, returning a pointer to the key portion
+  // of the leaf. The key is a memtable entry: a length prefixed internal
+  // key, optionally followed by more bytes. This method is thread-safe if
+  // the allocator is thread-safe.
+  char* AllocateKey(size_t key_size);
+
+  // Inserts a key allocated by AllocateKey, after the actual key value has
+  // been filled in. Returns false, leaving the tree as it is, if an entry
+  // with the same internal key is in the tree already.
+  //
+  // REQUIRES: no concurrent calls to any of inserts.
+  bool Insert(const char* key);
+
+  // Like Insert, but external synchronization is not required.
+  bool InsertConcurrently(const char* key);
+
+  // Returns true iff an entry with the same internal key as key is in the
+  // tree.
+  bool Contains(const char* key) const;
+
+  // Iteration over the contents of the tree
+  class Iterator {
+   public:
+    // Initialize an iterator over the specified tree.
+    // The returned iterator is not valid.
+    explicit Iterator(const AdaptiveRadixTree* tree);
+
+    // Change the underlying tree used for this iterator
+    void SetTree(const AdaptiveRadixTree* tree);
+
+    // Returns true iff the iterator is positioned at a valid entry.
+    bool Valid() const;
+
+    // Returns the key at the current position.
+    // REQUIRES: Valid()
+    const char* key() const;
+
+    // Advances to the next position.
+    // REQUIRES: Valid()
+    void Next();
+
+    // Advances to the previous position.
+    // REQUIRES: Valid()
+    void Prev();
+
+    // Advance to the first entry with an internal key >= target
+    void Seek(const Slice& internal_key);
+
+    // Retreat to the last entry with an internal key <= target
+    void SeekForPrev(const Slice& internal_key);
+
+    // Position at the first entry in the tree.
+    // Final state of iterator is Valid() iff the tree is not empty.
+    void SeekToFirst();
+
+    // Position at the last entry in the tree.
+    // Final state of iterator is Valid() iff the tree is not empty.
+    void SeekToLast();
+
+   private:
+    const AdaptiveRadixTree* tree_;
+    Leaf* leaf_;
+  };
+
+ private:
+  enum NodeType : uint8_t {
+    kNode4,
+    kNode16,
+    kNode48,
+    kNode256,
+  };
+
+  // The prefix symbols a node keeps itself, the rest are read from the key
+  // of a leaf below it
+  static const uint32_t kMaxStoredPrefix = 8;
+
+  // An internal key as a string of symbols: every byte of the user key plus
+  // one, then 0 to end the user key, then every byte of the inverted
+  // sequence number and type, most significant first, plus one. Ordering
+  // the strings symbol by symbol orders the keys like InternalKeyComparator
+  // with BytewiseComparator, and no string is a prefix of another, so two
+  // keys in the tree always branch before either of them ends.
+  struct SymbolKey {
+    const char* user_key;
+    uint32_t user_key_size;
+    uint64_t inverted_trailer;
+
+    explicit SymbolKey(const Slice& internal_key);
+
+    uint32_t size() const { return user_key_size + 9; }
+
+    uint16_t Symbol(uint32_t depth) const;
+
+    // Three-way comparison in symbol order
+    int Compare(const SymbolKey& other) const;
+  };
+
+  // The leaves are linked between head_ and tail_, which have no key.
+  // AllocateKey allocates the key right behind its leaf.
+  struct Leaf {
+    std::atomic<Leaf*> next;
+    std::atomic<Leaf*> prev;
+
+    const char* Key() const { return reinterpret_cast<const char*>(this + 1); }
+
+    SymbolKey Decode() const {
+      return SymbolKey(GetLengthPrefixedSlice(Key()));
+    }
+
+    Leaf* Next() const { return next.load(std::memory_order_acquire); }
+
+    Leaf* Prev() const { return prev.load(std::memory_order_acquire); }
+  };
+
+  // A child is a Node* or a Leaf* tagged with kLeafTag, 0 for none
+  typedef uintptr_t Ref;
+  static const Ref kLeafTag = 1;
+
+  static bool IsLeaf(Ref ref) { return (ref & kLeafTag) != 0; }
+  static Leaf* AsLeaf(Ref ref) {
+    return reinterpret_cast<Leaf*>(ref & ~kLeafTag);
+  }
+  static Node* AsNode(Ref ref) { return reinterpret_cast<Node*>(ref); }
+  static Ref LeafRef(Leaf* leaf) {
+    return reinterpret_cast<Ref>(leaf) | kLeafTag;
+  }
+  static Ref NodeRef(Node* node) { return reinterpret_cast<Ref>(node); }
+
+  static Leaf* LeafOf(const char* key) {
+    return reinterpret_cast<Leaf*>(const_cast<char*>(key)) - 1;
+  }
+
+  // Every key below a node has its prefix symbols from the depth of the
+  // node on, the children follow by the next symbol. The child for symbol
+  // 0 is end_child, the others by byte, symbol - 1.
+  struct Node {
+    NodeType type;
+    std::atomic<uint16_t> num_children;
+    uint32_t prefix_size;
+    uint16_t prefix[kMaxStoredPrefix];
+    // Any leaf below, for the prefix symbols beyond prefix[]
+    Leaf* any_leaf;
+    std::atomic<Ref> end_child;
+  };
+
+  // The children are kept in the order they were added
+  struct Node4 : public Node {
+    uint8_t keys[4];
+    std::atomic<Ref> children[4];
+  };
+
+  struct Node16 : public Node {
+    uint8_t keys[16];
+    std::atomic<Ref> children[16];
+  };
+
+  // index[byte] is the slot of the child plus one, 0 for none
+  struct Node48 : public Node {
+    std::atomic<uint8_t> index[256];
+    std::atomic<Ref> children[48];
+  };
+
+  struct Node256 : public Node {
+    std::atomic<Ref> children[256];
+  };
+
+  template <typename T>
+  T* NewZeroed() {
+    char* raw = allocator_->AllocateAligned(sizeof(T));
+    memset(raw, 0, sizeof(T));
+    return new (raw) T;
+  }
+
+  // Allocate an empty node of the type whose prefix is the prefix_size
+  // symbols of the key of any_leaf from depth on
+  Node* NewNode(NodeType type, Leaf* any_leaf, const SymbolKey& any_key,
+                uint32_t depth, uint32_t prefix_size);
+
+  // Allocate a node of the type with the children of node, and the
+  // prefix_size last symbols of its prefix, which starts at depth
+  Node* CopyNode(const Node* node, NodeType type, uint32_t depth,
+                 uint32_t prefix_size);
+
+  // Returns the child of node for the symbol, 0 if there is none
+  static Ref FindChild(const Node* node, uint16_t symbol);
+
+  // Like FindChild, but returns the slot of the child, nullptr if there is
+  // none
+  static std::atomic<Ref>* FindChildSlot(Node* node, uint16_t symbol);
+
+  // Add a child for the symbol, which node does not have. Returns false if
+  // node is full.
+  static bool AddChild(Node* node, uint16_t symbol, Ref child);
+
+  // The child of node for the smallest symbol > symbol, the largest symbol
+  // < symbol if less is set. 0 if there is none. symbol is a byte plus one,
+  // or -1 to start below the end symbol.
+  static Ref NextChild(const Node* node, int symbol, bool less);
+
+  static Ref MinChild(const Node* node) { return NextChild(node, -1, false); }
+  static Ref MaxChild(const Node* node) { return NextChild(node, 257, true); }
+
+  static Leaf* MinLeaf(Ref ref);
+  static Leaf* MaxLeaf(Ref ref);
+
+  // Compare the prefix of node to the symbols of key from depth on. Returns
+  // 0 if they are the same, and sets *mismatch to where they differ
+  // otherwise.
+  static int ComparePrefix(const Node* node, const SymbolKey& key,
+                           uint32_t depth, uint32_t* mismatch);
+
+  // The first leaf in the list whose key is >= key, &tail_ if there is none
+  Leaf* LowerBound(const SymbolKey& key) const;
+
+  // Publish leaf in the tree
+  void InsertIntoTree(Leaf* leaf, const SymbolKey& key);
+
+  Allocator* const allocator_;
+  std::atomic<Ref> root_;
+  // Writes of InsertConcurrently take turns on it
+  SpinMutex insert_mutex_;
+  // Sentinels of the list of leaves. Leaf::Key() is not valid for them.
+  mutable Leaf head_;
+  mutable Leaf tail_;
+};
+
+// Implementation details follow
+
+inline AdaptiveRadixTree::SymbolKey::SymbolKey(const Slice& internal_key) {
+  assert(internal_key.size() >= 8);
+  user_key = internal_key.data();
+  user_key_size = static_cast<uint32_t>(internal_key.size() - 8);
+  inverted_trailer = ~DecodeFixed64(internal_key.data() + user_key_size);
+}
+
+inline uint16_t AdaptiveRadixTree::SymbolKey::Symbol(uint32_t depth) const {
+  assert(depth < size());
+  if (depth < user_key_size) {
+    return static_cast<uint16_t>(static_cast<uint8_t>(user_key[depth]) + 1);
+  }
+  if (depth == user_key_size) {
+    return 0;
+  }
+  uint32_t shift = 8 * (user_key_size + 8 - depth);
+  return static_cast<uint16_t>(((inverted_trailer >> shift) & 0xff) + 1);
+}
+
+inline int AdaptiveRadixTree::SymbolKey::Compare(
+    const SymbolKey& other) const {
+  int r = Slice(user_key, user_key_size)
+              .compare(Slice(other.user_key, other.user_key_size));
+  if (r != 0) {
+    return r;
+  }
+  if (inverted_trailer < other.inverted_trailer) {
+    return -1;
+  }
+  return inverted_trailer > other.inverted_trailer ? 1 : 0;
+}
+
+inline AdaptiveRadixTree::AdaptiveRadixTree(Allocator* allocator)
+    : allocator_(allocator), root_(0) {
+  head_.next.store(&tail_, std::memory_order_relaxed);
+  head_.prev.store(nullptr, std::memory_order_relaxed);
+  tail_.next.store(nullptr, std::memory_order_relaxed);
+  tail_.prev.store(&head_, std::memory_order_relaxed);
+}
+
+inline char* AdaptiveRadixTree::AllocateKey(size_t key_size) {
+  char* raw = allocator_->AllocateAligned(sizeof(Leaf) + key_size);
+  Leaf* leaf = new (raw) Leaf;
+  return const_cast<char*>(leaf->Key());
+}
+
+inline bool AdaptiveRadixTree::Insert(const char* key) {
+  Leaf* leaf = LeafOf(key);
+  SymbolKey k = leaf->Decode();
+  Leaf* next = LowerBound(k);
+  if (next != &tail_ && next->Decode().Compare(k) == 0) {
+    return false;
+  }
+  Leaf* prev = next->prev.load(std::memory_order_relaxed);
+  leaf->next.store(next, std::memory_order_relaxed);
+  leaf->prev.store(prev, std::memory_order_relaxed);
+  InsertIntoTree(leaf, k);
+  prev->next.store(leaf, std::memory_order_release);
+  next->prev.store(leaf, std::memory_order_release);
+  return true;
+}
+
+inline bool AdaptiveRadixTree::InsertConcurrently(const char* key) {
+  std::lock_guard<SpinMutex> l(insert_mutex_);
+  return Insert(key);
+}
+
+inline bool AdaptiveRadixTree::Contains(const char* key) const {
+  SymbolKey k(GetLengthPrefixedSlice(key));
+  Leaf* leaf = LowerBound(k);
+  return leaf != &tail_ && leaf->Decode().Compare(k) == 0;
+}
+
+inline AdaptiveRadixTree::Node* AdaptiveRadixTree::NewNode(
+    NodeType type, Leaf* any_leaf, const SymbolKey& any_key, uint32_t depth,
+    uint32_t prefix_size) {
+  // Every child slot and index entry starts out 0
+  Node* node;
+  switch (type) {
+    case kNode4:
+      node = NewZeroed<Node4>();
+      break;
+    case kNode16:
+      node = NewZeroed<Node16>();
+      break;
+    case kNode48:
+      node = NewZeroed<Node48>();
+      break;
+    default:
+      node = NewZeroed<Node256>();
+      break;
+  }
+  node->type = type;
+  node->prefix_size = prefix_size;
+  for (uint32_t i = 0; i < prefix_size && i < kMaxStoredPrefix; i++) {
+    node->prefix[i] = any_key.Symbol(depth + i);
+  }
+  node->any_leaf = any_leaf;
+  return node;
+}
+
+inline AdaptiveRadixTree::Node* AdaptiveRadixTree::CopyNode(
+    const Node* node, NodeType type, uint32_t depth, uint32_t prefix_size) {
+  Node* copy = NewNode(type, node->any_leaf, node->any_leaf->Decode(), depth,
+                       prefix_size);
+  for (uint16_t symbol = 0; symbol <= 256; symbol++) {
+    Ref child = FindChild(node, symbol);
+    if (child != 0) {
+      bool added = AddChild(copy, symbol, child);
+      assert(added);
+      (void)added;
+    }
+  }
+  return copy;
+}
+
+inline AdaptiveRadixTree::Ref AdaptiveRadixTree::FindChild(const Node* node,
+                                                           uint16_t symbol) {
+  if (symbol == 0) {
+    return node->end_child.load(std::memory_order_acquire);
+  }
+  const uint8_t byte = static_cast<uint8_t>(symbol - 1);
+  switch (node->type) {
+    case kNode4: {
+      const Node4* n = static_cast<const Node4*>(node);
+      uint16_t count = n->num_children.load(std::memory_order_acquire);
+      for (uint16_t i = 0; i < count; i++) {
+        if (n->keys[i] == byte) {
+          return n->children[i].load(std::memory_order_acquire);
+        }
+      }
+      return 0;
+    }
+    case kNode16: {
+      const Node16* n = static_cast<const Node16*>(node);
+      uint16_t count = n->num_children.load(std::memory_order_acquire);
+      for (uint16_t i = 0; i < count; i++) {
+        if (n->keys[i] == byte) {
+          return n->children[i].load(std::memory_order_acquire);
+        }
+      }
+      return 0;
+    }
+    case kNode48: {
+      const Node48* n = static_cast<const Node48*>(node);
+      uint8_t slot = n->index[byte].load(std::memory_order_acquire);
+      return slot == 0 ? 0
+                       : n->children[slot - 1].load(std::memory_order_acquire);
+    }
+    default:
+      return static_cast<const Node256*>(node)->children[byte].load(
+          std::memory_order_acquire);
+  }
+}
+
+inline std::atomic<AdaptiveRadixTree::Ref>* AdaptiveRadixTree::FindChildSlot(
+    Node* node, uint16_t symbol) {
+  std::atomic<Ref>* slot = nullptr;
+  if (symbol == 0) {
+    slot = &node->end_child;
+  } else {
+    const uint8_t byte = static_cast<uint8_t>(symbol - 1);
+    switch (node->type) {
+      case kNode4: {
+        Node4* n = static_cast<Node4*>(node);
+        uint16_t count = n->num_children.load(std::memory_order_relaxed);
+        for (uint16_t i = 0; i < count && slot == nullptr; i++) {
+          if (n->keys[i] == byte) {
+            slot = &n->children[i];
+          }
+        }
+        break;
+      }
+      case kNode16: {
+        Node16* n = static_cast<Node16*>(node);
+        uint16_t count = n->num_children.load(std::memory_order_relaxed);
+        for (uint16_t i = 0; i < count && slot == nullptr; i++) {
+          if (n->keys[i] == byte) {
+            slot = &n->children[i];
+          }
+        }
+        break;
+      }
+      case kNode48: {
+        Node48* n = static_cast<Node48*>(node);
+        uint8_t index = n->index[byte].load(std::memory_order_relaxed);
+        if (index != 0) {
+          slot = &n->children[index - 1];
+        }
+        break;
+      }
+      default:
+        slot = &static_cast<Node256*>(node)->children[byte];
+        break;
+    }
+  }
+  if (slot != nullptr && slot->load(std::memory_order_relaxed) == 0) {
+    return nullptr;
+  }
+  return slot;
+}
+
+inline bool AdaptiveRadixTree::AddChild(Node* node, uint16_t symbol,
+                                        Ref child) {
+  if (symbol == 0) {
+    assert(node->end_child.load(std::memory_order_relaxed) == 0);
+    node->end_child.store(child, std::memory_order_release);
+    return true;
+  }
+  const uint8_t byte = static_cast<uint8_t>(symbol - 1);
+  uint16_t count = node->num_children.load(std::memory_order_relaxed);
+  switch (node->type) {
+    case kNode4: {
+      Node4* n = static_cast<Node4*>(node);
+      if (count == 4) {
+        return false;
+      }
+      n->keys[count] = byte;
+      n->children[count].store(child, std::memory_order_relaxed);
+      break;
+    }
+    case kNode16: {
+      Node16* n = static_cast<Node16*>(node);
+      if (count == 16) {
+        return false;
+      }
+      n->keys[count] = byte;
+      n->children[count].store(child, std::memory_order_relaxed);
+      break;
+    }
+    case kNode48: {
+      Node48* n = static_cast<Node48*>(node);
+      if (count == 48) {
+        return false;
+      }
+      n->children[count].store(child, std::memory_order_relaxed);
+      n->index[byte].store(static_cast<uint8_t>(count + 1),
+                           std::memory_order_release);
+      break;
+    }
+    default:
+      static_cast<Node256*>(node)->children[byte].store(
+          child, std::memory_order_release);
+      break;
+  }
+  node->num_children.store(static_cast<uint16_t>(count + 1),
+                           std::memory_order_release);
+  return true;
+}
+
+inline AdaptiveRadixTree::Ref AdaptiveRadixTree::NextChild(const Node* node,
+                                                           int symbol,
+                                                           bool less) {
+  Ref best = 0;
+  int best_symbol = less ? -1 : 257;
+  if (!less && symbol < 0) {
+    best = node->end_child.load(std::memory_order_acquire);
+    if (best != 0) {
+      return best;
+    }
+  }
+  switch (node->type) {
+    case kNode4:
+    case kNode16: {
+      const uint8_t* keys = node->type == kNode4
+                                ? static_cast<const Node4*>(node)->keys
+                                : static_cast<const Node16*>(node)->keys;
+      const std::atomic<Ref>* children =
+          node->type == kNode4 ? static_cast<const Node4*>(node)->children
+                               : static_cast<const Node16*>(node)->children;
+      uint16_t count = node->num_children.load(std::memory_order_acquire);
+      for (uint16_t i = 0; i < count; i++) {
+        int s = keys[i] + 1;
+        if (less ? (s < symbol && s > best_symbol)
+                 : (s > symbol && s < best_symbol)) {
+          best_symbol = s;
+          best = children[i].load(std::memory_order_acquire);
+        }
+      }
+      break;
+    }
+    case kNode48: {
+      const Node48* n = static_cast<const Node48*>(node);
+      const int step = less ? -1 : 1;
+      for (int s = less ? symbol - 1 : std::max(symbol + 1, 1);
+           s >= 1 && s <= 256; s += step) {
+        uint8_t slot = n->index[s - 1].load(std::memory_order_acquire);
+        if (slot != 0) {
+          best_symbol = s;
+          best = n->children[slot - 1].load(std::memory_order_acquire);
+          break;
+        }
+      }
+      break;
+    }
+    default: {
+      const Node256* n = static_cast<const Node256*>(node);
+      const int step = less ? -1 : 1;
+      for (int s = less ? symbol - 1 : std::max(symbol + 1, 1);
+           s >= 1 && s <= 256; s += step) {
+        Ref child = n->children[s - 1].load(std::memory_order_acquire);
+        if (child != 0) {
+          best_symbol = s;
+          best = child;
+          break;
+        }
+      }
+      break;
+    }
+  }
+  if (best == 0 && less && symbol > 0) {
+    best = node->end_child.load(std::memory_order_acquire);
+  }
+  return best;
+}
+
+inline AdaptiveRadixTree::Leaf* AdaptiveRadixTree::MinLeaf(Ref ref) {
+  while (!IsLeaf(ref)) {
+    ref = MinChild(AsNode(ref));
+  }
+  return AsLeaf(ref);
+}
+
+inline AdaptiveRadixTree::Leaf* AdaptiveRadixTree::MaxLeaf(Ref ref) {
+  while (!IsLeaf(ref)) {
+    ref = MaxChild(AsNode(ref));
+  }
+  return AsLeaf(ref);
+}
+
+inline int AdaptiveRadixTree::ComparePrefix(const Node* node,
+                                            const SymbolKey& key,
+                                            uint32_t depth,
+                                            uint32_t* mismatch) {
+  for (uint32_t i = 0; i < node->prefix_size; i++) {
+    uint16_t symbol;
+    if (LIKELY(i < kMaxStoredPrefix)) {
+      symbol = node->prefix[i];
+    } else {
+      symbol = node->any_leaf->Decode().Symbol(depth + i);
+    }
+    uint16_t other = key.Symbol(depth + i);
+    if (symbol != other) {
+      *mismatch = i;
+      return symbol < other ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+inline AdaptiveRadixTree::Leaf* AdaptiveRadixTree::LowerBound(
+    const SymbolKey& key) const {
+  Leaf* result = nullptr;
+  Ref ref = root_.load(std::memory_order_acquire);
+  uint32_t depth = 0;
+  if (ref == 0) {
+    result = head_.Next();
+  }
+  while (result == nullptr) {
+    if (IsLeaf(ref)) {
+      Leaf* leaf = AsLeaf(ref);
+      result = leaf->Decode().Compare(key) >= 0 ? leaf : leaf->Next();
+      break;
+    }
+    const Node* node = AsNode(ref);
+    uint32_t mismatch;
+    int cmp = ComparePrefix(node, key, depth, &mismatch);
+    if (cmp < 0) {
+      // All of the subtree is smaller than key
+      result = MaxLeaf(ref)->Next();
+      break;
+    } else if (cmp > 0) {
+      result = MinLeaf(ref);
+      break;
+    }
+    depth += node->prefix_size;
+    uint16_t symbol = key.Symbol(depth);
+    Ref child = FindChild(node, symbol);
+    if (child != 0) {
+      ref = child;
+      depth++;
+      continue;
+    }
+    Ref greater = NextChild(node, symbol, false);
+    if (greater != 0) {
+      result = MinLeaf(greater);
+    } else {
+      result = MaxLeaf(NextChild(node, symbol, true))->Next();
+    }
+  }
+  // The tree may have led to a leaf the list does not have yet, or have
+  // missed leaves linked since, see invariant (3)
+  while (result != &tail_ && result->Decode().Compare(key) < 0) {
+    result = result->Next();
+  }
+  return result;
+}
+
+inline void AdaptiveRadixTree::InsertIntoTree(Leaf* leaf,
+                                              const SymbolKey& key) {
+  const Ref leaf_ref = LeafRef(leaf);
+  std::atomic<Ref>* slot = &root_;
+  uint32_t depth = 0;
+  while (true) {
+    Ref ref = slot->load(std::memory_order_relaxed);
+    if (ref == 0) {
+      slot->store(leaf_ref, std::memory_order_release);
+      return;
+    }
+    if (IsLeaf(ref)) {
+      // Replace the leaf with a node for both keys from where they branch
+      Leaf* other = AsLeaf(ref);
+      SymbolKey other_key = other->Decode();
+      uint32_t branch = depth;
+      while (other_key.Symbol(branch) == key.Symbol(branch)) {
+        branch++;
+      }
+      Node* node = NewNode(kNode4, other, other_key, depth, branch - depth);
+      AddChild(node, other_key.Symbol(branch), ref);
+      AddChild(node, key.Symbol(branch), leaf_ref);
+      slot->store(NodeRef(node), std::memory_order_release);
+      return;
+    }
+    Node* node = AsNode(ref);
+    uint32_t mismatch;
+    if (ComparePrefix(node, key, depth, &mismatch) != 0) {
+      // Split the prefix: a new node for the symbols before the mismatch
+      // gets the key and a copy of node with the rest of the prefix
+      SymbolKey node_key = node->any_leaf->Decode();
+      Node* parent = NewNode(kNode4, node->any_leaf, node_key, depth, mismatch);
+      Node* rest = CopyNode(node, node->type, depth + mismatch + 1,
+                            node->prefix_size - mismatch - 1);
+      AddChild(parent, node_key.Symbol(depth + mismatch), NodeRef(rest));
+      AddChild(parent, key.Symbol(depth + mismatch), leaf_ref);
+      slot->store(NodeRef(parent), std::memory_order_release);
+      return;
+    }
+    depth += node->prefix_size;
+    uint16_t symbol = key.Symbol(depth);
+    std::atomic<Ref>* child = FindChildSlot(node, symbol);
+    if (child != nullptr) {
+      slot = child;
+      depth++;
+      continue;
+    }
+    if (!AddChild(node, symbol, leaf_ref)) {
+      // Full, the next size takes its place
+      Node* bigger = CopyNode(node, static_cast<NodeType>(node->type + 1),
+                              depth - node->prefix_size, node->prefix_size);
+      AddChild(bigger, symbol, leaf_ref);
+      slot->store(NodeRef(bigger), std::memory_order_release);
+    }
+    return;
+  }
+}
+
+inline AdaptiveRadixTree::Iterator::Iterator(const AdaptiveRadixTree* tree) {
+  SetTree(tree);
+}
+
+inline void AdaptiveRadixTree::Iterator::SetTree(
+    const AdaptiveRadixTree* tree) {
+  tree_ = tree;
+  leaf_ = nullptr;
+}
+
+inline bool AdaptiveRadixTree::Iterator::Valid() const {
+  return leaf_ != nullptr && leaf_ != &tree_->head_ && leaf_ != &tree_->tail_;
+}
+
+inline const char* AdaptiveRadixTree::Iterator::key() const {
+  assert(Valid());
+  return leaf_->Key();
+}
+
+inline void AdaptiveRadixTree::Iterator::Next() {
+  assert(Valid());
+  leaf_ = leaf_->Next();
+}
+
+inline void AdaptiveRadixTree::Iterator::Prev() {
+  assert(Valid());
+  leaf_ = leaf_->Prev();
+}
+
+inline void AdaptiveRadixTree::Iterator::Seek(const Slice& internal_key) {
+  leaf_ = tree_->LowerBound(SymbolKey(internal_key));
+}
+
+inline void AdaptiveRadixTree::Iterator::SeekForPrev(
+    const Slice& internal_key) {
+  SymbolKey target(internal_key);
+  leaf_ = tree_->LowerBound(target);
+  if (leaf_ == &tree_->tail_ || leaf_->Decode().Compare(target) > 0) {
+    leaf_ = leaf_->Prev();
+  }
+}
+
+inline void AdaptiveRadixTree::Iterator::SeekToFirst() {
+  leaf_ = tree_->head_.Next();
+}
+
+inline void AdaptiveRadixTree::Iterator::SeekToLast() {
+  leaf_ = tree_->tail_.Prev();
+}
+
+}  // namespace ROCKSDB_NAMESPACE
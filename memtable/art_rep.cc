@@ -0,0 +1,143 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+//
+#include "db/memtable.h"
+#include "logging/logging.h"
+#include "memory/arena.h"
+#include "memtable/art.h"
+#include "rocksdb/comparator.h"
+#include "rocksdb/memtablerep.h"
+
+namespace ROCKSDB_NAMESPACE {
+namespace {
+class ARTRep : public MemTableRep {
+  AdaptiveRadixTree tree_;
+
+ public:
+  explicit ARTRep(Allocator* allocator)
+      : MemTableRep(allocator), tree_(allocator) {}
+
+  KeyHandle Allocate(const size_t len, char** buf) override {
+    *buf = tree_.AllocateKey(len);
+    return static_cast<KeyHandle>(*buf);
+  }
+
+  // Insert key into the tree.
+  // REQUIRES: nothing that compares equal to key is currently in the tree.
+  void Insert(KeyHandle handle) override {
+    tree_.Insert(static_cast<char*>(handle));
+  }
+
+  bool InsertKey(KeyHandle handle) override {
+    return tree_.Insert(static_cast<char*>(handle));
+  }
+
+  void InsertConcurrently(KeyHandle handle) override {
+    tree_.InsertConcurrently(static_cast<char*>(handle));
+  }
+
+  bool InsertKeyConcurrently(KeyHandle handle) override {
+    return tree_.InsertConcurrently(static_cast<char*>(handle));
+  }
+
+  // Returns true iff an entry that compares equal to key is in the tree.
+  bool Contains(const char* key) const override { return tree_.Contains(key); }
+
+  size_t ApproximateMemoryUsage() override {
+    // All memory is allocated through allocator; nothing to report here
+    return 0;
+  }
+
+  void Get(const LookupKey& k, void* callback_args,
+           bool (*callback_func)(void* arg, const char* entry)) override {
+    AdaptiveRadixTree::Iterator iter(&tree_);
+    for (iter.Seek(k.internal_key());
+         iter.Valid() && callback_func(callback_args, iter.key());
+         iter.Next()) {
+    }
+  }
+
+  ~ARTRep() override {}
+
+  // Iteration over the contents of the tree
+  class Iterator : public MemTableRep::Iterator {
+    AdaptiveRadixTree::Iterator iter_;
+
+   public:
+    // Initialize an iterator over the specified tree.
+    // The returned iterator is not valid.
+    explicit Iterator(const AdaptiveRadixTree* tree) : iter_(tree) {}
+
+    ~Iterator() override {}
+
+    // Returns true iff the iterator is positioned at a valid node.
+    bool Valid() const override { return iter_.Valid(); }
+
+    // Returns the key at the current position.
+    // REQUIRES: Valid()
+    const char* key() const override { return iter_.key(); }
+
+    // Advances to the next position.
+    // REQUIRES: Valid()
+    void Next() override { iter_.Next(); }
+
+    // Advances to the previous position.
+    // REQUIRES: Valid()
+    void Prev() override { iter_.Prev(); }
+
+    // Advance to the first entry with a key >= target
+    void Seek(const Slice& internal_key, const char* memtable_key) override {
+      if (memtable_key != nullptr) {
+        iter_.Seek(GetLengthPrefixedSlice(memtable_key));
+      } else {
+        iter_.Seek(internal_key);
+      }
+    }
+
+    // Retreat to the last entry with a key <= target
+    void SeekForPrev(const Slice& internal_key,
+                     const char* memtable_key) override {
+      if (memtable_key != nullptr) {
+        iter_.SeekForPrev(GetLengthPrefixedSlice(memtable_key));
+      } else {
+        iter_.SeekForPrev(internal_key);
+      }
+    }
+
+    // Position at the first entry in the tree.
+    // Final state of iterator is Valid() iff the tree is not empty.
+    void SeekToFirst() override { iter_.SeekToFirst(); }
+
+    // Position at the last entry in the tree.
+    // Final state of iterator is Valid() iff the tree is not empty.
+    void SeekToLast() override { iter_.SeekToLast(); }
+  };
+
+  MemTableRep::Iterator* GetIterator(Arena* arena = nullptr) override {
+    void* mem = arena ? arena->AllocateAligned(sizeof(ARTRep::Iterator))
+                      : operator new(sizeof(ARTRep::Iterator));
+    return new (mem) ARTRep::Iterator(&tree_);
+  }
+};
+}  // namespace
+
+MemTableRep* ARTRepFactory::CreateMemTableRep(
+    const MemTableRep::KeyComparator& compare, Allocator* allocator,
+    const SliceTransform* transform, Logger* logger) {
+  // The tree orders the keys by their bytes, which is only the order of
+  // the memtable with BytewiseComparator
+  const Comparator* ucmp = compare.user_comparator();
+  if (ucmp != BytewiseComparator() || ucmp->timestamp_size() != 0) {
+    ROCKS_LOG_WARN(logger,
+                   "ARTRepFactory does not support comparator %s, "
+                   "using a skip list instead",
+                   ucmp != nullptr ? ucmp->Name() : "(none)");
+    return SkipListFactory().CreateMemTableRep(compare, allocator, transform,
+                                               logger);
+  }
+  return new ARTRep(allocator);
+}
+
+}  // namespace ROCKSDB_NAMESPACE
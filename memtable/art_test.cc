@@ -0,0 +1,308 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "memtable/art.h"
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "db/dbformat.h"
+#include "memory/concurrent_arena.h"
+#include "rocksdb/memtablerep.h"
+#include "test_util/testharness.h"
+#include "util/random.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+namespace {
+struct EntryLess {
+  InternalKeyComparator icmp{BytewiseComparator()};
+
+  bool operator()(const std::string& a, const std::string& b) const {
+    return icmp.Compare(a, b) < 0;
+  }
+};
+
+typedef std::set<std::string, EntryLess> EntrySet;
+
+// User keys that share long prefixes, are prefixes of each other and use
+// the smallest and largest bytes. The short ones branch on any byte, so
+// that nodes of every size are needed.
+std::string RandomUserKey(Random* rnd) {
+  static const char* kPrefixes[] = {"", "a", "abcdefghijklmnop",
+                                    "abcdefghijklmnoq", "\xff\xff"};
+  static const char kBytes[] = {'\0', 'a', 'b', '\xff'};
+  std::string key = kPrefixes[rnd->Uniform(5)];
+  if (rnd->OneIn(4)) {
+    int len = 1 + rnd->Uniform(2);
+    for (int i = 0; i < len; i++) {
+      key.push_back(static_cast<char>(rnd->Uniform(256)));
+    }
+    return key;
+  }
+  int len = rnd->Uniform(12);
+  for (int i = 0; i < len; i++) {
+    key.push_back(kBytes[rnd->Uniform(4)]);
+  }
+  return key;
+}
+
+std::string RandomInternalKey(Random* rnd) {
+  return InternalKey(RandomUserKey(rnd), rnd->Uniform(1000),
+                     rnd->OneIn(2) ? kTypeValue : kTypeDeletion)
+      .Encode()
+      .ToString();
+}
+
+Slice InternalKeyOf(const char* entry) { return GetLengthPrefixedSlice(entry); }
+
+struct TestKeyComparator : public MemTableRep::KeyComparator {
+  const InternalKeyComparator icmp;
+
+  explicit TestKeyComparator(const Comparator* ucmp) : icmp(ucmp) {}
+
+  int operator()(const char* a, const char* b) const override {
+    return icmp.Compare(InternalKeyOf(a), InternalKeyOf(b));
+  }
+
+  int operator()(const char* a, const Slice& b) const override {
+    return icmp.Compare(InternalKeyOf(a), b);
+  }
+
+  const Comparator* user_comparator() const override {
+    return icmp.user_comparator();
+  }
+};
+}  // namespace
+
+class ARTTest : public testing::Test {
+ public:
+  ARTTest() : tree_(&arena_) {}
+
+  bool Insert(const std::string& ikey, bool concurrently = false) {
+    uint32_t len = static_cast<uint32_t>(ikey.size());
+    char* buf = tree_.AllocateKey(VarintLength(len) + len);
+    char* p = EncodeVarint32(buf, len);
+    memcpy(p, ikey.data(), len);
+    return concurrently ? tree_.InsertConcurrently(buf) : tree_.Insert(buf);
+  }
+
+  bool Contains(const std::string& ikey) {
+    std::string entry;
+    PutLengthPrefixedSlice(&entry, ikey);
+    return tree_.Contains(entry.data());
+  }
+
+  void Validate(const EntrySet& keys) {
+    for (const std::string& key : keys) {
+      ASSERT_TRUE(Contains(key));
+    }
+    AdaptiveRadixTree::Iterator iter(&tree_);
+    ASSERT_FALSE(iter.Valid());
+    iter.SeekToFirst();
+    for (const std::string& key : keys) {
+      ASSERT_TRUE(iter.Valid());
+      ASSERT_EQ(key, InternalKeyOf(iter.key()).ToString());
+      iter.Next();
+    }
+    ASSERT_FALSE(iter.Valid());
+    iter.SeekToLast();
+    for (auto it = keys.rbegin(); it != keys.rend(); ++it) {
+      ASSERT_TRUE(iter.Valid());
+      ASSERT_EQ(*it, InternalKeyOf(iter.key()).ToString());
+      iter.Prev();
+    }
+    ASSERT_FALSE(iter.Valid());
+  }
+
+ protected:
+  ConcurrentArena arena_;
+  AdaptiveRadixTree tree_;
+};
+
+TEST_F(ARTTest, Empty) {
+  std::string key = InternalKey("foo", 100, kTypeValue).Encode().ToString();
+  ASSERT_FALSE(Contains(key));
+
+  AdaptiveRadixTree::Iterator iter(&tree_);
+  ASSERT_FALSE(iter.Valid());
+  iter.SeekToFirst();
+  ASSERT_FALSE(iter.Valid());
+  iter.Seek(key);
+  ASSERT_FALSE(iter.Valid());
+  iter.SeekForPrev(key);
+  ASSERT_FALSE(iter.Valid());
+  iter.SeekToLast();
+  ASSERT_FALSE(iter.Valid());
+}
+
+TEST_F(ARTTest, InsertAndLookup) {
+  const int N = 5000;
+  Random rnd(301);
+  EntrySet keys;
+  for (int i = 0; i < N; i++) {
+    std::string key = RandomInternalKey(&rnd);
+    ASSERT_EQ(keys.insert(key).second, Insert(key));
+  }
+  Validate(keys);
+
+  for (int i = 0; i < N; i++) {
+    std::string target = RandomInternalKey(&rnd);
+    ASSERT_EQ(keys.count(target) > 0, Contains(target));
+
+    AdaptiveRadixTree::Iterator iter(&tree_);
+    iter.Seek(target);
+    auto lower = keys.lower_bound(target);
+    if (lower == keys.end()) {
+      ASSERT_FALSE(iter.Valid());
+    } else {
+      ASSERT_TRUE(iter.Valid());
+      ASSERT_EQ(*lower, InternalKeyOf(iter.key()).ToString());
+    }
+
+    iter.SeekForPrev(target);
+    auto upper = keys.upper_bound(target);
+    if (upper == keys.begin()) {
+      ASSERT_FALSE(iter.Valid());
+    } else {
+      ASSERT_TRUE(iter.Valid());
+      ASSERT_EQ(*std::prev(upper), InternalKeyOf(iter.key()).ToString());
+    }
+  }
+}
+
+TEST_F(ARTTest, SameUserKey) {
+  // The versions of a user key are ordered by sequence number, newest first
+  EntrySet keys;
+  for (SequenceNumber seq : {5, 300, 1, 70000, 256, 255}) {
+    std::string key = InternalKey("key", seq, kTypeValue).Encode().ToString();
+    keys.insert(key);
+    ASSERT_TRUE(Insert(key));
+  }
+  for (const std::string& user_key :
+       {std::string("ke"), std::string("key\0", 4)}) {
+    std::string key = InternalKey(user_key, 3, kTypeValue).Encode().ToString();
+    keys.insert(key);
+    ASSERT_TRUE(Insert(key));
+  }
+  Validate(keys);
+
+  AdaptiveRadixTree::Iterator iter(&tree_);
+  LookupKey lookup("key", 280);
+  iter.Seek(lookup.internal_key());
+  ASSERT_TRUE(iter.Valid());
+  ParsedInternalKey parsed;
+  ASSERT_OK(ParseInternalKey(InternalKeyOf(iter.key()), &parsed));
+  ASSERT_EQ("key", parsed.user_key.ToString());
+  ASSERT_EQ(256U, parsed.sequence);
+}
+
+TEST_F(ARTTest, Duplicates) {
+  Random rnd(301);
+  EntrySet keys;
+  for (int i = 0; i < 1000; i++) {
+    std::string key = RandomInternalKey(&rnd);
+    keys.insert(key);
+    Insert(key);
+  }
+  for (const std::string& key : keys) {
+    ASSERT_FALSE(Insert(key));
+  }
+  Validate(keys);
+}
+
+TEST_F(ARTTest, ConcurrentInsert) {
+  const int kThreads = 4;
+  const int kPerThread = 2000;
+  std::vector<EntrySet> thread_keys(kThreads);
+  for (int t = 0; t < kThreads; t++) {
+    Random rnd(301 + t);
+    for (int i = 0; i < kPerThread; i++) {
+      // Every thread inserts its own sequence numbers
+      thread_keys[t].insert(
+          InternalKey(RandomUserKey(&rnd), i * kThreads + t, kTypeValue)
+              .Encode()
+              .ToString());
+    }
+  }
+
+  std::atomic<bool> done{false};
+  std::thread reader([&] {
+    // What a reader sees is in order at any time
+    EntryLess less;
+    Random rnd(1000);
+    while (!done.load()) {
+      AdaptiveRadixTree::Iterator iter(&tree_);
+      std::string last;
+      for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+        std::string key = InternalKeyOf(iter.key()).ToString();
+        ASSERT_TRUE(last.empty() || less(last, key));
+        last = key;
+      }
+      for (int i = 0; i < 100; i++) {
+        std::string target = RandomInternalKey(&rnd);
+        iter.Seek(target);
+        ASSERT_TRUE(!iter.Valid() ||
+                    !less(InternalKeyOf(iter.key()).ToString(), target));
+      }
+    }
+  });
+  std::vector<std::thread> writers;
+  for (int t = 0; t < kThreads; t++) {
+    writers.emplace_back([&, t] {
+      for (const std::string& key : thread_keys[t]) {
+        ASSERT_TRUE(Insert(key, true /* concurrently */));
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  done.store(true);
+  reader.join();
+
+  EntrySet keys;
+  for (const EntrySet& k : thread_keys) {
+    keys.insert(k.begin(), k.end());
+  }
+  Validate(keys);
+}
+
+TEST_F(ARTTest, FactoryFallsBackForOtherComparators) {
+  for (const Comparator* ucmp :
+       {BytewiseComparator(), ReverseBytewiseComparator()}) {
+    TestKeyComparator key_cmp(ucmp);
+    ConcurrentArena arena;
+    ARTRepFactory factory;
+    std::unique_ptr<MemTableRep> rep(
+        factory.CreateMemTableRep(key_cmp, &arena, nullptr, nullptr));
+
+    std::vector<std::string> user_keys = {"b", "a", "c"};
+    for (const std::string& user_key : user_keys) {
+      std::string ikey =
+          InternalKey(user_key, 1, kTypeValue).Encode().ToString();
+      char* buf;
+      KeyHandle handle = rep->Allocate(
+          VarintLength(ikey.size()) + ikey.size(), &buf);
+      char* p = EncodeVarint32(buf, static_cast<uint32_t>(ikey.size()));
+      memcpy(p, ikey.data(), ikey.size());
+      ASSERT_TRUE(rep->InsertKey(handle));
+    }
+
+    std::unique_ptr<MemTableRep::Iterator> iter(rep->GetIterator());
+    std::string order;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      order += ExtractUserKey(InternalKeyOf(iter->key())).ToString();
+    }
+    ASSERT_EQ(ucmp == BytewiseComparator() ? "abc" : "cba", order);
+  }
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -24,7 +24,7 @@ int main() {
 
 #include "db/dbformat.h"
 #include "db/memtable.h"
-#include "memory/arena.h"
+#include "memory/concurrent_arena.h"
 #include "port/port.h"
 #include "port/stack_trace.h"
 #include "rocksdb/comparator.h"
@@ -47,6 +47,8 @@ DEFINE_string(benchmarks, "fillrandom",
               "\tfillseq                -- write N values in sequential order\n"
               "\treadrandom             -- read N values in random order\n"
               "\treadseq                -- scan the DB\n"
+              "\tfillrandomconcurrent   -- N threads write N random values "
+              "together\n"
               "\treadwrite              -- 1 thread writes while N - 1 threads "
               "do random\n"
               "\t                          reads\n"
@@ -58,6 +60,7 @@ DEFINE_string(memtablerep, "skiplist",
               "include/memtablerep.h for\n"
               "  more details. Options:\n"
               "\tskiplist            -- backed by a skiplist\n"
+              "\tart                 -- backed by an adaptive radix tree\n"
               "\tvector              -- backed by an std::vector\n"
               "\thashskiplist        -- backed by a hash skip list\n"
               "\thashlinklist        -- backed by a hash linked list\n"
@@ -232,7 +235,9 @@ class FillBenchmarkThread : public BenchmarkThread {
       : BenchmarkThread(table, key_gen, bytes_written, bytes_read, sequence,
                         num_ops, read_hits) {}
 
-  void FillOne() {
+  void FillOne() { FillOne(key_gen_->Next(), ++(*sequence_), false); }
+
+  void FillOne(uint64_t key, uint64_t sequence, bool concurrently) {
     char* buf = nullptr;
     auto internal_key_size = 16;
     auto encoded_len =
@@ -240,16 +245,19 @@ class FillBenchmarkThread : public BenchmarkThread {
     KeyHandle handle = table_->Allocate(encoded_len, &buf);
     assert(buf != nullptr);
     char* p = EncodeVarint32(buf, internal_key_size);
-    auto key = key_gen_->Next();
     EncodeFixed64(p, key);
     p += 8;
-    EncodeFixed64(p, ++(*sequence_));
+    EncodeFixed64(p, sequence);
     p += 8;
     Slice bytes = generator_.Generate(FLAGS_item_size);
     memcpy(p, bytes.data(), FLAGS_item_size);
     p += FLAGS_item_size;
     assert(p == buf + encoded_len);
-    table_->Insert(handle);
+    if (concurrently) {
+      table_->InsertConcurrently(handle);
+    } else {
+      table_->Insert(handle);
+    }
     *bytes_written_ += encoded_len;
   }
 
@@ -284,6 +292,31 @@ class ConcurrentFillBenchmarkThread : public FillBenchmarkThread {
   std::atomic_int* threads_done_;
 };
 
+// One of the writers of fillrandomconcurrent. The writers draw their keys
+// from generators of their own, and take unique sequence numbers from
+// next_sequence, so that no two entries are the same.
+class ConcurrentInsertBenchmarkThread : public FillBenchmarkThread {
+ public:
+  ConcurrentInsertBenchmarkThread(MemTableRep* table, uint64_t* bytes_written,
+                                  uint64_t num_ops, uint64_t seed,
+                                  std::atomic<uint64_t>* next_sequence)
+      : FillBenchmarkThread(table, nullptr, bytes_written, nullptr, nullptr,
+                            num_ops, nullptr),
+        rand_(seed),
+        next_sequence_(next_sequence) {}
+
+  void operator()() override {
+    for (unsigned int i = 0; i < num_ops_; ++i) {
+      FillOne(rand_.Next() % FLAGS_num_operations,
+              next_sequence_->fetch_add(1) + 1, true /* concurrently */);
+    }
+  }
+
+ private:
+  Random64 rand_;
+  std::atomic<uint64_t>* next_sequence_;
+};
+
 class ReadBenchmarkThread : public BenchmarkThread {
  public:
   ReadBenchmarkThread(MemTableRep* table, KeyGenerator* key_gen,
@@ -473,6 +506,34 @@ class FillBenchmark : public Benchmark {
   }
 };
 
+class ConcurrentInsertBenchmark : public Benchmark {
+ public:
+  explicit ConcurrentInsertBenchmark(MemTableRep* table, uint64_t* sequence)
+      : Benchmark(table, nullptr, sequence, FLAGS_num_threads) {
+    num_write_ops_per_thread_ = FLAGS_num_operations / FLAGS_num_threads;
+  }
+
+  void RunThreads(std::vector<port::Thread>* threads, uint64_t* bytes_written,
+                  uint64_t* /*bytes_read*/, bool /*write*/,
+                  uint64_t* /*read_hits*/) override {
+    std::atomic<uint64_t> next_sequence(*sequence_);
+    // Every writer counts its own bytes
+    std::vector<uint64_t> thread_bytes_written(FLAGS_num_threads, 0);
+    for (int i = 0; i < FLAGS_num_threads; ++i) {
+      threads->emplace_back(ConcurrentInsertBenchmarkThread(
+          table_, &thread_bytes_written[i], num_write_ops_per_thread_,
+          FLAGS_seed + i, &next_sequence));
+    }
+    for (auto& thread : *threads) {
+      thread.join();
+    }
+    for (uint64_t bytes : thread_bytes_written) {
+      *bytes_written += bytes;
+    }
+    *sequence_ = next_sequence.load();
+  }
+};
+
 class ReadBenchmark : public Benchmark {
  public:
   explicit ReadBenchmark(MemTableRep* table, KeyGenerator* key_gen,
@@ -577,6 +638,8 @@ int main(int argc, char** argv) {
   std::unique_ptr<ROCKSDB_NAMESPACE::MemTableRepFactory> factory;
   if (FLAGS_memtablerep == "skiplist") {
     factory.reset(new ROCKSDB_NAMESPACE::SkipListFactory);
+  } else if (FLAGS_memtablerep == "art") {
+    factory.reset(new ROCKSDB_NAMESPACE::ARTRepFactory);
 #ifndef ROCKSDB_LITE
   } else if (FLAGS_memtablerep == "vector") {
     factory.reset(new ROCKSDB_NAMESPACE::VectorRepFactory);
@@ -602,7 +665,8 @@ int main(int argc, char** argv) {
   ROCKSDB_NAMESPACE::InternalKeyComparator internal_key_comp(
       ROCKSDB_NAMESPACE::BytewiseComparator());
   ROCKSDB_NAMESPACE::MemTable::KeyComparator key_comp(internal_key_comp);
-  ROCKSDB_NAMESPACE::Arena arena;
+  // Thread-safe like the arena of a MemTable, for fillrandomconcurrent
+  ROCKSDB_NAMESPACE::ConcurrentArena arena;
   ROCKSDB_NAMESPACE::WriteBufferManager wb(FLAGS_write_buffer_size);
   uint64_t sequence;
   auto createMemtableRep = [&] {
@@ -638,6 +702,16 @@ int main(int argc, char** argv) {
           &rng, ROCKSDB_NAMESPACE::UNIQUE_RANDOM, FLAGS_num_operations));
       benchmark.reset(new ROCKSDB_NAMESPACE::FillBenchmark(
           memtablerep.get(), key_gen.get(), &sequence));
+    } else if (name == ROCKSDB_NAMESPACE::Slice("fillrandomconcurrent")) {
+      if (!factory->IsInsertConcurrentlySupported()) {
+        std::cout << "WARNING: skipping fillrandomconcurrent, "
+                  << factory->Name() << " does not support concurrent inserts"
+                  << std::endl;
+        continue;
+      }
+      memtablerep.reset(createMemtableRep());
+      benchmark.reset(new ROCKSDB_NAMESPACE::ConcurrentInsertBenchmark(
+          memtablerep.get(), &sequence));
     } else if (name == ROCKSDB_NAMESPACE::Slice("readrandom")) {
       key_gen.reset(new ROCKSDB_NAMESPACE::KeyGenerator(
           &rng, ROCKSDB_NAMESPACE::RANDOM, FLAGS_num_operations));
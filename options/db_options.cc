@@ -7,6 +7,7 @@
 
 #include <cinttypes>
 
+#include "db/ship_job.h"
 #include "logging/logging.h"
 #include "options/configurable_helper.h"
 #include "options/options_helper.h"
@@ -599,17 +600,39 @@ ImmutableDBOptions::ImmutableDBOptions(const DBOptions& options)
       disallow_flush_on_secondary(options.disallow_flush_on_secondary),
       target_address(options.target_address),
       primary_address(options.primary_address),
+      replicator_address(options.replicator_address),
       remote_sst_dir(options.remote_sst_dir),
-      remote_sst_dirs(options.remote_sst_dirs),
+      remote_sst_dirs(std::make_shared<RemoteSstDirs>(options.remote_sst_dirs)),
       sst_pool_dir(options.sst_pool_dir),
       preallocated_sst_pool_size(options.preallocated_sst_pool_size),
+      max_sst_pool_size(options.max_sst_pool_size),
+      sst_pool_big_slots(options.sst_pool_big_slots),
+      sst_pool_low_watermark(options.sst_pool_low_watermark),
+      sst_pool_high_watermark(options.sst_pool_high_watermark),
+      sst_pool_grow_step(options.sst_pool_grow_step),
       sst_pad_len(options.sst_pad_len),
+      pad_sst_to_slot_size(options.pad_sst_to_slot_size),
+      stream_sst_shipping(options.stream_sst_shipping),
+      max_sst_ship_threads(options.max_sst_ship_threads),
+      max_sst_ships_per_target(options.max_sst_ships_per_target),
+      max_sst_stream_bytes_in_flight(options.max_sst_stream_bytes_in_flight),
+      max_version_edit_group(options.max_version_edit_group),
+      sst_prewarm_threads(options.sst_prewarm_threads),
+      chain_group_commit(options.chain_group_commit),
+      serve_direct_reads(options.serve_direct_reads),
+      sst_checksum_chunk_size(options.sst_checksum_chunk_size),
+      verify_shipped_sst(options.verify_shipped_sst),
+      async_server_cqs(options.async_server_cqs),
+      async_server_workers(options.async_server_workers),
+      async_server_pin_threads(options.async_server_pin_threads),
       max_num_mems_in_flush(options.max_num_mems_in_flush),
       channel(options.channel),
       primary_channel(options.primary_channel),
       sst_bit_map(options.sst_bit_map),
       piggyback_version_edits(options.piggyback_version_edits),
       edits(options.edits),
+      sst_ship_executor(nullptr),
+      shipping_db(nullptr),
       rid(options.rid),
       rf(options.rf)
       {
@@ -617,20 +640,14 @@ ImmutableDBOptions::ImmutableDBOptions(const DBOptions& options)
           if(remote_sst_dir.back() != '/'){
             remote_sst_dir.append("/");
           }
-          for (std::string dir : remote_sst_dirs) {
-            if (dir.back() != '/') {
-              dir.append("/");
-            }
-          }
         }
         version_edit_mu = std::shared_ptr<std::mutex>(new std::mutex);
         expected_edit_cv = std::shared_ptr<std::condition_variable>(new std::condition_variable);
         memtable_ready_mu = std::shared_ptr<std::mutex>(new std::mutex);
         memtable_ready_cv = std::shared_ptr<std::condition_variable>(new std::condition_variable);
-        op_buffer_mu = std::shared_ptr<std::mutex>(new std::mutex);
-        op_buffer_cv = std::shared_ptr<std::condition_variable>(new std::condition_variable);
 
         shipped_files_nvmeof = std::shared_ptr<std::atomic_int>(new std::atomic_int(0));
+        ship_failed = std::make_shared<std::atomic<bool>>(false);
 }
 
 void ImmutableDBOptions::Dump(Logger* log) const {
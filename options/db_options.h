@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <string>
 #include <vector>
 #include <shared_mutex>
@@ -13,6 +14,10 @@
 
 namespace ROCKSDB_NAMESPACE {
 
+class DBImpl;
+class SstShipExecutor;
+class RemoteSstDirs;
+
 struct ImmutableDBOptions {
   static const char* kName() { return "ImmutableDBOptions"; }
   ImmutableDBOptions();
@@ -102,11 +107,32 @@ struct ImmutableDBOptions {
   bool disallow_flush_on_secondary;
   std::string target_address;
   std::string primary_address;
+  std::string replicator_address;
   std::string remote_sst_dir;
-  mutable std::vector<std::string> remote_sst_dirs;
+  // changes when a tail leaves or joins the chain, see RemoteSstDirs
+  std::shared_ptr<RemoteSstDirs> remote_sst_dirs;
   std::string sst_pool_dir;
   int preallocated_sst_pool_size;
+  int max_sst_pool_size;
+  int sst_pool_big_slots;
+  int sst_pool_low_watermark;
+  int sst_pool_high_watermark;
+  int sst_pool_grow_step;
   uint64_t sst_pad_len;
+  bool pad_sst_to_slot_size;
+  bool stream_sst_shipping;
+  int max_sst_ship_threads;
+  int max_sst_ships_per_target;
+  uint64_t max_sst_stream_bytes_in_flight;
+  int max_version_edit_group;
+  int sst_prewarm_threads;
+  bool chain_group_commit;
+  bool serve_direct_reads;
+  uint64_t sst_checksum_chunk_size;
+  bool verify_shipped_sst;
+  int async_server_cqs;
+  int async_server_workers;
+  bool async_server_pin_threads;
   int max_num_mems_in_flush;
   std::shared_ptr<grpc::Channel> channel;
   std::shared_ptr<grpc::Channel> primary_channel;
@@ -117,9 +143,15 @@ struct ImmutableDBOptions {
   std::shared_ptr<std::condition_variable> expected_edit_cv;
   std::shared_ptr<std::mutex> memtable_ready_mu;
   std::shared_ptr<std::condition_variable> memtable_ready_cv;
-  std::shared_ptr<std::mutex> op_buffer_mu;
-  std::shared_ptr<std::condition_variable> op_buffer_cv;
   std::shared_ptr<std::atomic_int> shipped_files_nvmeof;
+  // ships sst files concurrently on the primary, see max_sst_ship_threads.
+  // Owned by the DBImpl, copies of the options don't start their own
+  SstShipExecutor* sst_ship_executor;
+  // primary: the DBImpl whose ssts are shipped, told about the first ship
+  // that failed for good, see DBImpl::SetShipError. Set by the DBImpl
+  DBImpl* shipping_db;
+  // primary: set once a ship failed, no later version edit is sent
+  std::shared_ptr<std::atomic<bool>> ship_failed;
   int rid;
   int rf;
 };
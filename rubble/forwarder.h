@@ -4,6 +4,7 @@
 #include <iostream>
 #include <string>
 #include <chrono>
+#include <mutex>
 
 #include <grpcpp/grpcpp.h>
 #include <grpcpp/health_check_service_interface.h>
@@ -26,21 +27,18 @@ class Forwarder{
         : stub_(RubbleKvStoreService::NewStub(channel)), stream_(stub_->DoOp(&context_)) {
     };
 
-    ~Forwarder(){
-      std::cout << "forwarder destroyed\n";
-    }
-
     // forward the op to the next node
     void Forward(const Op& op){
+      // the head's WalSyncer also writes watermarks to the stream
+      std::lock_guard<std::mutex> lk{mu_};
       if (need_recovery) {
-        std::cout << "[Forward] need recovery, simply return\n";
         return;
       }
       if (!stream_->Write(op)) {
         need_recovery = true;
         stream_->WritesDone();
         Status s = stream_->Finish();
-        std::cout << "Forward fail!"
+        std::cerr << "Forward fail!"
                 << " msg: " << s.error_message() 
                 << " detail: " << s.error_details() 
                 << " debug: " << context_.debug_error_string()
@@ -49,15 +47,30 @@ class Forwarder{
       }
     }
 
-    void ReadReply(OpReply *reply) {
-      if (!stream_->Read(reply)) {
-        stream_->Finish();
-        assert(false);
-      }
+    // tell the downstream nodes that the head's WAL is synced up to
+    // durable_seq, see WalSyncer
+    void ForwardWatermark(uint64_t durable_seq) {
+      Op watermark;
+      watermark.set_id(-2);
+      watermark.set_shard_idx(shard_idx);
+      watermark.set_client_idx(client_idx);
+      watermark.set_durable_seq(durable_seq);
+      Forward(watermark);
+    }
+
+    // read a reply the downstream node wrote on the stream, returns false
+    // once the stream is closed
+    bool ReadReply(OpReply *reply) {
+      return stream_->Read(reply);
     }
 
     // forward the op to the next node
     void WritesDone() {
+        std::lock_guard<std::mutex> lk{mu_};
+        if (need_recovery) {
+          // the stream is finished already
+          return;
+        }
         stream_->WritesDone();
         stream_->Finish();
     }
@@ -76,4 +89,5 @@ class Forwarder{
     std::unique_ptr<RubbleKvStoreService::Stub> stub_;
     std::shared_ptr<ClientReaderWriter<Op, OpReply> > stream_;
     bool need_recovery = false;
+    std::mutex mu_;
 };
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+// Recycles protobuf messages instead of allocating one per request. A
+// cleared message keeps the capacity of its strings and repeated fields, so
+// the next request of about the same shape doesn't allocate at all.
+//
+// Each thread has its own pool (ThreadLocal), a DoOp stream acquires and
+// releases its messages on its own thread, so there is no locking. A
+// message released on another thread just moves to that thread's pool.
+template <typename T>
+class MessagePool {
+  public:
+    static MessagePool& ThreadLocal() {
+        thread_local MessagePool pool;
+        return pool;
+    }
+
+    T* Acquire() {
+        if (free_.empty()) {
+            return new T();
+        }
+        T* msg = free_.back().release();
+        free_.pop_back();
+        return msg;
+    }
+
+    void Release(T* msg) {
+        if (msg == nullptr) {
+            return;
+        }
+        if (free_.size() >= kMaxFree) {
+            delete msg;
+            return;
+        }
+        msg->Clear();
+        free_.emplace_back(msg);
+    }
+
+  private:
+    // enough for the ops of a stream buffered across a memtable switch
+    static const size_t kMaxFree = 256;
+
+    std::vector<std::unique_ptr<T>> free_;
+};
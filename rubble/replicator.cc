@@ -1,9 +1,13 @@
 #include <iostream>
+#include <cassert>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
 #include <iomanip>
-#include <string> 
+#include <string>
 #include <memory>
 #include <thread>
-#include <bitset>
+#include <vector>
 #include <unordered_map>
 #include <condition_variable>
 
@@ -11,7 +15,8 @@
 #include <grpcpp/health_check_service_interface.h>
 #include <grpcpp/ext/proto_server_reflection_plugin.h>
 #include "rubble_kv_store.grpc.pb.h"
-#include "kvstore_client.h"
+#include "forwarder.h"
+#include "shard_router.h"
 
 using grpc::Server;
 using grpc::ServerBuilder;
@@ -25,171 +30,697 @@ using rubble::RubbleKvStoreService;
 using rubble::Op;
 using rubble::OpReply;
 using rubble::Reply;
-using rubble::Op_OpType_Name;
+using rubble::SingleOp;
+using rubble::SingleOpReply;
 
 using std::chrono::time_point;
 using std::chrono::high_resolution_clock;
 
 class Replicator final : public  RubbleKvStoreService::Service {
   public:
-    explicit Replicator(const std::vector<std::string>& shards)
-     :shards_(shards), num_of_shards_(shards.size()) {
+    // router decides the shard of a key, a ConsistentHashRouter over all the
+    // shards if not given. read_replicas are the addresses of all the nodes of
+    // each shard's chain, a read-only op whose keys have no write in flight
+    // goes to one of them instead of down the chain to the tail. Empty for a
+    // shard whose reads all go to the tail
+    explicit Replicator(const std::vector<std::string>& shards, int max_inflight = 128,
+                        std::unique_ptr<ShardRouter> router = nullptr,
+                        const std::vector<std::vector<std::string>>& read_replicas = {})
+     :shards_(shards), router_(std::move(router)), max_inflight_(max_inflight) {
+        for(const auto& shard: shards_){
+            channels_.emplace_back(grpc::CreateChannel(shard, grpc::InsecureChannelCredentials()));
+        }
+        assert(read_replicas.empty() || read_replicas.size() == shards_.size());
+        read_streams_.resize(read_replicas.size());
+        for(size_t i = 0; i < read_replicas.size(); i++){
+            for(const auto& replica: read_replicas[i]){
+                read_streams_[i].emplace_back(new ReadStream(
+                    grpc::CreateChannel(replica, grpc::InsecureChannelCredentials()), this));
+            }
+        }
+        if(router_ == nullptr){
+            router_.reset(new ConsistentHashRouter(static_cast<int>(shards_.size())));
+        }
+        assert(router_->NumShards() == static_cast<int>(shards_.size()));
+        router_->SetRebalanceListener([](const ShardRouter& router){
+            std::cout << router.Name() << " rebalanced, " << router.NumShards() << " shards\n";
+        });
     };
 
+    // add a shard online, it gets part of the keys of the other shards. The
+    // streams opened before only see it on their next op to it. Keys are
+    // only routed elsewhere, their data is not migrated, so this is refused
+    // (returns -1) once a write went through the replicator. The shards must
+    // also be empty when the replicator starts
+    int AddShard(const std::string& address){
+        std::lock_guard<std::mutex> reshard_lk{reshard_mu_};
+        if(wrote_.load()){
+            std::cerr << "Can't add shard " << address << ", the shards hold data\n";
+            return -1;
+        }
+        {
+            std::lock_guard<std::mutex> lk{channels_mu_};
+            shards_.push_back(address);
+            channels_.emplace_back(grpc::CreateChannel(address, grpc::InsecureChannelCredentials()));
+        }
+        return router_->AddShard();
+    }
+
+    // stop sending new keys to the shard. Refused like AddShard once a write
+    // went through, the keys of the shard would lose their data
+    bool RemoveShard(int shard_idx){
+        std::lock_guard<std::mutex> reshard_lk{reshard_mu_};
+        if(wrote_.load()){
+            std::cerr << "Can't remove shard " << shard_idx << ", the shards hold data\n";
+            return false;
+        }
+        router_->RemoveShard(shard_idx);
+        return true;
+    }
+
     ~Replicator() {}
 
-    class Task{
+    // a client's DoOp stream. Ops are forwarded without waiting for their
+    // replies, the SendReply threads write the replies back as they come
+    class ClientStream{
       public:
-        Task(std::thread::id id,
-                    std::condition_variable* cv,
-                    bool* ready)
-          :id_(id), cv_(cv), ready_(ready){
+        ClientStream(ServerReaderWriter<OpReply, Op>* stream, int max_inflight)
+          :stream_(stream), max_inflight_(max_inflight){
             }
 
-        ~Task(){}
+        ~ClientStream(){}
 
-        void SetReply(OpReply& reply){
-            reply_ = reply;
+        // wait until there is room for one more op in flight
+        void Acquire(){
+            std::unique_lock<std::mutex> lk{mu_};
+            cv_.wait(lk, [&](){return inflight_ < max_inflight_;});
+            inflight_++;
         }
 
-        OpReply GetReply(){
-            return reply_;
+        // write a reply back to the client, called by the SendReply threads
+        void WriteReply(const OpReply& reply){
+            {
+                // only one write may be outstanding on the stream
+                std::lock_guard<std::mutex> lk{write_mu_};
+                stream_->Write(reply);
+            }
+            std::lock_guard<std::mutex> lk{mu_};
+            inflight_--;
+            cv_.notify_all();
         }
-        void Notify(){
-            cv_->notify_one();
+
+        // wait for the replies of all the ops in flight
+        void Drain(){
+            std::unique_lock<std::mutex> lk{mu_};
+            cv_.wait(lk, [&](){return inflight_ == 0;});
+        }
+
+    private:
+        ServerReaderWriter<OpReply, Op>* stream_;
+        std::mutex write_mu_;
+        std::mutex mu_;
+        std::condition_variable cv_;
+        int inflight_ = 0;
+        int max_inflight_;
+    };
+
+    // where the values of a part of a MULTIGET go in the client's reply
+    struct Scatter{
+        // index of the merged MULTIGET reply, -1 if the MULTIGET is not split
+        int target;
+        // position of each key of the part in the client's MULTIGET
+        std::vector<int> positions;
+    };
+
+    // a client op, split into one op per shard its keys go to. The replies
+    // of the parts are merged and sent back once all of them are in
+    struct Batch{
+        Batch(ClientStream* s, int32_t id) :stream(s), client_id(id){}
+
+        // merge the reply of a part, consumes it. Reads are answered in the
+        // order of their op, so the MULTIGET replies of a part come in the
+        // order of multigets[part]
+        void Merge(int part, OpReply* part_reply){
+            const std::vector<Scatter>& scatters = multigets[part];
+            size_t next = 0;
+            reply.set_time(part_reply->time());
+            for(auto& single_reply: *part_reply->mutable_replies()){
+                if(single_reply.type() != rubble::MULTIGET || scatters[next++].target < 0){
+                    reply.add_replies()->Swap(&single_reply);
+                    continue;
+                }
+                const Scatter& scatter = scatters[next - 1];
+                SingleOpReply* merged = reply.mutable_replies(scatter.target);
+                assert(static_cast<size_t>(single_reply.values_size()) == scatter.positions.size());
+                for(size_t i = 0; i < scatter.positions.size(); i++){
+                    merged->set_values(scatter.positions[i], std::move(*single_reply.mutable_values(i)));
+                    merged->set_found(scatter.positions[i], single_reply.found(i));
+                }
+                if(!single_reply.ok()){
+                    merged->set_ok(false);
+                    merged->set_status(single_reply.status());
+                }
+            }
         }
 
-        void SetReady(){
-            *ready_ = true;
+        ClientStream* stream;
+        // the id the client gave the op
+        int32_t client_id;
+        std::mutex mu;
+        // parts without a reply yet
+        int remaining = 0;
+        // the merged reply, it already holds the MULTIGETs split over shards
+        OpReply reply;
+        // for each part, the MULTIGETs it carries in order
+        std::vector<std::vector<Scatter>> multigets;
+    };
+
+    // a part of a client op waiting for its reply from the tail
+    struct Pending{
+        Batch* batch;
+        int part;
+    };
+
+    // pending ops by the id the replicator gave them, sharded so that the
+    // DoOp and SendReply threads rarely touch the same lock
+    class PendingTable{
+      public:
+        void Add(int32_t id, const Pending& pending){
+            Shard& shard = shards_[id % kNumShards];
+            std::lock_guard<std::mutex> lk{shard.mu};
+            shard.map.emplace(id, pending);
         }
 
-        std::thread::id GetThreadId(){
-            return id_;
+        bool Remove(int32_t id, Pending* pending){
+            Shard& shard = shards_[id % kNumShards];
+            std::lock_guard<std::mutex> lk{shard.mu};
+            auto it = shard.map.find(id);
+            if(it == shard.map.end()){
+                return false;
+            }
+            *pending = it->second;
+            shard.map.erase(it);
+            return true;
         }
 
-    private:
-        OpReply reply_;
-        bool* ready_;
-        // std::mutex* mu_;
-        std::thread::id id_;
-        std::condition_variable* cv_;
+      private:
+        static const int kNumShards = 64;
+        struct Shard{
+            std::mutex mu;
+            std::unordered_map<int32_t, Pending> map;
+        };
+        Shard shards_[kNumShards];
     };
 
-    // called by the kvstore client
-    // replicator doesn't actually perform an op, but just forward it to one shard
-    Status DoOp(ServerContext* context, 
-              ServerReaderWriter<OpReply, Op>* stream) override {
-        std::string value;
-        if(!op_counter_.load()){
-            start_time_ = high_resolution_clock::now();
-            // do the initialization here
-            for(const auto& shard: shards_){
-                forwarders_.emplace_back(std::make_shared<KvStoreClient>(grpc::CreateChannel(shard, grpc::InsecureChannelCredentials())));
+    // number of writes in flight for each key hash. A key whose count is 0
+    // has no write between the head and the tail's reply, so every node of
+    // its chain holds the same value for it and any of them can serve the
+    // read. Keys that share a slot only send some clean reads to the tail.
+    // A write sent after the check may still reach the node before the read,
+    // the node checks again for it, see serve_direct_reads
+    class DirtyKeyTable{
+      public:
+        DirtyKeyTable() :counts_(new std::atomic<uint32_t>[kNumSlots]){
+            for(size_t i = 0; i < kNumSlots; i++){
+                counts_[i].store(0);
             }
         }
 
-        if((op_counter_.load() >> 16) && !( std::bitset<16>(op_counter_.load()) | op_counter_mask_ ).to_ulong()){
-            end_time_ = high_resolution_clock::now();
-            auto millisecs = std::chrono::duration_cast<std::chrono::milliseconds>(end_time_ - start_time_);
-            std::cout << "Throughput : handled 65536 in " << millisecs.count() << " milisecs\n";
-            start_time_ = end_time_;
+        // before the op goes down the chain
+        void MarkWrites(const Op& op){
+            for(const auto& single_op: op.ops()){
+                if(IsWrite(single_op.type())){
+                    Slot(single_op.key()).fetch_add(1);
+                }
+            }
+        }
+
+        // once the tail replied to the writes, returns false if the op had none
+        bool UnmarkWrites(const OpReply& reply){
+            bool writes = false;
+            for(const auto& single_reply: reply.replies()){
+                if(IsWrite(single_reply.type())){
+                    Slot(single_reply.key()).fetch_sub(1);
+                    writes = true;
+                }
+            }
+            return writes;
+        }
+
+        // if the op only reads keys without a write in flight
+        bool IsClean(const Op& op){
+            for(const auto& single_op: op.ops()){
+                if(single_op.type() == rubble::GET){
+                    if(Slot(single_op.key()).load() != 0){
+                        return false;
+                    }
+                }else if(single_op.type() == rubble::MULTIGET){
+                    for(const auto& key: single_op.keys()){
+                        if(Slot(key).load() != 0){
+                            return false;
+                        }
+                    }
+                }else{
+                    // a scan may cover a key being written
+                    return false;
+                }
+            }
+            return true;
         }
 
-        op_counter_.fetch_add(1);
+      private:
+        // the nodes only reply to PUTs and UPDATEs
+        static bool IsWrite(rubble::OpType type){
+            return type == rubble::PUT || type == rubble::UPDATE;
+        }
+
+        std::atomic<uint32_t>& Slot(const std::string& key){
+            return counts_[std::hash<std::string>()(key) % kNumSlots];
+        }
+
+        static const size_t kNumSlots = 1 << 18;
+        std::unique_ptr<std::atomic<uint32_t>[]> counts_;
+    };
+
+    // a stream to one node of a shard's chain, carrying the clean reads of
+    // all the clients. The node writes the replies back on the stream, they
+    // are read on a thread of their own. Lives as long as the replicator.
+    // It also tells the node which writes the tail replied to, see
+    // serve_direct_reads
+    class ReadStream{
+      public:
+        ReadStream(std::shared_ptr<Channel> channel, Replicator* replicator)
+          :forwarder_(channel){
+            std::thread([this, replicator](){
+                OpReply reply;
+                while(forwarder_.ReadReply(&reply)){
+                    replicator->Deliver(&reply);
+                }
+            }).detach();
+        }
+
+        // the ids the node hasn't got yet go with the op
+        void Forward(Op* op){
+            {
+                std::lock_guard<std::mutex> lk{mu_};
+                op->mutable_committed()->Add(committed_.begin(), committed_.end());
+                committed_.clear();
+            }
+            forwarder_.Forward(*op);
+            op->clear_committed();
+        }
+
+        // the tail replied to the write op id. The node learns it with the
+        // next read, or on its own once enough ids piled up
+        void Commit(int32_t id, int32_t shard_idx){
+            Op notice;
+            {
+                std::lock_guard<std::mutex> lk{mu_};
+                committed_.push_back(id);
+                if(committed_.size() < kMaxCommitted){
+                    return;
+                }
+                notice.mutable_committed()->Add(committed_.begin(), committed_.end());
+                committed_.clear();
+            }
+            notice.set_id(-3);
+            notice.set_shard_idx(shard_idx);
+            forwarder_.Forward(notice);
+        }
+
+      private:
+        static const size_t kMaxCommitted = 1024;
+
+        Forwarder forwarder_;
+        std::mutex mu_;
+        std::vector<int32_t> committed_;
+    };
+
+    // called by the kvstore client
+    // replicator doesn't actually perform an op, but just forward it to one shard
+    Status DoOp(ServerContext* context,
+              ServerReaderWriter<OpReply, Op>* stream) override {
+        ClientStream client(stream, max_inflight_);
+        // one stream per shard for every client, a node expects the ops of a
+        // stream to come from the same client
+        std::vector<std::unique_ptr<Forwarder>> forwarders;
+        AddForwarders(&forwarders);
+
         Op request;
-        OpReply reply;
+        // the ops of the shards the request's keys go to
+        std::vector<Op> parts;
+        std::vector<int> part_shards;
         while (stream->Read(&request)){
-            std::string key = request.key();
-            // take the last two bits in string cause num_of_shards_ is supposed to be 3 in our setting
-            int shard_idx = ((int)(std::bitset<8>(key[key.length() - 1]) & mask_).to_ulong())% num_of_shards_;
-            uint64_t id = request.id();
-            // std::cout << "thread " <<  std::this_thread::get_id() <<" Sending op " << id << " to shard " << shard_idx << std::endl;
-            // forward the op to the corrensponding shard
-            forwarders_[shard_idx]->ForwardOp(request);
-            std::mutex mu;
-            std::condition_variable cv;
-            bool ready = false;
-            Task task(std::this_thread::get_id(), &cv, &ready);
-            map_.emplace(id, &task);
-            {
-                std::unique_lock<std::mutex> lk{mu};
-                // wait until got notified (when the reply returned from the tail node)
-                // std::this_thread::sleep_for(std::chrono::microseconds(1000));
-                // std::cout << "waiting for notify " << std::endl;
-                assert(!ready);
-                cv.wait(lk, [&](){return ready;});
-                // std::cout << "notified" << std::endl;
-            }
-            uint64_t reply_id = task.GetReply().id();
-            // std::cout << "send a reply back for op " << reply_id <<  std::endl;  
-            stream->Write(task.GetReply());
-            map_.erase(reply_id);
+            if(request.id() == -1){
+                // termination, every shard should see it
+                for(const auto& forwarder: forwarders){
+                    forwarder->Forward(request);
+                }
+                continue;
+            }
+            if(request.ops_size() == 0){
+                continue;
+            }
+            CountOp();
+            if(!wrote_.load() && HasWrites(request)){
+                // no shard is added or removed from now on
+                std::lock_guard<std::mutex> reshard_lk{reshard_mu_};
+                wrote_.store(true);
+            }
+
+            Batch* batch = new Batch(&client, request.id());
+            Split(&request, batch, &parts, &part_shards);
+            if(*std::max_element(part_shards.begin(), part_shards.end()) >=
+               static_cast<int>(forwarders.size())){
+                // a shard added after the stream was opened
+                AddForwarders(&forwarders);
+            }
+            client.Acquire();
+            // a part may be answered before the next one is sent
+            batch->remaining = static_cast<int>(parts.size());
+            for(size_t i = 0; i < parts.size(); i++){
+                Op& part = parts[i];
+                int shard_idx = part_shards[i];
+                // ids from different clients may collide, so give the op our own
+                int32_t id = static_cast<int32_t>(next_id_.fetch_add(1) & 0x7fffffff);
+                pending_.Add(id, {batch, static_cast<int>(i)});
+                part.set_id(id);
+                part.set_shard_idx(shard_idx);
+                ReadStream* read_stream = CleanReadStream(part, shard_idx);
+                if(read_stream != nullptr){
+                    part.set_direct_read(true);
+                    // the read streams carry the ops of every client
+                    part.clear_client_idx();
+                    read_stream->Forward(&part);
+                    continue;
+                }
+                dirty_.MarkWrites(part);
+                // std::cout << "thread " <<  std::this_thread::get_id() <<" Sending op " << id << " to shard " << shard_idx << std::endl;
+                // forward the op to the corrensponding shard
+                forwarders[shard_idx]->Forward(part);
+            }
+        }
+
+        // the replies still hold a pointer to this stream
+        client.Drain();
+        for(const auto& forwarder: forwarders){
+            forwarder->WritesDone();
         }
         return Status::OK;
     }
 
-
-
     // used by the tail node in the chain to send the true reply back to the replicator
     // replicator is then responsible for sending this reply back to the client
-    Status SendReply(ServerContext* context, 
+    Status SendReply(ServerContext* context,
               ServerReaderWriter<Reply, OpReply>* stream) override {
-        
+
         OpReply reply;
         while(stream->Read(&reply)){
-            uint64_t id = reply.id();
-            auto it = map_.find(id);
-            assert(it != map_.end());
-            Task* task = it->second;
-            // std::cout << "thread " << task->GetThreadId() <<  " Got a reply for op : " << id << " , status : " << reply.status() << std::endl;
-            task->SetReply(reply);
-            task->SetReady();
-            // std::cout << "Notify" << std::endl;
-            task->Notify();
+            // the writes are on every node now
+            if(dirty_.UnmarkWrites(reply)){
+                CommitWrites(reply);
+            }
+            Deliver(&reply);
         }
         return Status::OK;
     }
 
   private:
+    // send a reply back to the client of its op once all its parts replied
+    void Deliver(OpReply* reply){
+        Pending pending;
+        if(!pending_.Remove(reply->id(), &pending)){
+            std::cerr << "Got a reply for unknown op " << reply->id() << std::endl;
+            return;
+        }
+        // std::cout << "Got a reply for op : " << reply->id() << std::endl;
+        Batch* batch = pending.batch;
+        if(batch->multigets.size() == 1){
+            // the whole op went to one shard
+            reply->set_id(batch->client_id);
+            batch->stream->WriteReply(*reply);
+            delete batch;
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lk{batch->mu};
+            batch->Merge(pending.part, reply);
+            if(--batch->remaining > 0){
+                return;
+            }
+        }
+        batch->reply.set_id(batch->client_id);
+        batch->stream->WriteReply(batch->reply);
+        delete batch;
+    }
+
+    static bool HasWrites(const Op& op){
+        for(const auto& single_op: op.ops()){
+            if(single_op.type() != rubble::GET && single_op.type() != rubble::MULTIGET &&
+               single_op.type() != rubble::SCAN){
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Split the request into one op per shard its keys go to, keeping the
+    // order of the single ops of each shard, and consume it. A MULTIGET
+    // whose keys go to several shards is split too, its reply is added to
+    // batch->reply and filled in as the parts reply. A SCAN goes to the shard
+    // of its start key only
+    void Split(Op* request, Batch* batch, std::vector<Op>* parts, std::vector<int>* part_shards){
+        int ops_size = request->ops_size();
+        // shard of each single op, -1 for a MULTIGET over several shards
+        std::vector<int> op_shards(ops_size);
+        // shard of every MULTIGET key, in order
+        std::vector<int> key_shards;
+        bool one_shard = true;
+        for(int i = 0; i < ops_size; i++){
+            const SingleOp& single_op = request->ops(i);
+            if(single_op.type() == rubble::MULTIGET && single_op.keys_size() > 0){
+                int first = router_->Route(single_op.keys(0));
+                op_shards[i] = first;
+                key_shards.push_back(first);
+                for(int k = 1; k < single_op.keys_size(); k++){
+                    key_shards.push_back(router_->Route(single_op.keys(k)));
+                    if(key_shards.back() != first){
+                        op_shards[i] = -1;
+                    }
+                }
+            }else{
+                op_shards[i] = router_->Route(single_op.key());
+            }
+            one_shard = one_shard && op_shards[i] >= 0 && op_shards[i] == op_shards[0];
+        }
+
+        parts->resize(1);
+        part_shards->assign(1, op_shards[0]);
+        batch->multigets.assign(1, {});
+        if(one_shard){
+            // no copy of the single ops, and the MULTIGETs need no scatter
+            (*parts)[0].Swap(request);
+            return;
+        }
+
+        parts->clear();
+        part_shards->clear();
+        batch->multigets.clear();
+        auto part_of = [&](int shard){
+            for(size_t p = 0; p < part_shards->size(); p++){
+                if((*part_shards)[p] == shard){
+                    return static_cast<int>(p);
+                }
+            }
+            part_shards->push_back(shard);
+            batch->multigets.emplace_back();
+            parts->emplace_back();
+            parts->back().set_client_idx(request->client_idx());
+            parts->back().set_time(request->time());
+            return static_cast<int>(parts->size() - 1);
+        };
+        size_t next_key = 0;
+        for(int i = 0; i < ops_size; i++){
+            SingleOp* single_op = request->mutable_ops(i);
+            bool multiget = single_op->type() == rubble::MULTIGET && single_op->keys_size() > 0;
+            if(op_shards[i] >= 0){
+                int p = part_of(op_shards[i]);
+                if(multiget){
+                    next_key += single_op->keys_size();
+                    batch->multigets[p].push_back({-1, {}});
+                }
+                (*parts)[p].add_ops()->Swap(single_op);
+                continue;
+            }
+
+            int target = batch->reply.replies_size();
+            SingleOpReply* merged = batch->reply.add_replies();
+            merged->set_type(rubble::MULTIGET);
+            merged->set_ok(true);
+            // (part, index of its MULTIGET in the part) for every part
+            std::vector<std::pair<int, int>> subs;
+            for(int k = 0; k < single_op->keys_size(); k++){
+                merged->add_values();
+                merged->add_found(false);
+                int p = part_of(key_shards[next_key++]);
+                auto sub = std::find_if(subs.begin(), subs.end(),
+                                        [p](const std::pair<int, int>& s){ return s.first == p; });
+                if(sub == subs.end()){
+                    SingleOp* sub_op = (*parts)[p].add_ops();
+                    sub_op->set_type(rubble::MULTIGET);
+                    batch->multigets[p].push_back({target, {}});
+                    subs.emplace_back(p, (*parts)[p].ops_size() - 1);
+                    sub = subs.end() - 1;
+                }
+                (*parts)[p].mutable_ops(sub->second)->add_keys()->swap(*single_op->mutable_keys(k));
+                batch->multigets[p].back().positions.push_back(k);
+            }
+        }
+    }
+
+    // tell the nodes serving the reads of the shard that the tail has the
+    // writes of the reply
+    void CommitWrites(const OpReply& reply){
+        int shard_idx = reply.shard_idx();
+        if(shard_idx < 0 || shard_idx >= static_cast<int>(read_streams_.size())){
+            return;
+        }
+        for(const auto& stream: read_streams_[shard_idx]){
+            stream->Commit(reply.id(), shard_idx);
+        }
+    }
+
+    // the stream of the node that serves the op if it's a clean read,
+    // nullptr if the op has to go down the chain
+    ReadStream* CleanReadStream(const Op& request, int shard_idx){
+        if(shard_idx >= static_cast<int>(read_streams_.size()) ||
+           read_streams_[shard_idx].empty() || !dirty_.IsClean(request)){
+            return nullptr;
+        }
+        const auto& streams = read_streams_[shard_idx];
+        return streams[next_read_.fetch_add(1) % streams.size()].get();
+    }
+
+    // open a stream to every shard the forwarders don't have yet
+    void AddForwarders(std::vector<std::unique_ptr<Forwarder>>* forwarders){
+        std::lock_guard<std::mutex> lk{channels_mu_};
+        for(size_t i = forwarders->size(); i < channels_.size(); i++){
+            forwarders->emplace_back(new Forwarder(channels_[i]));
+        }
+    }
 
-    // a db op request we get from the client
-    Op request_;
-    //reply we get back to the client for a db op
-    OpReply reply_;
+    void CountOp(){
+        uint64_t cnt = op_counter_.fetch_add(1);
+        if(cnt == 0){
+            start_time_ = high_resolution_clock::now();
+        }else if(!(cnt & 0xffff)){
+            end_time_ = high_resolution_clock::now();
+            auto millisecs = std::chrono::duration_cast<std::chrono::milliseconds>(end_time_ - start_time_);
+            std::cout << "Throughput : handled 65536 in " << millisecs.count() << " milisecs"
+                      << ", shard load " << router_->DumpLoad(true) << "\n";
+            start_time_ = end_time_;
+        }
+    }
 
     std::atomic<uint64_t> op_counter_{0};
     time_point<high_resolution_clock> start_time_;
     time_point<high_resolution_clock> end_time_;
-    
-    int num_of_shards_;
+
     // keep a vector of each shard's primary instance's address
-    const std::vector<std::string> shards_;
-    // used for forwarding the requests to the corresponding shards
-    std::vector<std::shared_ptr<KvStoreClient>> forwarders_;
+    std::vector<std::string> shards_;
+    // channels to each shard's primary instance, shared by the client streams
+    std::vector<std::shared_ptr<Channel>> channels_;
+    // guards shards_ and channels_, which grow when a shard is added
+    std::mutex channels_mu_;
 
-    std::bitset<8> mask_ {std::string{"00000011"}};
-    std::bitset<16> op_counter_mask_{std::string {"1111111111111111"}};
+    std::unique_ptr<ShardRouter> router_;
 
-    // keep a mapping between the request and the thread for handing it
-    std::unordered_map<uint64_t, Task*> map_;
+    // max number of ops of a client stream waiting for their replies
+    const int max_inflight_;
+
+    std::atomic<uint32_t> next_id_{0};
+
+    PendingTable pending_;
+
+    DirtyKeyTable dirty_;
+    // set once a write went through, from then on the shards hold data and
+    // AddShard and RemoveShard are refused. reshard_mu_ orders the first
+    // write against a rebalance
+    std::atomic<bool> wrote_{false};
+    std::mutex reshard_mu_;
+    // streams to every node of each shard given at construction, shards
+    // added later have none
+    std::vector<std::vector<std::unique_ptr<ReadStream>>> read_streams_;
+    std::atomic<uint64_t> next_read_{0};
 };
 
 int main(int argc, char** argv) {
-  
-    if(argc <= 1){
-        std::cout << " usage : ./program shards' primary instance's address(pass at least one) \n";
-        return 0;
-    }
 
     // server is running on port 50048;
     std::string server_addr = "localhost:50048";
-    
+
+    std::string router_type = "hash";
+    int num_vnodes = 128;
+    std::vector<std::string> split_points;
     std::vector<std::string> shards;
-    for(int i = 1 ; i < argc; i++){   
-        shards.emplace_back(argv[i]);
+    std::vector<std::vector<std::string>> read_replicas;
+    bool apportioned_reads = false;
+    for(int i = 1 ; i < argc; i++){
+        std::string arg = argv[i];
+        if(arg.rfind("--router=", 0) == 0){
+            router_type = arg.substr(strlen("--router="));
+        }else if(arg.rfind("--vnodes=", 0) == 0){
+            num_vnodes = std::stoi(arg.substr(strlen("--vnodes=")));
+        }else if(arg.rfind("--splits=", 0) == 0){
+            std::stringstream ss(arg.substr(strlen("--splits=")));
+            std::string split;
+            while(std::getline(ss, split, ',')){
+                split_points.push_back(split);
+            }
+        }else{
+            // head[,node,...,tail]: with the other nodes of the chain listed,
+            // its clean reads are spread over all of them
+            std::stringstream ss(arg);
+            std::string node;
+            std::vector<std::string> chain;
+            while(std::getline(ss, node, ',')){
+                chain.push_back(node);
+            }
+            shards.emplace_back(chain.front());
+            if(chain.size() == 1){
+                chain.clear();
+            }else{
+                apportioned_reads = true;
+            }
+            read_replicas.push_back(chain);
+        }
+    }
+    if(!apportioned_reads){
+        read_replicas.clear();
+    }
+
+    if(shards.empty()){
+        std::cout << " usage : ./program [--router=hash|range] [--vnodes=N] [--splits=k1,k2,...]"
+                  << " shards' primary instance's address(pass at least one),"
+                  << " or head,...,tail to spread clean reads over the chain \n";
+        return 0;
+    }
+
+    std::unique_ptr<ShardRouter> router;
+    if(router_type == "range"){
+        // one split point less than the shards
+        if(split_points.size() + 1 != shards.size()){
+            std::cout << "--splits needs " << shards.size() - 1 << " split points\n";
+            return 1;
+        }
+        std::sort(split_points.begin(), split_points.end());
+        router.reset(new RangeRouter(split_points));
+    }else{
+        router.reset(new ConsistentHashRouter(static_cast<int>(shards.size()), num_vnodes));
     }
+    std::cout << "Routing with " << router->Name() << std::endl;
 
-    Replicator service(shards);
+    Replicator service(shards, 128, std::move(router), read_replicas);
     grpc::EnableDefaultHealthCheckService(true);
     grpc::reflection::InitProtoReflectionServerBuilderPlugin();
     ServerBuilder builder;
@@ -199,4 +730,4 @@ int main(int argc, char** argv) {
     builder.RegisterService(&service);
     std::unique_ptr<Server> server(builder.BuildAndStart());
     server->Wait();
-}
\ No newline at end of file
+}
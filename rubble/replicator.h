@@ -271,7 +271,7 @@ class Replicator final {
 
 void RunServer( const std::string& server_addr, int thread_num = 16) {
   
-  g_thread_num = 16;
+  g_thread_num = thread_num;
   grpc::EnableDefaultHealthCheckService(true);
   grpc::reflection::InitProtoReflectionServerBuilderPlugin();
   // ServerBuilder builder;
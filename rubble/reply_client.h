@@ -4,6 +4,7 @@
 #include <iostream>
 #include <string>
 #include <chrono>
+#include <map>
 
 #include <grpcpp/grpcpp.h>
 #include <grpcpp/health_check_service_interface.h>
@@ -29,14 +30,9 @@ class ReplyClient{
         stream_ = stub_->SendReply(&context_);
     };
 
-    ~ReplyClient(){
-      std::cout << "reply client destroyed\n";
-    }
-
     // send the reply to the replicator
     void SendReply(const OpReply& reply){
       if (need_recovery) {
-        std::cout << "[SendReply] need recovery, simply return\n";
         return;
       }
       // std::cout << "Sent reply, size : "  << reply.reply_size() << std::endl;
@@ -44,7 +40,7 @@ class ReplyClient{
         need_recovery = true;
         stream_->WritesDone();
         Status s = stream_->Finish();
-        std::cout << "sendReply fail!"
+        std::cerr << "sendReply fail!"
                   << " msg: " << s.error_message() 
                   << " detail: " << s.error_details() 
                   << " debug: " << context_.debug_error_string()
@@ -54,6 +50,54 @@ class ReplyClient{
       //  std::cout << "sendReply client on reply: " << reply.ok() << "\n";
     }
 
+    // keep a reply until the head's WAL is synced up to head_seq, see
+    // chain_group_commit. Replies are only held on the DoOp thread. Returns
+    // false if the stream to the replicator is broken, the reply stays the
+    // caller's then
+    bool HoldReply(uint64_t head_seq, OpReply* reply) {
+      if (need_recovery) {
+        return false;
+      }
+      held_.emplace(head_seq, reply);
+      return true;
+    }
+
+    // send the held replies covered by the new watermark, they are appended
+    // to sent for the caller to recycle
+    void AdvanceDurableSeq(uint64_t durable_seq, std::vector<OpReply*>* sent) {
+      if (durable_seq > durable_seq_) {
+        durable_seq_ = durable_seq;
+      }
+      auto end = held_.upper_bound(durable_seq_);
+      for (auto it = held_.begin(); it != end; ++it) {
+        SendReply(*it->second);
+        sent->push_back(it->second);
+      }
+      held_.erase(held_.begin(), end);
+    }
+
+    // no watermark covers the held replies anymore, e.g. the head's WAL sync
+    // failed and the stream is closing. Send them with their writes failed
+    // with status so the replicator doesn't wait for them, they are appended
+    // to sent for the caller to recycle
+    void FailHeldReplies(const std::string& status, std::vector<OpReply*>* sent) {
+      for (auto& held : held_) {
+        for (auto& single_reply : *held.second->mutable_replies()) {
+          if (single_reply.type() == rubble::PUT || single_reply.type() == rubble::UPDATE) {
+            single_reply.set_ok(false);
+            single_reply.set_status(status);
+          }
+        }
+        SendReply(*held.second);
+        sent->push_back(held.second);
+      }
+      held_.clear();
+    }
+
+    uint64_t durable_seq() const {
+      return durable_seq_;
+    }
+
     void WritesDone() {
       stream_->WritesDone();
       stream_->Finish();
@@ -79,4 +123,9 @@ class ReplyClient{
     std::unique_ptr<RubbleKvStoreService::Stub> stub_ = nullptr;
 
     bool need_recovery = false;
+
+    // the last watermark from the head, and the replies waiting for it by
+    // the head's sequence number
+    uint64_t durable_seq_ = 0;
+    std::multimap<uint64_t, OpReply*> held_;
 };
@@ -1,175 +1,218 @@
 #pragma once
 
-#include <stdlib.h>
-#include <unistd.h>
-#include <iostream>
-#include <iomanip>
-#include <string> 
-#include <memory>
-#include <nlohmann/json.hpp>
-#include <unordered_map>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <grpcpp/grpcpp.h>
 #include <grpcpp/health_check_service_interface.h>
-#include <grpcpp/alarm.h>
 #include <grpcpp/ext/proto_server_reflection_plugin.h>
 #include "rubble_kv_store.grpc.pb.h"
-#include "reply_client.h"
-#include "forwarder.h"
-
-#include "rocksdb/db.h"
-#include "rocksdb/slice.h"
-#include "rocksdb/options.h"
-#include "port/port_posix.h"
-#include "port/port.h"
-#include "db/version_edit.h"
-#include "db/db_impl/db_impl.h"
-#include "util/aligned_buffer.h"
-#include "file/read_write_util.h"
-#include "logging/event_logger.h"
-
-using grpc::Server;
-using grpc::ServerBuilder;
-using grpc::ServerContext;
+#include "rubble_sync_server.h"
+#include "message_pool.h"
+
 using grpc::ServerCompletionQueue;
-using grpc::Channel;
-using grpc::ClientContext;
-using grpc::ServerReaderWriter;
+using grpc::ServerAsyncReaderWriter;
 using grpc::ServerAsyncResponseWriter;
-using grpc::Status;
-using grpc::StatusCode;
 
-using rubble::RubbleKvStoreService;
-using rubble::Op;
-using rubble::OpReply;
-using rubble::SingleOp;
-using rubble::SingleOpReply;
-using rubble::OpType_Name;
+// DoOp, Sync and Recover are served asynchronously, SendReply is only
+// served by the replicator
+typedef RubbleKvStoreService::WithAsyncMethod_DoOp<
+          RubbleKvStoreService::WithAsyncMethod_Sync<
+            RubbleKvStoreService::WithAsyncMethod_Recover<
+              RubbleKvStoreService::Service>>> AsyncRubbleService;
 
-using json = nlohmann::json;
-using std::chrono::time_point;
-using std::chrono::high_resolution_clock;
+class AsyncServer;
 
+// a call in flight on a completion queue, each of its pending operations
+// has a Tag of its own
 class CallData {
-public:
-  CallData(RubbleKvStoreService::AsyncService* service, 
-           ServerCompletionQueue* cq, 
-           rocksdb::DB* db, 
-           std::shared_ptr<Channel> channel)
-    :service_(service),
-     cq_(cq),
-     channel_(channel),
-     responder_(&ctx_),
-     status_(CREATE),
-     db_(db), impl_((rocksdb::DBImpl*)db_), 
-     mu_(impl_->mutex()),
-     version_set_(impl_->TEST_GetVersionSet()),
-     db_options_(version_set_->db_options()),
-     is_rubble_(db_options_->is_rubble),
-     is_head_(db_options_->is_primary),
-     is_tail_(db_options_->is_tail),
-     piggyback_edits_(db_options_->piggyback_version_edits),
-     edits_(db_options_->edits),
-     db_path_(db_options_->db_paths.front()),
-     column_family_set_(version_set_->GetColumnFamilySet()),
-     default_cf_(column_family_set_->GetDefault()),
-     ioptions_(default_cf_->ioptions()),
-     cf_options_(default_cf_->GetCurrentMutableCFOptions()),
-     fs_(ioptions_->fs) {
-       Proceed();
-    }
-
-  void Proceed();
-
-  void HandleOp();
-
-  // calling UpdateSstView and logAndApply
-  std::string ApplyVersionEdits(const std::string& args);
-  
-  std::string ApplyOneVersionEdit(std::vector<rocksdb::VersionEdit>& edits);
-
-  // parse the version edit json string to rocksdb::VersionEdit 
-  rocksdb::VersionEdit ParseJsonStringToVersionEdit(const json& j_edit /* json version edit */);
-
-  rocksdb::IOStatus UpdateSstViewAndShipSstFiles(const rocksdb::VersionEdit& edit);
-
-private:
-
-  // db instance
-  rocksdb::DB* db_;
-  rocksdb::DBImpl* impl_ = nullptr;
-  rocksdb::InstrumentedMutex* mu_;
-  rocksdb::VersionSet* version_set_;
-  const rocksdb::ImmutableDBOptions* db_options_;
-
-  bool is_rubble_ = false;
-  bool is_head_ = false;
-  bool is_tail_ = false;
-  bool piggyback_edits_ = false;
-  std::shared_ptr<Edits> edits_;
-  rocksdb::DbPath db_path_;
-
-  rocksdb::ColumnFamilySet* column_family_set_;
-  rocksdb::ColumnFamilyData* default_cf_;
-  const rocksdb::ImmutableCFOptions* ioptions_;
-  const rocksdb::MutableCFOptions* cf_options_;
-  rocksdb::FileSystem* fs_;
-
-  // status of the db after performing an operation.
-  rocksdb::Status s_;
-
-  std::shared_ptr<Channel> channel_ = nullptr;
-  std::shared_ptr<Forwarder> forwarder_ = nullptr;
-
-  // The means of communication with the gRPC runtime for an asynchronous
-  // server.
-  RubbleKvStoreService::AsyncService* service_;
-  // The producer-consumer queue where for asynchronous server notifications.
-  ServerCompletionQueue* cq_;
-
-  // Context for the rpc, allowing to tweak aspects of it such as the use
-  // of compression, authentication, as well as to send metadata back to the
-  // client.
-  ServerContext ctx_;
-
-  // The means to get back to the client.
-  ServerAsyncResponseWriter<OpReply> responder_;
-
-  // What we get from the client.
-  Op request_;
-  // What we send back to the client.
-  OpReply reply_;
-
-  // Let's implement a tiny state machine with the following states.
-  enum CallStatus { CREATE, PROCESS, FINISH };
-  // The current serving state.
-  CallStatus status_;
+  public:
+    virtual ~CallData() {}
+
+    enum Event { CONNECT, READ, WRITE, FINISH };
+
+    struct Tag {
+      CallData* call;
+      Event event;
+    };
+
+    // ok is what the completion queue returned for the tag
+    virtual void Proceed(Event event, bool ok) = 0;
+};
+
+class DoOpCall;
+
+// runs the ops of the DoOp streams assigned to it, the ops of a stream in
+// the order they were read. A stream whose ops wait for a later memtable is
+// parked instead of blocking the worker, see RubbleKvServiceImpl::WaitOpStream
+class OpWorker {
+  public:
+    // queue the call to run its pending ops, see DoOpCall::Schedule
+    void Push(DoOpCall* call);
+
+    void Run();
+
+    void Stop();
+
+  private:
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<DoOpCall*> runnable_;
+    bool stop_ = false;
 };
 
-class ServerImpl final {
+// one DoOp stream. The polling thread of its completion queue reads the ops
+// and writes the replies, its worker handles them
+class DoOpCall final : public CallData {
   public:
-  ServerImpl(const std::string& server_addr, rocksdb::DB* db, RubbleKvStoreService::AsyncService* service);
+    DoOpCall(AsyncServer* server, ServerCompletionQueue* cq);
+
+    void Proceed(Event event, bool ok) override;
+
+    // worker: handle the ops read so far, close the stream once the client
+    // is done
+    void Drain();
+
+  private:
+    // ops read ahead of the worker, reads pause beyond that
+    static const size_t kMaxPendingOps = 64;
+
+    // requires mu_
+    void StartRead();
+
+    void Write(OpReply* reply);
+
+    // requires mu_, returns true if the caller has to finish the stream
+    bool ShouldFinish();
+
+    // wait for the memtable of the first buffered op without blocking
+    void Park();
+
+    // push the call to its worker, unless it is there already or parked
+    void Schedule();
+
+    AsyncServer* server_;
+    ServerCompletionQueue* cq_;
+    OpWorker* worker_ = nullptr;
+
+    ServerContext ctx_;
+    ServerAsyncReaderWriter<OpReply, Op> stream_;
+    Tag connect_tag_{this, CONNECT};
+    Tag read_tag_{this, READ};
+    Tag write_tag_{this, WRITE};
+    Tag finish_tag_{this, FINISH};
+
+    // only touched by the worker
+    RubbleKvServiceImpl::OpStream* op_stream_ = nullptr;
+
+    std::mutex mu_;
+    Op* read_op_ = nullptr;
+    std::deque<Op*> pending_;
+    // a Read is in flight
+    bool reading_ = false;
+    // the client closed its side of the stream
+    bool read_done_ = false;
+    // queued on or running on the worker
+    bool scheduled_ = false;
+    // waiting for a memtable, the wake up schedules it again
+    bool parked_ = false;
+    // the direct read replies not written yet, the first one is in flight
+    std::deque<OpReply*> writes_;
+    bool writing_ = false;
+    // the worker is done with the stream
+    bool closed_ = false;
+    bool finishing_ = false;
+    // the stream is finished with it, see RubbleKvServiceImpl::OpStreamStatus
+    Status finish_status_;
+    // the finish tag came back
+    bool finished_ = false;
+};
+
+// a Sync stream, the requests are handled on the thread of the Sync
+// completion queue in the order they arrive
+class SyncCall final : public CallData {
+  public:
+    SyncCall(AsyncServer* server, ServerCompletionQueue* cq);
+
+    void Proceed(Event event, bool ok) override;
+
+  private:
+    AsyncServer* server_;
+    ServerCompletionQueue* cq_;
+    ServerContext ctx_;
+    ServerAsyncReaderWriter<SyncReply, SyncRequest> stream_;
+    SyncRequest request_;
+    Tag connect_tag_{this, CONNECT};
+    Tag read_tag_{this, READ};
+    Tag finish_tag_{this, FINISH};
+};
+
+class RecoverCall final : public CallData {
+  public:
+    RecoverCall(AsyncServer* server, ServerCompletionQueue* cq);
+
+    void Proceed(Event event, bool ok) override;
+
+  private:
+    AsyncServer* server_;
+    ServerCompletionQueue* cq_;
+    ServerContext ctx_;
+    ServerAsyncResponseWriter<RecoverReply> responder_;
+    RecoverRequest request_;
+    RecoverReply reply_;
+    Tag connect_tag_{this, CONNECT};
+    Tag finish_tag_{this, FINISH};
+};
+
+// Serves the rpcs of a node with the asynchronous gRPC api, see
+// async_server_cqs. The DoOp streams are spread over async_server_cqs
+// completion queues, Sync and Recover have one each, every queue is polled
+// by one thread. The ops themselves run on the workers, so a thread never
+// blocks on a slow stream while others wait behind it on the same queue
+class AsyncServer final {
+  public:
+    AsyncServer(const std::string& server_addr, rocksdb::DB* db,
+                RubbleKvServiceImpl* service_impl);
+
+    ~AsyncServer();
+
+    // returns once the server is shut down
+    void Run();
+
+    RubbleKvServiceImpl* service_impl() { return service_impl_; }
+
+    AsyncRubbleService* service() { return &service_; }
 
-  ~ServerImpl();
+    // the worker of a new DoOp stream
+    OpWorker* PickWorker();
 
-  // There is no shutdown handling in this code.
-  void Run(int g_thread_num, int g_pool, int g_cq_num);
+  private:
+    void HandleRpcs(ServerCompletionQueue* cq);
 
- private:
+    // pin the thread to the core if async_server_pin_threads is set
+    void PinThread(std::thread* thread, int core);
 
-  // This can be run in multiple threads if needed.
-  void HandleRpcs(int cq_idx);
+    const std::string server_addr_;
+    const rocksdb::ImmutableDBOptions* db_options_;
+    RubbleKvServiceImpl* service_impl_;
+    AsyncRubbleService service_;
+    std::unique_ptr<Server> server_;
 
-  rocksdb::IOStatus CreateSstPool();
+    std::vector<std::unique_ptr<ServerCompletionQueue>> op_cqs_;
+    std::unique_ptr<ServerCompletionQueue> sync_cq_;
+    std::unique_ptr<ServerCompletionQueue> recover_cq_;
+    std::vector<std::thread> cq_threads_;
 
-  std::shared_ptr<Channel> channel_ = nullptr;
-  std::vector<std::unique_ptr<ServerCompletionQueue>>  m_cq;
-  RubbleKvStoreService::AsyncService* service_;
-  std::unique_ptr<Server> server_;
-  const std::string& server_addr_;
-  ServerBuilder builder_;
-  rocksdb::DB* db_;
+    std::vector<std::unique_ptr<OpWorker>> workers_;
+    std::vector<std::thread> worker_threads_;
+    std::atomic<uint64_t> next_worker_{0};
 };
 
-void RunAsyncServer(rocksdb::DB* db, const std::string& server_addr);
\ No newline at end of file
+// serve the db with the async server, see async_server_cqs
+void RunAsyncServer(rocksdb::DB* db, const std::string& server_addr);
@@ -1,12 +1,17 @@
 #include "rubble_sync_server.h"
+#include <algorithm>
 #include <atomic>
 #include <thread>
 #include <chrono>
 #include <inttypes.h>
 #include "db/memtable.h"
 #include "db/ship_job.h"
+#include "rocksdb/write_batch.h"
 #include <ctime>
 #include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <linux/falloc.h>
 #include <error.h>
 #include <string.h>
 #include <shared_mutex>
@@ -23,7 +28,6 @@ static std::mutex debug_mu;
 static std::mutex buffers_mu;
 static std::map<uint64_t, uint64_t> primary_op_cnt_map;
 
-#define G_MEM_ARR_LEN 1024
 #define BATCH_SIZE 1000
 
 void PrintStatus(RubbleKvServiceImpl *srv) {
@@ -74,16 +78,32 @@ RubbleKvServiceImpl::RubbleKvServiceImpl(rocksdb::DB* db)
        status_thread_(PrintStatus, this) {
         status_thread_.detach();
         if(is_rubble_ && !is_head_) {
-          std::cout << "init sync_service --- is_rubble: " << is_rubble_ << "; is_head: " << is_head_ << std::endl;
-          std::cout << "db_option_->sst_pool_dir: " << db_options_->sst_pool_dir << std::endl;
           ios_ = CreateSstPool();
           if(!ios_.ok()) {
-            std::cout << "allocate sst pool failed :" << ios_.ToString() << std::endl;
+            RUBBLE_LOG_ERROR(logger_, "allocate sst pool in %s failed : %s\n",
+                             db_options_->sst_pool_dir.c_str(), ios_.ToString().c_str());
             assert(false);
           }
-          std::cout << "[secondary] sst pool allocation finished" << std::endl;
+          if (db_options_->sst_prewarm_threads > 0 || db_options_->verify_shipped_sst) {
+            prewarm_pool_.reset(new rocksdb::ThreadPoolImpl());
+            prewarm_pool_->SetBackgroundThreads(std::max(db_options_->sst_prewarm_threads, 1));
+          }
+        }
+        // the other nodes never write a WAL, with chain_group_commit they rely
+        // on the head's. A head that is also the tail has no one to send the
+        // watermark to, so it syncs the WAL with the writes instead, which
+        // rocksdb still does once for a whole write group
+        write_options_.disableWAL = !(is_head_ && db_options_->chain_group_commit);
+        if (is_head_ && db_options_->chain_group_commit) {
+          if (is_tail_) {
+            write_options_.sync = true;
+          } else {
+            wal_syncer_.reset(new WalSyncer(db_));
+          }
+        }
+        if (db_options_->serve_direct_reads && !is_tail_) {
+          uncommitted_.reset(new UncommittedWrites());
         }
-        std::cout << "target address : " << db_options_->target_address << std::endl;
         if(db_options_->target_address != "") {
           channel_ = db_options_->channel;
           assert(channel_ != nullptr);
@@ -92,18 +112,17 @@ RubbleKvServiceImpl::RubbleKvServiceImpl(rocksdb::DB* db)
           primary_channel_ = db_options_->primary_channel;
           assert(primary_channel_ != nullptr);
         }
-        // Rubble: sanity check
-        // std::cout << "[RubbleKvServiceImpl] cfd->current\n"
-        //     << default_cf_->BriefDebugString()
-        //     << "\nsv->current\n"
-        //     << default_cf_->GetSuperVersion()->BriefDebugString()
-        //     << std::endl;
     };
 
 RubbleKvServiceImpl::~RubbleKvServiceImpl(){
   std::cout << "Deconstruct RubbleKvServiceImpl\n";
+  if (prewarm_pool_ != nullptr) {
+    // the prewarm jobs use the table cache of the db
+    prewarm_pool_->WaitForJobsAndJoinAllThreads();
+  }
+  wal_syncer_.reset();
   delete db_;
-  for (std::map< std::thread::id, std::map< uint64_t, std::queue<SingleOp*> >* >::iterator it = buffers_.begin();
+  for (std::map< OpStream*, std::map< uint64_t, std::queue<SingleOp*> >* >::iterator it = buffers_.begin();
     it != buffers_.end(); it++) {
       assert(it->second->size() == 0);
       delete it->second;
@@ -136,83 +155,218 @@ size_t RubbleKvServiceImpl::QueuedEditNum() {
 
 Status RubbleKvServiceImpl::DoOp(ServerContext* context, 
               ServerReaderWriter<OpReply, Op>* stream) {
+    OpStream* op_stream = OpenOpStream();
+
+    // read straight into a pooled Op, it is released in PostProcessing
+    MessagePool<Op>& op_pool = MessagePool<Op>::ThreadLocal();
+    MessagePool<OpReply>& reply_pool = MessagePool<OpReply>::ThreadLocal();
+    Op* request = op_pool.Acquire();
+    Status status = Status::OK;
+    while (stream->Read(request)) {
+      status = OpStreamStatus();
+      if (!status.ok()) {
+        break;
+      }
+      OpReply* stream_reply = nullptr;
+      bool taken = HandleStreamOp(op_stream, request, &stream_reply);
+      if (stream_reply != nullptr) {
+        stream->Write(*stream_reply);
+        reply_pool.Release(stream_reply);
+      }
+      if (taken) {
+        request = op_pool.Acquire();
+      }
+    }
+    op_pool.Release(request);
+
+    CloseOpStream(op_stream);
+    return status;
+}
+
+Status RubbleKvServiceImpl::OpStreamStatus() {
+    if (wal_syncer_ != nullptr) {
+      rocksdb::Status s = wal_syncer_->status();
+      if (!s.ok()) {
+        // the tail never replies to the writes the WAL may have lost
+        return Status(grpc::StatusCode::UNAVAILABLE, "WAL sync failed : " + s.ToString());
+      }
+    }
+    return Status::OK;
+}
+
+RubbleKvServiceImpl::OpStream* RubbleKvServiceImpl::OpenOpStream() {
     // initialize the forwarder and reply client
-    int shard_idx = -1;
-    int client_idx = -1;
-    Forwarder* forwarder = nullptr;
-    ReplyClient* reply_client = nullptr;
-    if(!db_options_->is_tail) {
-      forwarder = new Forwarder(channel_);
+    OpStream* stream = new OpStream();
+    if (insert_tail_) {
+      stream->forwarder = new Forwarder(tail_channel_);
+    } else if (!is_tail_) {
+      stream->forwarder = new Forwarder(channel_);
+    } else if (remove_tail_) {
+      stream->reply_client = new ReplyClient(replicator_channel_);
     } else if (channel_ != nullptr) {
-      reply_client = new ReplyClient(channel_);
+      stream->reply_client = new ReplyClient(channel_);
     }
 
-    Op tmp_op;
-    std::map<uint64_t, std::queue<SingleOp *>> *op_buffer = 
-      new std::map<uint64_t, std::queue<SingleOp *>>();
+    stream->op_buffer = new std::map<uint64_t, std::queue<SingleOp *>>();
+    // SCANs of this stream reuse the same iterators
+    stream->scan_iters.reset(new ScanIteratorPool(db_));
 
     buffers_mu.lock();
-    buffers_[std::this_thread::get_id()] = op_buffer;
+    buffers_[stream] = stream->op_buffer;
     buffers_mu.unlock();
 
     num_stream.fetch_add(1);
     // std::cout << "num_stream: " << num_stream.load() << std::endl;
+    return stream;
+}
 
-    std::shared_ptr<grpc::Channel> recovery_channel = nullptr;
+bool RubbleKvServiceImpl::HandleStreamOp(OpStream* stream, Op* request,
+                                         OpReply** stream_reply, bool wait) {
+    Forwarder*& forwarder = stream->forwarder;
+    ReplyClient*& reply_client = stream->reply_client;
+    MessagePool<OpReply>& reply_pool = MessagePool<OpReply>::ThreadLocal();
+
+    if (wait && catching_up_) {
+      // a new tail only takes ops once it has the primary's snapshot,
+      // meanwhile they queue up in the stream. The async server parks the
+      // stream instead, see PollOpStream
+      std::unique_lock<std::mutex> lk{catch_up_mu_};
+      catch_up_cv_.wait(lk, [&] { return !catching_up_; });
+    }
 
-    while (stream->Read(&tmp_op)) {
-      if (remove_tail_) {
-        // We are the new tail now, so build the reply client
-        std::string replicator_addr = "10.10.1.1:50040";
-        recovery_channel = grpc::CreateChannel(replicator_addr, grpc::InsecureChannelCredentials());
-        reply_client = new ReplyClient(recovery_channel);
-        is_tail_ = true;
+    if (uncommitted_ != nullptr) {
+      for (int32_t id : request->committed()) {
+        uncommitted_->Commit(id);
       }
+    }
+    if (IsCommitNotice(request)) {
+      return false;
+    }
 
-      if (shard_idx == -1) {
-        shard_idx = tmp_op.shard_idx();
-        client_idx = tmp_op.client_idx();
-        if (forwarder != nullptr) {
-          forwarder->set_idx(shard_idx, client_idx);
-        }
-        if (reply_client != nullptr) {
-          reply_client->set_idx(shard_idx, client_idx);
+    if (request->direct_read()) {
+      // a clean read from the replicator's read stream to this node, it
+      // has no client of its own and is answered right here
+      OpReply* reply = reply_pool.Acquire();
+      if (HandleDirectRead(request, reply, stream->scan_iters.get()) || forwarder == nullptr) {
+        *stream_reply = reply;
+        return false;
+      }
+      // this node may hold a value the tail doesn't have yet, the read goes
+      // down the chain like any other and the tail answers it
+      reply_pool.Release(reply);
+      request->set_direct_read(false);
+    }
+
+    if (remove_tail_ && forwarder != nullptr) {
+      // We are the new tail now, so build the reply client
+      forwarder->WritesDone();
+      delete forwarder;
+      forwarder = nullptr;
+      if (reply_client == nullptr) {
+        reply_client = new ReplyClient(replicator_channel_);
+        if (stream->shard_idx != -1) {
+          reply_client->set_idx(stream->shard_idx, stream->client_idx);
         }
       }
-      assert(shard_idx == tmp_op.shard_idx());
-      assert(client_idx == tmp_op.client_idx());
+    } else if (insert_tail_ && forwarder == nullptr) {
+      // a new tail joined behind us, pass the ops on from now on. The
+      // replies held for the head's WAL still go out from here
+      forwarder = new Forwarder(tail_channel_);
+      if (stream->shard_idx != -1) {
+        forwarder->set_idx(stream->shard_idx, stream->client_idx);
+      }
+    }
 
-      // if (is_rubble_ && !is_head_) {
-      //   ApplyBufferedVersionEdits();
-      // }
+    if (stream->shard_idx == -1) {
+      stream->shard_idx = request->shard_idx();
+      stream->client_idx = request->client_idx();
+      if (forwarder != nullptr) {
+        forwarder->set_idx(stream->shard_idx, stream->client_idx);
+      }
+      if (reply_client != nullptr) {
+        reply_client->set_idx(stream->shard_idx, stream->client_idx);
+      }
+      if (wal_syncer_ != nullptr) {
+        wal_syncer_->AddStream(forwarder);
+      }
+    }
+    assert(stream->shard_idx == request->shard_idx());
+    assert(stream->client_idx == request->client_idx());
 
-      Op* request = new Op(tmp_op);
-      OpReply* reply = new OpReply();
-      reply->set_time(request->time());
-      // if (request->ops(0).type() == rubble::PUT) {
-      //   for (int i = 0; i < request->ops_size(); i++) {
-      //     std::cout << "Check key: " << request->ops(i).key() << " value: " << request->ops(i).value() << std::endl;
-      //   }
-      // }
+    // if (is_rubble_ && !is_head_) {
+    //   ApplyBufferedVersionEdits();
+    // }
 
-      if (IsTermination(request)) {
-        std::cout << "Received termination msg\n";
-        if (is_rubble_ && !is_head_) {
-          CleanBufferedOps(forwarder, reply_client, op_buffer);
-        }
-        
-        if (forwarder != nullptr) {
-          forwarder->Forward(*request);
-        }
-        continue;
+    // if (request->ops(0).type() == rubble::PUT) {
+    //   for (int i = 0; i < request->ops_size(); i++) {
+    //     std::cout << "Check key: " << request->ops(i).key() << " value: " << request->ops(i).value() << std::endl;
+    //   }
+    // }
+
+    if (IsWatermark(request)) {
+      if (reply_client != nullptr) {
+        ReleaseDurableReplies(reply_client, request->durable_seq());
+      }
+      if (forwarder != nullptr) {
+        forwarder->Forward(*request);
       }
+      return false;
+    }
 
-      // RUBBLE_LOG_INFO(logger_ , "[Request] Got %u\n", static_cast<uint32_t>(request->id()));
-      // printf("[Request] Got %u\n", static_cast<uint32_t>(request->id()));
-      HandleOp(request, reply, forwarder, reply_client, op_buffer);
+    if (IsTermination(request)) {
+      std::cout << "Received termination msg\n";
+      if (is_rubble_ && !is_head_) {
+        CleanBufferedOps(forwarder, reply_client, stream->op_buffer);
+      }
+      
+      if (forwarder != nullptr) {
+        forwarder->Forward(*request);
+      }
+      // the next read reuses the request
+      return false;
+    }
 
+    OpReply* reply = reply_pool.Acquire();
+    reply->set_time(request->time());
+    // RUBBLE_LOG_INFO(logger_ , "[Request] Got %u\n", static_cast<uint32_t>(request->id()));
+    // printf("[Request] Got %u\n", static_cast<uint32_t>(request->id()));
+    HandleOp(request, reply, forwarder, reply_client, stream->op_buffer,
+             stream->scan_iters.get(), wait);
+    return true;
+}
+
+uint64_t RubbleKvServiceImpl::PollOpStream(OpStream* stream) {
+    if (catching_up_) {
+      return kCatchUpWait;
+    }
+    poll_op_buffer(stream->forwarder, stream->reply_client, stream->op_buffer);
+    if (stream->op_buffer->empty()) {
+      return 0;
     }
+    return stream->op_buffer->begin()->first;
+}
 
+void RubbleKvServiceImpl::WaitOpStream(OpStream* stream, std::function<void()> wake) {
+    {
+      std::unique_lock<std::mutex> lk{catch_up_mu_};
+      if (catching_up_) {
+        catch_up_wakes_.push_back(std::move(wake));
+        return;
+      }
+    }
+    if (stream->op_buffer->empty()) {
+      // parked for a catch up that is over already
+      wake();
+      return;
+    }
+    uint64_t id = stream->op_buffer->begin()->first;
+    default_cf_->mem_epoch()->WaitAsync(id, [this, id] {
+      return this->should_execute(id);
+    }, std::move(wake));
+}
+
+void RubbleKvServiceImpl::CloseOpStream(OpStream* stream) {
+    assert(stream->op_buffer->empty());
     num_stream.fetch_add(-1);
     // std::cout << "num_stream: " << num_stream.load() << std::endl;
 
@@ -220,23 +374,42 @@ Status RubbleKvServiceImpl::DoOp(ServerContext* context,
     
     // std::cout << "end while loop with " << r_op_counter_.load() << " read and " 
     //           << w_op_counter_.load() << " write ops done. client "
-    //           << client_idx << " shard " << shard_idx << std::endl;
+    //           << stream->client_idx << " shard " << stream->shard_idx << std::endl;
 
-    if (forwarder != nullptr) {
-      forwarder->WritesDone();
+    if (stream->forwarder != nullptr) {
+      if (wal_syncer_ != nullptr && stream->shard_idx != -1) {
+        wal_syncer_->RemoveStream(stream->forwarder);
+      }
+      stream->forwarder->WritesDone();
       time_t t = time(0);
       // std::cout << "forwarder->WritesDone " << ctime(&t) << std::endl;
-      delete forwarder;
+      delete stream->forwarder;
     }
 
-    if (reply_client != nullptr) {
+    if (stream->reply_client != nullptr) {
+      // the head sends a last watermark before it closes its stream, see
+      // WalSyncer::RemoveStream, so the writes of the replies still held
+      // may not be in its WAL
+      std::vector<OpReply*> failed;
+      stream->reply_client->FailHeldReplies(
+          rocksdb::Status::Aborted("the head's WAL is not synced").ToString(), &failed);
+      if (!failed.empty()) {
+        RUBBLE_LOG_ERROR(logger_, "Failed %zu replies held for the head's WAL\n", failed.size());
+      }
+      for (OpReply* reply : failed) {
+        MessagePool<OpReply>::ThreadLocal().Release(reply);
+      }
       // reply_client->WritesDone();
       time_t t = time(0);
       // std::cout << "reply_client->WritesDone " << ctime(&t) << std::endl;
-      delete reply_client;
+      delete stream->reply_client;
     }
 
-    return Status::OK;
+    buffers_mu.lock();
+    buffers_.erase(stream);
+    buffers_mu.unlock();
+    delete stream->op_buffer;
+    delete stream;
 }
 
 void RubbleKvServiceImpl::SetDoOpReplyMessage(OpReply *reply) {
@@ -250,10 +423,6 @@ void RubbleKvServiceImpl::SetDoOpReplyMessage(OpReply *reply) {
   j_reply["DeletedSlots"] = deleted_slots_json;
 
   reply->set_sync_reply(j_reply.dump());
-  if (deleted_slots_.size() > 0) {
-    std::cout << "my doop reply message: " << j_reply.dump() << std::endl;
-    std::cout << "deleted slots: " << deleted_slots_json.dump() << std::endl;
-  }
   deleted_slots_.clear();
 }
 
@@ -346,19 +515,28 @@ should_execute(uint64_t target_mem_id) {
 
 void RubbleKvServiceImpl::HandleOp(Op* op, OpReply* reply,
                                    Forwarder* forwarder, ReplyClient* reply_client,
-                                   std::map<uint64_t, std::queue<SingleOp*>>* op_buffer) {
+                                   std::map<uint64_t, std::queue<SingleOp*>>* op_buffer,
+                                   ScanIteratorPool* scan_iters, bool wait) {
   assert(op->ops_size() > 0);
   assert(op->ops_size() <= BATCH_SIZE);
   assert(reply->replies_size() == 0);
 
   reply->set_shard_idx(op->shard_idx());
   reply->set_client_idx(op->client_idx());
+  reply->set_id(op->id());
+
+  if (uncommitted_ != nullptr && forwarder != nullptr) {
+    // before any of the writes can be read here, see HandleDirectRead
+    uncommitted_->Add(*op);
+  }
 
   batch_counter_.fetch_add(1);
   // There is a bug that op->ops_size() might change to a very large number,
   // so we preserve the ops_size as the loop condition
   // TODO: fix the bug
   int ops_size = op->ops_size();
+  // in-order PUTs for the same memtable not applied yet
+  std::vector<SingleOp*> run;
   for (int i = 0; i < ops_size; i++) {
     SingleOp* singleOp = op->mutable_ops(i);
     
@@ -375,35 +553,47 @@ void RubbleKvServiceImpl::HandleOp(Op* op, OpReply* reply,
     assert((uint64_t)reply == singleOp->reply_ptr());
 
     uint64_t id = singleOp->target_mem_id();
+    if (IsCaughtUpWrite(singleOp)) {
+      // the snapshot has it already, only the reply is missing
+      HandleWriteRun(&run, forwarder, reply_client);
+      if (forwarder == nullptr) {
+        AddWriteReply(singleOp, rocksdb::Status::OK());
+      }
+      PostProcessing(singleOp, forwarder, reply_client);
+      continue;
+    }
+    if (is_batchable_write(singleOp)) {
+      if (!run.empty() && run.front()->target_mem_id() != id) {
+        HandleWriteRun(&run, forwarder, reply_client);
+      }
+      // the buffered ops can't go before the run is applied, so there
+      // is no need to poll either
+      run.push_back(singleOp);
+      continue;
+    }
+    HandleWriteRun(&run, forwarder, reply_client);
+
     if (!is_ooo_write(singleOp)) {
-      HandleSingleOp(singleOp, forwarder, reply_client);
+      HandleSingleOp(singleOp, forwarder, reply_client, scan_iters);
     } else {
-      // The order of setting g_mem_op_cnt_arr/g_mem_id_arr and check if mem->GetID() == switched_mem is important.
       // To switch a memtable in Rubble secondaries, we have to make sure its num_operations equals to num_target_op,
       // which means we should set the num_target_op field for every memtable. The set_num_target_op() only happens in
-      // two places, i.e., here and DBImpl::SwitchMemTable(). We made the following ordering to guarantee at least one
-      // check will succeed.
-      //
-      // Time
-      // | Thread 1 (SwitchMemtable)               Thread 2 (HandleOp)
-      // | cfd->SetMemtable(new_mem)               set g_mem_op_cnt_arr[id]
-      // | check if (g_mem_id_arr[id] == mem_id)   set g_mem_id_arr[id]
-      // |                                         mem = default_cf_->mem()
-      // |                                         check if (mem->GetID() == switched_mem)
-      // v
+      // two places, i.e., here and DBImpl::SwitchMemTable(). Record the count first and check the memtable after,
+      // see MemTableEpoch for why at least one of them sets it.
       if (singleOp->mem_op_cnt() != 0) {
         uint64_t target_mem = singleOp->target_mem_id();
         uint64_t switched_mem = target_mem - 1;
         uint64_t target_op_cnt = singleOp->mem_op_cnt();
         // std::cout << "received mem_op_cnt for mem " << switched_mem << " target_op_cnt " << target_op_cnt << std::endl;
 
-        rocksdb::g_mem_op_cnt_arr[switched_mem % G_MEM_ARR_LEN] = target_op_cnt;
-        rocksdb::g_mem_id_arr[switched_mem % G_MEM_ARR_LEN] = switched_mem;
+        default_cf_->mem_epoch()->SetTargetOpCount(switched_mem, target_op_cnt);
         rocksdb::MemTable* mem = default_cf_->mem();
 
         if (mem->GetID() == switched_mem) {
           // std::cout << "set " << mem->GetID() << " 's target_op to " << target_op_cnt << std::endl;
           mem->set_num_target_op(target_op_cnt);
+          // the memtable may be full already
+          default_cf_->mem_epoch()->Notify(target_mem);
         }
       }
 
@@ -413,25 +603,19 @@ void RubbleKvServiceImpl::HandleOp(Op* op, OpReply* reply,
 
     poll_op_buffer(forwarder, reply_client, op_buffer);
   }
-  
+  HandleWriteRun(&run, forwarder, reply_client);
+  poll_op_buffer(forwarder, reply_client, op_buffer);
 
-  while (!op_buffer->empty()) {
-    // while not empty
-    // 1. lock
-    // 2. check should_exe
-    // 3.1 if no
-    //     wait
-    // 3.2 if yes
-    //     unlock and poll_op_buffer
+
+  // the async server parks the stream instead, see WaitOpStream
+  while (wait && !op_buffer->empty()) {
+    // while not empty, wait until the first buffered memtable can go,
+    // then poll_op_buffer
     // std::cout << "[DoOp] start polling op buffer, current memtable id " << default_cf_->mem()->GetID() << std::endl;
     auto it = op_buffer->begin();
-    std::unique_lock<std::mutex> lk{*db_options_->op_buffer_mu};
-    if (!should_execute(it->first)) {
-      db_options_->op_buffer_cv->wait(lk, [&] {
-        return this->should_execute(it->first);
-      });
-    }
-    lk.unlock();
+    default_cf_->mem_epoch()->Wait(it->first, [&] {
+      return this->should_execute(it->first);
+    });
     poll_op_buffer(forwarder, reply_client, op_buffer);
 
 
@@ -450,6 +634,109 @@ void RubbleKvServiceImpl::HandleOp(Op* op, OpReply* reply,
   }
 }
 
+bool RubbleKvServiceImpl::HandleDirectRead(Op* op, OpReply* reply, ScanIteratorPool* scan_iters) {
+  assert(op->ops_size() > 0);
+  reply->set_shard_idx(op->shard_idx());
+  reply->set_client_idx(op->client_idx());
+  reply->set_id(op->id());
+  reply->set_time(op->time());
+
+  int ops_size = op->ops_size();
+  for (int i = 0; i < ops_size; i++) {
+    SingleOp* singleOp = op->mutable_ops(i);
+    assert(singleOp->type() == rubble::GET || singleOp->type() == rubble::MULTIGET);
+    // without an op_ptr PostProcessing leaves the reply to the caller
+    singleOp->set_op_ptr((uint64_t)nullptr);
+    singleOp->set_reply_ptr((uint64_t)reply);
+    HandleSingleOp(singleOp, nullptr, nullptr, scan_iters);
+  }
+
+  if (uncommitted_ == nullptr) {
+    return true;
+  }
+  // checked after the reads, a value they saw is counted until the tail has it
+  for (int i = 0; i < ops_size; i++) {
+    const SingleOp& singleOp = op->ops(i);
+    if (singleOp.type() == rubble::GET && uncommitted_->IsDirty(singleOp.key())) {
+      return false;
+    }
+    for (const auto& key : singleOp.keys()) {
+      if (uncommitted_->IsDirty(key)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool RubbleKvServiceImpl::IsCaughtUpWrite(SingleOp* singleOp) {
+  uint64_t epoch = catch_up_epoch_.load();
+  if (epoch == 0 || (singleOp->type() != rubble::PUT && singleOp->type() != rubble::UPDATE)) {
+    return false;
+  }
+  uint64_t id = singleOp->target_mem_id();
+  return id != 0 && id < epoch;
+}
+
+bool RubbleKvServiceImpl::is_batchable_write(SingleOp* singleOp) {
+  // the head has to learn the memtable of every single PUT
+  if (is_head_ || singleOp->type() != rubble::PUT) {
+    return false;
+  }
+  return !is_ooo_write(singleOp);
+}
+
+void RubbleKvServiceImpl::HandleWriteRun(std::vector<SingleOp*>* run,
+                                         Forwarder* forwarder, ReplyClient* reply_client) {
+  if (run->empty()) {
+    return;
+  }
+  if (run->size() == 1) {
+    HandleSingleOp(run->front(), forwarder, reply_client);
+    run->clear();
+    return;
+  }
+
+  rocksdb::WriteBatch batch;
+  for (SingleOp* singleOp : *run) {
+    assert(singleOp->target_mem_id() == run->front()->target_mem_id());
+    batch.Put(singleOp->key(), singleOp->value());
+  }
+  rocksdb::Status s = db_->Write(write_options_, &batch);
+  assert(s.get_target_mem_id() != 0);
+  w_op_counter_.fetch_add(run->size());
+  if (!s.ok()) {
+    RUBBLE_LOG_ERROR(logger_, "Write Failed : %s \n", s.ToString().c_str());
+    assert(false);
+  }
+
+  for (SingleOp* singleOp : *run) {
+    if (forwarder == nullptr) {
+      // the whole batch went into the memtable the head put the keys in
+      assert(!is_rubble_ || singleOp->target_mem_id() == s.get_target_mem_id());
+      AddWriteReply(singleOp, s);
+    }
+    PostProcessing(singleOp, forwarder, reply_client);
+  }
+  run->clear();
+}
+
+void RubbleKvServiceImpl::AddWriteReply(SingleOp* singleOp, const rocksdb::Status& s) {
+  OpReply* reply = (OpReply*)singleOp->reply_ptr();
+  SingleOpReply* singleOpReply = reply->add_replies();
+  singleOpReply->set_type(singleOp->type());
+  singleOpReply->set_key(singleOp->key());
+  if (singleOp->type() == rubble::PUT) {
+    singleOpReply->set_keynum(singleOp->keynum());
+  }
+  singleOpReply->set_status(s.ToString());
+  if (s.ok()) {
+    singleOpReply->set_ok(true);
+  } else {
+    singleOpReply->set_ok(false);
+  }
+}
+
 void RubbleKvServiceImpl::poll_op_buffer(Forwarder* forwarder, ReplyClient* reply_client,
                           std::map<uint64_t, std::queue<SingleOp*>>* op_buffer) {
   for (auto it = op_buffer->begin(); it != op_buffer->end();) {
@@ -467,38 +754,55 @@ void RubbleKvServiceImpl::poll_op_buffer(Forwarder* forwarder, ReplyClient* repl
 }
 
 
-void RubbleKvServiceImpl::HandleSingleOp(SingleOp* singleOp, Forwarder* forwarder, ReplyClient* reply_client) {
+void RubbleKvServiceImpl::HandleSingleOp(SingleOp* singleOp, Forwarder* forwarder, ReplyClient* reply_client,
+                                         ScanIteratorPool* scan_iters) {
   rocksdb::Status s;
   // rocksdb::Status ss;
-  std::string value;
+  // pins the value in the block cache or memtable instead of copying it out
+  rocksdb::PinnableSlice value;
   SingleOpReply* singleOpReply;
   OpReply* reply = (OpReply*)singleOp->reply_ptr();
-  rocksdb::WriteOptions wo = rocksdb::WriteOptions();
-  wo.disableWAL = true;
   int iterations = 0;
   int record_cnt;
   rocksdb::ReadOptions ro = rocksdb::ReadOptions(/*verify_checksums*/true, /*fill_cache*/true);
   rocksdb::Iterator* it;
+  std::unique_ptr<rocksdb::Iterator> owned_it;
+  std::vector<rocksdb::Slice> keys;
+  std::vector<rocksdb::PinnableSlice> values;
+  std::vector<rocksdb::Status> statuses;
+  size_t num_keys;
+  rocksdb::Slice upper_bound;
 
   switch (singleOp->type()) {
     case rubble::GET:
-      assert(is_tail_);
-      s = db_->Get(ro, singleOp->key(), &value);
+      // the other nodes only serve direct reads, which have no forwarder
+      assert(is_tail_ || forwarder == nullptr);
+      singleOpReply = reply->add_replies();
+      {
+        // a value that can't be pinned (e.g. a merge result) is built right in
+        // the reply. A pinned one is copied once from the block into the reply,
+        // the only copy before serialization: a string field of the reply owns
+        // its bytes and protobuf has no Cord field that could borrow the block
+        rocksdb::PinnableSlice reply_value(singleOpReply->mutable_value());
+        s = db_->Get(ro, db_->DefaultColumnFamily(), singleOp->key(), &reply_value);
+        if (s.ok() && reply_value.IsPinned()) {
+          singleOpReply->mutable_value()->assign(reply_value.data(), reply_value.size());
+        }
+      }
       // std::cout << "Get status: " << s.ToString() << " key: " << singleOp->key() << std::endl;
       r_op_counter_.fetch_add(1);
       if (!s.ok()){
         RUBBLE_LOG_ERROR(logger_, "Get Failed : %s \n", s.ToString().c_str());
         assert(false);
       }
-      
-      singleOpReply = reply->add_replies();
+
       singleOpReply->set_key(singleOp->key());
       singleOpReply->set_type(rubble::GET);
       singleOpReply->set_status(s.ToString());
       if (s.ok()) {
         singleOpReply->set_ok(true);
-        singleOpReply->set_value(value);
       } else {
+        singleOpReply->clear_value();
         singleOpReply->set_ok(false);
       }
       break;
@@ -506,7 +810,16 @@ void RubbleKvServiceImpl::HandleSingleOp(SingleOp* singleOp, Forwarder* forwarde
     case rubble::SCAN:
       // assert(is_tail_);
       record_cnt = singleOp->record_cnt();
-      it = db_->NewIterator(ro);
+      if (scan_iters != nullptr) {
+        it = scan_iters->Get(singleOp->end_key());
+      } else {
+        if (!singleOp->end_key().empty()) {
+          upper_bound = rocksdb::Slice(singleOp->end_key());
+          ro.iterate_upper_bound = &upper_bound;
+        }
+        owned_it.reset(db_->NewIterator(ro));
+        it = owned_it.get();
+      }
       if (it == nullptr) {
         RUBBLE_LOG_ERROR(logger_, "Scan Failed : %s \n", s.ToString().c_str());
         assert(false);
@@ -517,15 +830,55 @@ void RubbleKvServiceImpl::HandleSingleOp(SingleOp* singleOp, Forwarder* forwarde
       singleOpReply->set_key(singleOp->key());
       singleOpReply->set_type(rubble::SCAN);
       singleOpReply->set_ok(true);
+      singleOpReply->mutable_scanned_values()->Reserve(record_cnt);
       for (it->Seek(rocksdb::Slice(singleOp->key())); it->Valid() && iterations < record_cnt; it->Next()) {
-        singleOpReply->add_scanned_values(it->value().data());
+        // copy the value straight from the pinned block into the reply, values
+        // are not NUL terminated and may contain NUL bytes
+        rocksdb::Slice v = it->value();
+        singleOpReply->add_scanned_values(v.data(), v.size());
         iterations++;
       }
-      delete it;
-      
+      if (scan_iters != nullptr) {
+        scan_iters->Done();
+      }
+      break;
+
+    case rubble::MULTIGET:
+      assert(is_tail_ || forwarder == nullptr);
+      num_keys = static_cast<size_t>(singleOp->keys_size());
+      for (const auto& key : singleOp->keys()) {
+        keys.emplace_back(key);
+      }
+      values.resize(num_keys);
+      statuses.resize(num_keys);
+      // one lookup for the whole batch, it sorts the keys and reads the
+      // blocks of a file together
+      db_->MultiGet(ro, db_->DefaultColumnFamily(), num_keys, keys.data(),
+                    values.data(), statuses.data());
+      r_op_counter_.fetch_add(num_keys);
+
+      singleOpReply = reply->add_replies();
+      singleOpReply->set_type(rubble::MULTIGET);
+      singleOpReply->set_ok(true);
+      singleOpReply->mutable_values()->Reserve(static_cast<int>(num_keys));
+      singleOpReply->mutable_found()->Reserve(static_cast<int>(num_keys));
+      for (size_t i = 0; i < num_keys; i++) {
+        if (statuses[i].ok()) {
+          singleOpReply->add_values(values[i].data(), values[i].size());
+          singleOpReply->add_found(true);
+        } else {
+          if (!statuses[i].IsNotFound()) {
+            RUBBLE_LOG_ERROR(logger_, "MultiGet Failed : %s \n", statuses[i].ToString().c_str());
+            singleOpReply->set_ok(false);
+            singleOpReply->set_status(statuses[i].ToString());
+          }
+          singleOpReply->add_values();
+          singleOpReply->add_found(false);
+        }
+      }
       break;
     case rubble::PUT:
-      s = db_->Put(wo, singleOp->key(), singleOp->value());
+      s = db_->Put(write_options_, singleOp->key(), singleOp->value());
       assert(s.get_target_mem_id() != 0);
       w_op_counter_.fetch_add(1);
       if (!s.ok()) {
@@ -542,44 +895,31 @@ void RubbleKvServiceImpl::HandleSingleOp(SingleOp* singleOp, Forwarder* forwarde
         assert(singleOp->target_mem_id() == 0);
         singleOp->set_target_mem_id(s.get_target_mem_id());
         // std::cout << "id: " << singleOp->target_mem_id() << std::endl;
-        if (rocksdb::g_mem_op_cnt != 0 && s.get_target_mem_id() == rocksdb::g_mem_id) {
-          rocksdb::g_mem_op_cnt_mtx.lock();
-          if (rocksdb::g_mem_op_cnt != 0 && s.get_target_mem_id() == rocksdb::g_mem_id) {
-            // std::cout << "[rubble_sync_server] set " << s.get_target_mem_id() - 1 << " 's mem_op_cnt " << rocksdb::g_mem_op_cnt << std::endl;
-            singleOp->set_mem_op_cnt(rocksdb::g_mem_op_cnt);
-            rocksdb::g_mem_op_cnt = 0;
-            rocksdb::g_mem_id = 0;
-            // std::cout << "[rubble_sync_server] set g_mem_op_cnt to 0\n";
-          }
-          rocksdb::g_mem_op_cnt_mtx.unlock();
+        // the first op in a new memtable carries the op count of the last one
+        uint64_t mem_op_cnt = 0;
+        if (default_cf_->mem_epoch()->ClaimSwitch(s.get_target_mem_id(), &mem_op_cnt)) {
+          // std::cout << "[rubble_sync_server] set " << s.get_target_mem_id() - 1 << " 's mem_op_cnt " << mem_op_cnt << std::endl;
+          singleOp->set_mem_op_cnt(mem_op_cnt);
         }
       }
 
-      if (is_tail_) {
+      if (forwarder == nullptr) {
         // this assertion ensures that the tail put the kv pair into the same mem as the primary
         assert(!is_rubble_ || singleOp->target_mem_id() == s.get_target_mem_id());
-        singleOpReply = reply->add_replies();
-        singleOpReply->set_type(rubble::PUT);
-        singleOpReply->set_key(singleOp->key());
-        singleOpReply->set_keynum(singleOp->keynum());
-        singleOpReply->set_status(s.ToString());
-        if (s.ok()) { 
-          singleOpReply->set_ok(true);
-        } else {
-          singleOpReply->set_ok(false);
-        }  
+        AddWriteReply(singleOp, s);
       }
       break;
 
     case rubble::UPDATE:
-      s = db_->Get(rocksdb::ReadOptions(/*verify_checksums*/true, /*fill_cache*/true), singleOp->key(), &value);
+      // the old value is not sent back, pinning it avoids the copy
+      s = db_->Get(ro, db_->DefaultColumnFamily(), singleOp->key(), &value);
       r_op_counter_.fetch_add(1);
       if (!s.ok()) {
         RUBBLE_LOG_ERROR(logger_, "Get Failed : %s \n", s.ToString().c_str());
         assert(false);
       }
 
-      s = db_->Put(wo, singleOp->key(), singleOp->value());
+      s = db_->Put(write_options_, singleOp->key(), singleOp->value());
       assert(s.get_target_mem_id() != 0);
       w_op_counter_.fetch_add(1);
       if (!s.ok()) {
@@ -591,29 +931,17 @@ void RubbleKvServiceImpl::HandleSingleOp(SingleOp* singleOp, Forwarder* forwarde
         assert(singleOp->target_mem_id() == 0);
         singleOp->set_target_mem_id(s.get_target_mem_id());
         // std::cout << "id: " << singleOp->target_mem_id() << std::endl;
-        if (rocksdb::g_mem_op_cnt != 0 && s.get_target_mem_id() == rocksdb::g_mem_id) {
-          rocksdb::g_mem_op_cnt_mtx.lock();
-          if (rocksdb::g_mem_op_cnt != 0 && s.get_target_mem_id() == rocksdb::g_mem_id) {
-            // std::cout << "set " << s.get_target_mem_id() - 1 << " 's mem_op_cnt " << rocksdb::g_mem_op_cnt << std::endl;
-            singleOp->set_mem_op_cnt(rocksdb::g_mem_op_cnt);
-            rocksdb::g_mem_op_cnt = 0;
-            rocksdb::g_mem_id = 0;
-          }
-          rocksdb::g_mem_op_cnt_mtx.unlock();
+        // the first op in a new memtable carries the op count of the last one
+        uint64_t mem_op_cnt = 0;
+        if (default_cf_->mem_epoch()->ClaimSwitch(s.get_target_mem_id(), &mem_op_cnt)) {
+          // std::cout << "[rubble_sync_server] set " << s.get_target_mem_id() - 1 << " 's mem_op_cnt " << mem_op_cnt << std::endl;
+          singleOp->set_mem_op_cnt(mem_op_cnt);
         }
       }
 
-      if (is_tail_) { 
+      if (forwarder == nullptr) {
         assert(!is_rubble_ || singleOp->target_mem_id() == s.get_target_mem_id());
-        singleOpReply = reply->add_replies();
-        singleOpReply->set_type(rubble::UPDATE);
-        singleOpReply->set_key(singleOp->key());
-        singleOpReply->set_status(s.ToString());
-        if (s.ok()) { 
-          singleOpReply->set_ok(true);
-        } else {
-          singleOpReply->set_ok(false);
-        }  
+        AddWriteReply(singleOp, s);
       }
 
       break;
@@ -657,9 +985,28 @@ void RubbleKvServiceImpl::PostProcessing(SingleOp* singleOp, Forwarder* forwarde
   //   ApplyBufferedVersionEdits();
   // }
 
-  if (is_tail_) {
-    reply_client->SendReply(*reply);
+  // the node at the end of the chain for this stream replies, a tail that
+  // just got a new tail behind it forwards instead
+  if (forwarder == nullptr) {
+    if (request->head_seq() != 0) {
+      ReleaseDurableReplies(reply_client, request->durable_seq());
+      if (request->head_seq() > reply_client->durable_seq() &&
+          reply_client->HoldReply(request->head_seq(), reply)) {
+        // the head's WAL doesn't cover the writes yet
+        reply = nullptr;
+      }
+    }
+    if (reply != nullptr) {
+      reply_client->SendReply(*reply);
+    }
   } else {
+    if (wal_syncer_ != nullptr) {
+      // everything up to here is in the WAL, the tail replies once it's synced
+      uint64_t head_seq = db_->GetLatestSequenceNumber();
+      request->set_head_seq(head_seq);
+      request->set_durable_seq(wal_syncer_->durable_seq());
+      wal_syncer_->RequestSync(head_seq);
+    }
     // if(piggyback_edits_ && is_rubble_ && is_head_) {
     //   std::vector<std::string> edits;
     //   edits_->GetEdits(edits);
@@ -694,8 +1041,18 @@ void RubbleKvServiceImpl::PostProcessing(SingleOp* singleOp, Forwarder* forwarde
     // ApplyDownstreamSstSlotDeletion(deleted_slots);
   }
 
-  delete request;
-  delete reply;
+  MessagePool<Op>::ThreadLocal().Release(request);
+  if (reply != nullptr) {
+    MessagePool<OpReply>::ThreadLocal().Release(reply);
+  }
+}
+
+void RubbleKvServiceImpl::ReleaseDurableReplies(ReplyClient* reply_client, uint64_t durable_seq) {
+  std::vector<OpReply*> sent;
+  reply_client->AdvanceDurableSeq(durable_seq, &sent);
+  for (OpReply* reply : sent) {
+    MessagePool<OpReply>::ThreadLocal().Release(reply);
+  }
 }
 
 // a streaming RPC used by the non-tail node to sync Version(view of sst files) states to the downstream node 
@@ -704,31 +1061,9 @@ Status RubbleKvServiceImpl::Sync(ServerContext* context,
     SyncRequest request;
     // std::cout << "enter Sync loop\n";
     while (stream->Read(&request)) {
-      std::string args = request.args();
-      int rid = request.rid();
-
-      // std::cout << "[Sync] get " << args << std::endl;
-
-      if (!db_options_->is_primary) {
-        BufferVersionEdits(args);
-        
-        if (!is_tail_) {
-          SyncClient* sync_client = rocksdb::GetSyncClient(db_options_);
-          sync_client->Sync(request);
-        }
-      } else {
-        // std::cout << "[Sync] primary: received deleted slots from tail, args: " << args << std::endl;
-        json sync_json = json::parse(args);
-        std::set<uint64_t> tail_deleted_files;
-        for (const auto& j : sync_json["DeletedSlots"]) {
-          int slot = j.get<int>();
-          uint64_t filenumber = db_options_->sst_bit_map->GetSlotFileNum(slot);
-          
-          // std::cout << "apply delete from dowmstream, delete file: " << filenumber << " slot: "
-          //     << slot << std::endl; 
-          tail_deleted_files.insert(filenumber);
-        }
-        db_options_->sst_bit_map->FreeSlot(tail_deleted_files, rid, true);
+      Status s = HandleSync(request);
+      if (!s.ok()) {
+        return s;
       }
 
       // {
@@ -769,6 +1104,52 @@ Status RubbleKvServiceImpl::Sync(ServerContext* context,
     return Status::OK;
 }
 
+Status RubbleKvServiceImpl::HandleSync(const SyncRequest& request) {
+    int rid = request.rid();
+
+    if (!db_options_->is_primary) {
+      if (request.pool_size_size() > 0) {
+        ScheduleSstPoolResize(request);
+      }
+      if (!request.edits().empty()) {
+        // an edit that can't be decoded would leave a hole in the edits
+        // applied in order, don't pass it on either
+        rocksdb::Status s = BufferVersionEdits(request);
+        if (!s.ok()) {
+          return Status(grpc::StatusCode::DATA_LOSS, s.ToString());
+        }
+      }
+
+
+      if (insert_tail_) {
+        std::lock_guard<std::mutex> lk{tail_sync_mu_};
+        tail_sync_client_->Sync(request);
+      } else if (!is_tail_) {
+        SyncClient* sync_client = rocksdb::GetSyncClient(db_options_);
+        sync_client->Sync(request);
+      }
+    } else {
+      // std::cout << "[Sync] primary: received deleted slots from tail, args: " << request.args() << std::endl;
+      json sync_json = json::parse(request.args());
+      std::set<uint64_t> tail_deleted_files;
+      for (const auto& j : sync_json["DeletedSlots"]) {
+        int slot = j.get<int>();
+        uint64_t filenumber = db_options_->sst_bit_map->GetSlotFileNum(slot);
+        
+        // std::cout << "apply delete from dowmstream, delete file: " << filenumber << " slot: "
+        //     << slot << std::endl; 
+        tail_deleted_files.insert(filenumber);
+      }
+      db_options_->sst_bit_map->FreeSlot(tail_deleted_files, rid, true);
+      if (sync_json.contains("PoolSize")) {
+        for (const auto& p : sync_json["PoolSize"].items()) {
+          db_options_->sst_bit_map->ReportPoolSize(rid, std::stoi(p.key()), p.value().get<int>());
+        }
+      }
+    }
+    return Status::OK;
+}
+
 // void RubbleKvServiceImpl::ApplyDownstreamSstSlotDeletion(const std::vector<int>& deleted_slots) {
 //   std::lock_guard<std::mutex> lk{deleted_slots_mu_};
 //   std::stringstream ss;
@@ -788,13 +1169,12 @@ Status RubbleKvServiceImpl::Sync(ServerContext* context,
 void RubbleKvServiceImpl::HandleSyncRequest(const SyncRequest* request, 
                           SyncReply* reply) {
       
-  std::string args = request->args();
-  reply->set_message(ApplyVersionEdits(args));
+  reply->set_message(ApplyVersionEdits(*request));
 }
 
-bool RubbleKvServiceImpl::IsReady(const rocksdb::VersionEdit& edit) {
+bool RubbleKvServiceImpl::IsReady(const rocksdb::VersionEdit& edit, uint64_t pending_mems) {
   if (edit.IsFlush()) {
-    bool ready = flushed_mem.load() + edit.GetBatchCount() < get_mem_id();
+    bool ready = flushed_mem.load() + pending_mems + edit.GetBatchCount() < get_mem_id();
     // std::cout << "[IsReady] flushed_mem " << flushed_mem.load()
     //           << " batch_count " << edit.GetBatchCount()
     //           << " mem_id " << get_mem_id()
@@ -810,73 +1190,444 @@ bool RubbleKvServiceImpl::IsTermination(Op* op) {
   return op->id() == -1;
 }
 
+bool RubbleKvServiceImpl::IsWatermark(Op* op) {
+  return op->id() == -2;
+}
+
+bool RubbleKvServiceImpl::IsCommitNotice(Op* op) {
+  return op->id() == -3;
+}
+
 // heartbeat between Replicator and db servers
-Status RubbleKvServiceImpl::Recover(ServerContext* context, const RecoverRequest* request, Empty* reply) {
+Status RubbleKvServiceImpl::Recover(ServerContext* context, const RecoverRequest* request, RecoverReply* reply) {
+  if (needs_recovery_) {
+    std::lock_guard<std::mutex> lk{recovery_mu_};
+    reply->set_needs_recovery(true);
+    reply->set_error(recovery_status_.ToString());
+  }
   if (request->remove_tail()) {
     if (db_options_->is_primary) {
       // 1. Update SST bitmap
       db_options_->sst_bit_map->RemoveTail(db_options_->rf);
 
       // 2. Update remote dirs in ship job
-      std::string tail_dir = db_options_->remote_sst_dirs.back();
-      db_options_->remote_sst_dirs.pop_back();
-      std::cout << "[Recover] remove " << tail_dir << " from remote_sst_dirs\n";
+      std::string tail_dir;
+      if (db_options_->remote_sst_dirs->RemoveLast(&tail_dir)) {
+        removed_sst_dirs_.push_back(tail_dir);
+        RUBBLE_LOG_INFO(logger_, "[Recover] remove %s from remote_sst_dirs\n", tail_dir.c_str());
+      }
     } else {
-      // 1. Mark self as the new tail
+      // 1. Mark self as the new tail, the DoOp streams switch to the
+      // replicator on their next op
+      std::string replicator_addr = request->tail_address().empty() ?
+          db_options_->replicator_address : request->tail_address();
+      if (replicator_addr.empty()) {
+        return Status(grpc::StatusCode::INVALID_ARGUMENT, "no replicator address for the new tail");
+      }
+      replicator_channel_ = grpc::CreateChannel(replicator_addr, grpc::InsecureChannelCredentials());
+      insert_tail_ = false;
+      is_tail_ = true;
       remove_tail_ = true;
     }
-  } else {
+  } else if (request->insert_tail()) {
+    if (db_options_->is_primary) {
+      if (request->catch_up() == rubble::CATCH_UP_COPY) {
+        return CatchUpCopy(request);
+      } else if (request->catch_up() == rubble::CATCH_UP_SNAPSHOT) {
+        return CatchUpSnapshot(reply);
+      }
+    } else if (!request->tail_address().empty()) {
+      // the new tail goes behind us, pass the version edits and ops on
+      std::shared_ptr<Channel> tail_channel = grpc::CreateChannel(
+          request->tail_address(), grpc::InsecureChannelCredentials());
+      {
+        std::lock_guard<std::mutex> lk{tail_sync_mu_};
+        tail_sync_client_.reset(new SyncClient(tail_channel));
+      }
+      tail_channel_ = tail_channel;
+      remove_tail_ = false;
+      insert_tail_ = true;
+      RUBBLE_LOG_INFO(logger_, "[Recover] insert tail %s\n", request->tail_address().c_str());
+    } else if (request->finish()) {
+      return FinishCatchUp();
+    } else {
+      return BeginCatchUp(request);
+    }
+  }
+  return Status::OK;
+}
+
+Status RubbleKvServiceImpl::CatchUpCopy(const RecoverRequest* request) {
+  std::string dir = request->sst_dir();
+  if (dir.empty()) {
+    if (removed_sst_dirs_.empty()) {
+      return Status(grpc::StatusCode::INVALID_ARGUMENT, "no sst dir for the new tail");
+    }
+    dir = removed_sst_dirs_.back();
+  }
+  if (db_options_->remote_sst_dirs->Add(dir)) {
+    // the ssts built from now on are shipped to the new tail as well
+    removed_sst_dirs_.erase(std::remove(removed_sst_dirs_.begin(), removed_sst_dirs_.end(), dir),
+                            removed_sst_dirs_.end());
+    db_options_->sst_bit_map->AddTail(db_options_->rf);
+  }
+
+  // the slots of the live files, unless the new tail's slot still holds
+  // the same file
+  std::set<uint64_t> live_files;
+  std::set<uint64_t> copied;
+  std::vector<std::pair<uint64_t, int>> to_copy;
+  {
+    rocksdb::InstrumentedMutexLock l(mu_);
+    rocksdb::VersionStorageInfo* vstorage = default_cf_->current()->storage_info();
+    for (int level = 0; level < vstorage->num_levels(); level++) {
+      for (const rocksdb::FileMetaData* f : vstorage->LevelFiles(level)) {
+        uint64_t file_num = f->fd.GetNumber();
+        int slot = db_options_->sst_bit_map->GetFileSlotNum(file_num);
+        if (slot == -1) {
+          continue;
+        }
+        live_files.insert(file_num);
+        auto it = request->slots().find(slot);
+        if (it != request->slots().end() && it->second == file_num) {
+          copied.insert(file_num);
+        } else {
+          to_copy.emplace_back(file_num, slot);
+        }
+      }
+    }
+    // the slots can't be reused before the new tail is caught up, see
+    // CatchUpSnapshot
+    db_options_->sst_bit_map->SyncTailSlots(db_options_->rf, live_files, 0);
+  }
 
+  for (const auto& p : to_copy) {
+    std::string fname = rocksdb::MakeTableFileName(ioptions_->cf_paths[0].path, p.first);
+    // a file deleted meanwhile is not in the snapshot either
+    if (rocksdb::CopySSTToDir(fname, p.second, dir, db_options_).ok()) {
+      copied.insert(p.first);
+    }
   }
+  RUBBLE_LOG_INFO(logger_, "[Catch up] copied %lu of %lu ssts to %s\n",
+                  to_copy.size(), live_files.size(), dir.c_str());
+
+  std::lock_guard<std::mutex> lk{catch_up_copy_mu_};
+  catch_up_dir_ = dir;
+  catch_up_copied_ = std::move(copied);
   return Status::OK;
 }
 
-// Update the secondary's states by applying the version edits
-// and ship sst to the downstream node if necessary
-std::string RubbleKvServiceImpl::ApplyVersionEdits(const std::string& args) {
-    // 1. assemble the version edit
-    const json j_args = json::parse(args);
-    bool is_flush = false;
-    bool is_trivial_move = false;
-    int batch_count = 0;
+Status RubbleKvServiceImpl::CatchUpSnapshot(RecoverReply* reply) {
+  std::string dir;
+  std::set<uint64_t> copied;
+  {
+    std::lock_guard<std::mutex> lk{catch_up_copy_mu_};
+    dir = catch_up_dir_;
+    copied.swap(catch_up_copied_);
+    catch_up_dir_.clear();
+  }
+  if (dir.empty()) {
+    return Status(grpc::StatusCode::FAILED_PRECONDITION, "no sst copied to the new tail");
+  }
 
-    if (j_args.contains("IsFlush")) {
-      assert(j_args["IsFlush"].get<bool>());
-      batch_count = j_args["BatchCount"].get<int>();
-      is_flush = true;
+  // the memtables before the snapshot go into ssts. No flush or compaction
+  // may run while the snapshot is taken, so every edit up to its counter is
+  // in the version and every sst built after it is shipped to the new tail
+  rocksdb::FlushOptions flush_options;
+  flush_options.wait = true;
+  rocksdb::Status s = impl_->Flush(flush_options);
+  if (s.ok()) {
+    s = impl_->PauseBackgroundWork();
+  }
+  if (!s.ok()) {
+    return Status(grpc::StatusCode::INTERNAL, s.ToString());
+  }
+
+  rocksdb::VersionEdit snapshot;
+  uint64_t next_file_num = 0;
+  uint64_t log_and_apply_counter = 0;
+  std::vector<std::pair<uint64_t, int>> to_copy;
+  {
+    rocksdb::InstrumentedMutexLock l(mu_);
+    std::set<uint64_t> live_files;
+    rocksdb::VersionStorageInfo* vstorage = default_cf_->current()->storage_info();
+    for (int level = 0; level < vstorage->num_levels(); level++) {
+      for (const rocksdb::FileMetaData* f : vstorage->LevelFiles(level)) {
+        uint64_t file_num = f->fd.GetNumber();
+        int slot = db_options_->sst_bit_map->GetFileSlotNum(file_num);
+        if (slot == -1) {
+          RUBBLE_LOG_ERROR(logger_, "[Catch up] sst %lu has no slot\n", file_num);
+          continue;
+        }
+        snapshot.AddFile(level, *f);
+        live_files.insert(file_num);
+        (*reply->mutable_slots())[file_num] = slot;
+        if (copied.count(file_num) == 0) {
+          to_copy.emplace_back(file_num, slot);
+        }
+      }
     }
+    snapshot.SetLastSequence(version_set_->LastSequence());
+    next_file_num = version_set_->current_next_file_number();
+    log_and_apply_counter = version_set_->LogAndApplyCounter();
+
+    // the back of the memlist is the earliest memtable
+    rocksdb::MemTableListVersion* imm = default_cf_->imm()->current();
+    reply->set_epoch(imm->GetMemlist().empty() ? default_cf_->mem()->GetID()
+                                               : imm->GetMemlist().back()->GetID());
+    db_options_->sst_bit_map->SyncTailSlots(db_options_->rf, live_files, next_file_num);
+  }
 
-    if (j_args.contains("IsTrivial")) {
-      is_trivial_move = true;
+  // no file of the version can go away while the background work is paused
+  rocksdb::IOStatus ios;
+  for (const auto& p : to_copy) {
+    std::string fname = rocksdb::MakeTableFileName(ioptions_->cf_paths[0].path, p.first);
+    ios = rocksdb::CopySSTToDir(fname, p.second, dir, db_options_);
+    if (!ios.ok()) {
+      break;
     }
+  }
+  impl_->ContinueBackgroundWork();
+  if (!ios.ok()) {
+    RUBBLE_LOG_ERROR(logger_, "[Catch up] copy to %s failed : %s\n", dir.c_str(), ios.ToString().c_str());
+    return Status(grpc::StatusCode::INTERNAL, ios.ToString());
+  }
 
-    uint64_t version_edit_id = j_args["Id"].get<uint64_t>();
-    uint64_t log_and_apply_counter = version_set_->LogAndApplyCounter();
-    uint64_t expected = log_and_apply_counter + 1;
-    
-    uint64_t next_file_num = j_args["NextFileNum"].get<uint64_t>();
-    rocksdb::autovector<rocksdb::VersionEdit*> edit_list;
-    std::vector<rocksdb::VersionEdit> edits;
-    for (const auto& edit_string : j_args["EditList"].get<std::vector<std::string>>()) {
-      auto j_edit = json::parse(edit_string);
-      auto edit = ParseJsonStringToVersionEdit(j_edit);
-      // RUBBLE_LOG_INFO(logger_, "Got a new edit %s ", edit.DebugString().c_str());
-      if (is_flush) {
-        edit.SetBatchCount(batch_count);
-      } else if(is_trivial_move) {
-        edit.MarkTrivialMove();
+  rocksdb::autovector<rocksdb::VersionEdit*> edit_list;
+  edit_list.push_back(&snapshot);
+  if (!rocksdb::EncodeShippedEdits(next_file_num, log_and_apply_counter,
+                                   edit_list, reply->mutable_snapshot())) {
+    return Status(grpc::StatusCode::INTERNAL, "encode snapshot failed");
+  }
+  RUBBLE_LOG_INFO(logger_, "[Catch up] snapshot of %d ssts at edit %lu, memtable %lu, copied %lu more\n",
+                  reply->slots_size(), log_and_apply_counter, reply->epoch(), to_copy.size());
+  return Status::OK;
+}
+
+Status RubbleKvServiceImpl::BeginCatchUp(const RecoverRequest* request) {
+  if (primary_channel_ == nullptr) {
+    return Status(grpc::StatusCode::FAILED_PRECONDITION, "no primary to catch up from");
+  }
+  catching_up_ = true;
+
+  // tell the primary which file each slot of ours still holds, it skips them
+  RecoverRequest copy_request;
+  copy_request.set_insert_tail(true);
+  copy_request.set_catch_up(rubble::CATCH_UP_COPY);
+  copy_request.set_sst_dir(request->sst_dir());
+  {
+    rocksdb::InstrumentedMutexLock l(mu_);
+    rocksdb::VersionStorageInfo* vstorage = default_cf_->current()->storage_info();
+    for (int level = 0; level < vstorage->num_levels(); level++) {
+      for (const rocksdb::FileMetaData* f : vstorage->LevelFiles(level)) {
+        uint64_t file_num = f->fd.GetNumber();
+        std::string sst_fname = rocksdb::MakeTableFileName(db_path_.path, file_num);
+        char slot_fname[PATH_MAX];
+        ssize_t len = readlink(sst_fname.c_str(), slot_fname, sizeof(slot_fname) - 1);
+        if (len <= 0) {
+          continue;
+        }
+        slot_fname[len] = '\0';
+        const char* slot = strrchr(slot_fname, '/');
+        (*copy_request.mutable_slots())[atoi(slot == nullptr ? slot_fname : slot + 1)] = file_num;
       }
-      edit.SetNextFile(next_file_num);
-      edits.push_back(edit);
     }
+  }
+
+  ClientContext context;
+  RecoverReply copy_reply;
+  Status s = RubbleKvStoreService::NewStub(primary_channel_)->Recover(&context, copy_request, &copy_reply);
+  if (!s.ok()) {
+    RUBBLE_LOG_ERROR(logger_, "[Recover] catch up copy failed : %s\n", s.error_message().c_str());
+    EndCatchUp();
+  }
+  return s;
+}
+
+void RubbleKvServiceImpl::EndCatchUp() {
+  std::vector<std::function<void()>> wakes;
+  {
+    std::lock_guard<std::mutex> lk{catch_up_mu_};
+    catching_up_ = false;
+    catch_up_cv_.notify_all();
+    wakes.swap(catch_up_wakes_);
+  }
+  for (auto& wake : wakes) {
+    wake();
+  }
+}
+
+Status RubbleKvServiceImpl::FinishCatchUp() {
+  if (!catching_up_) {
+    return Status(grpc::StatusCode::FAILED_PRECONDITION, "not catching up");
+  }
+  RecoverRequest snapshot_request;
+  snapshot_request.set_insert_tail(true);
+  snapshot_request.set_catch_up(rubble::CATCH_UP_SNAPSHOT);
+  ClientContext context;
+  RecoverReply snapshot_reply;
+  Status status = RubbleKvStoreService::NewStub(primary_channel_)->Recover(&context, snapshot_request, &snapshot_reply);
+  if (!status.ok()) {
+    return status;
+  }
+
+  std::unordered_map<uint64_t, int> slots(snapshot_reply.slots().begin(), snapshot_reply.slots().end());
+  std::vector<rocksdb::VersionEdit> edits;
+  uint64_t snapshot_edit = 0;
+  rocksdb::Status s = rocksdb::DecodeShippedEdits(snapshot_reply.snapshot(), slots, &snapshot_edit, &edits);
+  if (!s.ok() || edits.size() != 1) {
+    return Status(grpc::StatusCode::DATA_LOSS, "bad snapshot: " + s.ToString());
+  }
+  const rocksdb::VersionEdit& snapshot = edits[0];
+  uint64_t epoch = snapshot_reply.epoch();
+
+  // file -> level in the snapshot
+  std::unordered_map<uint64_t, int> snapshot_files;
+  for (const auto& new_file : snapshot.GetNewFiles()) {
+    snapshot_files[new_file.second.fd.GetNumber()] = new_file.first;
+  }
+
+  // turn the current version into the snapshot: drop the files the primary
+  // deleted, add the ones we don't have and move the ones it moved
+  rocksdb::VersionEdit install;
+  install.SetColumnFamily(0);
+  install.SetEditNumber(snapshot_edit);
+  std::set<uint64_t> kept_files;
+  std::vector<uint64_t> stale_files;
+  {
+    rocksdb::InstrumentedMutexLock l(mu_);
+    if (!default_cf_->mem()->IsEmpty() || !default_cf_->imm()->current()->GetMemlist().empty() ||
+        version_set_->LogAndApplyCounter() >= snapshot_edit) {
+      return Status(grpc::StatusCode::FAILED_PRECONDITION, "the new tail has applied writes or edits already");
+    }
+    rocksdb::VersionStorageInfo* vstorage = default_cf_->current()->storage_info();
+    for (int level = 0; level < vstorage->num_levels(); level++) {
+      for (const rocksdb::FileMetaData* f : vstorage->LevelFiles(level)) {
+        uint64_t file_num = f->fd.GetNumber();
+        auto it = snapshot_files.find(file_num);
+        if (it != snapshot_files.end() && it->second == level) {
+          kept_files.insert(file_num);
+          continue;
+        }
+        install.DeleteFile(level, file_num);
+        if (it == snapshot_files.end()) {
+          stale_files.push_back(file_num);
+        }
+      }
+    }
+  }
+  for (const auto& new_file : snapshot.GetNewFiles()) {
+    uint64_t file_num = new_file.second.fd.GetNumber();
+    if (kept_files.count(file_num) == 0) {
+      install.AddFile(new_file.first, new_file.second);
+      install.TrackSlot(file_num, snapshot.GetSlot(file_num));
+    }
+  }
+
+  // the primary filled the slots, link them and open the tables
+  rocksdb::IOStatus ios = UpdateSstViewAndShipSstFiles(install);
+  assert(ios.ok());
+  PrewarmSstFiles(install);
+  s = WaitForPrewarm(snapshot_edit);
+  if (!s.ok()) {
+    return Status(grpc::StatusCode::DATA_LOSS, s.ToString());
+  }
+
+  {
+    rocksdb::InstrumentedMutexLock l(mu_);
+    uint64_t current_next_file_num = version_set_->current_next_file_number();
+    if (snapshot.GetNextFile() > current_next_file_num) {
+      version_set_->FetchAddFileNumber(snapshot.GetNextFile() - current_next_file_num);
+    }
+    // the writes after the snapshot must be newer than its ssts
+    if (snapshot.HasLastSequence() && snapshot.GetLastSequence() > version_set_->LastSequence()) {
+      version_set_->SetLastAllocatedSequence(snapshot.GetLastSequence());
+      version_set_->SetLastPublishedSequence(snapshot.GetLastSequence());
+      version_set_->SetLastSequence(snapshot.GetLastSequence());
+    }
+
+    s = version_set_->LogAndApply(default_cf_, *default_cf_->GetLatestMutableCFOptions(), &install, mu_,
+                                  impl_->directories_.GetDbDir());
+    if (!s.ok()) {
+      RUBBLE_LOG_ERROR(logger_, "[Catch up] install snapshot failed : %s \n", s.ToString().c_str());
+      return Status(grpc::StatusCode::INTERNAL, s.ToString());
+    }
+    // the next edit is the first one after the snapshot
+    version_set_->AdvanceLogAndApplyCounter(snapshot_edit - version_set_->LogAndApplyCounter());
+
+    // the ops for memtables before epoch are in the ssts, see IsCaughtUpWrite
+    default_cf_->ResetMemtableID(epoch);
+    flushed_mem.store(epoch - 1);
+    catch_up_edit_ = snapshot_edit;
+
+    rocksdb::SuperVersionContext sv_ctx(true);
+    impl_->InstallSuperVersionAndScheduleWorkPublic(default_cf_, &sv_ctx,
+                                                    *default_cf_->GetLatestMutableCFOptions());
+    sv_ctx.Clean();
+  }
+
+  // unlink the files the snapshot doesn't have, ours and the ones of the
+  // edits it covers
+  std::vector<uint64_t> covered_edits;
+  {
+    std::lock_guard<std::mutex> lk{*db_options_->version_edit_mu};
+    for (auto it = cached_edits_.begin(); it != cached_edits_.end();) {
+      if (it->first > snapshot_edit) {
+        ++it;
+        continue;
+      }
+      for (const auto& new_file : it->second.first.GetNewFiles()) {
+        if (snapshot_files.count(new_file.second.fd.GetNumber()) == 0) {
+          stale_files.push_back(new_file.second.fd.GetNumber());
+        }
+      }
+      covered_edits.push_back(it->first);
+      it = cached_edits_.erase(it);
+    }
+  }
+  for (uint64_t edit_number : covered_edits) {
+    WaitForPrewarm(edit_number).PermitUncheckedError();
+  }
+  for (uint64_t file_num : stale_files) {
+    rocksdb::TableCache::Evict(table_cache_, file_num);
+    fs_->DeleteFile(rocksdb::MakeTableFileName(db_path_.path, file_num), rocksdb::IOOptions(), nullptr);
+    // the slot may hold a file of the snapshot already
+    int slot = db_options_->sst_bit_map->GetFileSlotNum(file_num);
+    if (slot != -1 && db_options_->sst_bit_map->GetSlotFileNum(slot) == file_num) {
+      db_options_->sst_bit_map->FreeSlot({file_num}, 0, false);
+    }
+  }
+
+  catch_up_epoch_ = epoch;
+  EndCatchUp();
+  {
+    std::lock_guard<std::mutex> lk{*db_options_->version_edit_mu};
+    db_options_->expected_edit_cv->notify_all();
+  }
+  RUBBLE_LOG_INFO(logger_, "[Catch up] installed %lu ssts at edit %lu, memtable %lu, dropped %lu\n",
+                  snapshot_files.size(), snapshot_edit, epoch, stale_files.size());
+  return Status::OK;
+}
+
+// Update the secondary's states by applying the version edits
+// and ship sst to the downstream node if necessary
+std::string RubbleKvServiceImpl::ApplyVersionEdits(const SyncRequest& request) {
+    // 1. assemble the version edit
+    std::vector<rocksdb::VersionEdit> edits;
+    uint64_t version_edit_id = 0;
+    rocksdb::Status s = ParseSyncRequest(request, &version_edit_id, &edits);
+    if (!s.ok()) {
+      return s.ToString();
+    }
+    uint64_t log_and_apply_counter = version_set_->LogAndApplyCounter();
+    uint64_t expected = log_and_apply_counter + 1;
 
     // 2. cache out-of-ordered version edit
     if (version_edit_id != expected || !IsReady(edits[0])) {
       RUBBLE_LOG_INFO(logger_, "Version Edit arrives out of order, expecting %lu, cache %lu \n", expected, version_edit_id);
-      printf("Version Edit arrives out of order, expecting %lu, cache %lu \n", expected, version_edit_id);
       assert(edits.size() == 1);
       for (const auto& edit : edits) {
-        cached_edits_.insert({edit.GetEditNumber(), {edit, args}});
+        cached_edits_.insert({edit.GetEditNumber(), {edit, request.edits()}});
       }
     } else {
       // 3. apply the version edit
@@ -887,42 +1638,34 @@ std::string RubbleKvServiceImpl::ApplyVersionEdits(const std::string& args) {
     return "ok";
 }
 
-void RubbleKvServiceImpl::BufferVersionEdits(const std::string& args) {
-    const json j_args = json::parse(args);
-    bool is_flush = false;
-    bool is_trivial_move = false;
-    int batch_count = 0;
-
-    if (j_args.contains("IsFlush")) {
-      assert(j_args["IsFlush"].get<bool>());
-      batch_count = j_args["BatchCount"].get<int>();
-      is_flush = true;
-    }
-
-    if (j_args.contains("IsTrivial")) {
-      is_trivial_move = true;
+rocksdb::Status RubbleKvServiceImpl::BufferVersionEdits(const SyncRequest& request) {
+    if (needs_recovery_) {
+      std::lock_guard<std::mutex> lk{recovery_mu_};
+      return recovery_status_;
     }
-
-    uint64_t version_edit_id = j_args["Id"].get<uint64_t>();
-    
-    uint64_t next_file_num = j_args["NextFileNum"].get<uint64_t>();
-    rocksdb::autovector<rocksdb::VersionEdit*> edit_list;
     std::vector<rocksdb::VersionEdit> edits;
-    for (const auto& edit_string : j_args["EditList"].get<std::vector<std::string>>()) {
-      auto j_edit = json::parse(edit_string);
-      auto edit = ParseJsonStringToVersionEdit(j_edit);
-      if (is_flush) {
-        edit.SetBatchCount(batch_count);
-      } else if(is_trivial_move) {
-        edit.MarkTrivialMove();
-      }
-      edit.SetNextFile(next_file_num);
-      edits.push_back(edit);
+    uint64_t version_edit_id = 0;
+    rocksdb::Status s = ParseSyncRequest(request, &version_edit_id, &edits);
+    if (!s.ok()) {
+      return s;
     }
 
     assert(edits.size() == 1);
+    if (version_edit_id <= catch_up_edit_.load()) {
+      // the snapshot this node installed covers it
+      return rocksdb::Status::OK();
+    }
     for (const auto& edit : edits) {
-      cached_edits_insert(edit.GetEditNumber(), {edit, args});
+      // take the slots and link the new files right away, off the apply
+      // path. A slot is only reused after every node applied the edit that
+      // freed it, so this never races with an edit still in the queue
+      rocksdb::IOStatus ios = UpdateSstViewAndShipSstFiles(edit);
+      if (!ios.ok()) {
+        SetNeedsRecovery(edit.GetEditNumber(), ios);
+        return ios;
+      }
+      PrewarmSstFiles(edit);
+      cached_edits_insert(edit.GetEditNumber(), {edit, request.edits()});
     }
 
     uint64_t log_and_apply_counter = version_set_->LogAndApplyCounter();
@@ -931,9 +1674,8 @@ void RubbleKvServiceImpl::BufferVersionEdits(const std::string& args) {
       // std::cout << "[version edits] Got expected " << expected << " so notify\n";
       std::lock_guard<std::mutex> lk{*db_options_->version_edit_mu};
       db_options_->expected_edit_cv->notify_all();
-    } else {
-      // std::cout << "[version edits] Got " << version_edit_id << " no notify\n"; 
     }
+    return rocksdb::Status::OK();
 }
 
 void RubbleKvServiceImpl::VersionEditsExecutor() {
@@ -943,11 +1685,13 @@ void RubbleKvServiceImpl::VersionEditsExecutor() {
 
     std::unique_lock<std::mutex> version_edit_lk{*db_options_->version_edit_mu};
     int count = cached_edits_.count(expected);
-    if (count == 0) {
+    if (count == 0 || catching_up_) {
       // std::cout << "[version edits] wait for version edit " << expected << " to be cached" << std::endl;
       db_options_->expected_edit_cv->wait(version_edit_lk, [&] {
+        // installing a snapshot moves the counter, see FinishCatchUp
+        expected = version_set_->LogAndApplyCounter() + 1;
         count = cached_edits_.count(expected);
-        return count > 0;
+        return count > 0 && !catching_up_;
       });
       assert(count == 1);
       // std::cout << "[version edits] version edit " << expected << " gets cached!" << std::endl;
@@ -971,20 +1715,76 @@ void RubbleKvServiceImpl::VersionEditsExecutor() {
     std::vector<rocksdb::VersionEdit> edits;
     edits.push_back(edit);
 
-    cached_edits_remove(expected);
+    // group commit: take the edits that queued up behind it and are ready
+    // too, they all go into one LogAndApply
+    version_edit_lk.lock();
+    cached_edits_.erase(cached_edits_.find(expected));
+    uint64_t pending_mems = edit.IsFlush() ? edit.GetBatchCount() : 0;
+    size_t max_group = static_cast<size_t>(std::max(db_options_->max_version_edit_group, 1));
+    while (edits.size() < max_group) {
+      auto it = cached_edits_.find(expected + edits.size());
+      if (it == cached_edits_.end() || !IsReady(it->second.first, pending_mems)) {
+        break;
+      }
+      if (it->second.first.IsFlush()) {
+        pending_mems += it->second.first.GetBatchCount();
+      }
+      edits.push_back(it->second.first);
+      cached_edits_.erase(it);
+    }
+    version_edit_lk.unlock();
 
-    rocksdb::InstrumentedMutexLock l(mu_);
-    ApplyOneVersionEdit(edits);
-    edits.clear();
+    // publish the new files only once their tables are open and checked
+    bool prewarmed = true;
+    for (const auto& e : edits) {
+      rocksdb::Status s = WaitForPrewarm(e.GetEditNumber());
+      if (!s.ok() && prewarmed) {
+        // the slot doesn't hold what the primary wrote, serving it would
+        // return corrupt data
+        SetNeedsRecovery(e.GetEditNumber(), s);
+        prewarmed = false;
+      }
+    }
+    if (!prewarmed) {
+      return;
+    }
 
-    auto sync_client = rocksdb::GetPrimarySyncClient(db_options_);
-    std::string sync_reply = SetSyncReplyMessage();
-    sync_client->Sync(sync_reply, db_options_->rid);
+    {
+      rocksdb::InstrumentedMutexLock l(mu_);
+      size_t num_edits = edits.size();
+      ApplyOneVersionEdit(edits, num_edits, /*files_staged*/true);
+      edits.clear();
+
+      auto sync_client = rocksdb::GetPrimarySyncClient(db_options_);
+      std::string sync_reply = SetSyncReplyMessage();
+      sync_client->Sync(sync_reply, db_options_->rid);
+    }
+    // the slots of the deleted ssts go back to the primary, no idle scan
+    // iterator may keep the old version open
+    ReleaseStaleScanIterators();
    }
 }
 
+void RubbleKvServiceImpl::ReleaseStaleScanIterators() {
+  std::lock_guard<std::mutex> lk{buffers_mu};
+  for (const auto& p : buffers_) {
+    p.first->scan_iters->ReleaseStale();
+  }
+}
 
 
+
+void RubbleKvServiceImpl::SetNeedsRecovery(uint64_t edit_number, const rocksdb::Status& s) {
+  RUBBLE_LOG_ERROR(logger_, "[version edits] edit %lu failed : %s, stop applying edits\n",
+                   edit_number, s.ToString().c_str());
+  std::lock_guard<std::mutex> lk{recovery_mu_};
+  if (recovery_status_.ok()) {
+    recovery_status_ = rocksdb::Status::Corruption(
+        "edit " + std::to_string(edit_number), s.ToString());
+  }
+  needs_recovery_ = true;
+}
+
 void RubbleKvServiceImpl::ApplyBufferedVersionEdits() {
   if (cached_edits_.size() != 0) {
     rocksdb::InstrumentedMutexLock l(mu_);
@@ -992,15 +1792,12 @@ void RubbleKvServiceImpl::ApplyBufferedVersionEdits() {
       uint64_t log_and_apply_counter = version_set_->LogAndApplyCounter();
       uint64_t expected = log_and_apply_counter + 1;
       int count = cached_edits_.count(expected);
-      std::cout << "[ApplyBufferedVersionEdits] expected: " 
-                << expected << " count: " << count << std::endl;
       while (count != 0) {
         auto edit = cached_edits_.cbegin()->second.first;
         if (!IsReady(edit)) {
           break;
         }
         RUBBLE_LOG_INFO(logger_, "Got %d edits in cache, edit id : %lu \n", count, expected);
-        printf("Got %d edits in cache, edit id : %lu \n", count, expected);
         std::vector<rocksdb::VersionEdit> edits;
         for (int i = 0; i < count; i++) {
           auto it = cached_edits_.cbegin();
@@ -1017,30 +1814,37 @@ void RubbleKvServiceImpl::ApplyBufferedVersionEdits() {
   }
 }
 
-std::string RubbleKvServiceImpl::ApplyOneVersionEdit(std::vector<rocksdb::VersionEdit>& edits) {
+std::string RubbleKvServiceImpl::ApplyOneVersionEdit(std::vector<rocksdb::VersionEdit>& edits,
+                                                     size_t num_primary_edits,
+                                                     bool files_staged) {
    
     bool is_flush = false;
-    bool is_trivial_move = false;
-    int batch_count = 0;
-    if(edits.size() >= 2){
+    if(edits.size() >= 2 && num_primary_edits == 1){
       for(const auto& edit : edits){
         assert(edit.IsFlush());
       }
     }
-    auto& first_edit = edits[0];
-    if(first_edit.IsFlush()){
-      is_flush = true;
-    }else if(first_edit.IsTrivialMove()){
-      is_trivial_move = true;
+    // the edits of one LogAndApply of the primary share an edit number, the
+    // first of them tells whether it was a flush and of how many memtables
+    std::vector<size_t> primary_edit_begin;
+    uint64_t next_file_num = 0;
+    for (size_t i = 0; i < edits.size(); i++) {
+      if (i == 0 || edits[i].GetEditNumber() != edits[i - 1].GetEditNumber()) {
+        primary_edit_begin.push_back(i);
+        if (edits[i].IsFlush()) {
+          is_flush = true;
+        }
+      }
+      next_file_num = std::max(next_file_num, edits[i].GetNextFile());
     }
-
-    batch_count += first_edit.GetBatchCount();
-    uint64_t next_file_num = first_edit.GetNextFile();
+    assert(num_primary_edits == 1 || primary_edit_begin.size() == num_primary_edits);
 
     rocksdb::IOStatus ios;
-    for (const auto& edit: edits) {
-      ios = UpdateSstViewAndShipSstFiles(edit);
-      assert(ios.ok());
+    if (!files_staged) {
+      for (const auto& edit: edits) {
+        ios = UpdateSstViewAndShipSstFiles(edit);
+        assert(ios.ok());
+      }
     }
      
     rocksdb::autovector<rocksdb::VersionEdit*> edit_list;
@@ -1073,6 +1877,10 @@ std::string RubbleKvServiceImpl::ApplyOneVersionEdit(std::vector<rocksdb::Versio
     // Calling LogAndApply on the secondary
     rocksdb::Status s = version_set_->LogAndApply(cfds, mutable_cf_options_list, edit_lists, mu_,
                       db_directory);
+    // keep counting the primary's edits, the next expected edit follows the group
+    if (num_primary_edits > 1) {
+      version_set_->AdvanceLogAndApplyCounter(num_primary_edits - 1);
+    }
     // if(s.ok()){
       // RUBBLE_LOG_INFO(logger_, "[Secondary] logAndApply succeeds \n");
       // printf("[Secondary] logAndApply succeeds \n");
@@ -1102,50 +1910,57 @@ std::string RubbleKvServiceImpl::ApplyOneVersionEdit(std::vector<rocksdb::Versio
 
         rocksdb::SuperVersion* sv = default_cf_->GetSuperVersion();
         rocksdb::MemTableListVersion* current = imm->current();
-        // assert(imm->current()->GetMemlist().size() >= batch_count_) ? 
-        // This is not always the case, sometimes secondary has only one immutable memtable in the list, say ID 89,
-        // while the primary has 2 immutable memtables, say 89 and 90, with a more latest one,
-        // so should set the number_of_immutable_memtable_to_delete to be the minimum of batch count and immutable memlist size
-        int imm_size = (int)current->GetMemlist().size();
-        int num_of_imm_to_delete = std::min(batch_count, imm_size);
-        RUBBLE_LOG_INFO(logger_ , "memlist size : %d, batch count : %d \n", imm_size ,  batch_count);
-        assert(num_of_imm_to_delete == batch_count);
-        // std::cout << "[ApplyOneVersionEdit] flushed_mem " << flushed_mem.load() << " add " << num_of_imm_to_delete << std::endl;
-        flushed_mem.fetch_add(num_of_imm_to_delete);
-        // fprintf(stdout, "memlist size : %d, bacth count : %d ,num_of_imms_to_delete : %d \n", imm_size ,batch_count, num_of_imm_to_delete);
-        int i = 0;
-        while(num_of_imm_to_delete -- > 0) {
-          rocksdb::MemTable* m = current->GetMemlist().back();
-          m->SetFlushCompleted(true);
-
-          auto& edit = edit_list[i];
-          auto& new_files = edit->GetNewFiles();
-          m->SetFileNumber(new_files[0].second.fd.GetNumber()); 
-          if(edit->GetBatchCount() == 1) {
-            i++;
+        for (size_t p = 0; p < primary_edit_begin.size(); p++) {
+          size_t begin = primary_edit_begin[p];
+          if (!edits[begin].IsFlush()) {
+            continue;
+          }
+          int batch_count = edits[begin].GetBatchCount();
+          // assert(imm->current()->GetMemlist().size() >= batch_count_) ? 
+          // This is not always the case, sometimes secondary has only one immutable memtable in the list, say ID 89,
+          // while the primary has 2 immutable memtables, say 89 and 90, with a more latest one,
+          // so should set the number_of_immutable_memtable_to_delete to be the minimum of batch count and immutable memlist size
+          int imm_size = (int)current->GetMemlist().size();
+          int num_of_imm_to_delete = std::min(batch_count, imm_size);
+          RUBBLE_LOG_INFO(logger_ , "memlist size : %d, batch count : %d \n", imm_size ,  batch_count);
+          assert(num_of_imm_to_delete == batch_count);
+          // std::cout << "[ApplyOneVersionEdit] flushed_mem " << flushed_mem.load() << " add " << num_of_imm_to_delete << std::endl;
+          flushed_mem.fetch_add(num_of_imm_to_delete);
+          // fprintf(stdout, "memlist size : %d, bacth count : %d ,num_of_imms_to_delete : %d \n", imm_size ,batch_count, num_of_imm_to_delete);
+          size_t i = begin;
+          while(num_of_imm_to_delete -- > 0) {
+            rocksdb::MemTable* m = current->GetMemlist().back();
+            m->SetFlushCompleted(true);
+
+            auto& edit = edit_list[i];
+            auto& new_files = edit->GetNewFiles();
+            m->SetFileNumber(new_files[0].second.fd.GetNumber()); 
+            if(edit->GetBatchCount() == 1) {
+              i++;
+            }
+            
+            RUBBLE_LOG_INFO(logger_,
+                          "[%s] Level-0 commit table #%lu : memtable #%lu done",
+                          default_cf_->GetName().c_str(), m->GetFileNumber(), mem_id);
+
+            assert(m->GetFileNumber() > 0);
+            /* drop the corresponding immutable memtable in the list if version edit corresponds to a flush */
+            // according the code comment in the MemTableList class : "The memtables are flushed to L0 as soon as possible and in any order." 
+            // as far as I observe, it's always the back of the imm memlist gets flushed first, which is the earliest memtable
+            // so here we always drop the memtable in the back of the list
+            mu_->AssertHeld();
+            current->RemoveLast(sv->GetToDelete());
+            // std::cout << "[rubble] imm ";
+            // for (rocksdb::MemTable* m : current->GetMemlist()) {
+            //   std::cout << m->GetID() << " ";
+            // }
+            // std::cout << std::endl;
+
+            imm->SetNumFlushNotStarted(current->GetMemlist().size());
+            imm->UpdateCachedValuesFromMemTableListVersion();
+            imm->ResetTrimHistoryNeeded();
+            ++mem_id;
           }
-          
-          RUBBLE_LOG_INFO(logger_,
-                        "[%s] Level-0 commit table #%lu : memtable #%lu done",
-                        default_cf_->GetName().c_str(), m->GetFileNumber(), mem_id);
-
-          assert(m->GetFileNumber() > 0);
-          /* drop the corresponding immutable memtable in the list if version edit corresponds to a flush */
-          // according the code comment in the MemTableList class : "The memtables are flushed to L0 as soon as possible and in any order." 
-          // as far as I observe, it's always the back of the imm memlist gets flushed first, which is the earliest memtable
-          // so here we always drop the memtable in the back of the list
-          mu_->AssertHeld();
-          current->RemoveLast(sv->GetToDelete());
-          // std::cout << "[rubble] imm ";
-          // for (rocksdb::MemTable* m : current->GetMemlist()) {
-          //   std::cout << m->GetID() << " ";
-          // }
-          // std::cout << std::endl;
-
-          imm->SetNumFlushNotStarted(current->GetMemlist().size());
-          imm->UpdateCachedValuesFromMemTableListVersion();
-          imm->ResetTrimHistoryNeeded();
-          ++mem_id;
         }
       } else {
         //TODO : Commit Failed For Some reason, need to reset state
@@ -1189,156 +2004,178 @@ std::string RubbleKvServiceImpl::ApplyOneVersionEdit(std::vector<rocksdb::Versio
 }
 
 
-// parse the version edit json string to rocksdb::VersionEdit 
-rocksdb::VersionEdit RubbleKvServiceImpl::ParseJsonStringToVersionEdit(const json& j_edit /* json version edit */){
-    rocksdb::VersionEdit edit;
-    // std::cout << j_edit.dump(4) << std::endl;
-    assert(j_edit.contains("AddedFiles"));
-    if(j_edit.contains("IsFlush")){ // means edit corresponds to a flush job
-        edit.MarkFlush();
-    }
-
-    if(j_edit.contains("LogNumber")){
-        edit.SetLogNumber(j_edit["LogNumber"].get<uint64_t>());
+// decode the binary version edit record carried by a SyncRequest
+rocksdb::Status RubbleKvServiceImpl::ParseSyncRequest(const SyncRequest& request, uint64_t* id,
+                                                      std::vector<rocksdb::VersionEdit>* edits) {
+    std::unordered_map<uint64_t, int> slots(request.slots().begin(), request.slots().end());
+    rocksdb::Status s = rocksdb::DecodeShippedEdits(request.edits(), slots, id, edits);
+    if (s.ok() && (*id == 0 || edits->empty())) {
+      s = rocksdb::Status::Corruption("shipped edits", "no edit in record");
     }
-    if(j_edit.contains("PrevLogNumber")){
-        edit.SetPrevLogNumber(j_edit["PrevLogNumber"].get<uint64_t>());
+    if (!s.ok()) {
+      RUBBLE_LOG_ERROR(logger_, "Decode shipped edits failed : %s \n", s.ToString().c_str());
+      edits->clear();
     }
-    
-    // right now, just use one column family(the default one)
-    edit.SetColumnFamily(0);
-
-    assert(j_edit.contains("EditNumber"));
-    edit.SetEditNumber(j_edit["EditNumber"].get<uint64_t>());
-    for(const auto& j_added_file : j_edit["AddedFiles"].get<std::vector<json>>()){
-        // std::cout << j_added_file.dump(4) << std::endl;
-        assert(!j_added_file["SmallestUserKey"].is_null());
-        assert(!j_added_file["SmallestSeqno"].is_null());
-        // TODO: should decide ValueType according to the info in the received version edit 
-        // basically pass the ValueType of the primary's version Edit's smallest/largest InterKey's ValueType
-        rocksdb::InternalKey smallest(rocksdb::Slice(j_added_file["SmallestUserKey"].get<std::string>()), 
-                                      j_added_file["SmallestSeqno"].get<uint64_t>(),
-                                      rocksdb::ValueType::kTypeValue);
-
-        assert(smallest.Valid());
-
-        uint64_t smallest_seqno = j_added_file["SmallestSeqno"].get<uint64_t>();
-        
-        assert(!j_added_file["LargestUserKey"].is_null());
-        assert(!j_added_file["LargestSeqno"].is_null());
-        rocksdb::InternalKey largest(rocksdb::Slice(j_added_file["LargestUserKey"].get<std::string>()), 
-                                      j_added_file["LargestSeqno"].get<uint64_t>(),
-                                      rocksdb::ValueType::kTypeValue);
-
-        assert(largest.Valid());
-
-        uint64_t largest_seqno = j_added_file["LargestSeqno"].get<uint64_t>();
-        int level = j_added_file["Level"].get<int>();
-        uint64_t file_num = j_added_file["FileNumber"].get<uint64_t>();
-        uint64_t file_size = j_added_file["FileSize"].get<uint64_t>();
-
-        int slot_num = j_added_file["Slot"].get<int>();
-        if (slot_num != -1) {
-          edit.TrackSlot(file_num, slot_num);
-          // std::cout << "track slot " << slot_num << std::endl;
-        }
-        
-        std::string file_checksum = j_added_file["FileChecksum"].get<std::string>();
-        std::string file_checksum_func_name = j_added_file["FileChecksumFuncName"].get<std::string>();
-        uint64_t file_creation_time = j_added_file["FileCreationTime"].get<uint64_t>();
-        uint64_t oldest_ancester_time = j_added_file["OldestAncesterTime"].get<uint64_t>();
-
-        const rocksdb::FileMetaData meta(file_num, 0/* path_id shoule be 0*/,
-                                        file_size, 
-                                        smallest, largest, 
-                                        smallest_seqno, largest_seqno,
-                                        false, 
-                                        rocksdb::kInvalidBlobFileNumber,
-                                        oldest_ancester_time,
-                                        file_creation_time,
-                                        file_checksum, 
-                                        file_checksum_func_name);
-
-        edit.AddFile(level, meta);
-    }
-
-    if(j_edit.contains("DeletedFiles")){
-        for(const auto& j_delete_file : j_edit["DeletedFiles"].get<std::vector<json>>()){
-            edit.DeleteFile(j_delete_file["Level"].get<int>(), j_delete_file["FileNumber"].get<uint64_t>());
-        }   
-    }
-
-    // if (j_edit.contains("SlotMap")) {
-    //   for (const auto& j_slot_map : j_edit["SlotMap"].get<std::vector<json>>()) {
-    //     edit.TrackSlot(j_slot_map["FileNumber"].get<uint64_t>(), j_slot_map["Slot"].get<int>());
-    //   }
-    // }
-    return std::move(edit);
+    return s;
 }
 
 //called by secondary nodes to create a pool of preallocated ssts in rubble mode
 rocksdb::IOStatus RubbleKvServiceImpl::CreateSstPool(){
     const std::string sst_dir = db_options_->sst_pool_dir;
-    uint64_t target_size = 10000000000;
     // size_t write_buffer_size = cf_options_->write_buffer_size;
     uint64_t target_file_size_base = cf_options_->target_file_size_base;
     assert((target_file_size_base % (1 << 20)) == 0);
-    std::cout << "target file size: " << target_file_size_base << "\n";
-    //assume the target_file_size_base is an integer multiple of 1MB
-    // use one more MB because of the footer, and pad to the buffer_size
-    uint64_t buffer_size = target_file_size_base + db_options_->sst_pad_len;
-    uint64_t big_buffer_size = 2*target_file_size_base + db_options_->sst_pad_len;
-
-    std::cout << "sst file size : " << buffer_size << std::endl;
 
-    rocksdb::AlignedBuffer buf;
     rocksdb::IOStatus s;
-    
-    int max_num_mems_to_flush = db_options_->max_num_mems_in_flush;
-    int pool_size = db_options_->preallocated_sst_pool_size;
-    int big_sst_pool_size = 100;
-    for (int i = 1; i <= pool_size + (max_num_mems_to_flush - 1)* big_sst_pool_size; i++) {
-        std::string sst_num = std::to_string(i);
-        // rocksdb::WriteStringToFile(fs_, rocksdb::Slice(std::string(buffer_size, 'c')), sst_dir + "/" + fname, true);
-        std::string sst_name = sst_dir + "/" + sst_num;
-        s = fs_->FileExists(sst_name, rocksdb::IOOptions(), nullptr);
-        if(!s.ok()) {
-            std::cout << "Create " << sst_name << " " << s.ToString() << std::endl;
-            std::unique_ptr<rocksdb::FSWritableFile> file;
-            rocksdb::EnvOptions soptions;
-            soptions.use_direct_writes = true;
-            s = fs_->NewWritableFile(sst_name, soptions, &file, nullptr);
-            if (!s.ok()) {
-                return s;
+    std::shared_ptr<SstBitMap> sst_bit_map = db_options_->sst_bit_map;
+    // only the active slots are created, a dynamic pool creates the rest
+    // when the primary asks for them, see ResizeSstPool
+    for (int times = 1; times <= sst_bit_map->NumSlotClasses(); times++) {
+        int first = sst_bit_map->GetFirstSlot(times);
+        int active = sst_bit_map->GetActiveSlots(times);
+        if (active == 0) {
+            continue;
+        }
+        //assume the target_file_size_base is an integer multiple of 1MB
+        // use one more MB because of the footer, and pad to the buffer_size
+        uint64_t buffer_size = times * target_file_size_base + db_options_->sst_pad_len;
+
+        rocksdb::AlignedBuffer buf;
+        for (int i = first; i < first + active; i++) {
+            std::string sst_name = sst_dir + "/" + std::to_string(i);
+            s = fs_->FileExists(sst_name, rocksdb::IOOptions(), nullptr);
+            if (s.ok()) {
+                continue;
             }
-            if(i == 1){
-                buf.Alignment(file->GetRequiredBufferAlignment());
+            if (buf.Capacity() == 0) {
+                buf.Alignment(rocksdb::kDefaultPageSize);
                 buf.AllocateNewBuffer(buffer_size);
                 buf.PadWith(buffer_size, 'c');
-            }else if( i > pool_size && ( ((i - pool_size) % big_sst_pool_size) == 1) ){
-                int times = (i - pool_size) / big_sst_pool_size + 2;
-                std::cout << " times : " << times << std::endl;
-                buffer_size = times * target_file_size_base + db_options_->sst_pad_len;
-                buf.Alignment(file->GetRequiredBufferAlignment());
-                buf.AllocateNewBuffer(buffer_size);
-                buf.PadWith(buffer_size - buf.CurrentSize(), 'c');
-            }
-
-            s = file->Append(rocksdb::Slice(buf.BufferStart()), rocksdb::IOOptions(), nullptr);
-            if (s.ok()) {
-                s = file->Sync(rocksdb::IOOptions(), nullptr);
             }
+            s = CreateSlotFile(sst_name, buf);
             if (!s.ok()) {
-                fs_->DeleteFile(sst_name, rocksdb::IOOptions(), nullptr);
                 return s;
             }
         }
     }
-         
-    std::cout << "allocated " << db_options_->preallocated_sst_pool_size << " sst slots in " << sst_dir << std::endl;
+
+    RUBBLE_LOG_INFO(logger_, "allocated %d sst slots in %s\n", sst_bit_map->GetActiveSlots(1), sst_dir.c_str());
+    return s;
+}
+
+rocksdb::IOStatus RubbleKvServiceImpl::CreateSlotFile(const std::string& sst_name,
+                                                     const rocksdb::AlignedBuffer& buf) {
+    std::unique_ptr<rocksdb::FSWritableFile> file;
+    rocksdb::EnvOptions soptions;
+    soptions.use_direct_writes = true;
+    rocksdb::IOStatus s = fs_->NewWritableFile(sst_name, soptions, &file, nullptr);
+    if (!s.ok()) {
+        return s;
+    }
+    // reserve the extents up front so a full disk fails here and not in the
+    // middle of the fill
+    s = file->Allocate(0, buf.CurrentSize(), rocksdb::IOOptions(), nullptr);
+    if (s.ok()) {
+        s = file->Append(rocksdb::Slice(buf.BufferStart(), buf.CurrentSize()), rocksdb::IOOptions(), nullptr);
+    }
+    if (s.ok()) {
+        s = file->Sync(rocksdb::IOOptions(), nullptr);
+    }
+    if (s.ok()) {
+        s = file->Close(rocksdb::IOOptions(), nullptr);
+    }
+    if (!s.ok()) {
+        fs_->DeleteFile(sst_name, rocksdb::IOOptions(), nullptr);
+    }
     return s;
 }
 
+void RubbleKvServiceImpl::ScheduleSstPoolResize(const SyncRequest& request) {
+    {
+        std::lock_guard<std::mutex> lk{sst_pool_mu_};
+        for (const auto& p : request.pool_size()) {
+            sst_pool_targets_[p.first] = p.second;
+        }
+    }
+    sst_pool_cv_.notify_one();
+}
+
+void RubbleKvServiceImpl::SstPoolResizer() {
+    std::unique_lock<std::mutex> lk{sst_pool_mu_};
+    while (true) {
+        sst_pool_cv_.wait(lk, [this] {
+            return sst_pool_resizer_exit_ || !sst_pool_targets_.empty();
+        });
+        if (sst_pool_resizer_exit_) {
+            return;
+        }
+        std::map<int, int> targets;
+        targets.swap(sst_pool_targets_);
+        lk.unlock();
+        ResizeSstPool(targets);
+        lk.lock();
+    }
+}
+
+void RubbleKvServiceImpl::ResizeSstPool(const std::map<int, int>& targets) {
+    const std::string sst_dir = db_options_->sst_pool_dir;
+    std::shared_ptr<SstBitMap> sst_bit_map = db_options_->sst_bit_map;
+
+    for (const auto& p : targets) {
+        int times = p.first;
+        if (times <= 0 || times > sst_bit_map->NumSlotClasses()) {
+            continue;
+        }
+        int first = sst_bit_map->GetFirstSlot(times);
+        int active = sst_bit_map->GetActiveSlots(times);
+        int target = std::min(p.second, sst_bit_map->GetSlotCapacity(times));
+        uint64_t buffer_size = times * cf_options_->target_file_size_base + db_options_->sst_pad_len;
+
+        if (target > active) {
+            rocksdb::AlignedBuffer buf;
+            buf.Alignment(rocksdb::kDefaultPageSize);
+            buf.AllocateNewBuffer(buffer_size);
+            buf.PadWith(buffer_size, 'c');
+            int created = active;
+            // the slots may have been hole punched before, always refill them
+            for (; created < target; created++) {
+                std::string sst_name = sst_dir + "/" + std::to_string(first + created);
+                rocksdb::IOStatus s = CreateSlotFile(sst_name, buf);
+                if (!s.ok()) {
+                    RUBBLE_LOG_ERROR(logger_, "Create %s failed : %s\n", sst_name.c_str(), s.ToString().c_str());
+                    break;
+                }
+            }
+            sst_bit_map->GrowSlots(times, created);
+            RUBBLE_LOG_INFO(logger_, "Slot class %d grows from %d to %d slots\n", times, active, created);
+        } else if (target < active) {
+            // the primary only retires slots that are free on every node
+            int retired = sst_bit_map->RetireSlots(times, target);
+            for (int i = retired; i < active; i++) {
+                std::string sst_name = sst_dir + "/" + std::to_string(first + i);
+                int fd = open(sst_name.c_str(), O_WRONLY);
+                if (fd < 0) {
+                    RUBBLE_LOG_ERROR(logger_, "Open %s failed : %s\n", sst_name.c_str(), strerror(errno));
+                    continue;
+                }
+                // the retired slot keeps its blocks if this fails, it's only
+                // space and the slot is refilled when it's reused
+                if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, buffer_size) != 0) {
+                    RUBBLE_LOG_ERROR(logger_, "Punch hole in %s failed : %s\n", sst_name.c_str(), strerror(errno));
+                }
+                close(fd);
+            }
+            RUBBLE_LOG_INFO(logger_, "Slot class %d shrinks from %d to %d slots\n", times, active, retired);
+        }
+    }
+
+    // the primary only hands out the new slots once every node reported them
+    if (primary_channel_ != nullptr) {
+        auto sync_client = rocksdb::GetPrimarySyncClient(db_options_);
+        sync_client->Sync(SetSyncReplyMessage(), db_options_->rid);
+    }
+}
+
 
 // In a 3-node setting, if it's the second node in the chain it should also ship sst files it received from the primary/first node
 // to the tail/downstream node and also delete the ones that get deleted in the compaction
@@ -1364,12 +2201,22 @@ rocksdb::IOStatus RubbleKvServiceImpl::UpdateSstViewAndShipSstFiles(const rocksd
 
         uint64_t file_size = new_file.second.fd.GetFileSize();
         // printf("filesize: %" PRIu64 " | target file base: %" PRIu64 "\n", file_size, cf_options_->target_file_size_base);
-        db_options_->sst_bit_map->TakeSlot(sst_num, slot, file_size/16777216);
-        // std::cout << "sst bitmap take slot: " << slot << " sst_num: " << sst_num << " edit num: " << edit.GetEditNumber() << std::endl;
+        // same slot size as BlockBasedTableBuilder::WriteFooter pads to, the
+        // table may be shorter than its slot, see pad_sst_to_slot_size
+        uint64_t target_file_size_base = cf_options_->target_file_size_base;
+        uint64_t pad_len = db_options_->sst_pad_len;
+        int times = 1;
+        if (file_size > pad_len) {
+          times = static_cast<int>((file_size - pad_len + target_file_size_base - 1) / target_file_size_base);
+        }
+        db_options_->sst_bit_map->TakeSlot(sst_num, slot, std::max(times, 1));
 
         // update secondary's view of sst files
-        if (symlink(slot_fname.c_str(), sst_fname.c_str()) != 0) {
-          std::cout << "Error when linking " << slot_fname << " to " << sst_fname << ": " << strerror(errno) << std::endl;  
+        // a tail that is catching up may have the link already
+        if (symlink(slot_fname.c_str(), sst_fname.c_str()) != 0 && errno != EEXIST) {
+          RUBBLE_LOG_ERROR(logger_, "Error when linking %s to %s : %s\n",
+                           slot_fname.c_str(), sst_fname.c_str(), strerror(errno));
+          return rocksdb::IOStatus::IOError("While linking " + slot_fname, sst_fname + ": " + strerror(errno));
         }
         
         // tail node doesn't need to ship sst files
@@ -1393,6 +2240,97 @@ rocksdb::IOStatus RubbleKvServiceImpl::UpdateSstViewAndShipSstFiles(const rocksd
     return ios;
 }
 
+void RubbleKvServiceImpl::PrewarmSstFiles(const rocksdb::VersionEdit& edit) {
+    if (prewarm_pool_ == nullptr || edit.IsTrivialMove() || edit.GetNewFiles().empty()) {
+      return;
+    }
+    std::shared_ptr<Prewarm> prewarm = std::make_shared<Prewarm>();
+    std::vector<std::function<void()>> jobs;
+
+    for (const auto& new_file : edit.GetNewFiles()) {
+      int level = new_file.first;
+      rocksdb::FileDescriptor fd = new_file.second.fd;
+      if (db_options_->sst_prewarm_threads > 0) {
+        jobs.emplace_back([this, level, fd]() {
+          rocksdb::ColumnFamilyData* cfd = default_cf_;
+          rocksdb::Cache::Handle* handle = nullptr;
+          // reads the footer, and with prefetch_index_and_filter_in_cache puts
+          // the index and filter blocks in the block cache, or pins them in
+          // the table reader if they are not cached
+          rocksdb::Status s = cfd->table_cache()->FindTable(
+              rocksdb::ReadOptions(), version_set_->file_options(),
+              cfd->internal_comparator(), fd, &handle,
+              cf_options_->prefix_extractor.get(), false /* no_io */,
+              true /* record_read_stats */, nullptr /* file_read_hist */,
+              false /* skip_filters */, level,
+              true /* prefetch_index_and_filter_in_cache */);
+          if (!s.ok()) {
+            // the first read opens it instead
+            RUBBLE_LOG_ERROR(logger_, "Prewarm sst %lu failed : %s \n", fd.GetNumber(), s.ToString().c_str());
+          }
+          if (handle != nullptr) {
+            cfd->table_cache()->ReleaseHandle(handle);
+          }
+        });
+      }
+
+      size_t num_chunks = db_options_->verify_shipped_sst ? rocksdb::NumSSTChunks(new_file.second) : 0;
+      if (num_chunks > 0) {
+        // spread the chunks of a big file over the threads
+        int num_threads = std::max(db_options_->sst_prewarm_threads, 1);
+        size_t chunks_per_job = (num_chunks + num_threads - 1) / num_threads;
+        std::shared_ptr<rocksdb::FileMetaData> meta =
+            std::make_shared<rocksdb::FileMetaData>(new_file.second);
+        std::string fname = rocksdb::MakeTableFileName(db_path_.path, fd.GetNumber());
+        for (size_t first = 0; first < num_chunks; first += chunks_per_job) {
+          jobs.emplace_back([this, prewarm, meta, fname, first, chunks_per_job]() {
+            rocksdb::Status s = rocksdb::VerifySSTChunks(fname, *meta, first, chunks_per_job);
+            if (!s.ok()) {
+              RUBBLE_LOG_ERROR(logger_, "Verify sst %lu failed : %s \n",
+                               meta->fd.GetNumber(), s.ToString().c_str());
+              std::lock_guard<std::mutex> lk{prewarm->mu};
+              prewarm->status = s;
+            }
+          });
+        }
+      }
+    }
+    if (jobs.empty()) {
+      return;
+    }
+
+    prewarm->pending = static_cast<int>(jobs.size());
+    {
+      std::lock_guard<std::mutex> lk{prewarm_mu_};
+      prewarms_[edit.GetEditNumber()] = prewarm;
+    }
+    for (auto& job : jobs) {
+      prewarm_pool_->SubmitJob([prewarm, job]() {
+        job();
+        std::lock_guard<std::mutex> lk{prewarm->mu};
+        if (--prewarm->pending == 0) {
+          prewarm->cv.notify_all();
+        }
+      });
+    }
+}
+
+rocksdb::Status RubbleKvServiceImpl::WaitForPrewarm(uint64_t edit_number) {
+    std::shared_ptr<Prewarm> prewarm;
+    {
+      std::lock_guard<std::mutex> lk{prewarm_mu_};
+      auto it = prewarms_.find(edit_number);
+      if (it == prewarms_.end()) {
+        return rocksdb::Status::OK();
+      }
+      prewarm = it->second;
+      prewarms_.erase(it);
+    }
+    std::unique_lock<std::mutex> lk{prewarm->mu};
+    prewarm->cv.wait(lk, [&] { return prewarm->pending == 0; });
+    return prewarm->status;
+}
+
 rocksdb::IOStatus RubbleKvServiceImpl::DeleteSstFiles(const rocksdb::VersionEdit& edit) {
     if(edit.IsTrivialMove()){
       return rocksdb::IOStatus::OK();
@@ -1454,6 +2392,16 @@ std::string RubbleKvServiceImpl::SetSyncReplyMessage() {
   }
   j_reply["DeletedSlots"] = deleted_slots_json;
 
+  // number of slot files ready in each slot class, see ResizeSstPool
+  std::shared_ptr<SstBitMap> sst_bit_map = db_options_->sst_bit_map;
+  if (sst_bit_map != nullptr && sst_bit_map->IsDynamic()) {
+    json pool_size_json = json::object();
+    for (int times = 1; times <= sst_bit_map->NumSlotClasses(); times++) {
+      pool_size_json[std::to_string(times)] = sst_bit_map->GetActiveSlots(times);
+    }
+    j_reply["PoolSize"] = pool_size_json;
+  }
+
   // std::cout << "deleted slots: " << deleted_slots_json.dump() << std::endl;
   deleted_slots_.clear();
   return j_reply.dump();
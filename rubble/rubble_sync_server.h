@@ -8,8 +8,12 @@
 #include <unordered_map>
 #include <chrono>
 #include <queue>
+#include <limits>
 #include <map>
 #include <thread>
+#include <condition_variable>
+#include <set>
+#include <functional>
 
 #include <grpcpp/grpcpp.h>
 #include <grpcpp/health_check_service_interface.h>
@@ -17,6 +21,11 @@
 #include "rubble_kv_store.grpc.pb.h"
 #include "reply_client.h"
 #include "forwarder.h"
+#include "scan_iterator_pool.h"
+#include "message_pool.h"
+#include "wal_syncer.h"
+#include "uncommitted_writes.h"
+#include "sync_client.h"
 
 #include "rocksdb/db.h"
 #include "port/port_posix.h"
@@ -25,6 +34,8 @@
 #include "db/db_impl/db_impl.h"
 #include "rocksdb/slice.h"
 #include "rocksdb/options.h"
+#include "util/aligned_buffer.h"
+#include "util/threadpool_imp.h"
 
 using grpc::Server;
 using grpc::ServerBuilder;
@@ -43,6 +54,7 @@ using rubble::SingleOp;
 using rubble::SingleOpReply;
 using rubble::OpType_Name;
 using rubble::RecoverRequest;
+using rubble::RecoverReply;
 using rubble::Empty;
 
 using json = nlohmann::json;
@@ -65,8 +77,54 @@ class RubbleKvServiceImpl final : public  RubbleKvStoreService::Service {
   Status Sync(ServerContext* context, 
               ServerReaderWriter<SyncReply, SyncRequest>* stream) override;
   
-  // heartbeat between Replicator and db servers
-  Status Recover(ServerContext* context, const RecoverRequest* request, Empty* reply) override;
+  // heartbeat between Replicator and db servers, also removes and inserts
+  // the tail of the chain, see RecoverRequest
+  Status Recover(ServerContext* context, const RecoverRequest* request, RecoverReply* reply) override;
+
+  // the state of one DoOp stream. The synchronous DoOp and the async server
+  // both hand the ops read from a stream to HandleStreamOp, one at a time
+  struct OpStream {
+    int shard_idx = -1;
+    int client_idx = -1;
+    Forwarder* forwarder = nullptr;
+    ReplyClient* reply_client = nullptr;
+    // ops for a later memtable, see is_ooo_write
+    std::map<uint64_t, std::queue<SingleOp*>>* op_buffer = nullptr;
+    std::unique_ptr<ScanIteratorPool> scan_iters;
+  };
+
+  OpStream* OpenOpStream();
+
+  // handle an op read from the stream. Returns true if the op is taken and
+  // released once handled, false if it can be reused for the next read.
+  // *stream_reply is set to the reply to write back on the stream, if any,
+  // the caller releases it to its MessagePool. If wait is false, the ops
+  // buffered for a later memtable stay in the stream and the caller parks
+  // the stream while the node catches up, see PollOpStream
+  bool HandleStreamOp(OpStream* stream, Op* request, OpReply** stream_reply,
+                      bool wait = true);
+
+  // run the buffered ops of the stream that can go now. Returns the
+  // memtable the first op left waits for, 0 if there is none, or
+  // kCatchUpWait while the node catches up and no op may go
+  uint64_t PollOpStream(OpStream* stream);
+
+  static constexpr uint64_t kCatchUpWait = std::numeric_limits<uint64_t>::max();
+
+  // call wake once the first buffered op of the stream may be able to go,
+  // or the catch up is over, without blocking, see MemTableEpoch::WaitAsync
+  void WaitOpStream(OpStream* stream, std::function<void()> wake);
+
+  // the stream has no ops buffered anymore
+  void CloseOpStream(OpStream* stream);
+
+  // fails once the node can't take ops anymore, the DoOp streams are then
+  // finished with it
+  Status OpStreamStatus();
+
+  // handle one request of a Sync stream, fails if its version edits can't
+  // be decoded
+  Status HandleSync(const SyncRequest& request);
 
   rocksdb::ColumnFamilyData* GetCFD();
 
@@ -93,9 +151,14 @@ class RubbleKvServiceImpl final : public  RubbleKvStoreService::Service {
     // class BGThreadsHandle;
     // friend class BGThreadHandle;
 
+    // resize the sst pool to the sizes queued by ScheduleSstPoolResize until
+    // FinishBGThreads
+    void SstPoolResizer();
+
     class BGThreadsHandle {
     private:
       std::thread handle_;
+      std::thread resizer_handle_;
       RubbleKvServiceImpl* rubble_impl_;
     public:   
       BGThreadsHandle(RubbleKvServiceImpl* impl_): rubble_impl_(impl_) {}
@@ -105,9 +168,19 @@ class RubbleKvServiceImpl final : public  RubbleKvStoreService::Service {
             rubble_impl_->VersionEditsExecutor();
           });
           pthread_setname_np(handle_.native_handle(), "VersionEditsExecutor");
+          resizer_handle_ = std::thread([this] {
+            rubble_impl_->SstPoolResizer();
+          });
+          pthread_setname_np(resizer_handle_.native_handle(), "SstPoolResizer");
       }
 
       void Finish() {
+          {
+            std::lock_guard<std::mutex> lk{rubble_impl_->sst_pool_mu_};
+            rubble_impl_->sst_pool_resizer_exit_ = true;
+          }
+          rubble_impl_->sst_pool_cv_.notify_all();
+          resizer_handle_.join();
           handle_.join();
       }
     } bg_threads_handle_;
@@ -143,39 +216,92 @@ class RubbleKvServiceImpl final : public  RubbleKvStoreService::Service {
     // actually handle an op request
     void HandleOp(Op* op, OpReply* reply,
                   Forwarder* forwarder, ReplyClient* reply_client,
-                  std::map<uint64_t, std::queue<SingleOp*>>* op_buffer);
+                  std::map<uint64_t, std::queue<SingleOp*>>* op_buffer,
+                  ScanIteratorPool* scan_iters = nullptr, bool wait = true);
+
+    // serve a direct read on any node of the chain, reply is written back on
+    // the DoOp stream by the caller. Returns false if a key read has a write
+    // the tail hasn't replied to, see UncommittedWrites
+    bool HandleDirectRead(Op* op, OpReply* reply, ScanIteratorPool* scan_iters);
 
-    void HandleSingleOp(SingleOp* singleOp, Forwarder* forwarder, ReplyClient* reply_client);
+    // scan_iters are the iterators of the stream, only reads use them and
+    // reads are never buffered, so buffered ops pass nullptr
+    void HandleSingleOp(SingleOp* singleOp, Forwarder* forwarder, ReplyClient* reply_client,
+                        ScanIteratorPool* scan_iters = nullptr);
 
     void PostProcessing(SingleOp* singleOp, Forwarder* forwarder, ReplyClient* reply_client);
 
+    // a non-head node applies the in-order PUTs of an Op for the same
+    // memtable as one WriteBatch, see HandleWriteRun
+    bool is_batchable_write(SingleOp* singleOp);
+
+    // apply the PUTs of the run with one write and post-process each of
+    // them. A batch puts one entry per key into the memtable, so the
+    // memtable's op count still matches the head's
+    void HandleWriteRun(std::vector<SingleOp*>* run, Forwarder* forwarder, ReplyClient* reply_client);
+
+    // add the tail's reply to a PUT or UPDATE
+    void AddWriteReply(SingleOp* singleOp, const rocksdb::Status& s);
+
     // actually handle the SyncRequest
     void HandleSyncRequest(const SyncRequest* request, 
                             SyncReply* reply);
 
     // calling UpdateSstView and logAndApply
-    std::string ApplyVersionEdits(const std::string& args);
+    std::string ApplyVersionEdits(const SyncRequest& request);
 
-    void BufferVersionEdits(const std::string& args);
+    rocksdb::Status BufferVersionEdits(const SyncRequest& request);
     
-    std::string ApplyOneVersionEdit(std::vector<rocksdb::VersionEdit>& edits);
+    // apply the edits with one LogAndApply. They are the edits of
+    // num_primary_edits consecutive LogAndApply calls on the primary, in
+    // order. If files_staged, their new files already have their slots and
+    // links, see BufferVersionEdits
+    std::string ApplyOneVersionEdit(std::vector<rocksdb::VersionEdit>& edits,
+                                    size_t num_primary_edits = 1,
+                                    bool files_staged = false);
 
     void ApplyBufferedVersionEdits();
     
-    bool IsReady(const rocksdb::VersionEdit& edit);
+    // a flush edit is ready once its memtables are immutable, pending_mems
+    // are the memtables flushed by the edits before it in the same group
+    bool IsReady(const rocksdb::VersionEdit& edit, uint64_t pending_mems = 0);
 
     bool IsTermination(Op* op);
 
+    // an op that only carries the head's durable sequence number, see WalSyncer
+    bool IsWatermark(Op* op);
+
+    // an op that only carries the ids of the ops the tail replied to, see
+    // UncommittedWrites
+    bool IsCommitNotice(Op* op);
+
+    // the tail sends the held replies the head's WAL covers now
+    void ReleaseDurableReplies(ReplyClient* reply_client, uint64_t durable_seq);
+
     void CleanBufferedOps(Forwarder* forwarder,
                           ReplyClient* reply_client,
                           std::map<uint64_t, std::queue<SingleOp *>> *op_buffer);
 
-    // parse the version edit json string to rocksdb::VersionEdit 
-    rocksdb::VersionEdit ParseJsonStringToVersionEdit(const json& j_edit /* json version edit */);
+    // decode the binary version edits in a SyncRequest and their edit id,
+    // edits is left empty if the record is corrupt
+    rocksdb::Status ParseSyncRequest(const SyncRequest& request, uint64_t* id,
+                                     std::vector<rocksdb::VersionEdit>* edits);
 
     //called by secondary nodes to create a pool of preallocated ssts in rubble mode
     rocksdb::IOStatus CreateSstPool();
 
+    // fill a slot file with buf. The whole file is written so that the
+    // upstream node only overwrites allocated blocks through NVMe-oF
+    rocksdb::IOStatus CreateSlotFile(const std::string& sst_name, const rocksdb::AlignedBuffer& buf);
+
+    // queue the pool sizes asked by the primary for SstPoolResizer, filling
+    // slot files takes a while and must not hold up the edits
+    void ScheduleSstPoolResize(const SyncRequest& request);
+
+    // grow or shrink the slot classes of the pool to the sizes asked by the
+    // primary (times -> number of slots), then report the new sizes back
+    void ResizeSstPool(const std::map<int, int>& targets);
+
     // In a 3-node setting, if it's the second node in the chain it should also ship sst files it received from the primary/first node
     // to the tail/downstream node and also delete the ones that get deleted in the compaction
     // for non-head node, should update sst bit map
@@ -186,6 +312,40 @@ class RubbleKvServiceImpl final : public  RubbleKvStoreService::Service {
      */
     rocksdb::IOStatus UpdateSstViewAndShipSstFiles(const rocksdb::VersionEdit& edit);
     rocksdb::IOStatus DeleteSstFiles(const rocksdb::VersionEdit& edit);
+
+    // open the tables of the new files of the edit and load their index and
+    // filter blocks on the prewarm pool, see sst_prewarm_threads. Checks
+    // their chunk checksums there too with verify_shipped_sst
+    void PrewarmSstFiles(const rocksdb::VersionEdit& edit);
+
+    // wait for the prewarm of the edit's files, if there is one. Fails if a
+    // file doesn't match its checksums
+    rocksdb::Status WaitForPrewarm(uint64_t edit_number);
+
+    // primary: copy the live ssts the new tail's slots don't hold yet
+    Status CatchUpCopy(const RecoverRequest* request);
+
+    // primary: flush, copy the files CatchUpCopy missed and return one edit
+    // with all the live files, see RecoverReply
+    Status CatchUpSnapshot(RecoverReply* reply);
+
+    // new tail: hold the ops and version edits and have the primary fill
+    // the slots
+    Status BeginCatchUp(const RecoverRequest* request);
+
+    // new tail: install the primary's snapshot in place of the current
+    // version, then let the held ops and edits go
+    Status FinishCatchUp();
+
+    // new tail: let the held ops and edits go and wake the parked streams
+    void EndCatchUp();
+
+    // drop the scan iterators of the streams that read an older version, see
+    // ScanIteratorPool::ReleaseStale
+    void ReleaseStaleScanIterators();
+
+    // new tail: a write to a memtable the installed snapshot covers
+    bool IsCaughtUpWrite(SingleOp* singleOp);
     // set the reply message according to the status
     void SetReplyMessage(SyncReply* reply, const rocksdb::Status& s, bool is_flush, bool is_trivial_move);
     std::string SetSyncReplyMessage();
@@ -236,6 +396,14 @@ class RubbleKvServiceImpl final : public  RubbleKvStoreService::Service {
     
     rocksdb::FileSystem* fs_;
 
+    // the pool sizes asked by the primary and not applied yet (times ->
+    // number of slots), a later ask replaces an earlier one. Applied one at
+    // a time by SstPoolResizer
+    std::map<int, int> sst_pool_targets_;
+    bool sst_pool_resizer_exit_ = false;
+    std::mutex sst_pool_mu_;
+    std::condition_variable sst_pool_cv_;
+
     std::atomic<uint64_t> log_apply_counter_{0};
 
     std::shared_ptr<Edits> edits_;
@@ -245,8 +413,34 @@ class RubbleKvServiceImpl final : public  RubbleKvStoreService::Service {
     bool is_head_ = false;
     bool is_tail_ = false;
 
-    bool remove_tail_ = false;
-    bool insert_tail_ = false;
+    // remove_tail: the tail died and we are the new one. insert_tail: a new
+    // tail joined behind us, the ops and edits go on to it
+    std::atomic<bool> remove_tail_{false};
+    std::atomic<bool> insert_tail_{false};
+    // the replicator the new tail replies to after a remove_tail
+    std::shared_ptr<Channel> replicator_channel_ = nullptr;
+    // the tail inserted behind us
+    std::shared_ptr<Channel> tail_channel_ = nullptr;
+    std::mutex tail_sync_mu_;
+    std::unique_ptr<SyncClient> tail_sync_client_;
+
+    // new tail: set from the first insert_tail call until the primary's
+    // snapshot is installed, DoOp and VersionEditsExecutor wait meanwhile
+    std::atomic<bool> catching_up_{false};
+    std::mutex catch_up_mu_;
+    std::condition_variable catch_up_cv_;
+    // the async streams parked until the catch up is over, see WaitOpStream
+    std::vector<std::function<void()>> catch_up_wakes_;
+    // the last edit and the first memtable not in the installed snapshot
+    std::atomic<uint64_t> catch_up_edit_{0};
+    std::atomic<uint64_t> catch_up_epoch_{0};
+
+    // primary: the sst pools of the removed tails, and the pool of the new
+    // tail with the files the first catch up phase copied to it
+    std::vector<std::string> removed_sst_dirs_;
+    std::mutex catch_up_copy_mu_;
+    std::string catch_up_dir_;
+    std::set<uint64_t> catch_up_copied_;
 
     bool  piggyback_edits_ = false;
   
@@ -262,7 +456,37 @@ class RubbleKvServiceImpl final : public  RubbleKvStoreService::Service {
     time_point<high_resolution_clock> batch_start_time_;
     time_point<high_resolution_clock> batch_end_time_;
     std::thread status_thread_;
-    std::map< std::thread::id, std::map< uint64_t, std::queue<SingleOp*> >* > buffers_;
+    std::map< OpStream*, std::map< uint64_t, std::queue<SingleOp*> >* > buffers_;
     std::mutex deleted_slots_mu_;
     std::unordered_set<int> deleted_slots_;
+
+    // a version edit can't be applied, e.g. a shipped sst fails its chunk
+    // checksums. VersionEditsExecutor stops, the Sync streams are rejected
+    // and the Recover replies ask for the node to be recovered
+    void SetNeedsRecovery(uint64_t edit_number, const rocksdb::Status& s);
+
+    std::atomic<bool> needs_recovery_{false};
+    std::mutex recovery_mu_;
+    rocksdb::Status recovery_status_;
+
+    // the files of an edit being prewarmed
+    struct Prewarm {
+      std::mutex mu;
+      std::condition_variable cv;
+      int pending = 0;
+      // the first chunk that failed its checksum
+      rocksdb::Status status;
+    };
+    std::unique_ptr<rocksdb::ThreadPoolImpl> prewarm_pool_;
+    std::mutex prewarm_mu_;
+    // edit number -> its prewarm
+    std::unordered_map<uint64_t, std::shared_ptr<Prewarm>> prewarms_;
+
+    // options of every write, only the head writes a WAL, see chain_group_commit
+    rocksdb::WriteOptions write_options_;
+    // group commits the head's WAL with chain_group_commit
+    std::unique_ptr<WalSyncer> wal_syncer_;
+    // the writes not replied to by the tail yet, with serve_direct_reads on
+    // the nodes before the tail
+    std::unique_ptr<UncommittedWrites> uncommitted_;
 };
\ No newline at end of file
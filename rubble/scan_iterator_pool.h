@@ -0,0 +1,101 @@
+#pragma once
+
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "rocksdb/db.h"
+#include "rocksdb/iterator.h"
+#include "rocksdb/options.h"
+
+// Iterators of a DoOp stream reused across its SCAN ops. Creating an
+// iterator takes a super version reference and builds the whole merging
+// iterator, a reused one only needs a Refresh, which is a no-op if no flush
+// or compaction happened since the last scan.
+//
+// A kept iterator pins the version it reads, with its memtables and the
+// table readers of its ssts, whose slots a secondary hands back to the
+// primary once the ssts are deleted. So an iterator is only kept while it
+// reads the current version: Done drops it at the end of a scan if the
+// version changed during the scan, and ReleaseStale drops the idle ones
+// once a new version is installed.
+//
+// iterate_upper_bound is a pointer into the iterator's ReadOptions, so the
+// bounded iterator keeps pointing at upper_bound_ and a scan only changes
+// the key it holds. A scan without an end key uses the unbounded iterator.
+class ScanIteratorPool {
+  public:
+    // the pool must be destroyed before the db is closed
+    explicit ScanIteratorPool(rocksdb::DB* db) : db_(db) {}
+
+    // an iterator that stops before end_key, or at the end of the db if
+    // end_key is empty. Valid until Done
+    rocksdb::Iterator* Get(const std::string& end_key) {
+        std::lock_guard<std::mutex> lk{mu_};
+        in_use_ = true;
+        std::unique_ptr<rocksdb::Iterator>* iter;
+        rocksdb::ReadOptions ro(/*verify_checksums*/true, /*fill_cache*/true);
+        if (end_key.empty()) {
+            iter = &unbounded_;
+        } else {
+            upper_bound_key_ = end_key;
+            upper_bound_ = rocksdb::Slice(upper_bound_key_);
+            ro.iterate_upper_bound = &upper_bound_;
+            iter = &bounded_;
+        }
+
+        if (*iter != nullptr && (*iter)->Refresh().ok()) {
+            return iter->get();
+        }
+        iter->reset(db_->NewIterator(ro));
+        return iter->get();
+    }
+
+    // the scan with the iterator of Get is over
+    void Done() {
+        std::lock_guard<std::mutex> lk{mu_};
+        in_use_ = false;
+        ReleaseStaleLocked();
+    }
+
+    // drop the iterators that read an older version than the current one,
+    // unless a scan is running. Called by the secondary once it applied
+    // version edits
+    void ReleaseStale() {
+        std::lock_guard<std::mutex> lk{mu_};
+        if (!in_use_) {
+            ReleaseStaleLocked();
+        }
+    }
+
+  private:
+    void ReleaseStaleLocked() {
+        uint64_t current = 0;
+        bool known = db_->GetIntProperty(
+            rocksdb::DB::Properties::kCurrentSuperVersionNumber, &current);
+        for (auto* iter : {&bounded_, &unbounded_}) {
+            if (*iter == nullptr) {
+                continue;
+            }
+            std::string version;
+            if (!known ||
+                !(*iter)->GetProperty("rocksdb.iterator.super-version-number", &version).ok() ||
+                std::stoull(version) != current) {
+                iter->reset();
+            }
+        }
+    }
+
+    rocksdb::DB* db_;
+
+    std::mutex mu_;
+    // a scan holds the iterator of Get
+    bool in_use_ = false;
+
+    std::string upper_bound_key_;
+    rocksdb::Slice upper_bound_;
+
+    std::unique_ptr<rocksdb::Iterator> bounded_;
+    std::unique_ptr<rocksdb::Iterator> unbounded_;
+};
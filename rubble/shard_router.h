@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Decides which shard a key goes to, used by the replicator. Counts the
+// keys routed to each shard so the load can be exported and used to decide
+// when to rebalance. Shards can be added or removed online, the listener set
+// by SetRebalanceListener is called after the mapping changes. Only the
+// mapping changes, the data of the keys that move stays on their old shard.
+class ShardRouter {
+  public:
+    explicit ShardRouter(int num_shards) {
+        for (int i = 0; i < num_shards; i++) {
+            load_.emplace_back(new std::atomic<uint64_t>(0));
+        }
+    }
+
+    virtual ~ShardRouter() {}
+
+    virtual const char* Name() const = 0;
+
+    // shard of the key, counts it in the shard's load
+    int Route(const std::string& key) {
+        int shard;
+        {
+            std::shared_lock<std::shared_timed_mutex> lk{mu_};
+            shard = RouteLocked(key);
+            load_[shard]->fetch_add(1, std::memory_order_relaxed);
+        }
+        return shard;
+    }
+
+    // rebalancing hooks, the new shard takes index NumShards()
+    int AddShard() {
+        int shard = -1;
+        Rebalance([&]() {
+            shard = static_cast<int>(load_.size());
+            load_.emplace_back(new std::atomic<uint64_t>(0));
+            AddShardLocked(shard);
+        });
+        return shard;
+    }
+
+    // no more keys go to the shard, its index stays taken
+    void RemoveShard(int shard) {
+        Rebalance([&]() { RemoveShardLocked(shard); });
+    }
+
+    void SetRebalanceListener(std::function<void(const ShardRouter&)> listener) {
+        std::unique_lock<std::shared_timed_mutex> lk{mu_};
+        listener_ = listener;
+    }
+
+    int NumShards() const {
+        std::shared_lock<std::shared_timed_mutex> lk{mu_};
+        return static_cast<int>(load_.size());
+    }
+
+    // number of keys routed to each shard since the last reset
+    std::vector<uint64_t> GetLoad(bool reset = false) const {
+        std::shared_lock<std::shared_timed_mutex> lk{mu_};
+        std::vector<uint64_t> load;
+        for (const auto& l : load_) {
+            load.push_back(reset ? l->exchange(0) : l->load());
+        }
+        return load;
+    }
+
+    // "shard:count" pairs, for the throughput log
+    std::string DumpLoad(bool reset = false) const {
+        std::vector<uint64_t> load = GetLoad(reset);
+        std::stringstream ss;
+        for (size_t i = 0; i < load.size(); i++) {
+            ss << (i ? " " : "") << i << ":" << load[i];
+        }
+        return ss.str();
+    }
+
+  protected:
+    // change the mapping while no key is routed, then tell the listener
+    void Rebalance(const std::function<void()>& change) {
+        {
+            std::unique_lock<std::shared_timed_mutex> lk{mu_};
+            change();
+        }
+        NotifyRebalance();
+    }
+
+    // the caller holds mu_
+    uint64_t LoadLocked(int shard) const { return load_[shard]->load(); }
+
+    virtual int RouteLocked(const std::string& key) const = 0;
+    virtual void AddShardLocked(int shard) = 0;
+    virtual void RemoveShardLocked(int shard) = 0;
+
+    // stable across processes and builds, unlike std::hash
+    static uint64_t HashKey(const std::string& key, uint64_t seed = 0) {
+        uint64_t h = 14695981039346656037ULL ^ seed;
+        for (unsigned char c : key) {
+            h = (h ^ c) * 1099511628211ULL;
+        }
+        // finalizer of splitmix64 so that similar keys spread out
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+        return h;
+    }
+
+  private:
+    void NotifyRebalance() {
+        std::function<void(const ShardRouter&)> listener;
+        {
+            std::shared_lock<std::shared_timed_mutex> lk{mu_};
+            listener = listener_;
+        }
+        if (listener) {
+            listener(*this);
+        }
+    }
+
+    mutable std::shared_timed_mutex mu_;
+    std::vector<std::unique_ptr<std::atomic<uint64_t>>> load_;
+    std::function<void(const ShardRouter&)> listener_;
+};
+
+// Consistent hashing with virtual nodes: every shard owns num_vnodes points
+// on a hash ring and a key goes to the first point after its hash. Adding or
+// removing a shard only moves the keys of its own points.
+class ConsistentHashRouter : public ShardRouter {
+  public:
+    ConsistentHashRouter(int num_shards, int num_vnodes = 128)
+      : ShardRouter(num_shards), num_vnodes_(std::max(num_vnodes, 1)) {
+        for (int i = 0; i < num_shards; i++) {
+            AddShardLocked(i);
+        }
+    }
+
+    const char* Name() const override { return "ConsistentHashRouter"; }
+
+  protected:
+    int RouteLocked(const std::string& key) const override {
+        assert(!ring_.empty());
+        auto it = std::upper_bound(ring_.begin(), ring_.end(),
+                                   std::make_pair(HashKey(key), -1));
+        if (it == ring_.end()) {
+            it = ring_.begin();
+        }
+        return it->second;
+    }
+
+    void AddShardLocked(int shard) override {
+        for (int v = 0; v < num_vnodes_; v++) {
+            std::string vnode = std::to_string(shard) + "#" + std::to_string(v);
+            ring_.emplace_back(HashKey(vnode, kVnodeSeed), shard);
+        }
+        std::sort(ring_.begin(), ring_.end());
+    }
+
+    void RemoveShardLocked(int shard) override {
+        ring_.erase(std::remove_if(ring_.begin(), ring_.end(),
+                                   [shard](const std::pair<uint64_t, int>& p) {
+                                       return p.second == shard;
+                                   }),
+                    ring_.end());
+    }
+
+  private:
+    static const uint64_t kVnodeSeed = 0x9e3779b97f4a7c15ULL;
+
+    const int num_vnodes_;
+    // (point, shard) sorted by point
+    std::vector<std::pair<uint64_t, int>> ring_;
+};
+
+// Range partitioning: shard i owns the keys in [split_points[i - 1],
+// split_points[i]). Keeps scans on one shard, needs split points that follow
+// the key distribution. A new shard splits the range with the most load.
+class RangeRouter : public ShardRouter {
+  public:
+    // split_points must be sorted, there is one more shard than split points
+    explicit RangeRouter(const std::vector<std::string>& split_points)
+      : ShardRouter(static_cast<int>(split_points.size()) + 1),
+        split_points_(split_points) {
+        assert(std::is_sorted(split_points_.begin(), split_points_.end()));
+        for (size_t i = 0; i <= split_points_.size(); i++) {
+            owners_.push_back(static_cast<int>(i));
+        }
+    }
+
+    const char* Name() const override { return "RangeRouter"; }
+
+    // move the boundaries, e.g. from the observed key distribution
+    void SetSplitPoints(const std::vector<std::string>& split_points,
+                        const std::vector<int>& owners) {
+        assert(owners.size() == split_points.size() + 1);
+        assert(std::is_sorted(split_points.begin(), split_points.end()));
+        Rebalance([&]() {
+            split_points_ = split_points;
+            owners_ = owners;
+        });
+    }
+
+  protected:
+    int RouteLocked(const std::string& key) const override {
+        auto it = std::upper_bound(split_points_.begin(), split_points_.end(), key);
+        return owners_[it - split_points_.begin()];
+    }
+
+    void AddShardLocked(int shard) override {
+        // split a range of the shard with the most load in half, by taking
+        // the middle of its two boundaries
+        size_t range = 0;
+        uint64_t max_load = 0;
+        for (size_t i = 0; i < owners_.size(); i++) {
+            uint64_t load = LoadLocked(owners_[i]);
+            if (i == 0 || load > max_load) {
+                range = i;
+                max_load = load;
+            }
+        }
+        std::string lo = range == 0 ? std::string() : split_points_[range - 1];
+        std::string hi = range == split_points_.size() ? lo + "\xff" : split_points_[range];
+        split_points_.insert(split_points_.begin() + range, MidPoint(lo, hi));
+        owners_.insert(owners_.begin() + range + 1, shard);
+    }
+
+    void RemoveShardLocked(int shard) override {
+        // merge every range of the shard into its left neighbour
+        for (size_t i = owners_.size(); i-- > 0;) {
+            if (owners_[i] != shard || owners_.size() == 1) {
+                continue;
+            }
+            size_t split = i == 0 ? 0 : i - 1;
+            owners_.erase(owners_.begin() + i);
+            split_points_.erase(split_points_.begin() + split);
+        }
+    }
+
+  private:
+    // a key between lo and hi
+    static std::string MidPoint(const std::string& lo, const std::string& hi) {
+        std::string mid;
+        size_t n = std::max(lo.size(), hi.size()) + 1;
+        int carry = 0;
+        std::vector<int> sum(n, 0);
+        for (size_t i = n; i-- > 0;) {
+            int a = i < lo.size() ? static_cast<unsigned char>(lo[i]) : 0;
+            int b = i < hi.size() ? static_cast<unsigned char>(hi[i]) : 0;
+            int s = a + b + carry;
+            sum[i] = s & 0xff;
+            carry = s >> 8;
+        }
+        int rem = carry;
+        for (size_t i = 0; i < n; i++) {
+            int v = (rem << 8) | sum[i];
+            mid.push_back(static_cast<char>(v >> 1));
+            rem = v & 1;
+        }
+        return mid;
+    }
+
+    std::vector<std::string> split_points_;
+    // owners_[i] is the shard of range i
+    std::vector<int> owners_;
+};
@@ -1,28 +1,53 @@
 #include "sst_bit_map.h"
 #include <iostream>
 #include <assert.h>
+#include <algorithm>
+#include <thread>
 #include <logging/logging.h>
 
+SstBitMap::SlotClass::SlotClass(int first, int num, int active)
+    : first_slot(first), num_slots(num),
+      num_words((static_cast<size_t>(num) + 63) / 64),
+      num_active(active), num_free(active), hint(0), target(active) {
+    words.reset(new std::atomic<uint64_t>[num_words > 0 ? num_words : 1]);
+    // bits of the retired slots and past the last slot are never free
+    for (size_t i = 0; i < num_words; i++) {
+        uint64_t word = 0;
+        for (int bit = 0; bit < 64; bit++) {
+            if (static_cast<int>(i * 64) + bit >= active) {
+                word |= uint64_t{1} << bit;
+            }
+        }
+        words[i].store(word);
+    }
+}
+
 SstBitMap::SstBitMap(int pool_size, int max_num_mems_in_flush,
         bool is_primary, int rf,
-        std::shared_ptr<rocksdb::Logger> logger, 
-        std::shared_ptr<rocksdb::Logger> map_logger)
-    :size_(pool_size), num_big_slots_(100),
+        std::shared_ptr<rocksdb::Logger> logger,
+        std::shared_ptr<rocksdb::Logger> map_logger,
+        int max_pool_size,
+        int num_big_slots)
+    :size_(std::max(pool_size, max_pool_size)), num_big_slots_(std::max(num_big_slots, 1)),
     max_num_mems_in_flush_(max_num_mems_in_flush),
+    max_pool_size_(max_pool_size),
     logger_(logger),
     map_logger_(map_logger){
-        int num_big_slots = (max_num_mems_in_flush_ - 1) *num_big_slots_;
-        slots_.reserve(size_ + 1 + num_big_slots);
-        slots_.assign(size_ + 1 + num_big_slots, 0);
-        slot_usage_.reserve(size_ + 1 + num_big_slots);
-        slot_usage_.assign(size_ + 1 + num_big_slots, 0);
-        next_available_slot_.push_back(1); // default slot start from 1
-        for(int i = 0; i < max_num_mems_in_flush_ - 1; i++){
-            // offset start of big sst slots
-            next_available_slot_.push_back(size_ + 1 + i * num_big_slots_);
+        int total_big_slots = (max_num_mems_in_flush_ - 1) *num_big_slots_;
+        num_slots_total_ = size_ + 1 + total_big_slots;
+        slots_.reset(new std::atomic<uint64_t>[num_slots_total_]);
+        slot_usage_.reset(new std::atomic<int>[num_slots_total_]);
+        for (size_t i = 0; i < num_slots_total_; i++) {
+            slots_[i].store(0);
+            slot_usage_[i].store(0);
         }
-        for(int i = 0; i < max_num_mems_in_flush_; i++){
-            num_slots_taken_.push_back(0);
+
+        classes_.emplace_back(new SlotClass(1, size_, pool_size)); // default slot start from 1
+        for(int i = 0; i < max_num_mems_in_flush_ - 1; i++){
+            // offset start of big sst slots, they are only created on demand
+            // if the pool is dynamic
+            classes_.emplace_back(new SlotClass(size_ + 1 + i * num_big_slots_, num_big_slots_,
+                                                IsDynamic() ? 0 : num_big_slots_));
         }
 
         if (is_primary) {
@@ -39,138 +64,129 @@ SstBitMap::SstBitMap(int pool_size, int max_num_mems_in_flush,
         // }
     }
 
+int SstBitMap::SlotClassOf(int slot_num) const {
+    return slot_num <= size_ ? 0 : ((slot_num - size_ - 1) / num_big_slots_ + 1);
+}
 
-int SstBitMap::TakeOneAvailableSlot(uint64_t file_num, int times){
-    // by default RocksDB sets max_write_buffer_number to 2,
-    // so flushes only 1 memtable each time
-    assert(times > 0);
-
-    std::lock_guard<std::mutex> lk{mu_};
+bool SstBitMap::Reserve(SlotClass* c, int n) {
+    int cur = c->num_free.load();
+    do {
+        if (cur < n) {
+            return false;
+        }
+    } while (!c->num_free.compare_exchange_weak(cur, cur - n));
+    return true;
+}
 
-    if (num_slots_taken_[0] == size_ 
-        || (times >= 2 && num_slots_taken_[times - 1] == num_big_slots_)) {
-        std::cerr << "run out of slots, try later\n";
-        return -1;
-    }
-    
-    int start, end;
-    if (times == 1) {
-        start = 1;
-        end = size_;
-    } else {
-        start = size_ + 1 + (times - 2)*num_big_slots_;
-        end = start + num_big_slots_ - 1;
-    }
-   
-    int slot_num = next_available_slot_[times - 1];
-    // we need to do elaborate checking because some slots might have been freed
-    // we would like to maximize the utilization
-    if (slots_[slot_num] != 0) { // if this slot has been taken
-        int cur = slot_num + 1;
-        while (cur <= end && slots_[cur] != 0) {
-            cur++;
+int SstBitMap::Claim(SlotClass* c) {
+    // a free bit exists since the caller reserved it, but concurrent takers
+    // may grab the bits this pass looks at first
+    static const int kMaxClaimPasses = 4;
+    for (int pass = 0; pass < kMaxClaimPasses; pass++) {
+        if (pass > 0) {
+            std::this_thread::yield();
         }
-        // circular buffer, loop from start again to find available slots
-        if(cur > end){
-            cur = start;
-            while(cur <= end && slots_[cur] != 0){
-                cur++;
-            }
-            // if still couldn't find it
-            if(cur > end){
-                std::cerr << "times: " << times << ", total " << num_slots_taken_[times - 1] << " taken\n";
-                return -1;
+        size_t start = c->hint.load(std::memory_order_relaxed);
+        for (size_t k = 0; k < c->num_words; k++) {
+            size_t idx = (start + k) % c->num_words;
+            uint64_t cur = c->words[idx].load();
+            while (~cur != 0) {
+                int bit = __builtin_ctzll(~cur);
+                if (c->words[idx].compare_exchange_weak(cur, cur | (uint64_t{1} << bit))) {
+                    c->hint.store(idx, std::memory_order_relaxed);
+                    return c->first_slot + static_cast<int>(idx * 64) + bit;
+                }
             }
         }
-        slot_num = cur;
     }
-    
-    slots_[slot_num] = file_num;
-    slot_usage_[slot_num] = slot_initial_usage_;
+    c->num_free.fetch_add(1);
+    return -1;
+}
+
+void SstBitMap::Release(int slot_num) {
+    SlotClass* c = classes_[SlotClassOf(slot_num)].get();
+    int i = slot_num - c->first_slot;
+    uint64_t prev = c->words[i / 64].fetch_and(~(uint64_t{1} << (i % 64)));
+    assert(prev & (uint64_t{1} << (i % 64)));
+    (void)prev;
+    c->num_free.fetch_add(1);
+}
+
+void SstBitMap::Publish(uint64_t file_num, int slot_num, int times) {
+    slots_[slot_num].store(file_num);
+    slot_usage_[slot_num].store(slot_initial_usage_.load());
+    FileSlotShard& shard = ShardOf(file_num);
+    {
+        std::lock_guard<std::mutex> lk{shard.mu};
+        shard.file_slots[file_num] = slot_num;
+    }
     RUBBLE_LOG_INFO(map_logger_, "%lu %d\n", file_num, times);
     RUBBLE_LOG_INFO(logger_, "Take Slot (%lu , %d)\n", file_num, slot_num);
-    // std::cout << "[sst bitmap] " << "File " << file_num << " takes slot " << slot_num << std::endl;
-    LogFlush(map_logger_);
-    LogFlush(logger_);
-    
-    file_slots_.emplace(file_num, slot_num);
-    num_slots_taken_[times - 1]++;
-
-    // CheckNumSlotsTaken();
-    if(slot_num == end){
-        next_available_slot_[times - 1]= start;
-    }else{
-        next_available_slot_[times - 1] = slot_num + 1;
-    }
+}
+
+int SstBitMap::TakeOneAvailableSlot(uint64_t file_num, int times){
+    // by default RocksDB sets max_write_buffer_number to 2,
+    // so flushes only 1 memtable each time
+    assert(times > 0 && times <= static_cast<int>(classes_.size()));
 
+    SlotClass* c = classes_[times - 1].get();
+    if (!Reserve(c, 1)) {
+        RUBBLE_LOG_INFO(logger_, "times: %d, run out of slots, try later\n", times);
+        return -1;
+    }
+    int slot_num = Claim(c);
+    if (slot_num == -1) {
+        return -1;
+    }
+    Publish(file_num, slot_num, times);
+    LogFlush(map_logger_);
     return slot_num;
 }
 
 bool SstBitMap::TakeSlotsInBatch(const std::vector<std::pair<uint64_t, int>>& files_info) {
-    std::lock_guard<std::mutex> lk{mu_};
-    int slots_to_take = files_info.size();
-
-    if (num_slots_taken_[0] + slots_to_take > size_) {
-        std::cerr << "run out of slots, don't have " << slots_to_take << " slots available\n";
-        return false;
+    std::map<int, int> needed_slots;
+    for (const auto& p : files_info) {
+        assert(p.second > 0 && p.second <= static_cast<int>(classes_.size()));
+        needed_slots[p.second]++;
     }
-    
-    int start = 1, end = size_;
-    std::map<uint64_t, int> assigned_file_slots;
-    
-    for (int i = 0; i < slots_to_take; i++) {
-        uint64_t file_num = files_info[i].first;
-        int times = files_info[i].second;
-        // we temporarily set each sst to be 17m
-        assert(times == 1);
-
-        int slot_num = next_available_slot_[times - 1];
-        if (slots_[slot_num] != 0) {
-            int cur = slot_num + 1;
-            while (cur <= end && slots_[cur] != 0) {
-                cur++;
-            }
 
-            if (cur > end) {
-                cur = start;
-                while (cur <= end && slots_[cur] != 0){
-                    cur++;
-                }
-                if (cur > end) {
-                    std::cerr << "run out of slots, don't have " << slots_to_take << " slots available\n";
-                    return false;
-                }
+    // reserve every class first so that either all files get a slot or none
+    for (auto it = needed_slots.begin(); it != needed_slots.end(); ++it) {
+        if (!Reserve(classes_[it->first - 1].get(), it->second)) {
+            for (auto r = needed_slots.begin(); r != it; ++r) {
+                classes_[r->first - 1]->num_free.fetch_add(r->second);
             }
-            slot_num = cur;
+            RUBBLE_LOG_INFO(logger_, "run out of slots, don't have %d slots of times %d available\n",
+                            it->second, it->first);
+            return false;
         }
-        if (slot_num == end) {
-            next_available_slot_[0] = start;
-        } else {
-            next_available_slot_[0] = slot_num + 1;
-        }
-        assigned_file_slots[file_num] = slot_num;
     }
 
-    for (const auto& p : assigned_file_slots) {
-        uint64_t file_num = p.first;
-        int slot_num = p.second;
-
-        slots_[slot_num] = file_num;
-        slot_usage_[slot_num] = slot_initial_usage_;
-        file_slots_.emplace(file_num, slot_num);
-        num_slots_taken_[0]++;  // as we suppose times=1 for now
-
-        assert(num_slots_taken_[0] <= size_);
-        
-        // std::cout << "[sst bitmap] TakeSlotInBatch: " << "File " << file_num << " takes slot " << slot_num <<
-        //     ", remains " << size_ - num_slots_taken_[0] << " free slots" << std::endl;
+    // claim every slot before publishing any, so a failed claim leaves no
+    // file behind
+    std::vector<int> slot_nums;
+    for (size_t i = 0; i < files_info.size(); i++) {
+        int slot_num = Claim(classes_[files_info[i].second - 1].get());
+        if (slot_num == -1) {
+            for (int claimed : slot_nums) {
+                Release(claimed);
+            }
+            for (size_t j = i + 1; j < files_info.size(); j++) {
+                classes_[files_info[j].second - 1]->num_free.fetch_add(1);
+            }
+            return false;
+        }
+        slot_nums.push_back(slot_num);
     }
-
+    for (size_t i = 0; i < files_info.size(); i++) {
+        Publish(files_info[i].first, slot_nums[i], files_info[i].second);
+    }
+    LogFlush(map_logger_);
     return true;
 }
 
 int SstBitMap::GetAvailableSlots(int times) {
-    return size_ - num_slots_taken_[times - 1];
+    return classes_[times - 1]->num_free.load();
 }
 
 // Since the tail is dead, we erase its bit in all slots
@@ -179,19 +195,44 @@ void SstBitMap::RemoveTail(int rf) {
     int tail_rid = rf -  1;
     int tail_bit = 1 << tail_rid;
     std::set<uint64_t> tail_used_files;
-    
-    for (size_t i = 0; i < slot_usage_.size(); i++) {
-        if (slot_usage_[i] & tail_bit) {
-            tail_used_files.insert(i);
+
+    for (size_t i = 0; i < num_slots_total_; i++) {
+        if (slot_usage_[i].load() & tail_bit) {
+            tail_used_files.insert(slots_[i].load());
         }
     }
 
     FreeSlot(tail_used_files, tail_rid, true);
 }
 
+void SstBitMap::AddTail(int rf) {
+    slot_initial_usage_ = (1 << rf) - 2;
+}
+
+void SstBitMap::SyncTailSlots(int rf, const std::set<uint64_t>& live_files, uint64_t next_file_num) {
+    int tail_rid = rf - 1;
+    int tail_bit = 1 << tail_rid;
+    std::set<uint64_t> dropped_files;
+
+    for (size_t i = 0; i < num_slots_total_; i++) {
+        uint64_t file_num = slots_[i].load();
+        if (file_num == 0) {
+            continue;
+        }
+        if (live_files.count(file_num) != 0) {
+            slot_usage_[i].fetch_or(tail_bit);
+        } else if (file_num < next_file_num && (slot_usage_[i].load() & tail_bit)) {
+            // deleted by an edit the snapshot already covers
+            dropped_files.insert(file_num);
+        }
+    }
+
+    FreeSlot(dropped_files, tail_rid, true);
+}
+
 void SstBitMap::WaitForFreeSlots(const std::map<int, int>& needed_slots) {
-    std::unique_lock<std::mutex> lock{mu_};
-    bitmap_full_cond_.wait(lock, [&] { 
+    std::unique_lock<std::mutex> lock{wait_mu_};
+    bitmap_full_cond_.wait(lock, [&] {
         for (const auto& p : needed_slots) {
             int times = p.first;
             int slots = p.second;
@@ -200,120 +241,228 @@ void SstBitMap::WaitForFreeSlots(const std::map<int, int>& needed_slots) {
         }
         return true;
     });
-    lock.unlock();
 }
 
 void SstBitMap::NotifyFreeSlot() {
+    // pairs with the check in WaitForFreeSlots so a wakeup is never lost
+    std::lock_guard<std::mutex> lock{wait_mu_};
     bitmap_full_cond_.notify_all();
 }
 
-void SstBitMap::CheckNumSlotsTaken(){
-    int total_slots_taken = 0;
-    for(int count : num_slots_taken_){
-        total_slots_taken += count;
-    }
-    int total_file_slots = static_cast<int>(file_slots_.size()); //initialization
-    std::vector<int> slot_taken(num_slots_taken_.capacity(), 0);
-    
-    // TODO: for debugging purposes only I think...
-    if(total_file_slots != total_slots_taken){
-        std::unordered_map<uint64_t, int>::iterator it;
-        for(it = file_slots_.begin(); it != file_slots_.end(); ++it){
-            if(it->second <= size_){ // if normal, idx = 0
-                slot_taken[0]++;
-            }else{ // else calculate times
-                int idx = (it->second - size_) /num_big_slots_ + 1;
-                slot_taken[idx]++;
-            }
-        }
-        for(int i = 0 ; i < static_cast<int>(slot_taken.size()); i++){
-            std::cout << " ( " << i << " : " << slot_taken[i] << " , " << num_slots_taken_[i] << " ) \n";
-        }
-    }
-    assert(static_cast<int>(file_slots_.size()) == total_slots_taken);
-}
-
 bool SstBitMap::CheckSlotFreed(int slot_num) {
-    return slot_usage_[slot_num] == 0;
+    return slot_usage_[slot_num].load() == 0;
 }
 
 void SstBitMap::FreeSlot(std::set<uint64_t> file_nums, int rid, bool notify) {
-    std::lock_guard<std::mutex> lk{mu_};
+    std::vector<std::pair<int, uint64_t>> freed;
 
     for (uint64_t file_num : file_nums) {
-        int slot_num = file_slots_[file_num];
-        // assert(slot_usage_[slot_num] == 1 || slot_usage_[slot_num] == 2);
-        slot_usage_[slot_num] &= ~(1 << rid);
-
-        // std::cout << "[sst bitmap] " << "try to free slot " << slot_num << " of file " << file_num << std::endl;
-
-        if (slot_usage_[slot_num] == 0) {
-            RUBBLE_LOG_INFO(map_logger_, "%lu\n", file_num);
-            RUBBLE_LOG_INFO(logger_, "Free Slot (%d , %lu) \n", slot_num, slots_[slot_num]);
-            // printf("Free Slot (%d , %lu) \n", slot_num, slots_[slot_num]);
-            LogFlush(map_logger_);
-            LogFlush(logger_);
-            int idx = slot_num <= size_ ? 0 : ((slot_num - size_ - 1) /num_big_slots_  + 1 );
-            num_slots_taken_[idx]--;
-            slots_[slot_num] = 0;
-            file_slots_.erase(file_num);
-
-            // std::cout << "[sst bitmap] " << "successfully free slot " << slot_num << " of file " << file_num << std::endl;   
+        int slot_num = GetFileSlotNum(file_num);
+        if (slot_num == -1) {
+            continue;
         }
+        int bit = 1 << rid;
+        int prev = slot_usage_[slot_num].fetch_and(~bit);
+
+        // only the one clearing the last bit frees the slot
+        if ((prev & bit) != 0 && (prev & ~bit) == 0) {
+            FileSlotShard& shard = ShardOf(file_num);
+            {
+                std::lock_guard<std::mutex> lk{shard.mu};
+                shard.file_slots.erase(file_num);
+            }
+            slots_[slot_num].store(0);
+            Release(slot_num);
+            freed.emplace_back(slot_num, file_num);
+        }
+    }
 
-        // std::cout << "[sst bitmap] remains " << size_ - num_slots_taken_[0] << " free slots" << std::endl;
+    for (const auto& p : freed) {
+        RUBBLE_LOG_INFO(map_logger_, "%lu\n", p.second);
+        RUBBLE_LOG_INFO(logger_, "Free Slot (%d , %lu) \n", p.first, p.second);
+    }
+    if (!freed.empty()) {
+        LogFlush(map_logger_);
     }
 
     if (notify) {
         NotifyFreeSlot();
     }
 }
-    
+
+void SstBitMap::ReturnSlot(uint64_t file_num) {
+    int slot_num;
+    FileSlotShard& shard = ShardOf(file_num);
+    {
+        std::lock_guard<std::mutex> lk{shard.mu};
+        auto it = shard.file_slots.find(file_num);
+        if (it == shard.file_slots.end()) {
+            return;
+        }
+        slot_num = it->second;
+        shard.file_slots.erase(it);
+    }
+    slot_usage_[slot_num].store(0);
+    slots_[slot_num].store(0);
+    Release(slot_num);
+    RUBBLE_LOG_INFO(map_logger_, "%lu\n", file_num);
+    RUBBLE_LOG_INFO(logger_, "Return Slot (%d , %lu) \n", slot_num, file_num);
+    NotifyFreeSlot();
+}
+
 uint64_t SstBitMap::GetSlotFileNum(int slot_num){
-    std::lock_guard<std::mutex> lk{mu_};
-    // why this assert here? what about big slots
-    assert(slot_num <= size_);
-    return slots_[slot_num];
+    assert(slot_num >= 0 && static_cast<size_t>(slot_num) < num_slots_total_);
+    return slots_[slot_num].load();
 }
 
 int SstBitMap::GetFileSlotNum(uint64_t file_num){
-    std::lock_guard<std::mutex> lk{mu_};
-    if (file_slots_.count(file_num) == 0)
+    FileSlotShard& shard = ShardOf(file_num);
+    std::lock_guard<std::mutex> lk{shard.mu};
+    auto it = shard.file_slots.find(file_num);
+    if (it == shard.file_slots.end())
         return -1;
-    // assert(file_slots_.find(file_num) != file_slots_.end());
-    return file_slots_[file_num];
+    return it->second;
 }
 
 void SstBitMap::TakeSlot(uint64_t file_num, int slot_num, int times) {
     assert(times > 0);
-    std::lock_guard<std::mutex> lk{mu_};
-
-    RUBBLE_LOG_INFO(map_logger_, "%lu %d\n", file_num, times);
-    RUBBLE_LOG_INFO(logger_, "Take Slot (%lu , %d)\n", file_num, slot_num);
-    // printf("Take Slot (%lu , %d)\n", file_num, slot_num);
-    
+    (void)times;
+    // the slot is chosen by the upstream node, claim exactly that bit
+    SlotClass* c = classes_[SlotClassOf(slot_num)].get();
+    int i = slot_num - c->first_slot;
+    // reserve before setting the bit so a concurrent Claim never counts on
+    // this slot
+    bool reserved = Reserve(c, 1);
+    uint64_t prev = c->words[i / 64].fetch_or(uint64_t{1} << (i % 64));
+    if ((prev & (uint64_t{1} << (i % 64))) != 0) {
+        // taken already, the free count never had it
+        if (reserved) {
+            c->num_free.fetch_add(1);
+        }
+    } else if (!reserved) {
+        // a Release cleared the bit but didn't give the slot back to the
+        // free count yet
+        c->num_free.fetch_sub(1);
+    }
+    Publish(file_num, slot_num, times);
     LogFlush(map_logger_);
-    LogFlush(logger_);
-
-    slots_[slot_num] = file_num;
-    slot_usage_[slot_num] = slot_initial_usage_;
-    file_slots_[file_num] = slot_num;
-    num_slots_taken_[times-1]++;
-
-    // std::cout << "[sst bitmap] TakeSlot:" << "File " << file_num << " takes slot " << slot_num <<
-    //     " remains " << size_ - num_slots_taken_[0] << " free slots" << std::endl;
-
-    int start, end;
-    if(times == 1){
-        start = 1;
-        end = size_;
-    }else{
-        start = size_ + 1 + (times - 2)*num_big_slots_;
-        end = start + num_big_slots_ - 1;
+}
+
+int SstBitMap::GetActiveSlots(int times) {
+    return classes_[times - 1]->num_active.load();
+}
+
+void SstBitMap::SetWatermarks(int low, int high, int step) {
+    std::lock_guard<std::mutex> lk{resize_mu_};
+    low_watermark_ = low;
+    high_watermark_ = high;
+    grow_step_ = std::max(step, 1);
+}
+
+bool SstBitMap::PlanPoolSize(const std::map<int, int>& needed_slots, std::map<int, int>* targets) {
+    if (!IsDynamic() || low_watermark_ <= 0) {
+        return false;
+    }
+    std::unique_lock<std::mutex> lk{resize_mu_};
+    for (int i = 0; i < NumSlotClasses(); i++) {
+        SlotClass* c = classes_[i].get();
+        int times = i + 1;
+        int active = c->num_active.load();
+        int free = c->num_free.load();
+        auto it = needed_slots.find(times);
+        int needed = it == needed_slots.end() ? 0 : it->second;
+
+        if (c->target > active) {
+            // still waiting for the secondaries to grow the class
+            continue;
+        }
+        // a class nobody asked for stays empty, so big classes only get
+        // the slots the observed sst sizes need
+        bool used = active > 0 || needed > 0;
+        if (used && free - needed < low_watermark_ && active < c->num_slots) {
+            c->target = std::min(c->num_slots,
+                                 active + std::max(grow_step_, needed + low_watermark_ - free));
+            (*targets)[times] = c->target;
+        } else if (high_watermark_ > low_watermark_ && needed == 0 && free > high_watermark_) {
+            int retired = RetireSlots(times, active - std::min(grow_step_, free - high_watermark_));
+            if (retired < active) {
+                c->target = retired;
+                (*targets)[times] = c->target;
+            }
+        }
+    }
+    lk.unlock();
+
+    for (const auto& p : *targets) {
+        RUBBLE_LOG_INFO(logger_, "Resize slot class %d to %d slots\n", p.first, p.second);
+    }
+    return !targets->empty();
+}
+
+void SstBitMap::ReportPoolSize(int rid, int times, int num_slots) {
+    if (times <= 0 || times > NumSlotClasses()) {
+        return;
     }
-    if(slot_num == end){
-        next_available_slot_[times - 1]= start;
-    }else{
-        next_available_slot_[times - 1] = slot_num + 1;
+    std::unique_lock<std::mutex> lk{resize_mu_};
+    SlotClass* c = classes_[times - 1].get();
+    c->reported[rid] = num_slots;
+
+    // ready on every live secondary, see RemoveTail
+    int ready = c->target;
+    int usage = slot_initial_usage_.load();
+    for (int r = 1; r < 31; r++) {
+        if (usage & (1 << r)) {
+            auto it = c->reported.find(r);
+            ready = std::min(ready, it == c->reported.end() ? 0 : it->second);
+        }
+    }
+    if (ready <= c->num_active.load()) {
+        return;
+    }
+    GrowSlots(times, ready);
+    lk.unlock();
+
+    RUBBLE_LOG_INFO(logger_, "Slot class %d grows to %d slots\n", times, ready);
+    NotifyFreeSlot();
+}
+
+void SstBitMap::GrowSlots(int times, int num_slots) {
+    SlotClass* c = classes_[times - 1].get();
+    int active = c->num_active.load();
+    num_slots = std::min(num_slots, c->num_slots);
+    for (int i = active; i < num_slots; i++) {
+        c->words[i / 64].fetch_and(~(uint64_t{1} << (i % 64)));
+    }
+    if (num_slots > active) {
+        c->num_active.store(num_slots);
+        c->num_free.fetch_add(num_slots - active);
+    }
+}
+
+int SstBitMap::RetireSlots(int times, int num_slots) {
+    SlotClass* c = classes_[times - 1].get();
+    int active = c->num_active.load();
+    int i = active - 1;
+    for (; i >= std::max(num_slots, 0); i--) {
+        // reserve the slot first so that takers still find every slot they
+        // reserved
+        if (!Reserve(c, 1)) {
+            break;
+        }
+        uint64_t mask = uint64_t{1} << (i % 64);
+        uint64_t cur = c->words[i / 64].load();
+        bool retired = false;
+        while ((cur & mask) == 0) {
+            if (c->words[i / 64].compare_exchange_weak(cur, cur | mask)) {
+                retired = true;
+                break;
+            }
+        }
+        if (!retired) {
+            c->num_free.fetch_add(1);
+            break;
+        }
     }
+    c->num_active.store(i + 1);
+    return i + 1;
 }
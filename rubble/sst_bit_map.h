@@ -1,31 +1,52 @@
 #include <vector>
 #include <mutex>
 #include <atomic>
+#include <map>
+#include <memory>
 #include <set>
 #include <unordered_map>
 #include <rocksdb/env.h>
 #include <condition_variable>
 
-// a circular array implementation of bit map
+// Slot allocator of the sst pool. Slots are grouped in size classes, class
+// times - 1 holds the slots for ssts of times * target_file_size_base. Each
+// class keeps an atomic bitmap of its slots and an atomic count of its free
+// slots, so taking and freeing a slot never blocks: a taker first reserves
+// from the free count, then claims a bit with a CAS starting from the word
+// it last allocated from.
+//
+// If max_pool_size is set, the pool of normal slots starts with pool_size
+// active slots and can grow up to max_pool_size, big slot classes start
+// empty. The primary plans the size of each class from the watermarks and
+// the slots the ship jobs ask for (PlanPoolSize), the secondaries fill the
+// new slot files and report them back (ReportPoolSize), and the primary only
+// hands out a new slot once every secondary has it.
 class SstBitMap{
 public:
     SstBitMap(int pool_size, int max_num_mems_in_flush,
     bool is_primary, int rf,
     std::shared_ptr<rocksdb::Logger> logger = nullptr,
-    std::shared_ptr<rocksdb::Logger> map_logger = nullptr);
-    
-    // take one slot for a specific file
+    std::shared_ptr<rocksdb::Logger> map_logger = nullptr,
+    int max_pool_size = 0,
+    int num_big_slots = 100);
+
+    // take one slot for a specific file, returns -1 if the class is full,
+    // see WaitForFreeSlots
     int TakeOneAvailableSlot(uint64_t file_num, int times);
 
     // take multiple slots in a batch, this is a all-or-nothing method
     bool TakeSlotsInBatch(const std::vector<std::pair<uint64_t, int>>& files_info);
-    
+
     // free the slots occupied by the set of files
     void FreeSlot(std::set<uint64_t> file_nums, int rid, bool notify);
 
+    // primary: give back the slot of a file that was never shipped, e.g. an
+    // empty or failed flush output
+    void ReturnSlot(uint64_t file_num);
+
     bool CheckSlotFreed(int slot_num);
 
-    // Get the file num that occupies the specific slot 
+    // Get the file num that occupies the specific slot
     uint64_t GetSlotFileNum(int slot_num);
 
     // Get the slot num occupied by a file
@@ -34,6 +55,7 @@ public:
     // update sst bit map with file num and slot num
     void TakeSlot(uint64_t file_num, int slot_num, int times);
 
+    // only blocks when the pool doesn't have the needed slots
     void WaitForFreeSlots(const std::map<int, int>& needed_slots);
 
     void NotifyFreeSlot();
@@ -42,39 +64,131 @@ public:
 
     void RemoveTail(int rf);
 
-private:
-    // check if the total num of slots taken matches the size of file_slots_
-    void CheckNumSlotsTaken();
-  
-    /* data */
-    std::vector<int> next_available_slot_;
+    // a new tail joins the chain as secondary rf - 1, the slots taken from
+    // now on wait for it too
+    void AddTail(int rf);
+
+    // the new tail installed a snapshot of the live files, it holds their
+    // slots and will never free the other files below next_file_num
+    void SyncTailSlots(int rf, const std::set<uint64_t>& live_files, uint64_t next_file_num);
+
+    bool IsDynamic() const { return max_pool_size_ > 0; }
+
+    // number of slots of the class that can be handed out
+    int GetActiveSlots(int times);
+
+    // number of classes and the first slot num, capacity of a class
+    int NumSlotClasses() const { return static_cast<int>(classes_.size()); }
+    int GetFirstSlot(int times) const { return classes_[times - 1]->first_slot; }
+    int GetSlotCapacity(int times) const { return classes_[times - 1]->num_slots; }
+
+    // set the slots a class grows or shrinks by when its free slots fall
+    // below low or rise above high
+    void SetWatermarks(int low, int high, int step);
+
+    // primary: decide the new size of the classes that crossed a watermark,
+    // needed_slots are the slots a ship job is waiting for. Shrinking retires
+    // free slots right away. Returns false if no class needs to be resized
+    bool PlanPoolSize(const std::map<int, int>& needed_slots, std::map<int, int>* targets);
 
-    std::vector<int> num_slots_taken_ ;
+    // primary: a secondary has num_slots slot files of the class ready, the
+    // slots become active once every secondary has them
+    void ReportPoolSize(int rid, int times, int num_slots);
 
+    // secondary: the slot files of the class are ready up to num_slots
+    void GrowSlots(int times, int num_slots);
+
+    // retire the free slots at the end of the class down to num_slots, stops
+    // at the first slot that is taken. Returns the new number of active slots
+    int RetireSlots(int times, int num_slots);
+
+private:
+    struct SlotClass {
+        // first slot num of the class
+        int first_slot;
+        int num_slots;
+        // bit i is set if slot first_slot + i is taken
+        std::unique_ptr<std::atomic<uint64_t>[]> words;
+        size_t num_words;
+        // slots past num_active are retired, their bits stay set
+        std::atomic<int> num_active;
+        std::atomic<int> num_free;
+        // the word to start looking for a free bit
+        std::atomic<size_t> hint;
+        // primary: the size last asked from the secondaries
+        int target;
+        // primary: rid -> number of slots the secondary has ready
+        std::map<int, int> reported;
+
+        SlotClass(int first, int num, int active);
+    };
+
+    static const int kNumFileSlotShards = 16;
+
+    // file num -> slot num, sharded to keep lookups from different threads apart
+    struct FileSlotShard {
+        std::mutex mu;
+        std::unordered_map<uint64_t, int> file_slots;
+    };
+
+    // index of the class the slot belongs to
+    int SlotClassOf(int slot_num) const;
+
+    // reserve n free slots of a class, all-or-nothing
+    bool Reserve(SlotClass* c, int n);
+
+    // claim a free bit of a class, the caller must have reserved it. Gives
+    // the reservation back and returns -1 if no free bit shows up after a few
+    // passes over the class
+    int Claim(SlotClass* c);
+
+    // mark a taken slot free and give it back to its class
+    void Release(int slot_num);
+
+    // record the file in the slot, the slot must be claimed
+    void Publish(uint64_t file_num, int slot_num, int times);
+
+    FileSlotShard& ShardOf(uint64_t file_num) {
+        return file_slot_shards_[file_num % kNumFileSlotShards];
+    }
+
+    /* data */
     // size of the slots of sst of normal size
     int size_;
 
     // number of slots for each size of sst which is multiple times as the normal size
-    int num_big_slots_{20};
+    int num_big_slots_;
 
     int max_num_mems_in_flush_{0};
 
+    // 0 if the pool has a fixed size
+    int max_pool_size_{0};
+
+    int low_watermark_{0};
+    int high_watermark_{0};
+    int grow_step_{0};
+
+    // serializes resizing the classes
+    std::mutex resize_mu_;
+
+    std::vector<std::unique_ptr<SlotClass>> classes_;
+
     //slots_[i] stores the file num that occupies slot i
-    std::vector<uint64_t> slots_;
+    std::unique_ptr<std::atomic<uint64_t>[]> slots_;
 
     // track whether the slot is still occupied in secondary and primary
-    std::vector<int> slot_usage_;
-    int slot_initial_usage_;
-
-    // keep track of the slot num taken by a file
-    std::unordered_map<uint64_t, int> file_slots_;
+    std::unique_ptr<std::atomic<int>[]> slot_usage_;
+    size_t num_slots_total_;
+    std::atomic<int> slot_initial_usage_;
 
-    std::mutex mu_;
+    FileSlotShard file_slot_shards_[kNumFileSlotShards];
 
     std::shared_ptr<rocksdb::Logger> logger_;
 
     // log the operations on the map, including add and delete an entry
     std::shared_ptr<rocksdb::Logger> map_logger_;
 
+    // only used to sleep in WaitForFreeSlots
+    std::mutex wait_mu_;
     std::condition_variable bitmap_full_cond_;
-};
\ No newline at end of file
+};
@@ -0,0 +1,141 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "rubble/reply_client.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "test_util/testharness.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+namespace {
+// the replicator's end of the reply stream, keeps the ids it got in order
+class ReplySink final : public RubbleKvStoreService::Service {
+ public:
+  grpc::Status SendReply(
+      grpc::ServerContext* /*context*/,
+      grpc::ServerReaderWriter<Reply, OpReply>* stream) override {
+    OpReply reply;
+    while (stream->Read(&reply)) {
+      std::lock_guard<std::mutex> lk{mu_};
+      ids_.push_back(reply.id());
+    }
+    return grpc::Status::OK;
+  }
+
+  std::vector<int> ids() {
+    std::lock_guard<std::mutex> lk{mu_};
+    return ids_;
+  }
+
+ private:
+  std::mutex mu_;
+  std::vector<int> ids_;
+};
+}  // namespace
+
+class ReplyClientTest : public testing::Test {
+ public:
+  ReplyClientTest() {
+    int port = 0;
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(),
+                             &port);
+    builder.RegisterService(&sink_);
+    server_ = builder.BuildAndStart();
+    channel_ = grpc::CreateChannel("127.0.0.1:" + std::to_string(port),
+                                   grpc::InsecureChannelCredentials());
+  }
+
+  ~ReplyClientTest() override { server_->Shutdown(); }
+
+  ReplySink sink_;
+  std::unique_ptr<grpc::Server> server_;
+  std::shared_ptr<Channel> channel_;
+};
+
+TEST_F(ReplyClientTest, HoldUntilDurable) {
+  ASSERT_NE(nullptr, server_);
+  ReplyClient client(channel_);
+  std::vector<OpReply> replies(4);
+  for (int i = 0; i < 4; i++) {
+    replies[i].set_id(i + 1);
+  }
+  client.HoldReply(5, &replies[0]);
+  client.HoldReply(3, &replies[1]);
+  client.HoldReply(8, &replies[2]);
+  client.HoldReply(5, &replies[3]);
+
+  std::vector<OpReply*> sent;
+  client.AdvanceDurableSeq(4, &sent);
+  ASSERT_EQ(4U, client.durable_seq());
+  ASSERT_EQ(std::vector<OpReply*>({&replies[1]}), sent);
+
+  // a stale watermark doesn't move it back or send anything
+  sent.clear();
+  client.AdvanceDurableSeq(2, &sent);
+  ASSERT_EQ(4U, client.durable_seq());
+  ASSERT_TRUE(sent.empty());
+
+  // replies of the same sequence number go in the order they were held
+  client.AdvanceDurableSeq(5, &sent);
+  ASSERT_EQ(std::vector<OpReply*>({&replies[0], &replies[3]}), sent);
+
+  sent.clear();
+  client.AdvanceDurableSeq(10, &sent);
+  ASSERT_EQ(10U, client.durable_seq());
+  ASSERT_EQ(std::vector<OpReply*>({&replies[2]}), sent);
+
+  // a reply held at or below the watermark goes out with the next one
+  sent.clear();
+  OpReply late;
+  late.set_id(5);
+  client.HoldReply(9, &late);
+  client.AdvanceDurableSeq(10, &sent);
+  ASSERT_EQ(std::vector<OpReply*>({&late}), sent);
+
+  client.WritesDone();
+  ASSERT_EQ(std::vector<int>({2, 1, 4, 3, 5}), sink_.ids());
+}
+
+TEST_F(ReplyClientTest, FailHeldReplies) {
+  ASSERT_NE(nullptr, server_);
+  ReplyClient client(channel_);
+  OpReply write, read;
+  write.set_id(1);
+  write.add_replies()->set_type(rubble::PUT);
+  write.mutable_replies(0)->set_ok(true);
+  read.set_id(2);
+  read.add_replies()->set_type(rubble::GET);
+  read.mutable_replies(0)->set_ok(true);
+  ASSERT_TRUE(client.HoldReply(5, &write));
+  ASSERT_TRUE(client.HoldReply(6, &read));
+
+  // the stream closes before a watermark covers them
+  std::vector<OpReply*> sent;
+  client.FailHeldReplies("Aborted", &sent);
+  ASSERT_EQ(std::vector<OpReply*>({&write, &read}), sent);
+  ASSERT_FALSE(write.replies(0).ok());
+  ASSERT_EQ("Aborted", write.replies(0).status());
+  // only the writes may be lost
+  ASSERT_TRUE(read.replies(0).ok());
+
+  // nothing is held anymore
+  sent.clear();
+  client.AdvanceDurableSeq(10, &sent);
+  ASSERT_TRUE(sent.empty());
+
+  client.WritesDone();
+  ASSERT_EQ(std::vector<int>({1, 2}), sink_.ids());
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
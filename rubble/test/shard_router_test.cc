@@ -0,0 +1,120 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "rubble/shard_router.h"
+#include <string>
+#include <vector>
+#include "test_util/testharness.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+namespace {
+std::string Key(int i) { return "user" + std::to_string(i); }
+
+std::vector<int> RouteAll(ShardRouter* router, int num_keys) {
+  std::vector<int> shards;
+  for (int i = 0; i < num_keys; i++) {
+    shards.push_back(router->Route(Key(i)));
+  }
+  return shards;
+}
+}  // namespace
+
+class ShardRouterTest : public testing::Test {};
+
+TEST_F(ShardRouterTest, ConsistentHashSpreadsKeys) {
+  const int kShards = 4;
+  const int kKeys = 100000;
+  ConsistentHashRouter router(kShards);
+  RouteAll(&router, kKeys);
+
+  std::vector<uint64_t> load = router.GetLoad();
+  ASSERT_EQ(static_cast<size_t>(kShards), load.size());
+  const uint64_t share = kKeys / kShards;
+  uint64_t total = 0;
+  for (uint64_t l : load) {
+    // within 25% of an even share
+    ASSERT_GT(l, share * 3 / 4);
+    ASSERT_LT(l, share * 5 / 4);
+    total += l;
+  }
+  ASSERT_EQ(static_cast<uint64_t>(kKeys), total);
+
+  // a key always goes to the same shard
+  ASSERT_EQ(router.Route("foo"), router.Route("foo"));
+  ConsistentHashRouter other(kShards);
+  ASSERT_EQ(RouteAll(&router, 1000), RouteAll(&other, 1000));
+
+  router.GetLoad(true /* reset */);
+  ASSERT_EQ(std::vector<uint64_t>(kShards, 0), router.GetLoad());
+}
+
+TEST_F(ShardRouterTest, ConsistentHashMovesFewKeys) {
+  const int kKeys = 20000;
+  ConsistentHashRouter router(4);
+  int rebalances = 0;
+  router.SetRebalanceListener([&](const ShardRouter& r) {
+    rebalances++;
+    ASSERT_EQ(5, r.NumShards());
+  });
+  std::vector<int> before = RouteAll(&router, kKeys);
+
+  ASSERT_EQ(4, router.AddShard());
+  ASSERT_EQ(1, rebalances);
+  std::vector<int> after = RouteAll(&router, kKeys);
+  int moved = 0;
+  for (int i = 0; i < kKeys; i++) {
+    if (before[i] != after[i]) {
+      // only to the new shard
+      ASSERT_EQ(4, after[i]);
+      moved++;
+    }
+  }
+  // about a fifth of the keys
+  ASSERT_GT(moved, kKeys / 10);
+  ASSERT_LT(moved, kKeys * 3 / 10);
+
+  router.RemoveShard(4);
+  ASSERT_EQ(2, rebalances);
+  ASSERT_EQ(before, RouteAll(&router, kKeys));
+  // the index stays taken
+  ASSERT_EQ(5, router.NumShards());
+}
+
+TEST_F(ShardRouterTest, RangeRouter) {
+  RangeRouter router({"g", "p"});
+  ASSERT_EQ(3, router.NumShards());
+  ASSERT_EQ(0, router.Route("a"));
+  ASSERT_EQ(1, router.Route("g"));
+  ASSERT_EQ(1, router.Route("o"));
+  ASSERT_EQ(2, router.Route("p"));
+  ASSERT_EQ(2, router.Route("z"));
+
+  // the new shard takes half of the hottest range
+  for (int i = 0; i < 10; i++) {
+    router.Route("h" + std::to_string(i));
+  }
+  ASSERT_EQ(3, router.AddShard());
+  ASSERT_EQ(1, router.Route("h"));
+  ASSERT_EQ(3, router.Route("o"));
+  ASSERT_EQ(0, router.Route("a"));
+  ASSERT_EQ(2, router.Route("z"));
+
+  // its range goes back to its left neighbour
+  router.RemoveShard(3);
+  ASSERT_EQ(1, router.Route("o"));
+  ASSERT_EQ(2, router.Route("p"));
+
+  router.SetSplitPoints({"m"}, {2, 0});
+  ASSERT_EQ(2, router.Route("a"));
+  ASSERT_EQ(0, router.Route("z"));
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,155 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "db/ship_job.h"
+#include "db/version_edit.h"
+#include "test_util/testharness.h"
+#include "util/autovector.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+namespace {
+void AddTestFile(VersionEdit* edit, int level, uint64_t file_num,
+                 const std::string& smallest, const std::string& largest) {
+  edit->AddFile(level, file_num, 0, 1024 * file_num,
+                InternalKey(smallest, 10, kTypeValue),
+                InternalKey(largest, 20, kTypeValue), 10, 20, false,
+                kInvalidBlobFileNumber, kUnknownOldestAncesterTime,
+                kUnknownFileCreationTime, kUnknownFileChecksum,
+                kUnknownFileChecksumFuncName);
+}
+}  // namespace
+
+class ShippedEditsTest : public testing::Test {};
+
+TEST_F(ShippedEditsTest, FlushRoundTrip) {
+  // a flush of two memtables into two files, the last edit carries the
+  // batch count
+  VersionEdit e1, e2;
+  AddTestFile(&e1, 0, 11, "a", "f");
+  e1.MarkFlush();
+  AddTestFile(&e2, 0, 12, "g", "p");
+  e2.MarkFlush();
+  e2.SetBatchCount(2);
+  autovector<VersionEdit*> edit_list{&e1, &e2};
+
+  std::string record;
+  ASSERT_TRUE(EncodeShippedEdits(13, 7, edit_list, &record));
+
+  std::unordered_map<uint64_t, int> slots{{11, 3}, {12, 4}};
+  uint64_t id = 0;
+  std::vector<VersionEdit> edits;
+  ASSERT_OK(DecodeShippedEdits(record, slots, &id, &edits));
+  ASSERT_EQ(7U, id);
+  ASSERT_EQ(2U, edits.size());
+  for (size_t i = 0; i < edits.size(); i++) {
+    const VersionEdit& e = edits[i];
+    ASSERT_EQ(7U, e.GetEditNumber());
+    ASSERT_TRUE(e.IsFlush());
+    ASSERT_FALSE(e.IsTrivialMove());
+    ASSERT_EQ(2, e.GetBatchCount());
+    ASSERT_EQ(13U, e.GetNextFile());
+    ASSERT_EQ(1U, e.GetNewFiles().size());
+    const FileMetaData& meta = e.GetNewFiles()[0].second;
+    uint64_t file_num = 11 + i;
+    ASSERT_EQ(file_num, meta.fd.GetNumber());
+    ASSERT_EQ(1024 * file_num, meta.fd.GetFileSize());
+    ASSERT_EQ(slots[file_num], e.GetSlot(file_num));
+  }
+  ASSERT_EQ("a", edits[0].GetNewFiles()[0].second.smallest.user_key().ToString());
+  ASSERT_EQ("p", edits[1].GetNewFiles()[0].second.largest.user_key().ToString());
+}
+
+TEST_F(ShippedEditsTest, CompactionRoundTrip) {
+  VersionEdit e;
+  e.DeleteFile(0, 11);
+  e.DeleteFile(0, 12);
+  AddTestFile(&e, 1, 20, "a", "p");
+  autovector<VersionEdit*> edit_list{&e};
+
+  std::string record;
+  ASSERT_TRUE(EncodeShippedEdits(21, 8, edit_list, &record));
+
+  // a file without a slot yet is decoded without one
+  uint64_t id = 0;
+  std::vector<VersionEdit> edits;
+  ASSERT_OK(DecodeShippedEdits(record, {}, &id, &edits));
+  ASSERT_EQ(8U, id);
+  ASSERT_EQ(1U, edits.size());
+  ASSERT_FALSE(edits[0].IsFlush());
+  ASSERT_FALSE(edits[0].IsTrivialMove());
+  ASSERT_EQ(2U, edits[0].GetDeletedFiles().size());
+  ASSERT_EQ(1U, edits[0].GetNewFiles().size());
+  ASSERT_EQ(1, edits[0].GetNewFiles()[0].first);
+  ASSERT_FALSE(edits[0].IsFileMapped(20));
+}
+
+TEST_F(ShippedEditsTest, TrivialMoveRoundTrip) {
+  VersionEdit e;
+  e.DeleteFile(0, 11);
+  AddTestFile(&e, 1, 11, "a", "f");
+  e.MarkTrivialMove();
+  autovector<VersionEdit*> edit_list{&e};
+
+  std::string record;
+  ASSERT_TRUE(EncodeShippedEdits(12, 9, edit_list, &record));
+
+  uint64_t id = 0;
+  std::vector<VersionEdit> edits;
+  ASSERT_OK(DecodeShippedEdits(record, {{11, 5}}, &id, &edits));
+  ASSERT_EQ(1U, edits.size());
+  ASSERT_TRUE(edits[0].IsTrivialMove());
+  ASSERT_FALSE(edits[0].IsFlush());
+}
+
+TEST_F(ShippedEditsTest, RejectCorruptRecord) {
+  VersionEdit e1, e2;
+  AddTestFile(&e1, 0, 11, "a", "f");
+  e1.MarkFlush();
+  AddTestFile(&e2, 0, 12, "g", "p");
+  e2.MarkFlush();
+  e2.SetBatchCount(2);
+  autovector<VersionEdit*> edit_list{&e1, &e2};
+  std::string record;
+  ASSERT_TRUE(EncodeShippedEdits(13, 7, edit_list, &record));
+
+  // every truncation of the record is caught
+  for (size_t len = 0; len < record.size(); len++) {
+    uint64_t id = 0;
+    std::vector<VersionEdit> edits;
+    Status s = DecodeShippedEdits(Slice(record.data(), len), {}, &id, &edits);
+    ASSERT_TRUE(s.IsCorruption()) << "length " << len;
+  }
+
+  // an edit claiming to be longer than the record
+  std::string bad;
+  PutVarint64Varint64(&bad, 7, 13);
+  PutVarint32Varint32Varint32(&bad, kShippedEditFlush, 1, 1);
+  PutVarint32(&bad, 1);
+  PutVarint32(&bad, 1000);
+  bad.append("abc");
+  uint64_t id = 0;
+  std::vector<VersionEdit> edits;
+  ASSERT_TRUE(DecodeShippedEdits(bad, {}, &id, &edits).IsCorruption());
+
+  // an edit that doesn't decode as a VersionEdit
+  bad.clear();
+  PutVarint64Varint64(&bad, 7, 13);
+  PutVarint32Varint32Varint32(&bad, 0, 0, 1);
+  PutVarint32(&bad, 0);
+  PutLengthPrefixedSlice(&bad, Slice("\xff\xff\xff\xff\x0f garbage"));
+  edits.clear();
+  ASSERT_FALSE(DecodeShippedEdits(bad, {}, &id, &edits).ok());
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,182 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "rubble/sst_bit_map.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "test_util/testharness.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+class SstBitMapTest : public testing::Test {};
+
+TEST_F(SstBitMapTest, TakeAndFree) {
+  // a secondary frees a slot as soon as it drops the file
+  SstBitMap map(4, 2, false /* is_primary */, 3, nullptr, nullptr, 0, 2);
+  ASSERT_EQ(2, map.NumSlotClasses());
+  ASSERT_EQ(4, map.GetAvailableSlots(1));
+  ASSERT_EQ(2, map.GetAvailableSlots(2));
+
+  std::vector<int> slots;
+  for (uint64_t f = 1; f <= 4; f++) {
+    int slot = map.TakeOneAvailableSlot(f, 1);
+    ASSERT_GE(slot, map.GetFirstSlot(1));
+    ASSERT_LT(slot, map.GetFirstSlot(1) + 4);
+    ASSERT_EQ(slot, map.GetFileSlotNum(f));
+    ASSERT_EQ(f, map.GetSlotFileNum(slot));
+    slots.push_back(slot);
+  }
+  ASSERT_EQ(-1, map.TakeOneAvailableSlot(5, 1));
+  ASSERT_EQ(0, map.GetAvailableSlots(1));
+
+  // the big class is apart
+  int big = map.TakeOneAvailableSlot(6, 2);
+  ASSERT_GE(big, map.GetFirstSlot(2));
+
+  map.FreeSlot({2}, 0, false);
+  ASSERT_EQ(-1, map.GetFileSlotNum(2));
+  ASSERT_EQ(1, map.GetAvailableSlots(1));
+  ASSERT_EQ(slots[1], map.TakeOneAvailableSlot(7, 1));
+}
+
+TEST_F(SstBitMapTest, PrimaryWaitsForEverySecondary) {
+  // rf 3: the slot is free once both secondaries freed it
+  SstBitMap map(2, 1, true /* is_primary */, 3);
+  int slot = map.TakeOneAvailableSlot(1, 1);
+  ASSERT_NE(-1, slot);
+  map.FreeSlot({1}, 1, false);
+  ASSERT_EQ(slot, map.GetFileSlotNum(1));
+  ASSERT_EQ(1, map.GetAvailableSlots(1));
+  map.FreeSlot({1}, 2, false);
+  ASSERT_EQ(-1, map.GetFileSlotNum(1));
+  ASSERT_EQ(2, map.GetAvailableSlots(1));
+}
+
+TEST_F(SstBitMapTest, ReturnSlot) {
+  SstBitMap map(2, 1, true /* is_primary */, 3);
+  ASSERT_NE(-1, map.TakeOneAvailableSlot(1, 1));
+  map.ReturnSlot(1);
+  ASSERT_EQ(-1, map.GetFileSlotNum(1));
+  ASSERT_EQ(2, map.GetAvailableSlots(1));
+}
+
+TEST_F(SstBitMapTest, TakeSlotsInBatchIsAllOrNothing) {
+  SstBitMap map(3, 1, false, 3);
+  ASSERT_NE(-1, map.TakeOneAvailableSlot(1, 1));
+  ASSERT_FALSE(map.TakeSlotsInBatch({{2, 1}, {3, 1}, {4, 1}}));
+  ASSERT_EQ(2, map.GetAvailableSlots(1));
+  ASSERT_EQ(-1, map.GetFileSlotNum(2));
+  ASSERT_EQ(-1, map.GetFileSlotNum(3));
+
+  ASSERT_TRUE(map.TakeSlotsInBatch({{2, 1}, {3, 1}}));
+  ASSERT_EQ(0, map.GetAvailableSlots(1));
+  ASSERT_NE(map.GetFileSlotNum(2), map.GetFileSlotNum(3));
+}
+
+TEST_F(SstBitMapTest, ConcurrentTakeAndFree) {
+  const int kPoolSize = 100;
+  const int kThreads = 8;
+  const int kRounds = 2000;
+  SstBitMap map(kPoolSize, 1, false, 3);
+  // the thread holding each slot, a slot is never handed out twice
+  std::unique_ptr<std::atomic<int>[]> owner(new std::atomic<int>[kPoolSize + 1]);
+  for (int i = 0; i <= kPoolSize; i++) {
+    owner[i].store(0);
+  }
+  std::atomic<int> errors{0};
+
+  std::vector<std::thread> threads;
+  for (int t = 1; t <= kThreads; t++) {
+    threads.emplace_back([&, t] {
+      std::vector<uint64_t> held;
+      for (int r = 0; r < kRounds; r++) {
+        uint64_t file_num = static_cast<uint64_t>(t) * kRounds + r + 1;
+        int slot = map.TakeOneAvailableSlot(file_num, 1);
+        if (slot != -1) {
+          int expected = 0;
+          if (!owner[slot].compare_exchange_strong(expected, t) ||
+              map.GetFileSlotNum(file_num) != slot) {
+            errors.fetch_add(1);
+          }
+          held.push_back(file_num);
+        }
+        // keep a few slots so that the pool runs full now and then
+        if (held.size() > 16 || (slot == -1 && !held.empty())) {
+          uint64_t f = held.front();
+          held.erase(held.begin());
+          owner[map.GetFileSlotNum(f)].store(0);
+          map.FreeSlot({f}, 0, false);
+        }
+      }
+      for (uint64_t f : held) {
+        owner[map.GetFileSlotNum(f)].store(0);
+        map.FreeSlot({f}, 0, false);
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  ASSERT_EQ(0, errors.load());
+  ASSERT_EQ(kPoolSize, map.GetAvailableSlots(1));
+}
+
+TEST_F(SstBitMapTest, ConcurrentTakeWhileResizing) {
+  // a dynamic pool grows and retires slots while ship jobs take them
+  const int kMaxPoolSize = 128;
+  SstBitMap map(8, 1, false, 3, nullptr, nullptr, kMaxPoolSize);
+  ASSERT_TRUE(map.IsDynamic());
+  ASSERT_EQ(8, map.GetActiveSlots(1));
+
+  std::atomic<bool> stop{false};
+  std::atomic<int> errors{0};
+  std::vector<std::thread> takers;
+  for (int t = 1; t <= 4; t++) {
+    takers.emplace_back([&, t] {
+      uint64_t file_num = static_cast<uint64_t>(t) << 32;
+      while (!stop.load()) {
+        int slot = map.TakeOneAvailableSlot(++file_num, 1);
+        if (slot == -1) {
+          std::this_thread::yield();
+          continue;
+        }
+        // a retired slot is never handed out
+        if (slot - map.GetFirstSlot(1) >= kMaxPoolSize) {
+          errors.fetch_add(1);
+        }
+        map.FreeSlot({file_num}, 0, false);
+      }
+    });
+  }
+  for (int i = 0; i < 200; i++) {
+    map.GrowSlots(1, 16 + (i % 8) * 16);
+    int active = map.RetireSlots(1, 8 + (i % 4) * 8);
+    if (active < 8 || active > kMaxPoolSize) {
+      errors.fetch_add(1);
+    }
+  }
+  stop.store(true);
+  for (auto& t : takers) {
+    t.join();
+  }
+  ASSERT_EQ(0, errors.load());
+
+  // every active slot is free again
+  int active = map.GetActiveSlots(1);
+  ASSERT_EQ(active, map.GetAvailableSlots(1));
+  ASSERT_EQ(8, map.RetireSlots(1, 8));
+  ASSERT_EQ(8, map.GetAvailableSlots(1));
+  map.GrowSlots(1, kMaxPoolSize);
+  ASSERT_EQ(kMaxPoolSize, map.GetAvailableSlots(1));
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,119 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include <memory>
+#include <string>
+#include "db/ship_job.h"
+#include "db/version_edit.h"
+#include "port/port.h"
+#include "rocksdb/env.h"
+#include "test_util/testharness.h"
+#include "test_util/testutil.h"
+#include "util/random.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+class SstChunkChecksumTest : public testing::Test {
+ public:
+  SstChunkChecksumTest()
+      : env_(Env::Default()),
+        dir_(test::PerThreadDBPath("sst_chunk_checksum_test")),
+        fname_(dir_ + "/000011.sst") {
+    env_->CreateDirIfMissing(dir_);
+  }
+
+  ~SstChunkChecksumTest() override {
+    env_->DeleteFile(fname_);
+    env_->DeleteDir(dir_);
+  }
+
+  // write the file and fill meta the way the file writer of a table does
+  void WriteFile(const std::string& data, uint64_t chunk_size,
+                 FileMetaData* meta) {
+    ASSERT_OK(WriteStringToFile(env_, data, fname_));
+    std::unique_ptr<FileChecksumGenerator> gen =
+        NewSstChunkChecksumGenFactory(chunk_size)
+            ->CreateFileChecksumGenerator(FileChecksumGenContext());
+    // in uneven pieces, a chunk may span several appends
+    for (size_t off = 0; off < data.size(); off += 1000) {
+      gen->Update(data.data() + off, std::min<size_t>(1000, data.size() - off));
+    }
+    gen->Finalize();
+    meta->fd = FileDescriptor(11, 0, data.size());
+    meta->file_checksum = gen->GetChecksum();
+    meta->file_checksum_func_name = gen->Name();
+  }
+
+  void CorruptByte(uint64_t offset) {
+    std::string data;
+    ASSERT_OK(ReadFileToString(env_, fname_, &data));
+    data[offset] ^= 0x55;
+    ASSERT_OK(WriteStringToFile(env_, data, fname_));
+  }
+
+  Env* env_;
+  std::string dir_;
+  std::string fname_;
+};
+
+TEST_F(SstChunkChecksumTest, DetectMismatch) {
+  if (!test::IsDirectIOSupported(env_, dir_)) {
+    fprintf(stderr, "skipping, no direct I/O in %s\n", dir_.c_str());
+    return;
+  }
+  const uint64_t kChunkSize = 2 * 4096;
+  Random rnd(301);
+  // the last chunk is a partial one
+  std::string data = rnd.RandomString(static_cast<int>(2 * kChunkSize + 100));
+  FileMetaData meta;
+  WriteFile(data, kChunkSize, &meta);
+  ASSERT_EQ(3U, NumSSTChunks(meta));
+  ASSERT_OK(VerifySSTChunks(fname_, meta, 0, 3));
+  // past the end of the file
+  ASSERT_OK(VerifySSTChunks(fname_, meta, 2, 4));
+
+  CorruptByte(kChunkSize + 7);
+  ASSERT_OK(VerifySSTChunks(fname_, meta, 0, 1));
+  ASSERT_TRUE(VerifySSTChunks(fname_, meta, 1, 1).IsCorruption());
+  ASSERT_OK(VerifySSTChunks(fname_, meta, 2, 1));
+  ASSERT_TRUE(VerifySSTChunks(fname_, meta, 0, 3).IsCorruption());
+
+  // a flip in the partial chunk
+  WriteFile(data, kChunkSize, &meta);
+  CorruptByte(2 * kChunkSize + 99);
+  ASSERT_OK(VerifySSTChunks(fname_, meta, 0, 2));
+  ASSERT_TRUE(VerifySSTChunks(fname_, meta, 2, 1).IsCorruption());
+}
+
+TEST_F(SstChunkChecksumTest, RejectBadChecksum) {
+  const uint64_t kChunkSize = 4096;
+  Random rnd(301);
+  std::string data = rnd.RandomString(static_cast<int>(3 * kChunkSize));
+  FileMetaData meta;
+  WriteFile(data, kChunkSize, &meta);
+
+  // a checksum that doesn't cover the whole file
+  FileMetaData truncated = meta;
+  truncated.file_checksum.resize(meta.file_checksum.size() - 1);
+  ASSERT_TRUE(VerifySSTChunks(fname_, truncated, 0, 3).IsCorruption());
+
+  // the file grew since
+  FileMetaData longer = meta;
+  longer.fd = FileDescriptor(11, 0, data.size() + 1);
+  ASSERT_TRUE(VerifySSTChunks(fname_, longer, 0, 3).IsCorruption());
+
+  // a file without chunk checksums has no chunks to verify
+  FileMetaData plain = meta;
+  plain.file_checksum = kUnknownFileChecksum;
+  plain.file_checksum_func_name = kUnknownFileChecksumFuncName;
+  ASSERT_EQ(0U, NumSSTChunks(plain));
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
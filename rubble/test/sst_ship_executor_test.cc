@@ -0,0 +1,78 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "db/ship_job.h"
+#include "port/port.h"
+#include "test_util/testharness.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+class SstShipExecutorTest : public testing::Test {};
+
+TEST_F(SstShipExecutorTest, OrderedWritesRunInOrder) {
+  SstShipExecutor executor(4, 4);
+  SstShipExecutor::Batch batch;
+  std::mutex mu;
+  std::vector<int> done;
+  // two remote files, each with its own order key and dir
+  int file_a = 0;
+  int file_b = 0;
+  for (int i = 0; i < 200; i++) {
+    const void* order = (i % 2 == 0) ? &file_a : &file_b;
+    ASSERT_OK(executor.Submit((i % 2 == 0) ? "a" : "b", [&, i] {
+      if (i % 7 == 0) {
+        // let a later write of the same file try to overtake this one
+        Env::Default()->SleepForMicroseconds(200);
+      }
+      std::lock_guard<std::mutex> lock(mu);
+      done.push_back(i);
+      return IOStatus::OK();
+    }, &batch, order, 10));
+  }
+  ASSERT_OK(executor.Wait(&batch));
+  ASSERT_EQ(200U, done.size());
+  ASSERT_EQ(0U, batch.bytes);
+
+  int last[2] = {-1, -1};
+  for (int i : done) {
+    ASSERT_GT(i, last[i % 2]);
+    last[i % 2] = i;
+  }
+}
+
+TEST_F(SstShipExecutorTest, ThrottleWaitsForQueuedBytes) {
+  SstShipExecutor executor(1, 1);
+  SstShipExecutor::Batch batch;
+  std::atomic<bool> release{false};
+  ASSERT_OK(executor.Submit("a", [&] {
+    while (!release.load()) {
+      Env::Default()->SleepForMicroseconds(100);
+    }
+    return IOStatus::OK();
+  }, &batch, nullptr, 100));
+
+  std::atomic<bool> throttled{true};
+  port::Thread t([&] {
+    executor.Throttle(&batch, 50);
+    throttled = false;
+  });
+  Env::Default()->SleepForMicroseconds(50000);
+  ASSERT_TRUE(throttled.load());
+
+  release = true;
+  t.join();
+  ASSERT_FALSE(throttled.load());
+  ASSERT_OK(executor.Wait(&batch));
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,72 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "rubble/uncommitted_writes.h"
+#include <string>
+#include "test_util/testharness.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+namespace {
+rubble::Op MakeOp(int32_t id, rubble::OpType type, const std::string& key) {
+  rubble::Op op;
+  op.set_id(id);
+  rubble::SingleOp* single_op = op.add_ops();
+  single_op->set_type(type);
+  single_op->set_key(key);
+  return op;
+}
+}  // namespace
+
+class UncommittedWritesTest : public testing::Test {};
+
+TEST_F(UncommittedWritesTest, DirtyUntilCommitted) {
+  UncommittedWrites writes;
+  rubble::Op op = MakeOp(7, rubble::PUT, "a");
+  rubble::SingleOp* update = op.add_ops();
+  update->set_type(rubble::UPDATE);
+  update->set_key("b");
+  rubble::SingleOp* get = op.add_ops();
+  get->set_type(rubble::GET);
+  get->set_key("c");
+  writes.Add(op);
+  ASSERT_TRUE(writes.IsDirty("a"));
+  ASSERT_TRUE(writes.IsDirty("b"));
+  // a read doesn't count
+  ASSERT_FALSE(writes.IsDirty("c"));
+
+  writes.Add(MakeOp(8, rubble::PUT, "a"));
+  writes.Commit(7);
+  // op 8 still writes it
+  ASSERT_TRUE(writes.IsDirty("a"));
+  ASSERT_FALSE(writes.IsDirty("b"));
+
+  // an op with no write here
+  writes.Commit(9);
+  ASSERT_TRUE(writes.IsDirty("a"));
+
+  writes.Commit(8);
+  ASSERT_FALSE(writes.IsDirty("a"));
+  // committed once only
+  writes.Commit(8);
+  ASSERT_FALSE(writes.IsDirty("a"));
+}
+
+TEST_F(UncommittedWritesTest, ReusedId) {
+  // the replicator's ids wrap around, an op left over must not be lost
+  UncommittedWrites writes;
+  writes.Add(MakeOp(3, rubble::PUT, "a"));
+  writes.Add(MakeOp(3, rubble::PUT, "b"));
+  writes.Commit(3);
+  ASSERT_FALSE(writes.IsDirty("a"));
+  ASSERT_FALSE(writes.IsDirty("b"));
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
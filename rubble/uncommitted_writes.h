@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "rubble_kv_store.grpc.pb.h"
+
+// The writes a node of the chain applied that the tail hasn't replied to yet,
+// with serve_direct_reads. A node may hold a value the tail doesn't have, so
+// a direct read of a key with such a write goes down the chain and the tail
+// answers it, which keeps the reads linearizable as in CRAQ. The replicator
+// sends the ids of the ops the tail replied to in Op::committed.
+//
+// Keys are counted by hash slot, the keys sharing a slot with a written key
+// only send some reads to the tail. A write is counted before it's applied,
+// so a read that saw its value sees the count once it checks after the read.
+class UncommittedWrites {
+  public:
+    UncommittedWrites() : counts_(new std::atomic<uint32_t>[kNumSlots]) {
+      for (size_t i = 0; i < kNumSlots; i++) {
+        counts_[i].store(0);
+      }
+    }
+
+    // before the writes of the op are applied
+    void Add(const rubble::Op& op) {
+      std::vector<size_t> slots;
+      for (const auto& single_op : op.ops()) {
+        if (single_op.type() == rubble::PUT || single_op.type() == rubble::UPDATE) {
+          slots.push_back(Slot(single_op.key()));
+          counts_[slots.back()].fetch_add(1);
+        }
+      }
+      if (slots.empty()) {
+        return;
+      }
+      Shard& shard = shards_[Index(op.id())];
+      std::lock_guard<std::mutex> lk{shard.mu};
+      std::vector<size_t>& op_slots = shard.ops[op.id()];
+      op_slots.insert(op_slots.end(), slots.begin(), slots.end());
+    }
+
+    // the tail replied to the op, ignored if it had no write here
+    void Commit(int32_t op_id) {
+      std::vector<size_t> slots;
+      {
+        Shard& shard = shards_[Index(op_id)];
+        std::lock_guard<std::mutex> lk{shard.mu};
+        auto it = shard.ops.find(op_id);
+        if (it == shard.ops.end()) {
+          return;
+        }
+        slots.swap(it->second);
+        shard.ops.erase(it);
+      }
+      for (size_t slot : slots) {
+        counts_[slot].fetch_sub(1);
+      }
+    }
+
+    // if the key may have a write the tail hasn't replied to
+    bool IsDirty(const std::string& key) const {
+      return counts_[Slot(key)].load() != 0;
+    }
+
+  private:
+    static size_t Slot(const std::string& key) {
+      return std::hash<std::string>()(key) % kNumSlots;
+    }
+
+    static size_t Index(int32_t op_id) {
+      return static_cast<uint32_t>(op_id) % kNumShards;
+    }
+
+    static const size_t kNumSlots = 1 << 18;
+    static const size_t kNumShards = 64;
+
+    std::unique_ptr<std::atomic<uint32_t>[]> counts_;
+
+    // the slots of every op by its id, sharded so that the DoOp threads
+    // rarely touch the same lock
+    struct Shard {
+      std::mutex mu;
+      std::unordered_map<int32_t, std::vector<size_t>> ops;
+    };
+    Shard shards_[kNumShards];
+};
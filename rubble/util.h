@@ -11,6 +11,8 @@
 #include "rocksdb/options.h"
 #include "rocksdb/utilities/options_util.h"
 #include "rubble_sync_server.h"
+#include "rubble_async_server.h"
+#include "db/ship_job.h"
 
 using std::string;
 using std::vector;
@@ -90,7 +92,12 @@ class zipf_table_distribution
 };
 
 void RunServer(rocksdb::DB* db, const std::string& server_addr) {
-  
+   auto db_options = static_cast<rocksdb::DBImpl*>(db)->TEST_GetVersionSet()->db_options();
+   if (db_options->async_server_cqs > 0) {
+      RunAsyncServer(db, server_addr);
+      return;
+   }
+
    RubbleKvServiceImpl service(db);
    grpc::EnableDefaultHealthCheckService(true);
    grpc::reflection::InitProtoReflectionServerBuilderPlugin();
@@ -261,7 +268,21 @@ rocksdb::DB* GetDBInstance(const string& db_path, const string& sst_dir,
             db_options.is_primary,
             db_options.rf,
             db_options.rubble_info_log,
-            map_logger);
+            map_logger,
+            db_options.max_sst_pool_size,
+            db_options.sst_pool_big_slots);
+      db_options.sst_bit_map->SetWatermarks(
+            db_options.sst_pool_low_watermark,
+            db_options.sst_pool_high_watermark,
+            db_options.sst_pool_grow_step);
+
+      // the file writers checksum the ssts as they are built. A user factory
+      // is kept, DB::Open rejects it
+      if (db_options.is_primary && db_options.sst_checksum_chunk_size > 0 &&
+          db_options.file_checksum_gen_factory == nullptr) {
+         db_options.file_checksum_gen_factory =
+               rocksdb::NewSstChunkChecksumGenFactory(db_options.sst_checksum_chunk_size);
+      }
    }
 
    // if(!db_options.is_primary){
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "rocksdb/db.h"
+#include "forwarder.h"
+
+// Group commit of the head's WAL with chain_group_commit. The head writes
+// its WAL without syncing it and asks for a sync after every op. The sync
+// thread syncs once for all the writes that came in meanwhile, then sends
+// the sequence number it synced up to down every DoOp stream as a watermark
+// op. The other nodes pass it on without writing a WAL, and the tail sends
+// the replies it holds once the watermark covers them. If a sync fails, no
+// watermark goes out anymore and the DoOp streams of the head are failed,
+// see status.
+class WalSyncer {
+  public:
+    // the syncer must be destroyed before the db is closed
+    explicit WalSyncer(rocksdb::DB* db) : db_(db) {
+      thread_ = std::thread([this] { Run(); });
+      pthread_setname_np(thread_.native_handle(), "WalSyncer");
+    }
+
+    ~WalSyncer() {
+      {
+        std::lock_guard<std::mutex> lk{mu_};
+        stop_ = true;
+      }
+      cv_.notify_all();
+      synced_cv_.notify_all();
+      thread_.join();
+    }
+
+    uint64_t durable_seq() const {
+      return durable_seq_.load();
+    }
+
+    // the error of the first failed sync. The writes after durable_seq may
+    // not be in the WAL, so their replies must never go out
+    rocksdb::Status status() {
+      std::lock_guard<std::mutex> lk{mu_};
+      return status_;
+    }
+
+    // the head wrote everything up to seq to the WAL
+    void RequestSync(uint64_t seq) {
+      if (seq <= durable_seq_.load() || failed_.load()) {
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> lk{mu_};
+        requested_seq_ = std::max(requested_seq_, seq);
+      }
+      cv_.notify_one();
+    }
+
+    // send the watermarks to the stream too, the forwarder must have its
+    // shard and client set
+    void AddStream(Forwarder* forwarder) {
+      std::lock_guard<std::mutex> lk{mu_};
+      forwarders_.push_back(forwarder);
+    }
+
+    // sync the writes so far and send their watermark before the stream is
+    // closed, so the tail holds no reply for it. Once it returns no watermark
+    // is sent to the forwarder anymore
+    void RemoveStream(Forwarder* forwarder) {
+      uint64_t seq = db_->GetLatestSequenceNumber();
+      RequestSync(seq);
+      std::unique_lock<std::mutex> lk{mu_};
+      synced_cv_.wait(lk, [&] {
+        return stop_ || !status_.ok() || (durable_seq_.load() >= seq && !sending_);
+      });
+      forwarders_.erase(std::remove(forwarders_.begin(), forwarders_.end(), forwarder),
+                        forwarders_.end());
+    }
+
+  private:
+    void Run() {
+      while (true) {
+        {
+          std::unique_lock<std::mutex> lk{mu_};
+          cv_.wait(lk, [&] { return stop_ || requested_seq_ > durable_seq_.load(); });
+          if (stop_) {
+            return;
+          }
+        }
+
+        // a sequence number is only published after its write is in the WAL
+        uint64_t seq = db_->GetLatestSequenceNumber();
+        rocksdb::Status s = db_->SyncWAL();
+        if (!s.ok()) {
+          std::cerr << "[WalSyncer] SyncWAL failed : " << s.ToString() << std::endl;
+          {
+            std::lock_guard<std::mutex> lk{mu_};
+            status_ = s;
+            failed_.store(true);
+          }
+          synced_cv_.notify_all();
+          return;
+        }
+
+        // the writes to the streams block, send them outside of mu_ so that
+        // RequestSync and AddStream don't wait for them. RemoveStream waits
+        // until they are done, its forwarder is deleted right after
+        std::vector<Forwarder*> forwarders;
+        {
+          std::lock_guard<std::mutex> lk{mu_};
+          durable_seq_.store(seq);
+          forwarders = forwarders_;
+          sending_ = true;
+        }
+        for (Forwarder* forwarder : forwarders) {
+          forwarder->ForwardWatermark(seq);
+        }
+        {
+          std::lock_guard<std::mutex> lk{mu_};
+          sending_ = false;
+        }
+        synced_cv_.notify_all();
+      }
+    }
+
+    rocksdb::DB* db_;
+
+    std::mutex mu_;
+    // signaled when a sync is requested
+    std::condition_variable cv_;
+    // signaled when a sync finished
+    std::condition_variable synced_cv_;
+    bool stop_ = false;
+    uint64_t requested_seq_ = 0;
+    std::atomic<uint64_t> durable_seq_{0};
+    std::vector<Forwarder*> forwarders_;
+    // the watermark of durable_seq_ is being sent
+    bool sending_ = false;
+    rocksdb::Status status_;
+    std::atomic<bool> failed_{false};
+
+    std::thread thread_;
+};
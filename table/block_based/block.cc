@@ -248,7 +248,7 @@ void DataBlockIter::SeekImpl(const Slice& target) {
   if (!ok) {
     return;
   }
-  FindKeyAfterBinarySeek(seek_key, index, skip_linear_scan);
+  FindKeyWithPrefixArray(seek_key, index, skip_linear_scan);
 }
 
 // Optimized Seek for point lookup for an internal key `target`
@@ -422,7 +422,7 @@ void DataBlockIter::SeekForPrevImpl(const Slice& target) {
   if (!ok) {
     return;
   }
-  FindKeyAfterBinarySeek(seek_key, index, skip_linear_scan);
+  FindKeyWithPrefixArray(seek_key, index, skip_linear_scan);
 
   if (!Valid()) {
     SeekToLastImpl();
@@ -674,6 +674,73 @@ void BlockIter<TValue>::FindKeyAfterBinarySeek(const Slice& target,
   }
 }
 
+void DataBlockIter::FindKeyWithPrefixArray(const Slice& target, uint32_t index,
+                                           bool skip_linear_scan) {
+  if (data_block_prefix_array_ == nullptr || skip_linear_scan) {
+    FindKeyAfterBinarySeek(target, index, skip_linear_scan);
+    return;
+  }
+  SeekToRestartPoint(index);
+  NextImpl();
+  if (!Valid()) {
+    return;
+  }
+
+  // `BinarySeek()` found the restart key less than `target`, and the keys of
+  // the interval share their first `skip` bytes with it. If `target` has
+  // greater bytes there, every key of the interval is less. If it has the
+  // same, the keys with a prefix less than its prefix are less, and those
+  // with a greater prefix are greater.
+  const Slice target_user_key = ExtractUserKey(target);
+  const Slice restart_user_key = raw_key_.GetUserKey();
+  const uint32_t skip = data_block_prefix_array_->Skip(index);
+  const uint32_t num_entries = data_block_prefix_array_->NumEntries(index);
+  bool use_prefix = false;
+  uint32_t target_prefix = 0;
+  // The restart key is less
+  uint32_t num_less = 1;
+  if (skip <= restart_user_key.size()) {
+    int cmp =
+        memcmp(target_user_key.data(), restart_user_key.data(),
+               std::min(static_cast<size_t>(skip), target_user_key.size()));
+    if (cmp > 0) {
+      num_less = num_entries;
+    } else if (cmp == 0 && skip <= target_user_key.size()) {
+      use_prefix = true;
+      target_prefix = DataBlockPrefixArray::GetPrefix(target_user_key, skip);
+      num_less = std::max(
+          data_block_prefix_array_->CountLess(index, target_prefix), num_less);
+    }
+  }
+
+  if (num_less == num_entries) {
+    // The next restart key, if any, is greater than `target`
+    if (index + 1 < num_restarts_) {
+      SeekToRestartPoint(index + 1);
+      NextImpl();
+    } else {
+      current_ = restarts_;
+      restart_index_ = num_restarts_;
+    }
+    return;
+  }
+  for (uint32_t i = 0; i < num_less && Valid(); i++) {
+    NextImpl();
+  }
+  if (use_prefix &&
+      data_block_prefix_array_->Prefix(index, num_less) > target_prefix) {
+    return;
+  }
+
+  // Linear search (within restart block) for first key >= target, from the
+  // first key not known to be less
+  const uint32_t max_offset =
+      index + 1 < num_restarts_ ? GetRestartPoint(index + 1) : port::kMaxUint32;
+  while (Valid() && current_ != max_offset && CompareCurrentKey(target) < 0) {
+    NextImpl();
+  }
+}
+
 // Binary searches in restart array to find the starting restart point for the
 // linear scan, and stores it in `*index`. Assumes restart array does not
 // contain duplicate keys. It is guaranteed that the restart key at `*index + 1`
@@ -959,6 +1026,18 @@ Block::Block(BlockContents&& contents, size_t read_amp_bytes_per_bit,
           break;
         }
         break;
+      case BlockBasedTableOptions::kDataBlockBinaryAndPrefix: {
+        uint32_t array_offset = 0;
+        if (!data_block_prefix_array_.Initialize(
+                data_, static_cast<uint32_t>(size_ - sizeof(uint32_t)),
+                num_restarts_, &array_offset) ||
+            array_offset < num_restarts_ * sizeof(uint32_t)) {
+          size_ = 0;
+          break;
+        }
+        restart_offset_ = array_offset - num_restarts_ * sizeof(uint32_t);
+        break;
+      }
       default:
         size_ = 0;  // Error marker
     }
@@ -988,10 +1067,14 @@ DataBlockIter* Block::NewDataIterator(const Comparator* raw_ucmp,
     ret_iter->Invalidate(Status::OK());
     return ret_iter;
   } else {
+    // The prefixes are only ordered like the keys with BytewiseComparator
     ret_iter->Initialize(
         raw_ucmp, data_, restart_offset_, num_restarts_, global_seqno,
         read_amp_bitmap_.get(), block_contents_pinned,
-        data_block_hash_index_.Valid() ? &data_block_hash_index_ : nullptr);
+        data_block_hash_index_.Valid() ? &data_block_hash_index_ : nullptr,
+        data_block_prefix_array_.Valid() && raw_ucmp == BytewiseComparator()
+            ? &data_block_prefix_array_
+            : nullptr);
     if (read_amp_bitmap_) {
       if (read_amp_bitmap_->GetStatistics() != stats) {
         // DB changed the Statistics pointer, we need to notify read_amp_bitmap_
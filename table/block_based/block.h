@@ -22,6 +22,7 @@
 #include "rocksdb/table.h"
 #include "table/block_based/block_prefix_index.h"
 #include "table/block_based/data_block_hash_index.h"
+#include "table/block_based/data_block_prefix_array.h"
 #include "table/format.h"
 #include "table/internal_iterator.h"
 #include "test_util/sync_point.h"
@@ -227,6 +228,7 @@ class Block {
   uint32_t num_restarts_;
   std::unique_ptr<BlockReadAmpBitmap> read_amp_bitmap_;
   DataBlockHashIndex data_block_hash_index_;
+  DataBlockPrefixArray data_block_prefix_array_;
 };
 
 // A `BlockIter` iterates over the entries in a `Block`'s data buffer. The
@@ -475,27 +477,36 @@ class BlockIter : public InternalIteratorBase<TValue> {
 class DataBlockIter final : public BlockIter<Slice> {
  public:
   DataBlockIter()
-      : BlockIter(), read_amp_bitmap_(nullptr), last_bitmap_offset_(0) {}
+      : BlockIter(),
+        read_amp_bitmap_(nullptr),
+        last_bitmap_offset_(0),
+        data_block_prefix_array_(nullptr) {}
   DataBlockIter(const Comparator* raw_ucmp, const char* data, uint32_t restarts,
                 uint32_t num_restarts, SequenceNumber global_seqno,
                 BlockReadAmpBitmap* read_amp_bitmap, bool block_contents_pinned,
-                DataBlockHashIndex* data_block_hash_index)
+                DataBlockHashIndex* data_block_hash_index,
+                const DataBlockPrefixArray* data_block_prefix_array = nullptr)
       : DataBlockIter() {
     Initialize(raw_ucmp, data, restarts, num_restarts, global_seqno,
-               read_amp_bitmap, block_contents_pinned, data_block_hash_index);
+               read_amp_bitmap, block_contents_pinned, data_block_hash_index,
+               data_block_prefix_array);
   }
+  // `data_block_prefix_array` must only be given for keys ordered by
+  // BytewiseComparator.
   void Initialize(const Comparator* raw_ucmp, const char* data,
                   uint32_t restarts, uint32_t num_restarts,
                   SequenceNumber global_seqno,
                   BlockReadAmpBitmap* read_amp_bitmap,
                   bool block_contents_pinned,
-                  DataBlockHashIndex* data_block_hash_index) {
+                  DataBlockHashIndex* data_block_hash_index,
+                  const DataBlockPrefixArray* data_block_prefix_array) {
     InitializeBase(raw_ucmp, data, restarts, num_restarts, global_seqno,
                    block_contents_pinned);
     raw_key_.SetIsUserKey(false);
     read_amp_bitmap_ = read_amp_bitmap;
     last_bitmap_offset_ = current_ + 1;
     data_block_hash_index_ = data_block_hash_index;
+    data_block_prefix_array_ = data_block_prefix_array;
   }
 
   Slice value() const override {
@@ -582,10 +593,16 @@ class DataBlockIter final : public BlockIter<Slice> {
   int32_t prev_entries_idx_ = -1;
 
   DataBlockHashIndex* data_block_hash_index_;
+  const DataBlockPrefixArray* data_block_prefix_array_;
 
   template <typename DecodeEntryFunc>
   inline bool ParseNextDataKey(const char* limit = nullptr);
 
+  // Like FindKeyAfterBinarySeek(), but skips comparing the keys of the
+  // restart interval that the prefix array shows are less than `target`
+  void FindKeyWithPrefixArray(const Slice& target, uint32_t index,
+                              bool skip_linear_scan);
+
   bool SeekForGetImpl(const Slice& target);
   void NextOrReportImpl();
   void SeekToFirstOrReportImpl();
@@ -103,6 +103,27 @@ FilterBlockBuilder* CreateFilterBlockBuilder(
   }
 }
 
+// The data block index type that the keys of the table allow
+BlockBasedTableOptions::DataBlockIndexType GetDataBlockIndexType(
+    const BlockBasedTableOptions& table_opt, const Comparator* ucmp) {
+  switch (table_opt.data_block_index_type) {
+    case BlockBasedTableOptions::kDataBlockBinaryAndHash:
+      if (ucmp->CanKeysWithDifferentByteContentsBeEqual()) {
+        return BlockBasedTableOptions::kDataBlockBinarySearch;
+      }
+      break;
+    case BlockBasedTableOptions::kDataBlockBinaryAndPrefix:
+      // Only then are the keys in the order of their prefixes
+      if (ucmp != BytewiseComparator()) {
+        return BlockBasedTableOptions::kDataBlockBinarySearch;
+      }
+      break;
+    default:
+      break;
+  }
+  return table_opt.data_block_index_type;
+}
+
 bool GoodCompressionRatio(size_t compressed_size, size_t raw_size) {
   // Check to see if compressed less than 12.5%
   return compressed_size < raw_size - (raw_size / 8u);
@@ -425,10 +446,8 @@ struct BlockBasedTableBuilder::Rep {
         data_block(table_options.block_restart_interval,
                    table_options.use_delta_encoding,
                    false /* use_value_delta_encoding */,
-                   icomparator.user_comparator()
-                           ->CanKeysWithDifferentByteContentsBeEqual()
-                       ? BlockBasedTableOptions::kDataBlockBinarySearch
-                       : table_options.data_block_index_type,
+                   GetDataBlockIndexType(table_options,
+                                         icomparator.user_comparator()),
                    table_options.data_block_hash_table_util_ratio),
         range_del_block(1 /* block_restart_interval */),
         internal_prefix_transform(_moptions.prefix_extractor.get()),
@@ -1652,13 +1671,20 @@ void BlockBasedTableBuilder::WriteFooter(BlockHandle& metaindex_block_handle,
 
     uint64_t target_file_size = target_file_size_base + r->ioptions.sst_pad_len;
     
-    // We always pad the SST file to the closest times * target_file_size_base + sst_pad_len,
-    // i.e., size <= times * target_file_size_base + sst_pad_len. But, there is a corner
-    // case that size < sst_pad_len, which only pads the SST file to sst_pad_len since the
-    // times will be 0. So, we need to make sure times >= 1.
-    int times = ceil(float(size - r->ioptions.sst_pad_len) / target_file_size_base);
-    times = std::max(times, 1);
-    pad_len = times * target_file_size_base + r->ioptions.sst_pad_len - size;
+    if (r->ioptions.db_options_->pad_sst_to_slot_size) {
+      // We always pad the SST file to the closest times * target_file_size_base + sst_pad_len,
+      // i.e., size <= times * target_file_size_base + sst_pad_len. But, there is a corner
+      // case that size < sst_pad_len, which only pads the SST file to sst_pad_len since the
+      // times will be 0. So, we need to make sure times >= 1.
+      int times = ceil(float(size - r->ioptions.sst_pad_len) / target_file_size_base);
+      times = std::max(times, 1);
+      pad_len = times * target_file_size_base + r->ioptions.sst_pad_len - size;
+    } else {
+      // only pad to the alignment so the whole table can be written to the
+      // remote slot with direct I/O, the footer stays at the end of the table
+      uint64_t alignment = r->file->writable_file()->GetRequiredBufferAlignment();
+      pad_len = static_cast<int>((alignment - size % alignment) % alignment);
+    }
 
     // std::cout << "[WriteFooter] fname: " << r->file->file_name()
     //           << " size: " << size << " times: " << times 
@@ -185,7 +185,9 @@ static std::unordered_map<std::string,
         {"kDataBlockBinarySearch",
          BlockBasedTableOptions::DataBlockIndexType::kDataBlockBinarySearch},
         {"kDataBlockBinaryAndHash",
-         BlockBasedTableOptions::DataBlockIndexType::kDataBlockBinaryAndHash}};
+         BlockBasedTableOptions::DataBlockIndexType::kDataBlockBinaryAndHash},
+        {"kDataBlockBinaryAndPrefix",
+         BlockBasedTableOptions::DataBlockIndexType::kDataBlockBinaryAndPrefix}};
 
 static std::unordered_map<std::string,
                           BlockBasedTableOptions::IndexShorteningMode>
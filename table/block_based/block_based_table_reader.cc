@@ -102,6 +102,10 @@ class BlocklikeTraits<BlockContents> {
   static uint32_t GetNumRestarts(const BlockContents& /* contents */) {
     return 0;
   }
+
+  static Slice GetContents(const BlockContents& contents) {
+    return contents.data;
+  }
 };
 
 template <>
@@ -118,6 +122,10 @@ class BlocklikeTraits<ParsedFullFilterBlock> {
   static uint32_t GetNumRestarts(const ParsedFullFilterBlock& /* block */) {
     return 0;
   }
+
+  static Slice GetContents(const ParsedFullFilterBlock& block) {
+    return block.GetBlockContentsData();
+  }
 };
 
 template <>
@@ -132,6 +140,11 @@ class BlocklikeTraits<Block> {
   static uint32_t GetNumRestarts(const Block& block) {
     return block.NumRestarts();
   }
+
+  // empty for a corrupted block, it is not kept once evicted
+  static Slice GetContents(const Block& block) {
+    return Slice(block.data(), block.size());
+  }
 };
 
 template <>
@@ -149,6 +162,10 @@ class BlocklikeTraits<UncompressionDict> {
   static uint32_t GetNumRestarts(const UncompressionDict& /* dict */) {
     return 0;
   }
+
+  static Slice GetContents(const UncompressionDict& dict) {
+    return dict.GetRawDict();
+  }
 };
 
 namespace {
@@ -192,6 +209,32 @@ void DeleteCachedEntry(const Slice& /*key*/, void* value) {
   delete entry;
 }
 
+template <class Entry>
+Slice GetCachedEntryContents(void* value) {
+  return BlocklikeTraits<Entry>::GetContents(
+      *reinterpret_cast<Entry*>(value));
+}
+
+// Lets the entry move to the secondary tier of the block cache once evicted,
+// see LRUCacheOptions::secondary_cache
+template <class Entry>
+const Cache::CacheItemHelper* GetCacheItemHelper() {
+  static const Cache::CacheItemHelper helper{&GetCachedEntryContents<Entry>,
+                                             &DeleteCachedEntry<Entry>};
+  return &helper;
+}
+
+// Index, filter and dictionary blocks may go to the high-pri pool
+Cache::Priority GetCachePriority(const BlockBasedTableOptions& table_options,
+                                 BlockType block_type) {
+  return table_options.cache_index_and_filter_blocks_with_high_priority &&
+                 (block_type == BlockType::kFilter ||
+                  block_type == BlockType::kCompressionDictionary ||
+                  block_type == BlockType::kIndex)
+             ? Cache::Priority::HIGH
+             : Cache::Priority::LOW;
+}
+
 // Release the cached entry and decrement its ref count.
 // Do not force erase
 void ReleaseCachedEntry(void* arg, void* h) {
@@ -436,8 +479,16 @@ void BlockBasedTable::UpdateCacheInsertionMetrics(BlockType block_type,
 
 Cache::Handle* BlockBasedTable::GetEntryFromCache(
     Cache* block_cache, const Slice& key, BlockType block_type,
-    GetContext* get_context) const {
-  auto cache_handle = block_cache->Lookup(key, rep_->ioptions.statistics);
+    GetContext* get_context, const Cache::CacheItemHelper* helper,
+    const Cache::CreateCallback& create_cb, Cache::Priority priority) const {
+  Cache::Handle* cache_handle;
+  if (helper != nullptr) {
+    cache_handle = block_cache->LookupWithHelper(key, helper, create_cb,
+                                                 priority,
+                                                 rep_->ioptions.statistics);
+  } else {
+    cache_handle = block_cache->Lookup(key, rep_->ioptions.statistics);
+  }
 
   if (cache_handle != nullptr) {
     UpdateCacheHitMetrics(block_type, get_context,
@@ -1202,8 +1253,29 @@ Status BlockBasedTable::GetDataBlockFromCache(
 
   // Lookup uncompressed cache first
   if (block_cache != nullptr) {
-    auto cache_handle = GetEntryFromCache(block_cache, block_cache_key,
-                                          block_type, get_context);
+    Cache::Handle* cache_handle;
+    if (read_options.fill_cache) {
+      // A block found in the secondary tier is rebuilt and cached again
+      Statistics* statistics = rep_->ioptions.statistics;
+      auto create_cb = [&](std::unique_ptr<char[]>&& buf, size_t size,
+                           void** value, size_t* charge) {
+        BlockContents contents(CacheAllocationPtr(buf.release()), size);
+        TBlocklike* entry = BlocklikeTraits<TBlocklike>::Create(
+            std::move(contents), read_amp_bytes_per_bit, statistics,
+            rep_->blocks_definitely_zstd_compressed,
+            rep_->table_options.filter_policy.get());
+        *value = entry;
+        *charge = entry->ApproximateMemoryUsage();
+        return Status::OK();
+      };
+      cache_handle = GetEntryFromCache(
+          block_cache, block_cache_key, block_type, get_context,
+          GetCacheItemHelper<TBlocklike>(), create_cb,
+          GetCachePriority(rep_->table_options, block_type));
+    } else {
+      cache_handle = GetEntryFromCache(block_cache, block_cache_key,
+                                       block_type, get_context);
+    }
     if (cache_handle != nullptr) {
       block->SetCachedValue(
           reinterpret_cast<TBlocklike*>(block_cache->Value(cache_handle)),
@@ -1260,8 +1332,9 @@ Status BlockBasedTable::GetDataBlockFromCache(
         read_options.fill_cache) {
       size_t charge = block_holder->ApproximateMemoryUsage();
       Cache::Handle* cache_handle = nullptr;
-      s = block_cache->Insert(block_cache_key, block_holder.get(), charge,
-                              &DeleteCachedEntry<TBlocklike>, &cache_handle);
+      s = block_cache->InsertWithHelper(block_cache_key, block_holder.get(),
+                                        GetCacheItemHelper<TBlocklike>(),
+                                        charge, &cache_handle);
       if (s.ok()) {
         assert(cache_handle != nullptr);
         block->SetCachedValue(block_holder.release(), block_cache,
@@ -1298,12 +1371,7 @@ Status BlockBasedTable::PutDataBlockToCache(
           ? rep_->table_options.read_amp_bytes_per_bit
           : 0;
   const Cache::Priority priority =
-      rep_->table_options.cache_index_and_filter_blocks_with_high_priority &&
-              (block_type == BlockType::kFilter ||
-               block_type == BlockType::kCompressionDictionary ||
-               block_type == BlockType::kIndex)
-          ? Cache::Priority::HIGH
-          : Cache::Priority::LOW;
+      GetCachePriority(rep_->table_options, block_type);
   assert(cached_block);
   assert(cached_block->IsEmpty());
 
@@ -1365,9 +1433,9 @@ Status BlockBasedTable::PutDataBlockToCache(
   if (block_cache != nullptr && block_holder->own_bytes()) {
     size_t charge = block_holder->ApproximateMemoryUsage();
     Cache::Handle* cache_handle = nullptr;
-    s = block_cache->Insert(block_cache_key, block_holder.get(), charge,
-                            &DeleteCachedEntry<TBlocklike>, &cache_handle,
-                            priority);
+    s = block_cache->InsertWithHelper(block_cache_key, block_holder.get(),
+                                      GetCacheItemHelper<TBlocklike>(), charge,
+                                      &cache_handle, priority);
     if (s.ok()) {
       assert(cache_handle != nullptr);
       cached_block->SetCachedValue(block_holder.release(), block_cache,
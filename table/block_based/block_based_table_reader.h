@@ -271,9 +271,14 @@ class BlockBasedTable : public TableReader {
   void UpdateCacheInsertionMetrics(BlockType block_type,
                                    GetContext* get_context, size_t usage,
                                    bool redundant) const;
-  Cache::Handle* GetEntryFromCache(Cache* block_cache, const Slice& key,
-                                   BlockType block_type,
-                                   GetContext* get_context) const;
+  // With a helper, a miss is looked up in the secondary tier of the cache
+  // too, see Cache::LookupWithHelper
+  Cache::Handle* GetEntryFromCache(
+      Cache* block_cache, const Slice& key, BlockType block_type,
+      GetContext* get_context,
+      const Cache::CacheItemHelper* helper = nullptr,
+      const Cache::CreateCallback& create_cb = nullptr,
+      Cache::Priority priority = Cache::Priority::LOW) const;
 
   // Either Block::NewDataIterator() or Block::NewIndexIterator().
   template <typename TBlockIter>
@@ -60,6 +60,9 @@ BlockBuilder::BlockBuilder(
       data_block_hash_index_builder_.Initialize(
           data_block_hash_table_util_ratio);
       break;
+    case BlockBasedTableOptions::kDataBlockBinaryAndPrefix:
+      data_block_prefix_array_builder_.Initialize(block_restart_interval);
+      break;
     default:
       assert(0);
   }
@@ -79,6 +82,7 @@ void BlockBuilder::Reset() {
   if (data_block_hash_index_builder_.Valid()) {
     data_block_hash_index_builder_.Reset();
   }
+  data_block_prefix_array_builder_.Reset();
 }
 
 void BlockBuilder::SwapAndReset(std::string& buffer) {
@@ -127,6 +131,11 @@ Slice BlockBuilder::Finish() {
       CurrentSizeEstimate() <= kMaxBlockSizeSupportedByHashIndex) {
     data_block_hash_index_builder_.Finish(buffer_);
     index_type = BlockBasedTableOptions::kDataBlockBinaryAndHash;
+  } else if (data_block_prefix_array_builder_.Valid() && !empty() &&
+             CurrentSizeEstimate() <= kMaxBlockSizeSupportedByHashIndex) {
+    // Larger blocks cannot have an index type in the footer either
+    data_block_prefix_array_builder_.Finish(buffer_);
+    index_type = BlockBasedTableOptions::kDataBlockBinaryAndPrefix;
   }
 
   // footer is a packed format of data_block_index_type and num_restarts
@@ -193,6 +202,9 @@ void BlockBuilder::Add(const Slice& key, const Slice& value,
     data_block_hash_index_builder_.Add(ExtractUserKey(key),
                                        restarts_.size() - 1);
   }
+  if (data_block_prefix_array_builder_.Valid()) {
+    data_block_prefix_array_builder_.Add(ExtractUserKey(key), counter_ == 0);
+  }
 
   counter_++;
   estimate_ += buffer_.size() - curr_size;
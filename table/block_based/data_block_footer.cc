@@ -15,11 +15,15 @@ namespace ROCKSDB_NAMESPACE {
 
 const int kDataBlockIndexTypeBitShift = 31;
 
+// Set instead for a prefix array. The blocks whose footer has an index type
+// (see Block::NumRestarts()) have far fewer than 2^30 restarts.
+const int kDataBlockPrefixArrayBitShift = 30;
+
 // 0x7FFFFFFF
 const uint32_t kMaxNumRestarts = (1u << kDataBlockIndexTypeBitShift) - 1u;
 
-// 0x7FFFFFFF
-const uint32_t kNumRestartsMask = (1u << kDataBlockIndexTypeBitShift) - 1u;
+// 0x3FFFFFFF
+const uint32_t kNumRestartsMask = (1u << kDataBlockPrefixArrayBitShift) - 1u;
 
 uint32_t PackIndexTypeAndNumRestarts(
     BlockBasedTableOptions::DataBlockIndexType index_type,
@@ -31,6 +35,9 @@ uint32_t PackIndexTypeAndNumRestarts(
   uint32_t block_footer = num_restarts;
   if (index_type == BlockBasedTableOptions::kDataBlockBinaryAndHash) {
     block_footer |= 1u << kDataBlockIndexTypeBitShift;
+  } else if (index_type == BlockBasedTableOptions::kDataBlockBinaryAndPrefix) {
+    assert(num_restarts <= kNumRestartsMask);
+    block_footer |= 1u << kDataBlockPrefixArrayBitShift;
   } else if (index_type != BlockBasedTableOptions::kDataBlockBinarySearch) {
     assert(0);
   }
@@ -45,6 +52,8 @@ void UnPackIndexTypeAndNumRestarts(
   if (index_type) {
     if (block_footer & 1u << kDataBlockIndexTypeBitShift) {
       *index_type = BlockBasedTableOptions::kDataBlockBinaryAndHash;
+    } else if (block_footer & 1u << kDataBlockPrefixArrayBitShift) {
+      *index_type = BlockBasedTableOptions::kDataBlockBinaryAndPrefix;
     } else {
       *index_type = BlockBasedTableOptions::kDataBlockBinarySearch;
     }
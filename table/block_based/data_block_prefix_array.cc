@@ -0,0 +1,162 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "table/block_based/data_block_prefix_array.h"
+
+#include "util/coding.h"
+#include "util/math.h"
+
+#ifdef HAVE_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace ROCKSDB_NAMESPACE {
+
+void DataBlockPrefixArrayBuilder::Add(const Slice& user_key, bool restart) {
+  if (restart) {
+    FinishInterval();
+  }
+  interval_key_offsets_.push_back(interval_keys_.size());
+  interval_keys_.append(user_key.data(), user_key.size());
+  num_entries_++;
+}
+
+void DataBlockPrefixArrayBuilder::FinishInterval() {
+  if (interval_key_offsets_.empty()) {
+    return;
+  }
+  // As the keys are sorted, the bytes they all share are those the first
+  // and the last share
+  const size_t num_keys = interval_key_offsets_.size();
+  Slice first(interval_keys_.data(), num_keys > 1 ? interval_key_offsets_[1]
+                                                  : interval_keys_.size());
+  Slice last(interval_keys_.data() + interval_key_offsets_.back(),
+             interval_keys_.size() - interval_key_offsets_.back());
+  uint32_t skip = static_cast<uint32_t>(
+      std::min(first.difference_offset(last), size_t{255}));
+  skips_.push_back(static_cast<char>(skip));
+
+  for (size_t i = 0; i < num_keys; i++) {
+    size_t end = i + 1 < num_keys ? interval_key_offsets_[i + 1]
+                                  : interval_keys_.size();
+    Slice key(interval_keys_.data() + interval_key_offsets_[i],
+              end - interval_key_offsets_[i]);
+    PutFixed32(&prefixes_, DataBlockPrefixArray::GetPrefix(key, skip));
+  }
+  interval_keys_.clear();
+  interval_key_offsets_.clear();
+}
+
+void DataBlockPrefixArrayBuilder::Finish(std::string& buffer) {
+  assert(Valid());
+  FinishInterval();
+  buffer.append(skips_);
+  buffer.append(prefixes_);
+  PutFixed16(&buffer, static_cast<uint16_t>(num_entries_));
+  PutFixed16(&buffer, static_cast<uint16_t>(restart_interval_));
+}
+
+void DataBlockPrefixArrayBuilder::Reset() {
+  num_entries_ = 0;
+  skips_.clear();
+  prefixes_.clear();
+  interval_keys_.clear();
+  interval_key_offsets_.clear();
+}
+
+bool DataBlockPrefixArray::Initialize(const char* data, uint32_t size,
+                                      uint32_t num_restarts,
+                                      uint32_t* array_offset) {
+  if (size < 2 * sizeof(uint16_t)) {
+    return false;
+  }
+  uint32_t num_entries = DecodeFixed16(data + size - 2 * sizeof(uint16_t));
+  uint32_t restart_interval = DecodeFixed16(data + size - sizeof(uint16_t));
+  if (num_entries == 0 || restart_interval == 0 ||
+      (num_entries + restart_interval - 1) / restart_interval !=
+          num_restarts) {
+    return false;
+  }
+  uint32_t array_size = num_restarts + num_entries * sizeof(uint32_t) +
+                        2 * sizeof(uint16_t);
+  if (array_size > size) {
+    return false;
+  }
+  *array_offset = size - array_size;
+  skips_ = data + *array_offset;
+  prefixes_ = skips_ + num_restarts;
+  num_entries_ = num_entries;
+  restart_interval_ = restart_interval;
+  return true;
+}
+
+uint32_t DataBlockPrefixArray::Prefix(uint32_t restart_index,
+                                      uint32_t i) const {
+  assert(i < NumEntries(restart_index));
+  return DecodeFixed32(prefixes_ + (restart_index * restart_interval_ + i) *
+                                       sizeof(uint32_t));
+}
+
+uint32_t DataBlockPrefixArray::CountLess(uint32_t restart_index,
+                                         uint32_t prefix) const {
+  const char* p =
+      prefixes_ + restart_index * restart_interval_ * sizeof(uint32_t);
+  const uint32_t n = NumEntries(restart_index);
+  uint32_t i = 0;
+  // The keys less than the target come first, so each loop stops at the
+  // first group of prefixes that are not all less. The prefixes are
+  // little-endian, like the lanes. There is no unsigned compare, so both
+  // sides are offset by 2^31 for a signed one.
+#ifdef HAVE_AVX2
+  const __m256i bias8 = _mm256_set1_epi32(static_cast<int>(0x80000000u));
+  const __m256i target8 =
+      _mm256_xor_si256(_mm256_set1_epi32(static_cast<int>(prefix)), bias8);
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = _mm256_xor_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i * 4)),
+        bias8);
+    int less = _mm256_movemask_ps(
+        _mm256_castsi256_ps(_mm256_cmpgt_epi32(target8, v)));
+    if (less != 0xff) {
+      return i + BitsSetToOne(static_cast<uint32_t>(less));
+    }
+  }
+#endif  // HAVE_AVX2
+#if defined(HAVE_AVX2) || defined(__SSE2__)
+  const __m128i bias4 = _mm_set1_epi32(static_cast<int>(0x80000000u));
+  const __m128i target4 =
+      _mm_xor_si128(_mm_set1_epi32(static_cast<int>(prefix)), bias4);
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_xor_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * 4)), bias4);
+    int less = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(target4, v)));
+    if (less != 0xf) {
+      return i + BitsSetToOne(static_cast<uint32_t>(less));
+    }
+  }
+#endif  // HAVE_AVX2 || __SSE2__
+  for (; i < n; i++) {
+    if (DecodeFixed32(p + i * sizeof(uint32_t)) >= prefix) {
+      break;
+    }
+  }
+  return i;
+}
+
+uint32_t DataBlockPrefixArray::GetPrefix(const Slice& user_key,
+                                         uint32_t skip) {
+  uint32_t prefix = 0;
+  for (size_t i = skip; i < skip + sizeof(uint32_t); i++) {
+    prefix <<= 8;
+    if (i < user_key.size()) {
+      prefix |= static_cast<unsigned char>(user_key[i]);
+    }
+  }
+  return prefix;
+}
+
+}  // namespace ROCKSDB_NAMESPACE
@@ -0,0 +1,126 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#include <assert.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "rocksdb/slice.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+// A data block built with kDataBlockBinaryAndPrefix stores a fixed-width
+// prefix of each user key, so that a seek can find its entry in a restart
+// interval by comparing the target with the prefixes of all the keys of the
+// interval at once, instead of decoding and comparing the keys one by one.
+// This is only valid for keys ordered by BytewiseComparator.
+//
+// The user keys of restart interval i share their first SKIP[i] bytes (at
+// most 255), and the prefix of a user key is the next 4 bytes, read as a
+// big-endian number and padded with zeros. The prefixes of an interval are
+// thus in the order of its keys, except that different keys can have the
+// same prefix.
+//
+// The array is stored between the restart array and the block footer:
+//
+// SKIP[0] ... SKIP[NUM_RESTARTS - 1]           (uint8 each)
+// PREFIX[0] ... PREFIX[NUM_ENTRIES - 1]        (fixed32 each)
+// NUM_ENTRIES                                  (fixed16)
+// RESTART_INTERVAL                             (fixed16)
+//
+// Every restart interval but the last has RESTART_INTERVAL entries.
+// Like the hash index, the array is only added to blocks of up to
+// kMaxBlockSizeSupportedByHashIndex bytes, as only those have their
+// DataBlockIndexType in the block footer.
+
+class DataBlockPrefixArrayBuilder {
+ public:
+  DataBlockPrefixArrayBuilder()
+      : restart_interval_(0), num_entries_(0), valid_(false) {}
+
+  void Initialize(int restart_interval) {
+    restart_interval_ = restart_interval;
+    valid_ = restart_interval > 0 && restart_interval <= kMaxRestartInterval;
+  }
+
+  // Whether the array can be added to the block
+  inline bool Valid() const { return valid_ && num_entries_ <= kMaxEntries; }
+  // The user key of the next entry, which starts a restart interval when
+  // `restart` is true
+  void Add(const Slice& user_key, bool restart);
+  void Finish(std::string& buffer);
+  void Reset();
+  inline size_t EstimateSize() const {
+    return skips_.size() + (interval_key_offsets_.empty() ? 0 : 1) +
+           num_entries_ * sizeof(uint32_t) + 2 * sizeof(uint16_t);
+  }
+
+  static constexpr int kMaxRestartInterval = 0xffff;
+  static constexpr size_t kMaxEntries = 0xffff;
+
+ private:
+  void FinishInterval();
+
+  int restart_interval_;
+  size_t num_entries_;
+  bool valid_;
+  std::string skips_;
+  std::string prefixes_;
+  // The keys of the current restart interval, whose prefixes depend on the
+  // bytes they all share
+  std::string interval_keys_;
+  std::vector<size_t> interval_key_offsets_;
+};
+
+class DataBlockPrefixArray {
+ public:
+  DataBlockPrefixArray()
+      : skips_(nullptr),
+        prefixes_(nullptr),
+        num_entries_(0),
+        restart_interval_(0) {}
+
+  // Reads the array that ends at data + size, where the block footer
+  // starts, and sets *array_offset to where it starts. Returns false if the
+  // array does not match a block with num_restarts restart points.
+  bool Initialize(const char* data, uint32_t size, uint32_t num_restarts,
+                  uint32_t* array_offset);
+
+  inline bool Valid() const { return prefixes_ != nullptr; }
+
+  // Number of leading bytes shared by the user keys of a restart interval
+  inline uint32_t Skip(uint32_t restart_index) const {
+    return static_cast<unsigned char>(skips_[restart_index]);
+  }
+
+  inline uint32_t NumEntries(uint32_t restart_index) const {
+    uint32_t first = restart_index * restart_interval_;
+    assert(first < num_entries_);
+    return std::min(restart_interval_, num_entries_ - first);
+  }
+
+  uint32_t Prefix(uint32_t restart_index, uint32_t i) const;
+
+  // Returns the number of keys in a restart interval whose prefix is less
+  // than `prefix`, which, as the prefixes are sorted, is also the index of
+  // the first key that can be greater than or equal to a key with that
+  // prefix.
+  uint32_t CountLess(uint32_t restart_index, uint32_t prefix) const;
+
+  // The prefix of user_key for a restart interval whose keys share their
+  // first `skip` bytes
+  static uint32_t GetPrefix(const Slice& user_key, uint32_t skip);
+
+ private:
+  const char* skips_;
+  const char* prefixes_;
+  uint32_t num_entries_;
+  uint32_t restart_interval_;
+};
+
+}  // namespace ROCKSDB_NAMESPACE
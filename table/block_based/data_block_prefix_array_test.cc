@@ -0,0 +1,258 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "table/block_based/data_block_prefix_array.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "db/dbformat.h"
+#include "table/block_based/block.h"
+#include "table/block_based/block_builder.h"
+#include "table/format.h"
+#include "test_util/testharness.h"
+#include "util/coding.h"
+#include "util/random.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+namespace {
+// User keys with long shared prefixes, keys that are prefixes of others, and
+// the smallest and largest bytes
+std::string RandomUserKey(Random* rnd) {
+  static const char* kPrefixes[] = {"", "a", "abcdefgh", "abcdefghij",
+                                    "\xff\xff\xff"};
+  static const char kBytes[] = {'\0', 'a', 'b', '\x7f', '\x80', '\xff'};
+  std::string key = kPrefixes[rnd->Uniform(5)];
+  int len = rnd->Uniform(9);
+  for (int i = 0; i < len; i++) {
+    key.push_back(kBytes[rnd->Uniform(6)]);
+  }
+  return key;
+}
+
+std::vector<std::string> RandomSortedKeys(Random* rnd, int n) {
+  std::vector<std::string> user_keys;
+  for (int i = 0; i < n; i++) {
+    user_keys.push_back(RandomUserKey(rnd));
+  }
+  std::sort(user_keys.begin(), user_keys.end());
+  std::vector<std::string> keys;
+  for (const std::string& user_key : user_keys) {
+    // Versions of a user key are newest first
+    SequenceNumber seq = 1000 - keys.size();
+    keys.push_back(InternalKey(user_key, seq, kTypeValue).Encode().ToString());
+  }
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  return keys;
+}
+
+std::string BuildBlock(const std::vector<std::string>& keys,
+                       int restart_interval,
+                       BlockBasedTableOptions::DataBlockIndexType index_type) {
+  BlockBuilder builder(restart_interval, true /* use_delta_encoding */,
+                       false /* use_value_delta_encoding */, index_type);
+  for (const std::string& key : keys) {
+    builder.Add(key, "v" + key);
+  }
+  return builder.Finish().ToString();
+}
+
+std::unique_ptr<Block> NewBlock(const std::string& data) {
+  BlockContents contents;
+  contents.data = data;
+  return std::unique_ptr<Block>(new Block(std::move(contents)));
+}
+
+std::string IterState(const DataBlockIter& iter) {
+  return iter.Valid() ? iter.key().ToString() : "(invalid)";
+}
+}  // namespace
+
+TEST(DataBlockPrefixArrayTest, GetPrefix) {
+  ASSERT_EQ(0x61626364u, DataBlockPrefixArray::GetPrefix("abcdefg", 0));
+  ASSERT_EQ(0x64656667u, DataBlockPrefixArray::GetPrefix("abcdefg", 3));
+  ASSERT_EQ(0x66670000u, DataBlockPrefixArray::GetPrefix("abcdefg", 5));
+  ASSERT_EQ(0u, DataBlockPrefixArray::GetPrefix("abc", 3));
+  ASSERT_EQ(0xff000000u, DataBlockPrefixArray::GetPrefix("\xff", 0));
+}
+
+TEST(DataBlockPrefixArrayTest, CountLess) {
+  Random rnd(301);
+  // Every length of restart interval up to and past the widest SIMD loop
+  for (int restart_interval = 1; restart_interval <= 20; restart_interval++) {
+    std::vector<uint32_t> prefixes;
+    for (int i = 0; i < 50; i++) {
+      // Few distinct values, so that many are equal
+      prefixes.push_back((rnd.Uniform(4) << 30) | rnd.Uniform(4));
+    }
+    for (size_t begin = 0; begin < prefixes.size();
+         begin += restart_interval) {
+      size_t end = std::min(begin + restart_interval, prefixes.size());
+      std::sort(prefixes.begin() + begin, prefixes.begin() + end);
+      // The keys of an interval then share no bytes, so their prefix is the
+      // number that the 4 bytes of the key spell. A key alone in its
+      // interval shares all its bytes with itself, so it gets prefix 0.
+      prefixes[begin] = 0;
+      if (end - begin > 1) {
+        prefixes[end - 1] = 0xffffffffu;
+      }
+    }
+
+    DataBlockPrefixArrayBuilder builder;
+    builder.Initialize(restart_interval);
+    for (size_t i = 0; i < prefixes.size(); i++) {
+      std::string key;
+      for (int shift = 24; shift >= 0; shift -= 8) {
+        key.push_back(static_cast<char>(prefixes[i] >> shift));
+      }
+      builder.Add(key, i % restart_interval == 0);
+    }
+    ASSERT_TRUE(builder.Valid());
+    std::string data;
+    builder.Finish(data);
+    ASSERT_EQ(builder.EstimateSize(), data.size());
+
+    uint32_t num_restarts = static_cast<uint32_t>(
+        (prefixes.size() + restart_interval - 1) / restart_interval);
+    DataBlockPrefixArray array;
+    uint32_t array_offset = 1;
+    ASSERT_TRUE(array.Initialize(data.data(),
+                                 static_cast<uint32_t>(data.size()),
+                                 num_restarts, &array_offset));
+    ASSERT_EQ(0u, array_offset);
+
+    for (uint32_t r = 0; r < num_restarts; r++) {
+      uint32_t begin = r * restart_interval;
+      uint32_t n = array.NumEntries(r);
+      ASSERT_EQ(std::min(static_cast<size_t>(restart_interval),
+                         prefixes.size() - begin),
+                n);
+      for (uint32_t i = 0; i < n; i++) {
+        ASSERT_EQ(prefixes[begin + i], array.Prefix(r, i));
+        uint32_t target = prefixes[begin + i];
+        for (uint32_t t : {target - 1, target, target + 1}) {
+          uint32_t expected = static_cast<uint32_t>(
+              std::lower_bound(prefixes.begin() + begin,
+                               prefixes.begin() + begin + n, t) -
+              (prefixes.begin() + begin));
+          ASSERT_EQ(expected, array.CountLess(r, t));
+        }
+      }
+    }
+  }
+}
+
+TEST(DataBlockPrefixArrayTest, SeekMatchesBinarySearch) {
+  Random rnd(301);
+  for (int restart_interval : {1, 2, 3, 4, 7, 8, 16, 17, 33}) {
+    std::vector<std::string> keys = RandomSortedKeys(&rnd, 500);
+    std::string plain_data = BuildBlock(
+        keys, restart_interval, BlockBasedTableOptions::kDataBlockBinarySearch);
+    std::string prefix_data =
+        BuildBlock(keys, restart_interval,
+                   BlockBasedTableOptions::kDataBlockBinaryAndPrefix);
+    std::unique_ptr<Block> plain = NewBlock(plain_data);
+    std::unique_ptr<Block> prefix = NewBlock(prefix_data);
+    ASSERT_EQ(BlockBasedTableOptions::kDataBlockBinaryAndPrefix,
+              prefix->IndexType());
+    ASSERT_EQ(plain->NumRestarts(), prefix->NumRestarts());
+
+    std::unique_ptr<DataBlockIter> plain_iter(plain->NewDataIterator(
+        BytewiseComparator(), kDisableGlobalSequenceNumber));
+    std::unique_ptr<DataBlockIter> prefix_iter(prefix->NewDataIterator(
+        BytewiseComparator(), kDisableGlobalSequenceNumber));
+
+    size_t count = 0;
+    for (prefix_iter->SeekToFirst(); prefix_iter->Valid();
+         prefix_iter->Next()) {
+      ASSERT_EQ(keys[count], prefix_iter->key().ToString());
+      ASSERT_EQ("v" + keys[count], prefix_iter->value().ToString());
+      count++;
+    }
+    ASSERT_EQ(keys.size(), count);
+
+    std::vector<std::string> targets;
+    for (const std::string& key : keys) {
+      Slice user_key = ExtractUserKey(key);
+      targets.push_back(key);
+      targets.push_back(
+          InternalKey(user_key, kMaxSequenceNumber, kValueTypeForSeek)
+              .Encode()
+              .ToString());
+      targets.push_back(
+          InternalKey(user_key, 0, kTypeValue).Encode().ToString());
+    }
+    for (int i = 0; i < 1000; i++) {
+      targets.push_back(InternalKey(RandomUserKey(&rnd), rnd.Uniform(1100),
+                                    kTypeValue)
+                            .Encode()
+                            .ToString());
+    }
+    for (const std::string& target : targets) {
+      plain_iter->Seek(target);
+      prefix_iter->Seek(target);
+      ASSERT_EQ(IterState(*plain_iter), IterState(*prefix_iter));
+      ASSERT_OK(prefix_iter->status());
+      if (prefix_iter->Valid()) {
+        ASSERT_EQ(plain_iter->value(), prefix_iter->value());
+      }
+
+      plain_iter->SeekForPrev(target);
+      prefix_iter->SeekForPrev(target);
+      ASSERT_EQ(IterState(*plain_iter), IterState(*prefix_iter));
+      ASSERT_OK(prefix_iter->status());
+    }
+  }
+}
+
+TEST(DataBlockPrefixArrayTest, LargeBlockHasNoPrefixArray) {
+  std::vector<std::string> keys;
+  for (int i = 0; i < 10000; i++) {
+    keys.push_back(InternalKey("key" + ToString(100000 + i), 0, kTypeValue)
+                       .Encode()
+                       .ToString());
+  }
+  std::string data =
+      BuildBlock(keys, 16, BlockBasedTableOptions::kDataBlockBinaryAndPrefix);
+  ASSERT_GT(data.size(), kMaxBlockSizeSupportedByHashIndex);
+  std::unique_ptr<Block> block = NewBlock(data);
+  ASSERT_EQ(BlockBasedTableOptions::kDataBlockBinarySearch, block->IndexType());
+
+  std::unique_ptr<DataBlockIter> iter(block->NewDataIterator(
+      BytewiseComparator(), kDisableGlobalSequenceNumber));
+  iter->Seek(keys[5000]);
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ(keys[5000], iter->key().ToString());
+}
+
+TEST(DataBlockPrefixArrayTest, CorruptArray) {
+  Random rnd(301);
+  std::vector<std::string> keys = RandomSortedKeys(&rnd, 100);
+  std::string data =
+      BuildBlock(keys, 16, BlockBasedTableOptions::kDataBlockBinaryAndPrefix);
+  // NUM_ENTRIES, then RESTART_INTERVAL, before the footer
+  const size_t trailer = data.size() - sizeof(uint32_t) - 2 * sizeof(uint16_t);
+  ASSERT_EQ(keys.size(), DecodeFixed16(data.data() + trailer));
+  ASSERT_EQ(16u, DecodeFixed16(data.data() + trailer + sizeof(uint16_t)));
+
+  for (uint16_t num_entries : {0, 1, 200, 0xffff}) {
+    std::string corrupt = data;
+    EncodeFixed16(&corrupt[trailer], num_entries);
+    std::unique_ptr<Block> block = NewBlock(corrupt);
+    std::unique_ptr<DataBlockIter> iter(block->NewDataIterator(
+        BytewiseComparator(), kDisableGlobalSequenceNumber));
+    ASSERT_FALSE(iter->Valid());
+    ASSERT_TRUE(iter->status().IsCorruption());
+  }
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
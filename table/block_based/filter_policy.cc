@@ -20,13 +20,37 @@
 #include "util/bloom_impl.h"
 #include "util/coding.h"
 #include "util/hash.h"
+#include "util/ribbon_impl.h"
 
 namespace ROCKSDB_NAMESPACE {
 
 namespace {
 
+// Base class for filter builders using the 64-bit hash of the keys
+class XXH3pFilterBitsBuilder : public BuiltinFilterBitsBuilder {
+ public:
+  ~XXH3pFilterBitsBuilder() override {}
+
+  virtual void AddKey(const Slice& key) override {
+    uint64_t hash = GetSliceHash64(key);
+    if (hash_entries_.empty() || hash != hash_entries_.back()) {
+      hash_entries_.push_back(hash);
+    }
+  }
+
+ protected:
+  // For delegating to another builder with the keys added so far
+  void SwapEntriesWith(XXH3pFilterBitsBuilder* other) {
+    std::swap(hash_entries_, other->hash_entries_);
+  }
+
+  // A deque avoids unnecessary copying of already-saved values
+  // and has near-minimal peak memory use.
+  std::deque<uint64_t> hash_entries_;
+};
+
 // See description in FastLocalBloomImpl
-class FastLocalBloomBitsBuilder : public BuiltinFilterBitsBuilder {
+class FastLocalBloomBitsBuilder : public XXH3pFilterBitsBuilder {
  public:
   // Non-null aggregate_rounding_balance implies optimize_filters_for_memory
   explicit FastLocalBloomBitsBuilder(
@@ -43,13 +67,6 @@ class FastLocalBloomBitsBuilder : public BuiltinFilterBitsBuilder {
 
   ~FastLocalBloomBitsBuilder() override {}
 
-  virtual void AddKey(const Slice& key) override {
-    uint64_t hash = GetSliceHash64(key);
-    if (hash_entries_.empty() || hash != hash_entries_.back()) {
-      hash_entries_.push_back(hash);
-    }
-  }
-
   virtual Slice Finish(std::unique_ptr<const char[]>* buf) override {
     size_t num_entry = hash_entries_.size();
     std::unique_ptr<char[]> mutable_buf;
@@ -294,9 +311,6 @@ class FastLocalBloomBitsBuilder : public BuiltinFilterBitsBuilder {
   // See BloomFilterPolicy::aggregate_rounding_balance_. If nullptr,
   // always "round up" like historic behavior.
   std::atomic<int64_t>* aggregate_rounding_balance_;
-  // A deque avoids unnecessary copying of already-saved values
-  // and has near-minimal peak memory use.
-  std::deque<uint64_t> hash_entries_;
 };
 
 // See description in FastLocalBloomImpl
@@ -341,6 +355,194 @@ class FastLocalBloomBitsReader : public FilterBitsReader {
   const uint32_t len_bytes_;
 };
 
+// See description in StandardRibbonImpl. Builds a FastLocalBloom filter
+// instead where that is no larger, as for few keys, or if banding fails.
+class StandardRibbonBitsBuilder : public XXH3pFilterBitsBuilder {
+ public:
+  // Non-null aggregate_rounding_balance implies optimize_filters_for_memory
+  // for the Bloom filters built instead
+  explicit StandardRibbonBitsBuilder(
+      const int millibits_per_key,
+      std::atomic<int64_t>* aggregate_rounding_balance, Logger* info_log)
+      : num_columns_(ChooseNumColumns(millibits_per_key)),
+        bloom_fallback_(millibits_per_key, aggregate_rounding_balance),
+        info_log_(info_log) {}
+
+  // No Copy allowed
+  StandardRibbonBitsBuilder(const StandardRibbonBitsBuilder&) = delete;
+  void operator=(const StandardRibbonBitsBuilder&) = delete;
+
+  ~StandardRibbonBitsBuilder() override {}
+
+  virtual Slice Finish(std::unique_ptr<const char[]>* buf) override {
+    const size_t num_entries = hash_entries_.size();
+    if (!UseRibbon(num_entries)) {
+      return FinishAsBloom(buf);
+    }
+
+    const uint32_t num_slots = StandardRibbonImpl::GetNumSlots(num_entries);
+    for (uint32_t seed = 0; seed < kMaxSeeds; ++seed) {
+      StandardRibbonImpl::Bander bander(num_slots);
+      if (!bander.AddRange(hash_entries_.begin(), hash_entries_.end(), seed)) {
+        continue;
+      }
+
+      uint32_t len = static_cast<uint32_t>(
+          StandardRibbonImpl::GetBytes(num_slots, num_columns_));
+      uint32_t len_with_metadata = len + /* metadata */ 5;
+      std::unique_ptr<char[]> mutable_buf(new char[len_with_metadata]);
+      bander.BackSubst(num_columns_, mutable_buf.get());
+      hash_entries_.clear();
+
+      // See BloomFilterPolicy::GetRibbonBitsReader re: metadata
+      // -2 = Marker for Standard Ribbon
+      mutable_buf[len] = static_cast<char>(-2);
+      mutable_buf[len + 1] = static_cast<char>(seed);
+      // num_blocks in three bytes
+      uint32_t num_blocks = num_slots / StandardRibbonImpl::kCoeffBits;
+      mutable_buf[len + 2] = static_cast<char>(num_blocks);
+      mutable_buf[len + 3] = static_cast<char>(num_blocks >> 8);
+      mutable_buf[len + 4] = static_cast<char>(num_blocks >> 16);
+
+      Slice rv(mutable_buf.get(), len_with_metadata);
+      *buf = std::move(mutable_buf);
+      return rv;
+    }
+
+    ROCKS_LOG_WARN(info_log_,
+                   "Failed to build a Ribbon filter for %" ROCKSDB_PRIszt
+                   " keys after %u attempts, using a Bloom filter instead",
+                   num_entries, kMaxSeeds);
+    return FinishAsBloom(buf);
+  }
+
+  int CalculateNumEntry(const uint32_t bytes) override {
+    // Binary search, as the space grows with the number of keys, and is
+    // at least a bit per key
+    int low = 0;
+    int high = static_cast<int>(
+        std::min(uint64_t{bytes} * 8 + 1, uint64_t{0x7fffffff}));
+    while (low + 1 < high) {
+      int mid = low + (high - low) / 2;
+      if (CalculateSpace(mid) <= bytes) {
+        low = mid;
+      } else {
+        high = mid;
+      }
+    }
+    return low;
+  }
+
+  uint32_t CalculateSpace(const int num_entry) override {
+    size_t n = static_cast<size_t>(num_entry);
+    if (UseRibbon(n)) {
+      return static_cast<uint32_t>(RibbonSpace(n));
+    } else {
+      return bloom_fallback_.CalculateSpace(num_entry);
+    }
+  }
+
+  double EstimatedFpRate(size_t keys, size_t len_with_metadata) override {
+    if (len_with_metadata != RibbonSpace(keys)) {
+      return bloom_fallback_.EstimatedFpRate(keys, len_with_metadata);
+    }
+    // Also counting collisions in the 64-bit hash
+    return BloomMath::IndependentProbabilitySum(
+        StandardRibbonImpl::EstimatedFpRate(num_columns_),
+        BloomMath::FingerprintFpRate(keys, /*fingerprint bits*/ 64));
+  }
+
+ private:
+  // Banding fails with low probability for a seed. After this many
+  // failures, something like many colliding hashes is more likely.
+  static constexpr uint32_t kMaxSeeds = 16;
+
+  // The number of columns for about the FP rate of a Bloom filter with
+  // the same millibits per key
+  static int ChooseNumColumns(int millibits_per_key) {
+    double bloom_fp_rate = BloomMath::CacheLocalFpRate(
+        millibits_per_key / 1000.0,
+        FastLocalBloomImpl::ChooseNumProbes(millibits_per_key),
+        /*cache line bits*/ 512);
+    int num_columns =
+        static_cast<int>(std::floor(-std::log2(bloom_fp_rate) + 0.5));
+    return std::min(std::max(num_columns, 1), StandardRibbonImpl::kMaxColumns);
+  }
+
+  // Bytes with metadata for a Ribbon filter with num_entries keys
+  uint64_t RibbonSpace(size_t num_entries) const {
+    return StandardRibbonImpl::GetBytes(
+               StandardRibbonImpl::GetNumSlots(num_entries), num_columns_) +
+           /* metadata */ 5;
+  }
+
+  // Whether a Ribbon filter is smaller than the Bloom filter, and not too
+  // large for this data structure implementation
+  bool UseRibbon(size_t num_entries) {
+    if (num_entries == 0) {
+      return false;
+    }
+    uint64_t space = RibbonSpace(num_entries);
+    int bloom_entries =
+        static_cast<int>(std::min(num_entries, size_t{0x7fffffff}));
+    return space < uint64_t{0xffffffc0} &&
+           StandardRibbonImpl::GetNumSlots(num_entries) > num_entries &&
+           space < bloom_fallback_.CalculateSpace(bloom_entries);
+  }
+
+  Slice FinishAsBloom(std::unique_ptr<const char[]>* buf) {
+    SwapEntriesWith(&bloom_fallback_);
+    assert(hash_entries_.empty());
+    return bloom_fallback_.Finish(buf);
+  }
+
+  const int num_columns_;
+  FastLocalBloomBitsBuilder bloom_fallback_;
+  Logger* info_log_;
+};
+
+// See description in StandardRibbonImpl
+class StandardRibbonBitsReader : public FilterBitsReader {
+ public:
+  StandardRibbonBitsReader(const char* data, uint32_t num_blocks,
+                           int num_columns, uint32_t seed)
+      : data_(data),
+        num_slots_(num_blocks * StandardRibbonImpl::kCoeffBits),
+        num_columns_(num_columns),
+        seed_(seed) {}
+
+  // No Copy allowed
+  StandardRibbonBitsReader(const StandardRibbonBitsReader&) = delete;
+  void operator=(const StandardRibbonBitsReader&) = delete;
+
+  ~StandardRibbonBitsReader() override {}
+
+  bool MayMatch(const Slice& key) override {
+    return StandardRibbonImpl::HashMayMatch(GetSliceHash64(key), seed_,
+                                            num_slots_, num_columns_, data_);
+  }
+
+  virtual void MayMatch(int num_keys, Slice** keys, bool* may_match) override {
+    std::array<uint64_t, MultiGetContext::MAX_BATCH_SIZE> hashes;
+    std::array<uint32_t, MultiGetContext::MAX_BATCH_SIZE> starts;
+    for (int i = 0; i < num_keys; ++i) {
+      StandardRibbonImpl::PrepareHash(GetSliceHash64(*keys[i]), seed_,
+                                      num_slots_, num_columns_, data_,
+                                      /*out*/ &hashes[i], &starts[i]);
+    }
+    for (int i = 0; i < num_keys; ++i) {
+      may_match[i] = StandardRibbonImpl::HashMayMatchPrepared(
+          hashes[i], starts[i], num_columns_, data_);
+    }
+  }
+
+ private:
+  const char* data_;
+  const uint32_t num_slots_;
+  const int num_columns_;
+  const uint32_t seed_;
+};
+
 using LegacyBloomImpl = LegacyLocalityBloomImpl</*ExtraRotates*/ false>;
 
 class LegacyBloomBitsBuilder : public BuiltinFilterBitsBuilder {
@@ -595,6 +797,7 @@ const std::vector<BloomFilterPolicy::Mode> BloomFilterPolicy::kAllFixedImpls = {
     kLegacyBloom,
     kDeprecatedBlock,
     kFastLocalBloom,
+    kStandardRibbon,
 };
 
 const std::vector<BloomFilterPolicy::Mode> BloomFilterPolicy::kAllUserModes = {
@@ -694,7 +897,12 @@ FilterBitsBuilder* BloomFilterPolicy::GetFilterBitsBuilder() const {
 
 FilterBitsBuilder* BloomFilterPolicy::GetBuilderWithContext(
     const FilterBuildingContext& context) const {
-  Mode cur = mode_;
+  return GetBuilderForMode(mode_, context);
+}
+
+FilterBitsBuilder* BloomFilterPolicy::GetBuilderForMode(
+    Mode mode, const FilterBuildingContext& context) const {
+  Mode cur = mode;
   bool offm = context.table_options.optimize_filters_for_memory;
   // Unusual code construction so that we can have just
   // one exhaustive switch without (risky) recursion
@@ -712,6 +920,10 @@ FilterBitsBuilder* BloomFilterPolicy::GetBuilderWithContext(
       case kFastLocalBloom:
         return new FastLocalBloomBitsBuilder(
             millibits_per_key_, offm ? &aggregate_rounding_balance_ : nullptr);
+      case kStandardRibbon:
+        return new StandardRibbonBitsBuilder(
+            millibits_per_key_, offm ? &aggregate_rounding_balance_ : nullptr,
+            context.info_log);
       case kLegacyBloom:
         if (whole_bits_per_key_ >= 14 && context.info_log &&
             !warned_.load(std::memory_order_relaxed)) {
@@ -784,6 +996,10 @@ FilterBitsReader* BloomFilterPolicy::GetFilterBitsReader(
       // Marker for newer Bloom implementations
       return GetBloomBitsReader(contents);
     }
+    if (raw_num_probes == -2) {
+      // Marker for Ribbon implementations
+      return GetRibbonBitsReader(contents);
+    }
     // otherwise
     // Treat as zero probes (always FP) for now.
     return new AlwaysTrueFilter();
@@ -884,6 +1100,64 @@ FilterBitsReader* BloomFilterPolicy::GetBloomBitsReader(
   return new AlwaysTrueFilter();
 }
 
+// For Ribbon filter implementations
+FilterBitsReader* BloomFilterPolicy::GetRibbonBitsReader(
+    const Slice& contents) const {
+  uint32_t len_with_meta = static_cast<uint32_t>(contents.size());
+  uint32_t len = len_with_meta - 5;
+
+  assert(len > 0);  // precondition
+
+  // Standard Ribbon filter data:
+  //             0 +-----------------------------------+
+  //               | Solution for each block of 128    |
+  //               |   slots, 16 bytes per column      |
+  //               | ...                               |
+  //           len +-----------------------------------+
+  //               | char{-2} byte -> Standard Ribbon  |
+  //         len+1 +-----------------------------------+
+  //               | byte for hash seed                |
+  //         len+2 +-----------------------------------+
+  //               | three bytes for number of blocks  |
+  //               |   (num_columns follows from len)  |
+  // len_with_meta +-----------------------------------+
+
+  uint32_t seed = static_cast<uint8_t>(contents.data()[len + 1]);
+  uint32_t num_blocks = static_cast<uint8_t>(contents.data()[len + 2]);
+  num_blocks |= static_cast<uint8_t>(contents.data()[len + 3]) << 8;
+  num_blocks |= static_cast<uint8_t>(contents.data()[len + 4]) << 16;
+
+  uint32_t bytes_per_column = num_blocks * StandardRibbonImpl::kCoeffBytes;
+  if (num_blocks < 2 || len % bytes_per_column != 0) {
+    // Invalid (too few blocks for any start slot, or no solution to
+    // num_columns * bytes_per_column == len)
+    return new AlwaysTrueFilter();
+  }
+  uint32_t num_columns = len / bytes_per_column;
+  if (num_columns > StandardRibbonImpl::kMaxColumns) {
+    // Reserved / future safe
+    return new AlwaysTrueFilter();
+  }
+  return new StandardRibbonBitsReader(contents.data(), num_blocks,
+                                      static_cast<int>(num_columns), seed);
+}
+
+RibbonFilterPolicy::RibbonFilterPolicy(double bloom_equivalent_bits_per_key,
+                                       int bloom_before_level)
+    : BloomFilterPolicy(bloom_equivalent_bits_per_key, kAuto),
+      bloom_before_level_(bloom_before_level) {}
+
+FilterBitsBuilder* RibbonFilterPolicy::GetBuilderWithContext(
+    const FilterBuildingContext& context) const {
+  // Like the newer Bloom filters, a legacy Bloom filter instead for
+  // format_version < 5
+  if (context.table_options.format_version < 5 ||
+      context.level_at_creation < bloom_before_level_) {
+    return GetBuilderForMode(kAuto, context);
+  }
+  return GetBuilderForMode(kStandardRibbon, context);
+}
+
 const FilterPolicy* NewBloomFilterPolicy(double bits_per_key,
                                          bool use_block_based_builder) {
   BloomFilterPolicy::Mode m;
@@ -898,6 +1172,12 @@ const FilterPolicy* NewBloomFilterPolicy(double bits_per_key,
   return new BloomFilterPolicy(bits_per_key, m);
 }
 
+const FilterPolicy* NewRibbonFilterPolicy(double bloom_equivalent_bits_per_key,
+                                          int bloom_before_level) {
+  return new RibbonFilterPolicy(bloom_equivalent_bits_per_key,
+                                bloom_before_level);
+}
+
 FilterBuildingContext::FilterBuildingContext(
     const BlockBasedTableOptions& _table_options)
     : table_options(_table_options) {}
@@ -908,6 +1188,7 @@ Status FilterPolicy::CreateFromString(
     const ConfigOptions& /*options*/, const std::string& value,
     std::shared_ptr<const FilterPolicy>* policy) {
   const std::string kBloomName = "bloomfilter:";
+  const std::string kRibbonName = "ribbonfilter:";
   if (value == kNullptrString || value == "rocksdb.BuiltinBloomFilter") {
     policy->reset();
 #ifndef ROCKSDB_LITE
@@ -924,6 +1205,18 @@ Status FilterPolicy::CreateFromString(
       policy->reset(
           NewBloomFilterPolicy(bits_per_key, use_block_based_builder));
     }
+  } else if (value.compare(0, kRibbonName.size(), kRibbonName) == 0) {
+    size_t pos = value.find(':', kRibbonName.size());
+    int bloom_before_level = 0;
+    if (pos == std::string::npos) {
+      pos = value.size();
+    } else {
+      bloom_before_level = ParseInt(trim(value.substr(pos + 1)));
+    }
+    double bloom_equivalent_bits_per_key = ParseDouble(
+        trim(value.substr(kRibbonName.size(), pos - kRibbonName.size())));
+    policy->reset(NewRibbonFilterPolicy(bloom_equivalent_bits_per_key,
+                                        bloom_before_level));
   } else {
     return Status::NotFound("Invalid filter policy name ", value);
 #else
@@ -64,8 +64,13 @@ class BloomFilterPolicy : public FilterPolicy {
     // FastLocalBloomImpl.
     // NOTE: TESTING ONLY as this mode does not check format_version
     kFastLocalBloom = 2,
-    // Automatically choose from the above (except kDeprecatedBlock) based on
-    // context at build time, including compatibility with format_version.
+    // A Standard Ribbon filter, for about the FP rate of the Bloom filter
+    // with the same bits per key. See description in StandardRibbonImpl.
+    // NOTE: TESTING ONLY as this mode does not check format_version
+    kStandardRibbon = 3,
+    // Automatically choose from the above (except kDeprecatedBlock and
+    // kStandardRibbon) based on context at build time, including
+    // compatibility with format_version.
     // NOTE: This is currently the only recommended mode that is user exposed.
     kAuto = 100,
   };
@@ -147,6 +152,32 @@ class BloomFilterPolicy : public FilterPolicy {
 
   // For newer Bloom filter implementation(s)
   FilterBitsReader* GetBloomBitsReader(const Slice& contents) const;
+
+  // For Ribbon filter implementation(s)
+  FilterBitsReader* GetRibbonBitsReader(const Slice& contents) const;
+
+ protected:
+  // GetBuilderWithContext for a given mode
+  FilterBitsBuilder* GetBuilderForMode(
+      Mode mode, const FilterBuildingContext& context) const;
+};
+
+// Uses a Standard Ribbon filter for tables created at bloom_before_level
+// or higher, for about the FP rate of a Bloom filter with the same bits
+// per key in less space, and kAuto for the others.
+// See NewRibbonFilterPolicy.
+class RibbonFilterPolicy : public BloomFilterPolicy {
+ public:
+  explicit RibbonFilterPolicy(double bloom_equivalent_bits_per_key,
+                              int bloom_before_level);
+
+  FilterBitsBuilder* GetBuilderWithContext(
+      const FilterBuildingContext&) const override;
+
+  int GetBloomBeforeLevel() const { return bloom_before_level_; }
+
+ private:
+  const int bloom_before_level_;
 };
 
 }  // namespace ROCKSDB_NAMESPACE
@@ -174,6 +174,14 @@ Status GetMemTableRepFactoryFromString(
     } else if (1 == len) {
       mem_factory = new SkipListFactory();
     }
+  } else if (opts_list[0] == "art" || opts_list[0] == "ARTRepFactory") {
+    // Expecting format
+    // art
+    if (1 != len) {
+      return Status::InvalidArgument("art memtable_factory takes no option ",
+                                     opts_str);
+    }
+    mem_factory = new ARTRepFactory();
   } else if (opts_list[0] == "prefix_hash" ||
              opts_list[0] == "HashSkipListRepFactory") {
     // Expecting format
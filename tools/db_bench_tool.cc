@@ -46,6 +46,7 @@
 #include "rocksdb/perf_context.h"
 #include "rocksdb/persistent_cache.h"
 #include "rocksdb/rate_limiter.h"
+#include "rocksdb/secondary_cache.h"
 #include "rocksdb/slice.h"
 #include "rocksdb/slice_transform.h"
 #include "rocksdb/stats_history.h"
@@ -535,6 +536,11 @@ DEFINE_bool(use_data_block_hash_index, false,
             "instead of kDataBlockBinarySearch. "
             "This is valid if only we use BlockTable");
 
+DEFINE_bool(use_data_block_prefix_array, false,
+            "if use kDataBlockBinaryAndPrefix "
+            "instead of kDataBlockBinarySearch. "
+            "This is valid if only we use BlockTable");
+
 DEFINE_double(data_block_hash_table_util_ratio, 0.75,
               "util ratio for data block hash index table. "
               "This is only valid if use_data_block_hash_index is "
@@ -543,6 +549,18 @@ DEFINE_double(data_block_hash_table_util_ratio, 0.75,
 DEFINE_int64(compressed_cache_size, -1,
              "Number of bytes to use as a cache of compressed data.");
 
+DEFINE_int64(secondary_cache_size, -1,
+             "Number of bytes to use as a compressed secondary tier behind "
+             "the LRU block cache. It only keeps the blocks the block cache "
+             "evicts. Negative value disables the secondary tier.");
+
+DEFINE_string(secondary_cache_compression_type, "lz4",
+              "Algorithm the secondary tier compresses blocks with");
+
+DEFINE_int32(secondary_cache_max_dict_bytes, 0,
+             "Size of the dictionary the secondary tier builds from the first "
+             "blocks it receives (0 = no dictionary).");
+
 DEFINE_int64(row_cache_size, 0,
              "Number of bytes to use as a cache of individual rows"
              " (0 = disabled).");
@@ -1300,6 +1318,7 @@ enum RepFactory {
   kPrefixHash,
   kVectorRep,
   kHashLinkedList,
+  kART,
 };
 
 static enum RepFactory StringToRepFactory(const char* ctype) {
@@ -1313,6 +1332,8 @@ static enum RepFactory StringToRepFactory(const char* ctype) {
     return kVectorRep;
   else if (!strcasecmp(ctype, "hash_linkedlist"))
     return kHashLinkedList;
+  else if (!strcasecmp(ctype, "art"))
+    return kART;
 
   fprintf(stdout, "Cannot parse memreptable %s\n", ctype);
   return kSkipList;
@@ -1331,6 +1352,10 @@ DEFINE_bool(use_hash_search, false, "if use kHashSearch "
 DEFINE_bool(use_block_based_filter, false, "if use kBlockBasedFilter "
             "instead of kFullFilter for filter block. "
             "This is valid if only we use BlockTable");
+DEFINE_bool(use_ribbon_filter, false, "Use a Ribbon filter instead of a "
+            "Bloom filter, for about the FP rate of -bloom_bits");
+DEFINE_int32(ribbon_filter_bloom_before_level, 0, "With -use_ribbon_filter, "
+             "tables created at a lower level get a Bloom filter");
 DEFINE_string(merge_operator, "", "The merge operator to use with the database."
               "If a new merge operator is specified, be sure to use fresh"
               " database The possible merge operators are defined in"
@@ -2513,6 +2538,9 @@ class Benchmark {
       case kHashLinkedList:
         fprintf(stdout, "Memtablerep: hash_linkedlist\n");
         break;
+      case kART:
+        fprintf(stdout, "Memtablerep: art\n");
+        break;
     }
     fprintf(stdout, "Perf Level: %d\n", FLAGS_perf_level);
 
@@ -2650,7 +2678,8 @@ class Benchmark {
     const char* Name() const override { return "KeepFilter"; }
   };
 
-  std::shared_ptr<Cache> NewCache(int64_t capacity) {
+  std::shared_ptr<Cache> NewCache(int64_t capacity,
+                                  bool with_secondary_cache = false) {
     if (capacity <= 0) {
       return nullptr;
     }
@@ -2675,21 +2704,41 @@ class Benchmark {
         exit(1);
 #endif
       } else {
-        return NewLRUCache(
+        LRUCacheOptions opts(
             static_cast<size_t>(capacity), FLAGS_cache_numshardbits,
             false /*strict_capacity_limit*/, FLAGS_cache_high_pri_pool_ratio);
+        if (with_secondary_cache && FLAGS_secondary_cache_size > 0) {
+          opts.secondary_cache =
+              NewCompressedSecondaryCache(CompressedSecondaryCacheOptions(
+                  static_cast<size_t>(FLAGS_secondary_cache_size),
+                  FLAGS_cache_numshardbits,
+                  StringToCompressionType(
+                      FLAGS_secondary_cache_compression_type.c_str()),
+                  static_cast<uint32_t>(FLAGS_secondary_cache_max_dict_bytes)));
+          if (!opts.secondary_cache) {
+            fprintf(stderr,
+                    "Secondary cache compression type not supported.\n");
+            exit(1);
+          }
+        }
+        return NewLRUCache(opts);
       }
     }
   }
 
  public:
   Benchmark()
-      : cache_(NewCache(FLAGS_cache_size)),
+      : cache_(NewCache(FLAGS_cache_size, true /* with_secondary_cache */)),
         compressed_cache_(NewCache(FLAGS_compressed_cache_size)),
-        filter_policy_(FLAGS_bloom_bits >= 0
-                           ? NewBloomFilterPolicy(FLAGS_bloom_bits,
-                                                  FLAGS_use_block_based_filter)
-                           : nullptr),
+        filter_policy_(
+            FLAGS_bloom_bits < 0
+                ? nullptr
+                : FLAGS_use_ribbon_filter
+                      ? NewRibbonFilterPolicy(
+                            FLAGS_bloom_bits,
+                            FLAGS_ribbon_filter_bloom_before_level)
+                      : NewBloomFilterPolicy(FLAGS_bloom_bits,
+                                             FLAGS_use_block_based_filter)),
         prefix_extractor_(NewFixedPrefixTransform(FLAGS_prefix_size)),
         num_(FLAGS_num),
         key_size_(FLAGS_key_size),
@@ -3703,6 +3752,9 @@ class Benchmark {
         options.memtable_factory.reset(new SkipListFactory(
             FLAGS_skip_list_lookahead));
         break;
+      case kART:
+        options.memtable_factory.reset(new ARTRepFactory);
+        break;
 #ifndef ROCKSDB_LITE
       case kPrefixHash:
         options.memtable_factory.reset(
@@ -3719,7 +3771,7 @@ class Benchmark {
         break;
 #else
       default:
-        fprintf(stderr, "Only skip list is supported in lite mode\n");
+        fprintf(stderr, "Only skip list and art are supported in lite mode\n");
         exit(1);
 #endif  // ROCKSDB_LITE
     }
@@ -3849,6 +3901,9 @@ class Benchmark {
       if (FLAGS_use_data_block_hash_index) {
         block_based_options.data_block_index_type =
             ROCKSDB_NAMESPACE::BlockBasedTableOptions::kDataBlockBinaryAndHash;
+      } else if (FLAGS_use_data_block_prefix_array) {
+        block_based_options.data_block_index_type = ROCKSDB_NAMESPACE::
+            BlockBasedTableOptions::kDataBlockBinaryAndPrefix;
       } else {
         block_based_options.data_block_index_type =
             ROCKSDB_NAMESPACE::BlockBasedTableOptions::kDataBlockBinarySearch;
@@ -22,8 +22,10 @@ int main() {
 #include "logging/logging.h"
 #include "memory/arena.h"
 #include "port/jemalloc_helper.h"
+#include "rocksdb/convenience.h"
 #include "rocksdb/filter_policy.h"
 #include "table/block_based/filter_policy_internal.h"
+#include "table/multiget_context.h"
 #include "test_util/testharness.h"
 #include "test_util/testutil.h"
 #include "util/gflags_compat.h"
@@ -330,6 +332,13 @@ class FullBloomTest : public testing::TestWithParam<BloomFilterPolicy::Mode> {
     return bits_reader_->MayMatch(s);
   }
 
+  void MatchesBatch(int num_keys, Slice** keys, bool* may_match) {
+    if (bits_reader_ == nullptr) {
+      Build();
+    }
+    bits_reader_->MayMatch(num_keys, keys, may_match);
+  }
+
   // Provides a kind of fingerprint on the Bloom filter's
   // behavior, for reasonbly high FP rates.
   uint64_t PackedMatches() {
@@ -382,6 +391,7 @@ class FullBloomTest : public testing::TestWithParam<BloomFilterPolicy::Mode> {
       case BloomFilterPolicy::kFastLocalBloom:
         return for_fast_local_bloom;
       case BloomFilterPolicy::kDeprecatedBlock:
+      case BloomFilterPolicy::kStandardRibbon:
       case BloomFilterPolicy::kAuto:
           /* N/A */;
     }
@@ -977,6 +987,237 @@ INSTANTIATE_TEST_CASE_P(Full, FullBloomTest,
                         testing::Values(BloomFilterPolicy::kLegacyBloom,
                                         BloomFilterPolicy::kFastLocalBloom));
 
+// Ribbon filters, with the FullBloomTest helpers
+class RibbonFilterTest : public FullBloomTest {};
+
+TEST_P(RibbonFilterTest, FilterSize) {
+  for (double bpk : {1.0, 6.5, 10.0, 20.0, 100.0}) {
+    ResetPolicy(bpk);
+    auto bits_builder = GetBuiltinFilterBitsBuilder();
+    for (int n = 1; n < 5000; n = n * 5 / 4 + 1) {
+      auto space = bits_builder->CalculateSpace(n);
+      auto n2 = bits_builder->CalculateNumEntry(space);
+      EXPECT_GE(n2, n);
+      auto space2 = bits_builder->CalculateSpace(n2);
+      EXPECT_EQ(space, space2);
+    }
+  }
+  ResetPolicy();
+}
+
+TEST_P(RibbonFilterTest, VaryingLengths) {
+  char buffer[sizeof(int)];
+  BloomFilterPolicy bloom_policy(FLAGS_bits_per_key,
+                                 BloomFilterPolicy::kFastLocalBloom);
+  std::unique_ptr<FilterBitsBuilder> bloom_builder(
+      bloom_policy.GetBuilderWithContext(FilterBuildingContext(table_options_)));
+  auto bloom_bits_builder =
+      &dynamic_cast<BuiltinFilterBitsBuilder&>(*bloom_builder);
+
+  for (int length = 1; length <= 10000; length = NextLength(length)) {
+    Reset();
+    for (int i = 0; i < length; i++) {
+      Add(Key(i, buffer));
+    }
+    Build();
+
+    // Never larger than the Bloom filter, and much smaller for many keys
+    size_t bloom_size = bloom_bits_builder->CalculateSpace(length);
+    ASSERT_LE(FilterSize(), bloom_size);
+    if (length >= 2000) {
+      ASSERT_LE(FilterSize(), bloom_size * 80 / 100);
+    }
+
+    // All added keys must match
+    for (int i = 0; i < length; i++) {
+      ASSERT_TRUE(Matches(Key(i, buffer)))
+          << "Length " << length << "; key " << i;
+    }
+
+    // No worse than the Bloom filter
+    double rate = FalsePositiveRate();
+    if (kVerbose >= 1) {
+      fprintf(stderr, "False positives: %5.2f%% @ length = %6d ; bytes = %6d\n",
+              rate * 100.0, length, static_cast<int>(FilterSize()));
+    }
+    ASSERT_LE(rate, 0.0125);
+  }
+}
+
+TEST_P(RibbonFilterTest, BloomForFewKeys) {
+  char buffer[sizeof(int)];
+  for (int i = 0; i < 10; i++) {
+    Add(Key(i, buffer));
+  }
+  Build();
+  // Marker for newer Bloom filters
+  ASSERT_EQ(-1, static_cast<int8_t>(FilterData()[FilterSize() - 5]));
+
+  Reset();
+  for (int i = 0; i < 1000; i++) {
+    Add(Key(i, buffer));
+  }
+  Build();
+  // Marker for Ribbon filters
+  ASSERT_EQ(-2, static_cast<int8_t>(FilterData()[FilterSize() - 5]));
+}
+
+// Ensure the implementation doesn't accidentally change in an
+// incompatible way
+TEST_P(RibbonFilterTest, Schema) {
+  char buffer[sizeof(int)];
+  ResetPolicy(10);
+  for (int key = 0; key < 1000; key++) {
+    Add(Key(key, buffer));
+  }
+  Build();
+  EXPECT_EQ(FilterSize(), 1013U);
+  EXPECT_EQ(BloomHash(FilterData()), 3704652920U);
+  EXPECT_EQ("186,326,496,504,542,1101,1314,1339", FirstFPs(8));
+
+  ResetPolicy(16);
+  for (int key = 0; key < 1000; key++) {
+    Add(Key(key, buffer));
+  }
+  Build();
+  EXPECT_EQ(FilterSize(), 1445U);
+  EXPECT_EQ(BloomHash(FilterData()), 3244100862U);
+  EXPECT_EQ("496,1416,2869,4552,5286,6685,8141,8262", FirstFPs(8));
+
+  ResetPolicy();
+}
+
+TEST_P(RibbonFilterTest, BatchedMayMatch) {
+  char buffer[sizeof(int)];
+  for (int i = 0; i < 5000; i++) {
+    Add(Key(i, buffer));
+  }
+  Build();
+
+  std::vector<std::string> key_strs;
+  for (int i = 0; i < MultiGetContext::MAX_BATCH_SIZE; i++) {
+    // Every other key was added
+    key_strs.push_back(Key(i % 2 == 0 ? i : i + 1000000, buffer).ToString());
+  }
+  std::vector<Slice> keys(key_strs.begin(), key_strs.end());
+  std::vector<Slice*> key_ptrs;
+  for (Slice& key : keys) {
+    key_ptrs.push_back(&key);
+  }
+  bool may_match[MultiGetContext::MAX_BATCH_SIZE];
+  MatchesBatch(static_cast<int>(keys.size()), key_ptrs.data(), may_match);
+  for (size_t i = 0; i < keys.size(); i++) {
+    ASSERT_EQ(Matches(keys[i]), may_match[i]);
+    if (i % 2 == 0) {
+      ASSERT_TRUE(may_match[i]);
+    }
+  }
+}
+
+TEST_P(RibbonFilterTest, CorruptFilters) {
+  // The solution for 2 blocks of 128 slots and 7 columns, followed by the
+  // metadata with a seed and the number of blocks
+  auto make_filter = [](uint32_t len, uint32_t num_blocks) {
+    std::string filter(len, '\x5a');
+    filter.push_back(static_cast<char>(-2));
+    filter.push_back(static_cast<char>(42));
+    filter.push_back(static_cast<char>(num_blocks));
+    filter.push_back(static_cast<char>(num_blocks >> 8));
+    filter.push_back(static_cast<char>(num_blocks >> 16));
+    return filter;
+  };
+  auto count_matches = [this]() {
+    char buffer[sizeof(int)];
+    int count = 0;
+    for (int i = 0; i < 100; i++) {
+      count += Matches(Key(i, buffer)) ? 1 : 0;
+    }
+    return count;
+  };
+
+  // Good filter bits
+  std::string filter = make_filter(2 * 16 * 7, 2);
+  OpenRaw(filter);
+  ASSERT_LT(count_matches(), 100);
+
+  // Bad filter bits - returns true for safety
+  // Can't have 3 * 16 * x == 2 * 16 * 7 for integer x
+  filter = make_filter(2 * 16 * 7, 3);
+  OpenRaw(filter);
+  ASSERT_EQ(count_matches(), 100);
+
+  // Bad filter bits - returns true for safety
+  // One block has no room for any start but 0
+  filter = make_filter(16 * 7, 1);
+  OpenRaw(filter);
+  ASSERT_EQ(count_matches(), 100);
+
+  // Reserved filter bits - returns true for safety
+  // 33 columns is more than supported
+  filter = make_filter(2 * 16 * 33, 2);
+  OpenRaw(filter);
+  ASSERT_EQ(count_matches(), 100);
+}
+
+INSTANTIATE_TEST_CASE_P(Ribbon, RibbonFilterTest,
+                        testing::Values(BloomFilterPolicy::kStandardRibbon));
+
+TEST(RibbonFilterPolicyTest, BloomBeforeLevel) {
+  char buffer[sizeof(int)];
+  BlockBasedTableOptions table_options;
+  table_options.filter_policy.reset(NewRibbonFilterPolicy(10, 2));
+  for (uint32_t format_version : {4U, 5U}) {
+    table_options.format_version = format_version;
+    for (int level : {-1, 0, 1, 2, 6}) {
+      FilterBuildingContext context(table_options);
+      context.level_at_creation = level;
+      std::unique_ptr<FilterBitsBuilder> builder(
+          BloomFilterPolicy::GetBuilderFromContext(context));
+      for (int i = 0; i < 1000; i++) {
+        builder->AddKey(Key(i, buffer));
+      }
+      std::unique_ptr<const char[]> buf;
+      Slice filter = builder->Finish(&buf);
+
+      int8_t marker = static_cast<int8_t>(filter[filter.size() - 5]);
+      if (format_version < 5) {
+        // num_probes of a legacy Bloom filter
+        ASSERT_GT(marker, 0);
+      } else if (level < 2) {
+        ASSERT_EQ(-1, marker);
+      } else {
+        ASSERT_EQ(-2, marker);
+      }
+
+      std::unique_ptr<FilterBitsReader> reader(
+          table_options.filter_policy->GetFilterBitsReader(filter));
+      for (int i = 0; i < 1000; i++) {
+        ASSERT_TRUE(reader->MayMatch(Key(i, buffer)));
+      }
+    }
+  }
+}
+
+#ifndef ROCKSDB_LITE
+TEST(RibbonFilterPolicyTest, CreateFromString) {
+  ConfigOptions config_options;
+  std::shared_ptr<const FilterPolicy> policy;
+  ASSERT_OK(FilterPolicy::CreateFromString(config_options, "ribbonfilter:9.5",
+                                           &policy));
+  auto ribbon = dynamic_cast<const RibbonFilterPolicy*>(policy.get());
+  ASSERT_NE(ribbon, nullptr);
+  ASSERT_EQ(9500, ribbon->GetMillibitsPerKey());
+  ASSERT_EQ(0, ribbon->GetBloomBeforeLevel());
+
+  ASSERT_OK(FilterPolicy::CreateFromString(config_options,
+                                           "ribbonfilter:10:6", &policy));
+  ribbon = dynamic_cast<const RibbonFilterPolicy*>(policy.get());
+  ASSERT_NE(ribbon, nullptr);
+  ASSERT_EQ(10000, ribbon->GetMillibitsPerKey());
+  ASSERT_EQ(6, ribbon->GetBloomBeforeLevel());
+}
+#endif  // ROCKSDB_LITE
+
 }  // namespace ROCKSDB_NAMESPACE
 
 int main(int argc, char** argv) {
@@ -0,0 +1,241 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+//
+// Implementation details of a Standard Ribbon filter ("Ribbon filter:
+// practically smaller than Bloom and Xor", Dillinger & Walzer), a static
+// filter that takes about 5-7% more space than the information theoretic
+// minimum for its FP rate, vs. 45% or more for Bloom filters.
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include "port/port.h"
+#include "util/coding.h"
+#include "util/fastrange.h"
+#include "util/hash.h"
+#include "util/math.h"
+#include "util/math128.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+// Each key is hashed to a start slot s, a 128-bit coefficient row c with
+// bit 0 set, and a result row r of num_columns bits. The filter stores a
+// solution S, num_columns bits per slot, of the linear system over GF(2)
+// where, for every added key,
+//   XOR of S[s + j] for each bit j set in c == r
+// and a query checks that equation for its key, which a key not added
+// satisfies with probability 2^-num_columns.
+//
+// The system is solved by Gaussian elimination as the keys are added
+// ("banding"), which usually succeeds with a few percent more slots than
+// keys. Otherwise the builder tries again with another seed for the hashes.
+//
+// The solution is stored "interleaved column-major": for each block of 128
+// slots, one 128-bit word per column, so that a query reads at most two
+// consecutive blocks.
+class StandardRibbonImpl {
+ public:
+  using CoeffRow = Unsigned128;
+  // Slots per block, and the width of the coefficient rows
+  static constexpr uint32_t kCoeffBits = 128;
+  static constexpr uint32_t kCoeffBytes = kCoeffBits / 8;
+  // More than enough accuracy for 64-bit hashes
+  static constexpr int kMaxColumns = 32;
+  // Fits in the 24 bits of metadata for it
+  static constexpr uint32_t kMaxBlocks = 0xffffff;
+
+  static double EstimatedFpRate(int num_columns) {
+    return std::pow(0.5, num_columns);
+  }
+
+  // Number of slots (a multiple of kCoeffBits, or 0 for no keys) for which
+  // banding num_keys keys succeeds with high probability. The overhead
+  // needed grows slowly with the number of keys, and relatively more for
+  // few keys because of rounding up to whole blocks.
+  static uint32_t GetNumSlots(size_t num_keys) {
+    if (num_keys == 0) {
+      return 0;
+    }
+    uint64_t n = num_keys;
+    // 5% for 100K keys, 6.5% for 4M keys
+    uint64_t overhead = n * (FloorLog2(n) + 4) / 400;
+    uint64_t num_blocks = (n + overhead + kCoeffBits - 1) / kCoeffBits;
+    // Enough start slots to spread the keys
+    num_blocks = std::max(num_blocks, uint64_t{2});
+    return static_cast<uint32_t>(std::min(num_blocks, uint64_t{kMaxBlocks}) *
+                                 kCoeffBits);
+  }
+
+  // The hashes for a key hash and seed
+  static inline uint64_t SeedHash(uint64_t h, uint32_t seed) {
+    // A bijection of h for each seed, so that no keys collide with another
+    // seed if they do not already collide in h
+    h ^= seed * 0x9e3779b97f4a7c15U;
+    h *= 0xff51afd7ed558ccdU;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53U;
+    h ^= h >> 29;
+    return h;
+  }
+
+  static inline uint32_t GetStart(uint64_t sh, uint32_t num_slots) {
+    // Every start leaves room for a whole coefficient row
+    return FastRange32(Upper32of64(sh), num_slots - kCoeffBits + 1);
+  }
+
+  static inline CoeffRow GetCoeffRow(uint64_t sh) {
+    uint64_t lower = sh * 0x9e3779b97f4a7c13U;
+    uint64_t upper = (sh ^ (sh >> 31)) * 0xbf58476d1ce4e5b9U;
+    return (CoeffRow{upper} << 64) | CoeffRow{lower | 1};
+  }
+
+  static inline uint32_t GetResultRow(uint64_t sh) {
+    return Lower32of64((sh >> 32) * 0xc2b2ae3d27d4eb4fU ^ sh);
+  }
+
+  // Solves the system for the keys added, keeping the row with the pivot
+  // in each slot
+  class Bander {
+   public:
+    explicit Bander(uint32_t num_slots)
+        : coeff_rows_(num_slots), result_rows_(num_slots) {}
+
+    // Returns false if the key's equation contradicts those already added,
+    // which means banding with this seed failed
+    bool Add(uint64_t sh) {
+      const uint32_t num_slots = static_cast<uint32_t>(coeff_rows_.size());
+      uint32_t i = GetStart(sh, num_slots);
+      CoeffRow coeff_row = GetCoeffRow(sh);
+      uint32_t result_row = GetResultRow(sh);
+      for (;;) {
+        CoeffRow& pivot_row = coeff_rows_[i];
+        if (pivot_row == CoeffRow{0}) {
+          pivot_row = coeff_row;
+          result_rows_[i] = result_row;
+          return true;
+        }
+        coeff_row ^= pivot_row;
+        result_row ^= result_rows_[i];
+        if (coeff_row == CoeffRow{0}) {
+          // Redundant (e.g. a repeated key) unless contradicting
+          return result_row == 0;
+        }
+        int tz = CountTrailingZeroBits(coeff_row);
+        i += tz;
+        coeff_row >>= static_cast<unsigned>(tz);
+      }
+    }
+
+    // Adds the keys with hashes in [begin, end) for seed, or returns false
+    // when that fails. Overlaps the cache misses of a few keys.
+    template <typename Iter>
+    bool AddRange(Iter begin, Iter end, uint32_t seed) {
+      const uint32_t num_slots = static_cast<uint32_t>(coeff_rows_.size());
+      constexpr size_t kBufferMask = 7;
+      std::array<uint64_t, kBufferMask + 1> buffer;
+      size_t n = 0;
+      for (Iter it = begin; it != end; ++it, ++n) {
+        uint64_t& sh = buffer[n & kBufferMask];
+        if (n > kBufferMask && !Add(sh)) {
+          return false;
+        }
+        sh = SeedHash(*it, seed);
+        uint32_t start = GetStart(sh, num_slots);
+        PREFETCH(&coeff_rows_[start], 1 /* rw */, 1 /* locality */);
+        PREFETCH(&result_rows_[start], 1 /* rw */, 1 /* locality */);
+      }
+      for (size_t i = n > kBufferMask ? n - kBufferMask - 1 : 0; i < n; ++i) {
+        if (!Add(buffer[i & kBufferMask])) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // Writes the solution to data, of GetBytes(num_slots, num_columns)
+    void BackSubst(int num_columns, char* data) const {
+      assert(num_columns >= 1 && num_columns <= kMaxColumns);
+      const uint32_t num_slots = static_cast<uint32_t>(coeff_rows_.size());
+      // For each column, the solution for kCoeffBits slots from i, slot
+      // i + j in bit j
+      CoeffRow state[kMaxColumns];
+      std::fill(state, state + num_columns, CoeffRow{0});
+      for (uint32_t i = num_slots; i-- > 0;) {
+        const CoeffRow coeff_row = coeff_rows_[i];
+        const uint32_t result_row = result_rows_[i];
+        for (int col = 0; col < num_columns; ++col) {
+          CoeffRow tmp = state[col] << 1;
+          // Slots without a pivot (coeff_row 0) could take any value
+          uint32_t bit =
+              (BitParity(tmp & coeff_row) ^ (result_row >> col)) & 1;
+          state[col] = tmp | CoeffRow{bit};
+        }
+        if (i % kCoeffBits == 0) {
+          char* block = data + GetBytes(i, num_columns);
+          for (int col = 0; col < num_columns; ++col) {
+            EncodeFixed128(block + col * kCoeffBytes, state[col]);
+          }
+        }
+      }
+    }
+
+   private:
+    std::vector<CoeffRow> coeff_rows_;
+    std::vector<uint32_t> result_rows_;
+  };
+
+  // Bytes for the solution in num_slots slots, or the offset of the block
+  // starting at slot num_slots
+  static inline size_t GetBytes(uint32_t num_slots, int num_columns) {
+    return size_t{num_slots / kCoeffBits} * num_columns * kCoeffBytes;
+  }
+
+  static inline void PrepareHash(uint64_t h, uint32_t seed, uint32_t num_slots,
+                                 int num_columns, const char* data,
+                                 uint64_t* sh, uint32_t* start) {
+    *sh = SeedHash(h, seed);
+    *start = GetStart(*sh, num_slots);
+    const char* block = data + GetBytes(*start, num_columns);
+    // A query reads at most two blocks from here
+    PREFETCH(block, 0 /* rw */, 1 /* locality */);
+    PREFETCH(block + 2 * num_columns * kCoeffBytes - 1, 0 /* rw */,
+             1 /* locality */);
+  }
+
+  static inline bool HashMayMatchPrepared(uint64_t sh, uint32_t start,
+                                          int num_columns, const char* data) {
+    const CoeffRow coeff_row = GetCoeffRow(sh);
+    const uint32_t result_row = GetResultRow(sh);
+    const char* block = data + GetBytes(start, num_columns);
+    const char* next_block = block + num_columns * kCoeffBytes;
+    const unsigned shift = start % kCoeffBits;
+    for (int col = 0; col < num_columns; ++col) {
+      CoeffRow segment = DecodeFixed128(block + col * kCoeffBytes) >> shift;
+      if (shift != 0) {
+        segment |= DecodeFixed128(next_block + col * kCoeffBytes)
+                   << (kCoeffBits - shift);
+      }
+      if (((BitParity(segment & coeff_row) ^ (result_row >> col)) & 1) != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static inline bool HashMayMatch(uint64_t h, uint32_t seed,
+                                  uint32_t num_slots, int num_columns,
+                                  const char* data) {
+    uint64_t sh = SeedHash(h, seed);
+    return HashMayMatchPrepared(sh, GetStart(sh, num_slots), num_columns,
+                                data);
+  }
+};
+
+}  // namespace ROCKSDB_NAMESPACE